@@ -30,23 +30,29 @@ in vec2 fTextCoords;
 // hit color for the intersected triangle
 in vec3 hitColor;
 
-// ambient, diffusive and specular components (passed from the application)
-uniform vec3 ambientColor;
-uniform vec3 diffuseColor;
-uniform vec3 specularColor;
 uniform sampler2D SightTex;
-// weight of the components
-// in this case, we can pass separate values from the main application even if Ka+Kd+Ks>1. In more "realistic" situations, I have to set this sum = 1, or at least Kd+Ks = 1, by passing Kd as uniform, and then setting Ks = 1.0-Kd
-uniform float Ka;
-uniform float Kd;
-uniform float Ks;
-
-// shininess coefficients (passed from the application)
-uniform float shininess;
-
-// uniforms for GGX model
-uniform float alpha; // rugosity - 0 : smooth, 1: rough
-uniform float F0; // fresnel reflectance at normal incidence
+
+// light and material parameters (binding point 2)
+// each vec3 is followed by a float, which uses the last 4 bytes of its 16 bytes in the std140 layout
+layout(std140, binding = 2) uniform MaterialData
+{
+    // the position of the point light -> ( N. B.) with more lights, and of different kinds, the shader code must be modified with a for cycle, with different treatment of the source lights parameters (directions, position, cutoff angle for spot lights, etc)
+    vec3 PointLightPosition;
+    // weight of the components
+    // in this case, we can pass separate values from the main application even if Ka+Kd+Ks>1. In more "realistic" situations, I have to set this sum = 1, or at least Kd+Ks = 1, by passing Kd as uniform, and then setting Ks = 1.0-Kd
+    float Ka;
+    // ambient, diffusive and specular components
+    vec3 ambientColor;
+    float Kd;
+    vec3 diffuseColor;
+    float Ks;
+    vec3 specularColor;
+    // shininess coefficients
+    float shininess;
+    // GGX model
+    float alpha; // rugosity - 0 : smooth, 1: rough
+    float F0; // fresnel reflectance at normal incidence
+};
 
 ////////////////////////////////////////////////////////////////////
 
@@ -15,13 +15,8 @@ author: Andrea Cipollini; based on RTGP course code by prof. Davide Gadia
 
 #version 460 core
 
-struct Intersection
-{
-    float[3] Position;
-    float[3] Normal;
-    bool hit;
-    uint v0, v1, v2;
-};
+// records shared with the C++ code (Vertex, Intersection, BrushDab), expanded by the Shader class
+#include "include/usculpt/layout.h"
 
 // Vertex attributes in VAO
 
@@ -48,18 +43,52 @@ layout(std430, binding = 2) buffer IntersectionDataOutput
 
 // Uniforms
 
-// model matrix
-uniform mat4 ModelMatrix;
-// view matrix
-uniform mat4 ViewMatrix;
-// projection matrix
-uniform mat4 ProjectionMatrix;
-// normals transformation matrix (= transpose of the inverse of the model-view matrix)
-uniform mat4 NormalMatrix;
-// the position of the point light is passed as uniform -> ( N. B.) with more lights, and of different kinds, the shader code must be modified with a for cycle, with different treatment of the source lights parameters (directions, position, cutoff angle for spot lights, etc)
-uniform vec3 PointLightPosition;
-// Radius of the current brush
-uniform float Radius;
+// camera data (uniform buffer updated once per frame by the application, binding point 0)
+layout(std140, binding = 0) uniform CameraData
+{
+    mat4 ProjectionMatrix;
+    mat4 ViewMatrix;
+    vec3 RayOrigin;
+    vec3 RayDirection;
+};
+
+// model transformations (binding point 1)
+layout(std140, binding = 1) uniform ModelData
+{
+    mat4 ModelMatrix;
+    // normals transformation matrix (= transpose of the inverse of the model-view matrix)
+    mat4 NormalMatrix;
+    mat4 InvModelMatrix;
+};
+
+// light and material parameters (binding point 2)
+// each vec3 is followed by a float, which uses the last 4 bytes of its 16 bytes in the std140 layout
+layout(std140, binding = 2) uniform MaterialData
+{
+    // the position of the point light -> ( N. B.) with more lights, and of different kinds, the shader code must be modified with a for cycle, with different treatment of the source lights parameters (directions, position, cutoff angle for spot lights, etc)
+    vec3 PointLightPosition;
+    // weight of the components
+    // in this case, we can pass separate values from the main application even if Ka+Kd+Ks>1. In more "realistic" situations, I have to set this sum = 1, or at least Kd+Ks = 1, by passing Kd as uniform, and then setting Ks = 1.0-Kd
+    float Ka;
+    // ambient, diffusive and specular components
+    vec3 ambientColor;
+    float Kd;
+    vec3 diffuseColor;
+    float Ks;
+    vec3 specularColor;
+    // shininess coefficients
+    float shininess;
+    // GGX model
+    float alpha; // rugosity - 0 : smooth, 1: rough
+    float F0; // fresnel reflectance at normal incidence
+};
+
+// brush parameters (binding point 3)
+layout(std140, binding = 3) uniform BrushData
+{
+    float Radius;
+    float Strength;
+};
 
 // outputs to fragment shader
 
@@ -116,7 +145,7 @@ void main()
 
     /*
     // check if the vertex belongs to the intersected triangle
-    if (IntersectionData.hit && (IntersectionData.v0 == gl_VertexID || IntersectionData.v1 == gl_VertexID || IntersectionData.v2 == gl_VertexID))
+    if (IntersectionData.hit && (IntersectionData.idxv0 == gl_VertexID || IntersectionData.idxv1 == gl_VertexID || IntersectionData.idxv2 == gl_VertexID))
         hitColor = vec3(1.0, 0.0, 0.0);
     else
         hitColor = vec3(0.0, 0.0, 0.0);
@@ -0,0 +1,147 @@
+/*
+Adjacency functions
+- welding of the vertices with the same position (the importer duplicates a vertex for each different normal / texture coordinate)
+- neighbours of each welded position, in CSR form: counts, prefix sum, then fill of a single array
+
+The neighbours of a position are the couples of the other two vertices of each triangle around it (ex: {1, 2, 2, 3, 3, 4, 4, 1}), in the order of the faces;
+all the vertices with the same position share the same range of the neighbours array (NeighboursIndex, NeighboursNumber)
+
+N.B.) all the passes are distributed on the shared ThreadPool: the welding sorts the positions (by their bits), so no hash map of the positions is needed
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <cstring>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+#include <usculpt/threadpool.h>
+
+// key of a vertex for the welding: bits of its coordinates (-0.0 is the same position of 0.0), then its index
+struct WeldKey
+{
+    GLuint Bits[3];
+    GLuint Vertex;
+
+    bool operator<(const WeldKey& other) const
+    {
+        if (this->Bits[0] != other.Bits[0]) return this->Bits[0] < other.Bits[0];
+        if (this->Bits[1] != other.Bits[1]) return this->Bits[1] < other.Bits[1];
+        if (this->Bits[2] != other.Bits[2]) return this->Bits[2] < other.Bits[2];
+        return this->Vertex < other.Vertex;
+    }
+
+    bool SamePosition(const WeldKey& other) const
+    {
+        return this->Bits[0] == other.Bits[0] && this->Bits[1] == other.Bits[1] && this->Bits[2] == other.Bits[2];
+    }
+};
+
+// welded position of each vertex: vertices with the same position have the same index, in [0, positions number)
+// it returns the number of different positions
+inline GLuint WeldVertices(const vector<Vertex>& vertices, vector<GLuint>& welded, ThreadPool& pool = ThreadPool::Instance())
+{
+    vector<WeldKey> keys(vertices.size());
+    pool.ParallelFor(0, vertices.size(), 65536, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                float coordinate = vertices[i].Position[c] == 0.0f ? 0.0f : vertices[i].Position[c];
+                memcpy(&keys[i].Bits[c], &coordinate, sizeof(GLuint));
+            }
+            keys[i].Vertex = (GLuint)i;
+        }
+    });
+
+    pool.ParallelSort(keys.begin(), keys.end(), [](const WeldKey& a, const WeldKey& b) { return a < b; });
+
+    // a new position starts where the bits change
+    welded.resize(vertices.size());
+    GLuint positions = 0;
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (i > 0 && !keys[i].SamePosition(keys[i - 1]))
+            positions++;
+        welded[keys[i].Vertex] = positions;
+    }
+
+    return keys.empty() ? 0 : positions + 1;
+}
+
+// neighbours array of the mesh, and NeighboursIndex / NeighboursNumber of each vertex
+// only the triangles are considered (faces with other numbers of indices have to be triangulated before)
+// welded[i] = position of the vertex i, in [0, positions) (e.g. from WeldVertices, or the identity for a mesh without duplicated vertices)
+inline void BuildNeighbours(vector<Vertex>& vertices, const vector<GLuint>& indices, vector<GLuint>& neighbours, const vector<GLuint>& welded, GLuint positions, ThreadPool& pool = ThreadPool::Instance())
+{
+    size_t corners = indices.size() / 3 * 3;
+
+    // counts: triangle corners of each position
+    unique_ptr<atomic<GLuint>[]> cursor(new atomic<GLuint>[positions + 1]());
+    pool.ParallelFor(0, corners, 65536, [&](size_t first, size_t last)
+    {
+        for (size_t c = first; c < last; c++)
+            cursor[welded[indices[c]]].fetch_add(1, memory_order_relaxed);
+    });
+
+    // prefix sum: first corner of each position
+    vector<GLuint> offsets(positions + 1, 0);
+    for (GLuint p = 0; p < positions; p++)
+        offsets[p + 1] = offsets[p] + cursor[p].load(memory_order_relaxed);
+    for (GLuint p = 0; p < positions; p++)
+        cursor[p].store(offsets[p], memory_order_relaxed);
+
+    // fill: corners of each position, then sorted to keep the order of the faces whatever the order of the threads
+    vector<GLuint> positionCorners(corners);
+    pool.ParallelFor(0, corners, 65536, [&](size_t first, size_t last)
+    {
+        for (size_t c = first; c < last; c++)
+            positionCorners[cursor[welded[indices[c]]].fetch_add(1, memory_order_relaxed)] = (GLuint)c;
+    });
+    pool.ParallelFor(0, positions, 16384, [&](size_t first, size_t last)
+    {
+        for (size_t p = first; p < last; p++)
+            sort(positionCorners.begin() + offsets[p], positionCorners.begin() + offsets[p + 1]);
+    });
+
+    // couple of the other two vertices of the triangle of each corner
+    neighbours.resize(corners * 2);
+    pool.ParallelFor(0, corners, 65536, [&](size_t first, size_t last)
+    {
+        for (size_t k = first; k < last; k++)
+        {
+            GLuint c = positionCorners[k];
+            GLuint triangle = c - c % 3;
+            neighbours[k * 2] = indices[triangle + (c + 1) % 3];
+            neighbours[k * 2 + 1] = indices[triangle + (c + 2) % 3];
+        }
+    });
+
+    pool.ParallelFor(0, vertices.size(), 65536, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            vertices[i].NeighboursIndex = offsets[welded[i]] * 2;
+            vertices[i].NeighboursNumber = (offsets[welded[i] + 1] - offsets[welded[i]]) * 2;
+        }
+    });
+}
+
+// neighbours of the positions of the welded vertices
+inline void BuildNeighbours(vector<Vertex>& vertices, const vector<GLuint>& indices, vector<GLuint>& neighbours, ThreadPool& pool = ThreadPool::Instance())
+{
+    vector<GLuint> welded;
+    GLuint positions = WeldVertices(vertices, welded, pool);
+    BuildNeighbours(vertices, indices, neighbours, welded, positions, pool);
+}
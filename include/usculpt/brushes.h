@@ -0,0 +1,235 @@
+/*
+Brush library
+- the brushes of the sculpting (draw, inflate, smooth, flatten, pinch, grab, crease) and the falloff curves of their weight
+  from the center to the radius of the dab (gaussian, smooth, sphere, sharp, linear, constant)
+- each brush and each falloff is a template specialization (BrushKernel, FalloffCurve): the Sculptor instantiates a displacement kernel
+  for each couple, so the choice of the brush is made once for each dab and the loop on the vertices has no branches
+- the same kernels are compiled in ShaderBrush.comp from the definitions of BrushShaderDefines (BRUSH_* and FALLOFF_*):
+  a compute shader is compiled for each brush, instead of branching at runtime on the brush of the dab
+
+Brushes (offset of a vertex inside the dab, with weight w of the falloff):
+- draw -> along the normal of the surface at the dab (the Gaussian brush of the first versions, with the gaussian falloff)
+- inflate -> along the normal of the vertex
+- smooth -> towards the centroid of the neighbours of the vertex (Laplacian over the neighbour ring)
+- flatten -> towards the plane of the dab
+- pinch -> towards the center of the dab, on the plane of the dab
+- grab -> by the movement of the stroke from the previous dab (BrushDab::Delta), for the vertices around the previous dab
+- crease -> draw and pinch together (a sharp fold along the stroke)
+
+N.B. 1) draw, inflate and crease move the vertices by the height of the Gaussian brush (BrushHeight) times the weight;
+smooth, flatten and pinch move the vertices by a fraction of the distance to their target (BrushFraction): the strength is the speed of the brush
+
+N.B. 2) the smooth brush reads the neighbours of the vertex, which are moved by the same pass: the centroids of the rings are computed before
+the displacement (BrushUsesRing), from the positions before the dab, so the result does not depend on the order of the vertices
+
+N.B. 3) the maximum displacement of a dab (BrushReach) bounds how far a vertex moved by a dab can go: it grows the bounding spheres of the tiles
+of the batched brushing (see Sculptor::cullDabs). For the smooth brush it is the radius of the dab times the fraction (the rings are smaller than the brush)
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+
+// brushes of the library
+enum BrushType { DRAW_BRUSH, INFLATE_BRUSH, SMOOTH_BRUSH, FLATTEN_BRUSH, PINCH_BRUSH, GRAB_BRUSH, CREASE_BRUSH, BRUSH_TYPES };
+// falloff curves of the weight, from 1 at the center to the radius of the dab
+enum FalloffType { GAUSSIAN_FALLOFF, SMOOTH_FALLOFF, SPHERE_FALLOFF, SHARP_FALLOFF, LINEAR_FALLOFF, CONSTANT_FALLOFF, FALLOFF_TYPES };
+
+// names of the brushes and of the falloffs (for the GUI), and suffixes of their shader definitions
+inline const char* const* BrushNames()
+{
+    static const char* const names[BRUSH_TYPES] = { "Draw", "Inflate", "Smooth", "Flatten", "Pinch", "Grab", "Crease" };
+    return names;
+}
+
+inline const char* const* FalloffNames()
+{
+    static const char* const names[FALLOFF_TYPES] = { "Gaussian", "Smooth", "Sphere", "Sharp", "Linear", "Constant" };
+    return names;
+}
+
+// definitions of the brushing shaders for a brush and a falloff (e.g. "#define BRUSH_SMOOTH\n#define FALLOFF_SPHERE\n")
+inline string BrushShaderDefines(BrushType brush, FalloffType falloff)
+{
+    string brushName = BrushNames()[brush], falloffName = FalloffNames()[falloff];
+    transform(brushName.begin(), brushName.end(), brushName.begin(), ::toupper);
+    transform(falloffName.begin(), falloffName.end(), falloffName.begin(), ::toupper);
+    return "#define BRUSH_" + brushName + "\n#define FALLOFF_" + falloffName + "\n";
+}
+
+// the brush reads the neighbours of the vertices (see N.B. 2)
+constexpr bool BrushUsesRing(BrushType brush)
+{
+    return brush == SMOOTH_BRUSH;
+}
+
+// the brush needs the movement of the stroke (BrushDab::Delta, known only for the dabs placed by the CPU)
+inline bool BrushUsesDelta(BrushType brush)
+{
+    return brush == GRAB_BRUSH;
+}
+
+//////////////////////////////////////////
+
+// height of the Gaussian brush (maximum displacement of draw, inflate and crease)
+inline float BrushHeight(float strength, float radius)
+{
+    const float pi = 3.1415926535f;
+    const float stdDev = BRUSH_STD_DEV;
+
+    float N = 1.0f / ((stdDev * stdDev * stdDev) * sqrt((2.0f * pi) * (2.0f * pi) * (2.0f * pi)));
+    return N * (strength * 0.2f * radius);
+}
+
+// fraction of the distance to the target covered by a vertex with weight w (smooth, flatten, pinch)
+inline float BrushFraction(float strength, float weight)
+{
+    return glm::clamp(strength * weight * 0.1f, -1.0f, 1.0f);
+}
+
+//////////////////////////////////////////
+
+// weight of a vertex at distance t * radius from the center of the dab (t in [0, 1])
+template<FalloffType F>
+struct FalloffCurve;
+
+template<>
+struct FalloffCurve<GAUSSIAN_FALLOFF>
+{
+    // same standard deviation of the Gaussian brush, with the radius at 4 standard deviations
+    static float Weight(float t) { return exp(-(16.0f * t * t) / (2.0f * BRUSH_STD_DEV * BRUSH_STD_DEV)); }
+};
+
+template<>
+struct FalloffCurve<SMOOTH_FALLOFF>
+{
+    static float Weight(float t) { return 1.0f - t * t * (3.0f - 2.0f * t); }
+};
+
+template<>
+struct FalloffCurve<SPHERE_FALLOFF>
+{
+    static float Weight(float t) { return sqrt(max(1.0f - t * t, 0.0f)); }
+};
+
+template<>
+struct FalloffCurve<SHARP_FALLOFF>
+{
+    static float Weight(float t) { return (1.0f - t) * (1.0f - t); }
+};
+
+template<>
+struct FalloffCurve<LINEAR_FALLOFF>
+{
+    static float Weight(float t) { return 1.0f - t; }
+};
+
+template<>
+struct FalloffCurve<CONSTANT_FALLOFF>
+{
+    static float Weight(float) { return 1.0f; }
+};
+
+//////////////////////////////////////////
+
+// offset of a vertex (position, normal and centroid of its ring) inside a dab, with the weight of the falloff
+// and maximum displacement of a vertex by a dab (see N.B. 3)
+template<BrushType B>
+struct BrushKernel;
+
+template<>
+struct BrushKernel<DRAW_BRUSH>
+{
+    static glm::vec3 Offset(glm::vec3, glm::vec3, glm::vec3, const BrushDab& dab, float weight)
+    {
+        return dab.Normal * (BrushHeight(dab.Strength, dab.Radius) * weight);
+    }
+    static float Reach(const BrushDab& dab) { return fabs(BrushHeight(dab.Strength, dab.Radius)); }
+};
+
+template<>
+struct BrushKernel<INFLATE_BRUSH>
+{
+    static glm::vec3 Offset(glm::vec3, glm::vec3 normal, glm::vec3, const BrushDab& dab, float weight)
+    {
+        return normal * (BrushHeight(dab.Strength, dab.Radius) * weight);
+    }
+    static float Reach(const BrushDab& dab) { return fabs(BrushHeight(dab.Strength, dab.Radius)); }
+};
+
+template<>
+struct BrushKernel<SMOOTH_BRUSH>
+{
+    static glm::vec3 Offset(glm::vec3 position, glm::vec3, glm::vec3 centroid, const BrushDab& dab, float weight)
+    {
+        return (centroid - position) * BrushFraction(dab.Strength, weight);
+    }
+    static float Reach(const BrushDab& dab) { return dab.Radius * fabs(BrushFraction(dab.Strength, 1.0f)); }
+};
+
+template<>
+struct BrushKernel<FLATTEN_BRUSH>
+{
+    static glm::vec3 Offset(glm::vec3 position, glm::vec3, glm::vec3, const BrushDab& dab, float weight)
+    {
+        return dab.Normal * (-glm::dot(position - dab.Position, dab.Normal) * BrushFraction(dab.Strength, weight));
+    }
+    static float Reach(const BrushDab& dab) { return dab.Radius * fabs(BrushFraction(dab.Strength, 1.0f)); }
+};
+
+template<>
+struct BrushKernel<PINCH_BRUSH>
+{
+    static glm::vec3 Offset(glm::vec3 position, glm::vec3, glm::vec3, const BrushDab& dab, float weight)
+    {
+        glm::vec3 toCenter = dab.Position - position;
+        return (toCenter - dab.Normal * glm::dot(toCenter, dab.Normal)) * BrushFraction(dab.Strength, weight);
+    }
+    static float Reach(const BrushDab& dab) { return dab.Radius * fabs(BrushFraction(dab.Strength, 1.0f)); }
+};
+
+template<>
+struct BrushKernel<GRAB_BRUSH>
+{
+    static glm::vec3 Offset(glm::vec3, glm::vec3, glm::vec3, const BrushDab& dab, float weight)
+    {
+        return dab.Delta * weight;
+    }
+    static float Reach(const BrushDab& dab) { return glm::length(dab.Delta); }
+};
+
+template<>
+struct BrushKernel<CREASE_BRUSH>
+{
+    static glm::vec3 Offset(glm::vec3 position, glm::vec3 normal, glm::vec3 centroid, const BrushDab& dab, float weight)
+    {
+        return BrushKernel<DRAW_BRUSH>::Offset(position, normal, centroid, dab, weight) + BrushKernel<PINCH_BRUSH>::Offset(position, normal, centroid, dab, weight);
+    }
+    static float Reach(const BrushDab& dab) { return BrushKernel<DRAW_BRUSH>::Reach(dab) + BrushKernel<PINCH_BRUSH>::Reach(dab); }
+};
+
+// maximum displacement of a dab of a brush
+inline float BrushReach(BrushType brush, const BrushDab& dab)
+{
+    switch (brush)
+    {
+        case INFLATE_BRUSH: return BrushKernel<INFLATE_BRUSH>::Reach(dab);
+        case SMOOTH_BRUSH: return BrushKernel<SMOOTH_BRUSH>::Reach(dab);
+        case FLATTEN_BRUSH: return BrushKernel<FLATTEN_BRUSH>::Reach(dab);
+        case PINCH_BRUSH: return BrushKernel<PINCH_BRUSH>::Reach(dab);
+        case GRAB_BRUSH: return BrushKernel<GRAB_BRUSH>::Reach(dab);
+        case CREASE_BRUSH: return BrushKernel<CREASE_BRUSH>::Reach(dab);
+        default: return BrushKernel<DRAW_BRUSH>::Reach(dab);
+    }
+}
@@ -0,0 +1,569 @@
+/*
+BVH class
+- Bounding Volume Hierarchy over the triangles of a Mesh (Mesh::indices), for the ray picking on CPU
+- top-down build with binned Surface Area Heuristic (SAH)
+- flattened array of 32 bytes nodes: the two children of a node are stored next to each other, so that they share the same cache line
+- refitting of the nodes affected by a brush stroke, instead of a full rebuild
+- the triangles added by an edit of the topology (see dyntopo.h) are tested by brute force, until they are enough to rebuild the hierarchy
+
+N.B.) the BVH stores only the order of the triangles and the bounding boxes: positions and indices are always read from the Mesh
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+#include <usculpt/raycast.h>
+
+// node of the hierarchy
+// - internal node: Count = 0 and the children are the nodes LeftFirst and LeftFirst + 1
+// - leaf: triangles from LeftFirst to LeftFirst + Count - 1 of the BVH triangles order
+struct BVHNode
+{
+    glm::vec3 Min;
+    GLuint LeftFirst;
+    glm::vec3 Max;
+    GLuint Count;
+};
+
+/////////////////// BVH class ///////////////////////
+class BVH
+{
+public:
+    // number of bins for the SAH evaluation
+    static const int BINS = 16;
+    // maximum number of triangles in a leaf
+    static const GLuint MAX_LEAF_SIZE = 4;
+    // depth of the fixed traversal stack (the deeper nodes of degenerate hierarchies go in a growing stack)
+    static const int STACK_SIZE = 128;
+    // triangles added after the build (plus 1/64 of the triangles of the build) over which the hierarchy is rebuilt
+    static const GLuint MAX_NEW_TRIANGLES = 4096;
+
+    // flattened hierarchy (root = node 0, node 1 is unused to align the children pairs)
+    vector<BVHNode> nodes;
+    // triangles order (indices of the triangles of the mesh)
+    vector<GLuint> triangles;
+
+    //////////////////////////////////////////
+
+    // it builds the hierarchy over the triangles of the mesh
+    void Build(Mesh& mesh)
+    {
+        GLuint trianglesNumber = (GLuint)(mesh.indices.size() / 3);
+
+        this->nodes.clear();
+        this->triangles.resize(trianglesNumber);
+        this->centroids.resize(trianglesNumber);
+        this->parents.clear();
+        this->leaves.assign(trianglesNumber, 0);
+
+        for (GLuint i = 0; i < trianglesNumber; i++)
+        {
+            this->triangles[i] = i;
+            glm::vec3 v0, v1, v2;
+            triangleVertices(mesh, i, v0, v1, v2);
+            this->centroids[i] = (v0 + v1 + v2) / 3.0f;
+        }
+
+        if (trianglesNumber == 0)
+            return;
+
+        // a binary tree has at most 2n - 1 nodes, plus the unused one
+        this->nodes.reserve(trianglesNumber * 2);
+        this->parents.reserve(trianglesNumber * 2);
+
+        BVHNode root;
+        root.LeftFirst = 0;
+        root.Count = trianglesNumber;
+        this->nodes.push_back(root);
+        this->nodes.push_back(root);
+        this->parents.push_back(0);
+        this->parents.push_back(0);
+
+        // iterative subdivision (a recursion could be too deep on large meshes)
+        vector<GLuint> stack;
+        stack.push_back(0);
+        while (!stack.empty())
+        {
+            GLuint nodeIndex = stack.back();
+            stack.pop_back();
+
+            this->updateBounds(mesh, nodeIndex);
+            if (this->subdivide(mesh, nodeIndex))
+            {
+                stack.push_back(this->nodes[nodeIndex].LeftFirst);
+                stack.push_back(this->nodes[nodeIndex].LeftFirst + 1);
+            }
+        }
+
+        // leaf of each triangle, for the refit
+        for (GLuint n = 0; n < this->nodes.size(); n++)
+        {
+            if (n == 1 || this->nodes[n].Count == 0)
+                continue;
+            for (GLuint i = 0; i < this->nodes[n].Count; i++)
+                this->leaves[this->triangles[this->nodes[n].LeftFirst + i]] = n;
+        }
+
+        // with the corners of the neighbours the triangles around a vertex are found in the mesh (they follow the edits of the topology)
+        mesh.UpdateNeighboursCorners();
+        if (mesh.neighboursCorners.empty())
+            this->buildVertexTriangles(mesh);
+        else
+        {
+            this->vertexTrianglesIndex.clear();
+            this->vertexTriangles.clear();
+        }
+        this->centroids.clear();
+        this->centroids.shrink_to_fit();
+    }
+
+    //////////////////////////////////////////
+
+    // closest intersection between the ray (in model coordinates) and the mesh
+    Intersection Intersect(const Mesh& mesh, const Ray3& ray) const
+    {
+        float t;
+        GLuint triangle;
+        if (!this->ClosestHit(mesh, ray, t, triangle))
+            return NoIntersection();
+
+        return TriangleIntersection(ray, mesh, triangle, t);
+    }
+
+    // closest hit: distance on the ray and hit triangle
+    // in case of equal distances, the triangle with the lowest index is chosen
+    bool ClosestHit(const Mesh& mesh, const Ray3& ray, float& t, GLuint& triangle) const
+    {
+        t = FLT_MAX;
+        triangle = (GLuint)-1;
+        if (this->nodes.empty())
+            return false;
+
+        glm::vec3 invDirection = 1.0f / ray.direction;
+
+        // the closest child is visited first, the other one is pushed on the stack with its entry distance
+        GLuint stack[STACK_SIZE];
+        float stackDistance[STACK_SIZE];
+        int stackSize = 0;
+        // top of the stack when the fixed one is full (allocated only by the deep hierarchies)
+        vector<pair<GLuint, float>> overflow;
+
+        // triangles added after the build (not in the hierarchy)
+        for (GLuint tri = (GLuint)this->leaves.size(); tri < mesh.indices.size() / 3; tri++)
+        {
+            glm::vec3 v0, v1, v2;
+            triangleVertices(mesh, tri, v0, v1, v2);
+
+            float hitDistance;
+            if (RayTriangleIntersection(ray, v0, v1, v2, hitDistance) && hitDistance < t)
+            {
+                t = hitDistance;
+                triangle = tri;
+            }
+        }
+
+        float rootDistance = intersectBox(this->nodes[0], ray, invDirection, t);
+        if (rootDistance == FLT_MAX)
+            return triangle != (GLuint)-1;
+        stack[stackSize] = 0;
+        stackDistance[stackSize++] = rootDistance;
+
+        while (stackSize > 0 || !overflow.empty())
+        {
+            GLuint entry;
+            float entryDistance;
+            if (!overflow.empty())
+            {
+                entry = overflow.back().first;
+                entryDistance = overflow.back().second;
+                overflow.pop_back();
+            }
+            else
+            {
+                stackSize--;
+                entry = stack[stackSize];
+                entryDistance = stackDistance[stackSize];
+            }
+            // the node could have been already passed by a closer hit
+            if (entryDistance > t)
+                continue;
+
+            const BVHNode* node = &this->nodes[entry];
+            while (node->Count == 0)
+            {
+                GLuint left = node->LeftFirst;
+                float nearDistance = intersectBox(this->nodes[left], ray, invDirection, t);
+                float farDistance = intersectBox(this->nodes[left + 1], ray, invDirection, t);
+
+                GLuint nearChild = left, farChild = left + 1;
+                if (farDistance < nearDistance)
+                {
+                    swap(nearDistance, farDistance);
+                    swap(nearChild, farChild);
+                }
+
+                if (nearDistance == FLT_MAX)
+                {
+                    node = nullptr;
+                    break;
+                }
+                if (farDistance != FLT_MAX)
+                {
+                    if (stackSize < STACK_SIZE)
+                    {
+                        stack[stackSize] = farChild;
+                        stackDistance[stackSize++] = farDistance;
+                    }
+                    else
+                        overflow.push_back(make_pair(farChild, farDistance));
+                }
+                node = &this->nodes[nearChild];
+            }
+
+            if (!node)
+                continue;
+
+            // leaf: test of its triangles
+            for (GLuint i = node->LeftFirst; i < node->LeftFirst + node->Count; i++)
+            {
+                GLuint tri = this->triangles[i];
+                glm::vec3 v0, v1, v2;
+                triangleVertices(mesh, tri, v0, v1, v2);
+
+                float hitDistance;
+                if (RayTriangleIntersection(ray, v0, v1, v2, hitDistance))
+                {
+                    if (hitDistance < t || (hitDistance == t && tri < triangle))
+                    {
+                        t = hitDistance;
+                        triangle = tri;
+                    }
+                }
+            }
+        }
+
+        return triangle != (GLuint)-1;
+    }
+
+    //////////////////////////////////////////
+
+    // it updates the bounding boxes of the nodes containing the triangles of the moved vertices, and of their ancestors
+    // the topology of the hierarchy is not changed (the quality of the tree slowly degrades with large deformations)
+    void Refit(const Mesh& mesh, const vector<GLuint>& movedVertices)
+    {
+        if (this->nodes.empty())
+            return;
+
+        if (this->dirty.size() != this->nodes.size())
+            this->dirty.assign(this->nodes.size(), 0);
+
+        // leaves touched by the moved vertices, and all their ancestors
+        vector<GLuint> dirtyNodes;
+        for (size_t i = 0; i < movedVertices.size(); i++)
+        {
+            GLuint v = movedVertices[i];
+            if (this->vertexTrianglesIndex.empty())
+            {
+                const Vertex& vertex = mesh.vertices[v];
+                for (GLuint k = vertex.NeighboursIndex / 2; k < (vertex.NeighboursIndex + vertex.NeighboursNumber) / 2; k++)
+                {
+                    if (mesh.neighboursCorners[k] != (GLuint)-1)
+                        this->markDirty(mesh.neighboursCorners[k] / 3, dirtyNodes);
+                }
+            }
+            else
+            {
+                for (GLuint j = this->vertexTrianglesIndex[v]; j < this->vertexTrianglesIndex[v + 1]; j++)
+                    this->markDirty(this->vertexTriangles[j], dirtyNodes);
+            }
+        }
+
+        this->refitDirty(mesh, dirtyNodes);
+    }
+
+    // update after an edit of the topology: the changed triangles of the hierarchy are refitted in their leaves,
+    // the new ones (index >= triangles of the build) are tested by brute force until they are more than a fraction of the hierarchy, then it is rebuilt
+    void UpdateTriangles(Mesh& mesh, const vector<GLuint>& changedTriangles)
+    {
+        GLuint trianglesNumber = (GLuint)(mesh.indices.size() / 3);
+        if (this->nodes.empty() || trianglesNumber < this->leaves.size() || trianglesNumber - this->leaves.size() > MAX_NEW_TRIANGLES + this->leaves.size() / 64)
+        {
+            this->Build(mesh);
+            return;
+        }
+
+        if (this->dirty.size() != this->nodes.size())
+            this->dirty.assign(this->nodes.size(), 0);
+
+        vector<GLuint> dirtyNodes;
+        for (size_t i = 0; i < changedTriangles.size(); i++)
+            this->markDirty(changedTriangles[i], dirtyNodes);
+
+        this->refitDirty(mesh, dirtyNodes);
+    }
+
+    // refit of the whole hierarchy
+    void Refit(const Mesh& mesh)
+    {
+        for (size_t n = this->nodes.size(); n-- > 0; )
+        {
+            if (n != 1)
+                this->refitNode(mesh, (GLuint)n);
+        }
+    }
+
+private:
+    // parent of each node
+    vector<GLuint> parents;
+    // leaf containing each triangle
+    vector<GLuint> leaves;
+    // triangles around each vertex, for the refit of meshes without neighbours corners
+    // (compressed rows: triangles of vertex v are from vertexTrianglesIndex[v] to vertexTrianglesIndex[v + 1])
+    vector<GLuint> vertexTrianglesIndex;
+    vector<GLuint> vertexTriangles;
+    // flags of the nodes during the refit
+    vector<unsigned char> dirty;
+    // centroids of the triangles (only during the build)
+    vector<glm::vec3> centroids;
+
+    // bin of the SAH evaluation
+    struct Bin
+    {
+        glm::vec3 Min = glm::vec3(FLT_MAX);
+        glm::vec3 Max = glm::vec3(-FLT_MAX);
+        GLuint Count = 0;
+    };
+
+    //////////////////////////////////////////
+
+    static void triangleVertices(const Mesh& mesh, GLuint triangle, glm::vec3& v0, glm::vec3& v1, glm::vec3& v2)
+    {
+        v0 = mesh.vertices[mesh.indices[triangle * 3]].Position;
+        v1 = mesh.vertices[mesh.indices[triangle * 3 + 1]].Position;
+        v2 = mesh.vertices[mesh.indices[triangle * 3 + 2]].Position;
+    }
+
+    static float area(glm::vec3 min, glm::vec3 max)
+    {
+        glm::vec3 e = max - min;
+        return e.x * e.y + e.y * e.z + e.z * e.x;
+    }
+
+    // slab test: entry distance of the ray in the box, or FLT_MAX if the box is missed (or it is farther than maxDistance)
+    static float intersectBox(const BVHNode& node, const Ray3& ray, glm::vec3 invDirection, float maxDistance)
+    {
+        glm::vec3 t1 = (node.Min - ray.origin) * invDirection;
+        glm::vec3 t2 = (node.Max - ray.origin) * invDirection;
+        glm::vec3 tMin = glm::min(t1, t2);
+        glm::vec3 tMax = glm::max(t1, t2);
+        float tNear = max(max(tMin.x, tMin.y), tMin.z);
+        float tFar = min(min(tMax.x, tMax.y), tMax.z);
+
+        if (tFar >= tNear && tFar > 0.0f && tNear <= maxDistance)
+            return max(tNear, 0.0f);
+        return FLT_MAX;
+    }
+
+    //////////////////////////////////////////
+
+    // bounding box of the triangles of a node
+    void updateBounds(const Mesh& mesh, GLuint nodeIndex)
+    {
+        BVHNode& node = this->nodes[nodeIndex];
+        node.Min = glm::vec3(FLT_MAX);
+        node.Max = glm::vec3(-FLT_MAX);
+        for (GLuint i = node.LeftFirst; i < node.LeftFirst + node.Count; i++)
+        {
+            glm::vec3 v0, v1, v2;
+            triangleVertices(mesh, this->triangles[i], v0, v1, v2);
+            node.Min = glm::min(node.Min, glm::min(v0, glm::min(v1, v2)));
+            node.Max = glm::max(node.Max, glm::max(v0, glm::max(v1, v2)));
+        }
+    }
+
+    // the leaf of a triangle of the hierarchy, and all its ancestors, are added to the nodes to refit
+    void markDirty(GLuint triangle, vector<GLuint>& dirtyNodes)
+    {
+        if (triangle >= this->leaves.size())
+            return;
+
+        GLuint node = this->leaves[triangle];
+        while (!this->dirty[node])
+        {
+            this->dirty[node] = 1;
+            dirtyNodes.push_back(node);
+            if (node == 0)
+                break;
+            node = this->parents[node];
+        }
+    }
+
+    // children are always stored after their parent: going backwards the children are updated before the parents
+    void refitDirty(const Mesh& mesh, vector<GLuint>& dirtyNodes)
+    {
+        sort(dirtyNodes.begin(), dirtyNodes.end(), greater<GLuint>());
+        for (size_t i = 0; i < dirtyNodes.size(); i++)
+        {
+            this->refitNode(mesh, dirtyNodes[i]);
+            this->dirty[dirtyNodes[i]] = 0;
+        }
+    }
+
+    void refitNode(const Mesh& mesh, GLuint nodeIndex)
+    {
+        BVHNode& node = this->nodes[nodeIndex];
+        if (node.Count > 0)
+        {
+            this->updateBounds(mesh, nodeIndex);
+            return;
+        }
+
+        const BVHNode& left = this->nodes[node.LeftFirst];
+        const BVHNode& right = this->nodes[node.LeftFirst + 1];
+        node.Min = glm::min(left.Min, right.Min);
+        node.Max = glm::max(left.Max, right.Max);
+    }
+
+    // binned SAH split of a node: returns false if the node stays a leaf
+    bool subdivide(const Mesh& mesh, GLuint nodeIndex)
+    {
+        BVHNode node = this->nodes[nodeIndex];
+        if (node.Count <= MAX_LEAF_SIZE)
+            return false;
+
+        // bounds of the centroids, used to place the bins
+        glm::vec3 centroidMin = glm::vec3(FLT_MAX), centroidMax = glm::vec3(-FLT_MAX);
+        for (GLuint i = node.LeftFirst; i < node.LeftFirst + node.Count; i++)
+        {
+            centroidMin = glm::min(centroidMin, this->centroids[this->triangles[i]]);
+            centroidMax = glm::max(centroidMax, this->centroids[this->triangles[i]]);
+        }
+
+        int bestAxis = -1;
+        int bestSplit = 0;
+        float bestCost = FLT_MAX;
+
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float extent = centroidMax[axis] - centroidMin[axis];
+            if (extent <= 0.0f)
+                continue;
+
+            Bin bins[BINS];
+            float scale = BINS / extent;
+            for (GLuint i = node.LeftFirst; i < node.LeftFirst + node.Count; i++)
+            {
+                GLuint tri = this->triangles[i];
+                int b = min(BINS - 1, (int)((this->centroids[tri][axis] - centroidMin[axis]) * scale));
+                glm::vec3 v0, v1, v2;
+                triangleVertices(mesh, tri, v0, v1, v2);
+                bins[b].Count++;
+                bins[b].Min = glm::min(bins[b].Min, glm::min(v0, glm::min(v1, v2)));
+                bins[b].Max = glm::max(bins[b].Max, glm::max(v0, glm::max(v1, v2)));
+            }
+
+            // sweeps from left and right to evaluate the cost of each of the BINS - 1 planes
+            float leftArea[BINS - 1], rightArea[BINS - 1];
+            GLuint leftCount[BINS - 1], rightCount[BINS - 1];
+            glm::vec3 leftMin = glm::vec3(FLT_MAX), leftMax = glm::vec3(-FLT_MAX);
+            glm::vec3 rightMin = glm::vec3(FLT_MAX), rightMax = glm::vec3(-FLT_MAX);
+            GLuint leftSum = 0, rightSum = 0;
+            for (int i = 0; i < BINS - 1; i++)
+            {
+                leftSum += bins[i].Count;
+                leftCount[i] = leftSum;
+                leftMin = glm::min(leftMin, bins[i].Min);
+                leftMax = glm::max(leftMax, bins[i].Max);
+                leftArea[i] = leftSum > 0 ? area(leftMin, leftMax) : 0.0f;
+
+                rightSum += bins[BINS - 1 - i].Count;
+                rightCount[BINS - 2 - i] = rightSum;
+                rightMin = glm::min(rightMin, bins[BINS - 1 - i].Min);
+                rightMax = glm::max(rightMax, bins[BINS - 1 - i].Max);
+                rightArea[BINS - 2 - i] = rightSum > 0 ? area(rightMin, rightMax) : 0.0f;
+            }
+
+            for (int i = 0; i < BINS - 1; i++)
+            {
+                float cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (leftCount[i] > 0 && rightCount[i] > 0 && cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        // the split is kept only if it is cheaper than testing all the triangles of the node
+        float leafCost = node.Count * area(node.Min, node.Max);
+        if (bestAxis < 0 || bestCost >= leafCost)
+            return false;
+
+        // partition of the triangles on the chosen plane
+        float extent = centroidMax[bestAxis] - centroidMin[bestAxis];
+        float scale = BINS / extent;
+        GLuint i = node.LeftFirst;
+        GLuint j = node.LeftFirst + node.Count - 1;
+        while (i <= j)
+        {
+            int b = min(BINS - 1, (int)((this->centroids[this->triangles[i]][bestAxis] - centroidMin[bestAxis]) * scale));
+            if (b <= bestSplit)
+                i++;
+            else
+            {
+                swap(this->triangles[i], this->triangles[j]);
+                if (j == 0)
+                    break;
+                j--;
+            }
+        }
+
+        GLuint leftCount = i - node.LeftFirst;
+        if (leftCount == 0 || leftCount == node.Count)
+            return false;
+
+        // the children are allocated as a pair
+        GLuint leftChild = (GLuint)this->nodes.size();
+        BVHNode child;
+        child.LeftFirst = node.LeftFirst;
+        child.Count = leftCount;
+        this->nodes.push_back(child);
+        child.LeftFirst = i;
+        child.Count = node.Count - leftCount;
+        this->nodes.push_back(child);
+        this->parents.push_back(nodeIndex);
+        this->parents.push_back(nodeIndex);
+
+        this->nodes[nodeIndex].LeftFirst = leftChild;
+        this->nodes[nodeIndex].Count = 0;
+
+        return true;
+    }
+
+    // triangles around each vertex (counts, prefix sum, fill)
+    void buildVertexTriangles(const Mesh& mesh)
+    {
+        this->vertexTrianglesIndex.assign(mesh.vertices.size() + 1, 0);
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+            this->vertexTrianglesIndex[mesh.indices[i] + 1]++;
+        for (size_t v = 0; v < mesh.vertices.size(); v++)
+            this->vertexTrianglesIndex[v + 1] += this->vertexTrianglesIndex[v];
+
+        this->vertexTriangles.resize(mesh.indices.size());
+        vector<GLuint> fill(this->vertexTrianglesIndex.begin(), this->vertexTrianglesIndex.end() - 1);
+        for (size_t i = 0; i < mesh.indices.size(); i++)
+            this->vertexTriangles[fill[mesh.indices[i]]++] = (GLuint)(i / 3);
+    }
+};
@@ -145,6 +145,13 @@ public:
     //////////////////////////////////////////
     // it updates the camera ray according to current mouse cursor position
     void UpdateCameraRay(GLfloat mouseX, GLfloat mouseY)
+    {
+        this->CameraRay = this->ScreenRay(mouseX, mouseY);
+    }
+
+    //////////////////////////////////////////
+    // it returns the ray from the camera through a point of the screen (e.g. the points of a stroke, see StrokeEngine)
+    Ray3 ScreenRay(GLfloat mouseX, GLfloat mouseY)
     {
         // we need the inverse matrix to pass from screen space to world space
         glm::mat4 projection = this->GetProjectionMatrix();
@@ -167,10 +174,12 @@ public:
         out.y *= out.w;
         out.z *= out.w;
 
+        Ray3 ray;
         // the origin of the ray is the camera position (the ray comes out from the camera)
-        this->CameraRay.origin = this->Position;
+        ray.origin = this->Position;
         // the direction of the ray is the vector from the origin to the mouse cursor position in world coordinates (its position on the viewport in world coordinates)
-        this->CameraRay.direction = glm::normalize(glm::vec3(out.x, out.y, out.z) - this->CameraRay.origin);
+        ray.direction = glm::normalize(glm::vec3(out.x, out.y, out.z) - ray.origin);
+        return ray;
     }
 
 private:
@@ -0,0 +1,904 @@
+/*
+DynamicTopology class
+- adaptive remeshing of the region of a dab (dynamic topology): after the displacement, the edges around the brush longer than 4/3 of the detail size
+  are split at their middle point, and the edges shorter than 4/5 of it are collapsed, so the triangles keep about the same size where the mesh is sculpted
+  (the triangles stretched by the brush are refined, the crowded ones are merged), and the rest of the mesh is not changed
+- the edits are local: each one removes and adds a few corners in the neighbours ranges of the vertices around the edge, the neighbours array is never rebuilt
+- the removed vertices and faces are kept in free lists and used again by the next splits; when they are too many the mesh is compacted (Compact,
+  at the end of a stroke), so the memory follows the detail of the mesh
+
+Neighbours ranges (see adjacency.h):
+- each vertex has its own range, with a capacity: a range which grows over its capacity is moved at the end of the neighbours array (with double capacity),
+  and the old one is left unused until the mesh is compacted
+- the couples of a range are not in the order of the faces anymore: the corners (Mesh::neighboursCorners) are changed together with the couples
+
+Half-edges (see halfedge.h):
+- the half-edges of the mesh (Mesh::halfEdges) are kept by the edits: the changed corners move to their new vertex, and the edges around them
+  are paired again searching the two ranges of the edge (O(valence))
+- the queries of the remeshing use the twins: the faces of an edge (from a half-edge of the edge found by the one-ring), the one-ring of a vertex
+  (its fan), the boundary vertices (a corner without twin) and the link condition of the collapse; a vertex whose fan does not visit all its faces
+  (non-manifold) is searched in its range
+
+N.B. 1) the vertices with the same position are welded when the mesh is attached (they share the same range, so an edit could not change only one of them):
+after it the mesh has no seams of texture coordinates (see N.B. 2 of Mesh)
+
+N.B. 2) a removed face has the same three indices (it is degenerate: it is not drawn and it is never hit); a removed vertex has no neighbours
+(it is not in the SpatialGrid, and it is never in the neighbours of another vertex)
+
+N.B. 3) checks of the collapse (from "A Remeshing Approach to Multiresolution Modeling" paper by Botsch and Kobbelt, and the link condition of Dey et al.):
+no boundary vertices (or non-manifold edges around them), the two vertices have only the two opposite vertices in common, the opposite vertices keep at least 3 faces,
+the new edges are not longer than the split length, and no face is flipped
+
+N.B. 4) the edits of a remeshing are recorded by the StrokeHistory passed to Remesh (the faces, the vertices and the couples of neighbours are saved
+before their first change, see history.h), so a stroke with edits of the topology is undone like the other ones: after an undo / redo
+the free lists are found again by Resync. Compact renumbers the vertices and the faces: the history must be cleared after it
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+#include <usculpt/adjacency.h>
+#include <usculpt/sculptor.h>
+#include <usculpt/history.h>
+
+/////////////////// DYNAMICTOPOLOGY class ///////////////////////
+class DynamicTopology
+{
+public:
+    // maximum number of splits of a dab (the remaining long edges are split by the next dabs)
+    static const GLuint MAX_SPLITS = 4096;
+    // passes of splits of a dab: each pass splits the long edges of the vertices added by the previous one
+    static const int SPLIT_PASSES = 4;
+    // capacity (in couples) of the range of a new vertex, and minimum capacity of a moved range
+    static const GLuint MIN_CAPACITY = 8;
+
+    //////////////////////////////////////////
+
+    // constructor
+    DynamicTopology()
+        : attached(nullptr), history(nullptr), stamp(0)
+    {
+    }
+
+    //////////////////////////////////////////
+
+    // the mesh is prepared for the edits: vertices with the same position welded, capacity of each range, free vertices and faces
+    // it returns true if the mesh has been changed by the welding (the whole mesh must be copied again on the GPU, see Mesh::UploadTopology())
+    bool Attach(Mesh& mesh)
+    {
+        // the faces around the vertices are found from the corners of the neighbours
+        this->attached = nullptr;
+        mesh.UpdateNeighboursCorners();
+        if (mesh.neighboursCorners.empty() || find(mesh.neighboursCorners.begin(), mesh.neighboursCorners.end(), (GLuint)-1) != mesh.neighboursCorners.end())
+        {
+            cout << "WARNING::DYNAMICTOPOLOGY:: NEIGHBOURS NOT MATCHING THE FACES OF THE MESH" << endl;
+            return false;
+        }
+
+        this->attached = &mesh;
+        this->marks.clear();
+        this->stamp = 0;
+        this->freeVertices.clear();
+        this->freeFaces.clear();
+
+        vector<GLuint> welded;
+        GLuint positions = WeldVertices(mesh.vertices, welded);
+        bool changed = positions < mesh.vertices.size();
+        if (changed)
+        {
+            // the first vertex of each position represents it in the faces and in the neighbours
+            vector<GLuint> representative(positions, (GLuint)-1);
+            for (GLuint i = 0; i < mesh.vertices.size(); i++)
+            {
+                if (representative[welded[i]] == (GLuint)-1)
+                    representative[welded[i]] = i;
+                else
+                    mesh.vertices[i].NeighboursNumber = 0;
+            }
+            for (size_t i = 0; i < mesh.indices.size(); i++)
+                mesh.indices[i] = representative[welded[mesh.indices[i]]];
+            for (size_t i = 0; i < mesh.neighbours.size(); i++)
+                mesh.neighbours[i] = representative[welded[mesh.neighbours[i]]];
+        }
+
+        this->capacities.resize(mesh.vertices.size());
+        for (GLuint i = 0; i < mesh.vertices.size(); i++)
+            this->capacities[i] = mesh.vertices[i].NeighboursNumber / 2;
+
+        // the half-edges of the loaded mesh are welded with the same vertices (the first one of each position): their origins are the new indices
+        mesh.UpdateHalfEdges();
+
+        // faces with the same vertex in two corners (e.g. at the poles of a sphere, after the welding) are removed
+        for (GLuint f = 0; f < mesh.indices.size() / 3; f++)
+        {
+            GLuint a = mesh.indices[f * 3], b = mesh.indices[f * 3 + 1], c = mesh.indices[f * 3 + 2];
+            if (a == b && a == c)
+                this->freeFaces.push_back(f);
+            else if (a == b || b == c || c == a)
+            {
+                this->removeFace(mesh, f);
+                changed = true;
+            }
+        }
+
+        this->removed.assign(mesh.vertices.size(), 0);
+        for (GLuint i = 0; i < mesh.vertices.size(); i++)
+        {
+            if (mesh.vertices[i].NeighboursNumber == 0)
+            {
+                this->removed[i] = 1;
+                this->freeVertices.push_back(i);
+            }
+        }
+
+        return changed;
+    }
+
+    // the mesh has been changed by an undo / redo of a stroke with edits of the topology (see N.B. 4): the removed vertices and faces are found again
+    // (N.B. 2), and the capacity of each range is its length (a range which grows is moved at the end of the neighbours array)
+    // (the half-edges dropped by the history are built again by the next remeshing)
+    void Resync(const Mesh& mesh)
+    {
+        if (this->attached != &mesh)
+            return;
+
+        this->capacities.resize(mesh.vertices.size());
+        this->removed.assign(mesh.vertices.size(), 0);
+        this->freeVertices.clear();
+        this->freeFaces.clear();
+        for (GLuint i = 0; i < mesh.vertices.size(); i++)
+        {
+            this->capacities[i] = mesh.vertices[i].NeighboursNumber / 2;
+            if (mesh.vertices[i].NeighboursNumber == 0)
+            {
+                this->removed[i] = 1;
+                this->freeVertices.push_back(i);
+            }
+        }
+        for (GLuint f = 0; f < mesh.indices.size() / 3; f++)
+        {
+            if (mesh.indices[f * 3] == mesh.indices[f * 3 + 1] && mesh.indices[f * 3] == mesh.indices[f * 3 + 2])
+                this->freeFaces.push_back(f);
+        }
+    }
+
+    // true if the mesh has been attached, and it has not been changed in other ways after the last edit
+    bool Attached(const Mesh& mesh) const
+    {
+        return this->attached == &mesh && this->capacities.size() == mesh.vertices.size();
+    }
+
+    // the mesh is not edited anymore (e.g. its data have been replaced by a Multires level): the free lists are dropped
+    void Detach()
+    {
+        this->attached = nullptr;
+        this->capacities.clear();
+        this->removed.clear();
+        this->freeVertices.clear();
+        this->freeFaces.clear();
+    }
+
+    //////////////////////////////////////////
+
+    // remeshing of the edges around the vertices of region (e.g. the vertices of the dab) with their middle point at distance <= radius from center:
+    // the edges longer than 4/3 of detailSize are split, then the edges shorter than 4/5 of detailSize are collapsed,
+    // and the normals of the changed vertices are updated by the sculptor
+    // it returns true if the topology has been changed (the changed, added and removed vertices and the changed faces are in the lists of the last remeshing)
+    // the edits are recorded by the history, if any (see N.B. 4)
+    bool Remesh(Mesh& mesh, Sculptor& sculptor, const vector<GLuint>& region, glm::vec3 center, float radius, float detailSize, StrokeHistory* history = nullptr)
+    {
+        this->changedVertices.clear();
+        this->changedFaces.clear();
+        this->addedVertices.clear();
+        this->removedVertices.clear();
+        this->touched.clear();
+        if (!this->Attached(mesh) || detailSize <= 0.0f)
+            return false;
+
+        mesh.UpdateHalfEdges();
+        float maxLength = detailSize * 4.0f / 3.0f;
+        float minLength = detailSize * 4.0f / 5.0f;
+        this->history = history;
+
+        // splits: the longest edges first, then the edges of the new vertices
+        vector<GLuint> candidates, added;
+        for (size_t i = 0; i < region.size(); i++)
+        {
+            if (!this->removed[region[i]])
+                candidates.push_back(region[i]);
+        }
+
+        GLuint splits = 0;
+        for (int pass = 0; pass < SPLIT_PASSES && !candidates.empty() && splits < MAX_SPLITS; pass++)
+        {
+            this->collectEdges(mesh, candidates, center, radius, maxLength * maxLength, true);
+
+            candidates.clear();
+            for (size_t i = 0; i < this->edges.size() && splits < MAX_SPLITS; i++)
+            {
+                const Edge& e = this->edges[i];
+                if (lengthSquared(mesh, e.A, e.B) <= maxLength * maxLength)
+                    continue;
+
+                GLuint middle = this->split(mesh, e.A, e.B, e.HalfEdge);
+                if (middle == (GLuint)-1)
+                    continue;
+                candidates.push_back(middle);
+                added.push_back(middle);
+                splits++;
+            }
+        }
+
+        // collapses: the shortest edges first
+        candidates.clear();
+        for (size_t i = 0; i < region.size(); i++)
+        {
+            if (!this->removed[region[i]])
+                candidates.push_back(region[i]);
+        }
+        candidates.insert(candidates.end(), added.begin(), added.end());
+        this->collectEdges(mesh, candidates, center, radius, minLength * minLength, false);
+        for (size_t i = 0; i < this->edges.size(); i++)
+        {
+            const Edge& e = this->edges[i];
+            if (this->removed[e.A] || this->removed[e.B] || lengthSquared(mesh, e.A, e.B) >= minLength * minLength)
+                continue;
+            this->collapse(mesh, e.A, e.B, e.HalfEdge, maxLength * maxLength);
+        }
+
+        this->history = nullptr;
+        if (this->changedFaces.empty())
+            return false;
+
+        this->finishLists(mesh, sculptor);
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // the removed vertices and faces, and the unused parts of the neighbours array, are dropped when they are too many
+    // (more free vertices than 1/4 of the vertices, or more unused couples than used ones): the vertices and the faces are renumbered,
+    // so it returns true if the mesh has been compacted (the whole mesh must be copied again on the GPU, and the BVH, the grid and the history are not valid)
+    bool Compact(Mesh& mesh)
+    {
+        if (!this->Attached(mesh))
+            return false;
+
+        size_t used = 0;
+        for (size_t i = 0; i < mesh.vertices.size(); i++)
+            used += mesh.vertices[i].NeighboursNumber / 2;
+        if (mesh.neighboursCorners.size() <= used * 2 && this->freeVertices.size() * 4 <= mesh.vertices.size())
+            return false;
+
+        // new index of each vertex and of each face (the removed ones are dropped, the others keep their order)
+        vector<GLuint> vertexIndex(mesh.vertices.size(), (GLuint)-1), faceIndex(mesh.indices.size() / 3, (GLuint)-1);
+        GLuint verticesNumber = 0, facesNumber = 0;
+        for (size_t i = 0; i < mesh.vertices.size(); i++)
+        {
+            if (!this->removed[i])
+                vertexIndex[i] = verticesNumber++;
+        }
+        for (size_t i = 0; i < this->freeFaces.size(); i++)
+            faceIndex[this->freeFaces[i]] = 0;
+        for (size_t f = 0; f < faceIndex.size(); f++)
+            faceIndex[f] = faceIndex[f] == (GLuint)-1 ? facesNumber++ : (GLuint)-1;
+
+        // ranges without spare capacity, in the order of the vertices
+        vector<GLuint> neighbours, corners;
+        neighbours.reserve(used * 2);
+        corners.reserve(used);
+        for (size_t i = 0; i < mesh.vertices.size(); i++)
+        {
+            if (this->removed[i])
+                continue;
+
+            Vertex v = mesh.vertices[i];
+            for (GLuint k = v.NeighboursIndex / 2; k < (v.NeighboursIndex + v.NeighboursNumber) / 2; k++)
+            {
+                GLuint corner = mesh.neighboursCorners[k];
+                neighbours.push_back(vertexIndex[mesh.neighbours[k * 2]]);
+                neighbours.push_back(vertexIndex[mesh.neighbours[k * 2 + 1]]);
+                corners.push_back(faceIndex[corner / 3] * 3 + corner % 3);
+            }
+            v.NeighboursIndex = (GLuint)neighbours.size() - v.NeighboursNumber;
+            mesh.vertices[vertexIndex[i]] = v;
+        }
+        for (size_t f = 0; f < faceIndex.size(); f++)
+        {
+            if (faceIndex[f] == (GLuint)-1)
+                continue;
+            for (int c = 0; c < 3; c++)
+                mesh.indices[faceIndex[f] * 3 + c] = vertexIndex[mesh.indices[f * 3 + c]];
+        }
+
+        mesh.vertices.resize(verticesNumber);
+        mesh.indices.resize(facesNumber * 3);
+        mesh.neighbours.swap(neighbours);
+        mesh.neighboursCorners.swap(corners);
+        mesh.vertices.shrink_to_fit();
+        mesh.indices.shrink_to_fit();
+
+        this->capacities.resize(verticesNumber);
+        for (GLuint i = 0; i < verticesNumber; i++)
+            this->capacities[i] = mesh.vertices[i].NeighboursNumber / 2;
+        this->removed.assign(verticesNumber, 0);
+        this->freeVertices.clear();
+        this->freeFaces.clear();
+        // (the half-edges of the renumbered faces are built again by the next remeshing)
+        mesh.halfEdges.Clear();
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // lists of the last remeshing (sorted)
+    // changed vertices: positions, normals or neighbours changed (the removed vertices too); changed faces: indices or positions changed
+    const vector<GLuint>& ChangedVertices() const { return this->changedVertices; }
+    const vector<GLuint>& ChangedFaces() const { return this->changedFaces; }
+    const vector<GLuint>& AddedVertices() const { return this->addedVertices; }
+    const vector<GLuint>& RemovedVertices() const { return this->removedVertices; }
+
+    // removed vertices and faces, which can be used again
+    size_t FreeVertices() const { return this->freeVertices.size(); }
+    size_t FreeFaces() const { return this->freeFaces.size(); }
+
+private:
+    // edge of the remeshing (A < B), with its squared length and a half-edge of the edge (see sharedFaces)
+    struct Edge
+    {
+        GLuint A, B;
+        float Length;
+        GLuint HalfEdge;
+    };
+
+    // attached mesh, and history recording the edits of the current remeshing
+    const Mesh* attached;
+    StrokeHistory* history;
+
+    // capacity (in couples) of the range of each vertex, removed vertices, free lists
+    vector<GLuint> capacities;
+    vector<unsigned char> removed;
+    vector<GLuint> freeVertices, freeFaces;
+
+    // lists of the last remeshing, and vertices whose faces have been changed (their normals are updated)
+    vector<GLuint> changedVertices, changedFaces, addedVertices, removedVertices, touched;
+    // buffers reused by each remeshing
+    vector<Edge> edges;
+    vector<GLuint> facesA, facesB, adjacentA, adjacentB, ring;
+    // mark of the vertices of a one-ring (link condition of the collapse), and mark of the current check
+    vector<GLuint> marks;
+    GLuint stamp;
+
+    //////////////////////////////////////////
+
+    static float lengthSquared(const Mesh& mesh, GLuint a, GLuint b)
+    {
+        glm::vec3 e = mesh.vertices[a].Position - mesh.vertices[b].Position;
+        return glm::dot(e, e);
+    }
+
+    // edges of the vertices with the middle point inside the brush, longer (or shorter) than the squared length, sorted by length (longest or shortest first)
+    void collectEdges(const Mesh& mesh, const vector<GLuint>& vertices, glm::vec3 center, float radius, float length, bool longer)
+    {
+        this->edges.clear();
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            GLuint a = vertices[i];
+            this->adjacent(mesh, a, this->adjacentA, &this->ring);
+            for (size_t j = 0; j < this->adjacentA.size(); j++)
+            {
+                GLuint b = this->adjacentA[j];
+                float l = lengthSquared(mesh, a, b);
+                if ((longer ? l <= length : l >= length) || !Sculptor::InBrush(center, (mesh.vertices[a].Position + mesh.vertices[b].Position) * 0.5f, radius))
+                    continue;
+
+                Edge e = { min(a, b), max(a, b), l, this->ring[j] };
+                this->edges.push_back(e);
+            }
+        }
+
+        sort(this->edges.begin(), this->edges.end(), [longer](const Edge& x, const Edge& y)
+        {
+            if (x.Length != y.Length)
+                return longer ? x.Length > y.Length : x.Length < y.Length;
+            return x.A != y.A ? x.A < y.A : x.B < y.B;
+        });
+        this->edges.erase(unique(this->edges.begin(), this->edges.end(), [](const Edge& x, const Edge& y) { return x.A == y.A && x.B == y.B; }), this->edges.end());
+    }
+
+    //////////////////////////////////////////
+
+    // faces around a vertex
+    void faces(const Mesh& mesh, GLuint vertex, vector<GLuint>& result) const
+    {
+        result.clear();
+        const Vertex& v = mesh.vertices[vertex];
+        for (GLuint k = v.NeighboursIndex / 2; k < (v.NeighboursIndex + v.NeighboursNumber) / 2; k++)
+            result.push_back(mesh.neighboursCorners[k] / 3);
+    }
+
+    // vertices connected to a vertex by an edge (without repetitions), and a half-edge of each edge (if halfEdges is not null):
+    // the one-ring of the fan of the vertex, or the couples of its range (without half-edges) if the fan does not visit all its faces
+    void adjacent(const Mesh& mesh, GLuint vertex, vector<GLuint>& result, vector<GLuint>* halfEdges = nullptr) const
+    {
+        const Vertex& v = mesh.vertices[vertex];
+        result.clear();
+        if (halfEdges)
+            halfEdges->clear();
+        if (v.NeighboursNumber == 0)
+            return;
+
+        GLuint faces = mesh.halfEdges.ForEachNeighbour(mesh.neighboursCorners[v.NeighboursIndex / 2], [&](GLuint position, GLuint h)
+        {
+            result.push_back(position);
+            if (halfEdges)
+                halfEdges->push_back(h);
+        });
+        if (faces == v.NeighboursNumber / 2)
+            return;
+
+        result.assign(mesh.neighbours.begin() + v.NeighboursIndex, mesh.neighbours.begin() + v.NeighboursIndex + v.NeighboursNumber);
+        sort(result.begin(), result.end());
+        result.erase(unique(result.begin(), result.end()), result.end());
+        if (halfEdges)
+            halfEdges->assign(result.size(), (GLuint)HalfEdges::NO_HALFEDGE);
+    }
+
+    // faces with the edge a - b (up to 3, for a non-manifold edge): the two faces of the half-edge h and of its twin, if h is still on the edge
+    // and it has a twin, otherwise the faces of the range of a
+    GLuint sharedFaces(const Mesh& mesh, GLuint a, GLuint b, GLuint h, GLuint shared[3]) const
+    {
+        if (h != HalfEdges::NO_HALFEDGE && h < mesh.halfEdges.Size() && !mesh.halfEdges.IsBoundary(h))
+        {
+            GLuint u = mesh.indices[h], w = mesh.indices[HalfEdges::Next(h)];
+            if ((u == a && w == b) || (u == b && w == a))
+            {
+                shared[0] = HalfEdges::Face(h);
+                shared[1] = HalfEdges::Face(mesh.halfEdges.Twin(h));
+                return 2;
+            }
+        }
+
+        GLuint count = 0;
+        const Vertex& v = mesh.vertices[a];
+        for (GLuint k = v.NeighboursIndex / 2; k < (v.NeighboursIndex + v.NeighboursNumber) / 2 && count < 3; k++)
+        {
+            if (mesh.neighbours[k * 2] == b || mesh.neighbours[k * 2 + 1] == b)
+                shared[count++] = mesh.neighboursCorners[k] / 3;
+        }
+        return count;
+    }
+
+    // a vertex is on a boundary if one of its edges has no twin (a single face, or a non-manifold edge): the half-edges going out of it
+    // and coming into it are the corners of its range and their previous half-edges
+    static bool boundary(const Mesh& mesh, GLuint vertex)
+    {
+        const Vertex& v = mesh.vertices[vertex];
+        for (GLuint k = v.NeighboursIndex / 2; k < (v.NeighboursIndex + v.NeighboursNumber) / 2; k++)
+        {
+            GLuint corner = mesh.neighboursCorners[k];
+            if (mesh.halfEdges.IsBoundary(corner) || mesh.halfEdges.IsBoundary(HalfEdges::Prev(corner)))
+                return true;
+        }
+        return false;
+    }
+
+    // twins of the half-edges of the edge a - b after an edit of its faces: they are paired only if the edge has a half-edge in each direction
+    // (like HalfEdges::Build); the half-edges a -> b are the corners of the range of a with b as next vertex, and the other way round
+    static void pairEdge(Mesh& mesh, GLuint a, GLuint b)
+    {
+        if (a == b)
+            return;
+
+        // half-edges a -> b (found[0]) and b -> a (found[1]), and their numbers
+        GLuint found[2], count[2] = {0, 0};
+        for (int s = 0; s < 2; s++)
+        {
+            GLuint from = s == 0 ? a : b, to = s == 0 ? b : a;
+            const Vertex& v = mesh.vertices[from];
+            for (GLuint k = v.NeighboursIndex / 2; k < (v.NeighboursIndex + v.NeighboursNumber) / 2; k++)
+            {
+                if (mesh.neighbours[k * 2] != to)
+                    continue;
+                found[s] = mesh.neighboursCorners[k];
+                count[s]++;
+                mesh.halfEdges.Unlink(found[s]);
+            }
+        }
+
+        if (count[0] == 1 && count[1] == 1)
+            mesh.halfEdges.Link(found[0], found[1]);
+    }
+
+    //////////////////////////////////////////
+    // elements which are going to be changed by an edit, saved by the history (see N.B. 4)
+
+    void recordVertex(const Mesh& mesh, GLuint vertex)
+    {
+        if (this->history)
+            this->history->RecordVertex(mesh, vertex);
+    }
+
+    void recordFace(const Mesh& mesh, GLuint face)
+    {
+        if (this->history)
+            this->history->RecordFace(mesh, face);
+    }
+
+    void recordCouple(const Mesh& mesh, GLuint couple)
+    {
+        if (this->history)
+            this->history->RecordCouple(mesh, couple);
+    }
+
+    //////////////////////////////////////////
+    // edits of the corners: the couple of a corner is in the range of its vertex, with the other two vertices of the face in order
+
+    // position of the couple of a corner in the range of its vertex
+    static GLuint couple(const Mesh& mesh, GLuint corner)
+    {
+        const Vertex& v = mesh.vertices[mesh.indices[corner]];
+        GLuint k = v.NeighboursIndex / 2;
+        while (mesh.neighboursCorners[k] != corner)
+            k++;
+        return k;
+    }
+
+    // the couple of the corner is removed from the range of its vertex (the last couple takes its place)
+    void removeCorner(Mesh& mesh, GLuint corner)
+    {
+        Vertex& v = mesh.vertices[mesh.indices[corner]];
+        GLuint k = couple(mesh, corner);
+        GLuint last = (v.NeighboursIndex + v.NeighboursNumber) / 2 - 1;
+        this->recordVertex(mesh, mesh.indices[corner]);
+        this->recordCouple(mesh, k);
+        this->recordCouple(mesh, last);
+        mesh.neighbours[k * 2] = mesh.neighbours[last * 2];
+        mesh.neighbours[k * 2 + 1] = mesh.neighbours[last * 2 + 1];
+        mesh.neighboursCorners[k] = mesh.neighboursCorners[last];
+        mesh.neighboursCorners[last] = (GLuint)-1;
+        v.NeighboursNumber -= 2;
+        this->touched.push_back(mesh.indices[corner]);
+    }
+
+    // the couple of the corner is added to the range of its vertex (moved at the end of the neighbours array if it is full)
+    void addCorner(Mesh& mesh, GLuint corner)
+    {
+        GLuint vertex = mesh.indices[corner];
+        this->recordVertex(mesh, vertex);
+        Vertex& v = mesh.vertices[vertex];
+        GLuint count = v.NeighboursNumber / 2;
+        if (count == this->capacities[vertex])
+        {
+            GLuint capacity = count * 2 > MIN_CAPACITY ? count * 2 : MIN_CAPACITY;
+            GLuint index = (GLuint)mesh.neighbours.size();
+            mesh.neighbours.resize(index + capacity * 2);
+            mesh.neighboursCorners.resize(index / 2 + capacity, (GLuint)-1);
+            copy(mesh.neighbours.begin() + v.NeighboursIndex, mesh.neighbours.begin() + v.NeighboursIndex + v.NeighboursNumber, mesh.neighbours.begin() + index);
+            copy(mesh.neighboursCorners.begin() + v.NeighboursIndex / 2, mesh.neighboursCorners.begin() + v.NeighboursIndex / 2 + count, mesh.neighboursCorners.begin() + index / 2);
+            this->capacities[vertex] = capacity;
+            v.NeighboursIndex = index;
+        }
+
+        GLuint k = v.NeighboursIndex / 2 + count;
+        GLuint triangle = corner - corner % 3;
+        this->recordCouple(mesh, k);
+        mesh.neighbours[k * 2] = mesh.indices[triangle + (corner + 1) % 3];
+        mesh.neighbours[k * 2 + 1] = mesh.indices[triangle + (corner + 2) % 3];
+        mesh.neighboursCorners[k] = corner;
+        v.NeighboursNumber += 2;
+        this->touched.push_back(vertex);
+    }
+
+    // the vertex of a corner is replaced: the corner moves to the range of the new vertex, and the couples of the other two corners of the face are updated
+    void setCorner(Mesh& mesh, GLuint corner, GLuint vertex)
+    {
+        GLuint old = mesh.indices[corner];
+        this->recordFace(mesh, corner / 3);
+        this->removeCorner(mesh, corner);
+        mesh.indices[corner] = vertex;
+        this->addCorner(mesh, corner);
+
+        GLuint triangle = corner - corner % 3;
+        for (GLuint c = triangle; c < triangle + 3; c++)
+        {
+            if (c == corner)
+                continue;
+            GLuint k = couple(mesh, c);
+            this->recordCouple(mesh, k);
+            mesh.neighbours[k * 2] = mesh.indices[triangle + (c + 1) % 3];
+            mesh.neighbours[k * 2 + 1] = mesh.indices[triangle + (c + 2) % 3];
+            this->touched.push_back(mesh.indices[c]);
+        }
+
+        // the two edges of the corner are changed: the old ones lose a face, the new ones gain it
+        GLuint next = mesh.indices[HalfEdges::Next(corner)], prev = mesh.indices[HalfEdges::Prev(corner)];
+        mesh.halfEdges.SetOrigin(corner, vertex);
+        pairEdge(mesh, old, next);
+        pairEdge(mesh, prev, old);
+        pairEdge(mesh, vertex, next);
+        pairEdge(mesh, prev, vertex);
+        this->changedFaces.push_back(triangle / 3);
+    }
+
+    // new face (a free face, or a new one at the end of the indices)
+    void addFace(Mesh& mesh, GLuint a, GLuint b, GLuint c)
+    {
+        GLuint face;
+        if (!this->freeFaces.empty())
+        {
+            face = this->freeFaces.back();
+            this->freeFaces.pop_back();
+            this->recordFace(mesh, face);
+        }
+        else
+        {
+            face = (GLuint)(mesh.indices.size() / 3);
+            mesh.indices.resize(mesh.indices.size() + 3);
+        }
+
+        mesh.indices[face * 3] = a;
+        mesh.indices[face * 3 + 1] = b;
+        mesh.indices[face * 3 + 2] = c;
+        for (GLuint corner = face * 3; corner < face * 3 + 3; corner++)
+            this->addCorner(mesh, corner);
+
+        mesh.halfEdges.SetFace(face, a, b, c);
+        pairEdge(mesh, a, b);
+        pairEdge(mesh, b, c);
+        pairEdge(mesh, c, a);
+        this->changedFaces.push_back(face);
+    }
+
+    // the corners of the face are removed, and it becomes degenerate (see N.B. 2)
+    void removeFace(Mesh& mesh, GLuint face)
+    {
+        GLuint a = mesh.indices[face * 3], b = mesh.indices[face * 3 + 1], c = mesh.indices[face * 3 + 2];
+        this->recordFace(mesh, face);
+        for (GLuint corner = face * 3; corner < face * 3 + 3; corner++)
+            this->removeCorner(mesh, corner);
+
+        mesh.indices[face * 3 + 1] = mesh.indices[face * 3 + 2] = mesh.indices[face * 3];
+        mesh.halfEdges.SetFace(face, a, a, a);
+        pairEdge(mesh, a, b);
+        pairEdge(mesh, b, c);
+        pairEdge(mesh, c, a);
+        this->freeFaces.push_back(face);
+        this->changedFaces.push_back(face);
+    }
+
+    // new vertex in the middle of the edge a - b (a free vertex, or a new one at the end of the vertices, with a new range)
+    GLuint addVertex(Mesh& mesh, GLuint a, GLuint b)
+    {
+        GLuint vertex;
+        if (!this->freeVertices.empty())
+        {
+            vertex = this->freeVertices.back();
+            this->freeVertices.pop_back();
+            this->recordVertex(mesh, vertex);
+        }
+        else
+        {
+            vertex = (GLuint)mesh.vertices.size();
+            mesh.vertices.push_back(Vertex());
+            this->capacities.push_back(0);
+            this->removed.push_back(0);
+        }
+
+        const Vertex& va = mesh.vertices[a];
+        const Vertex& vb = mesh.vertices[b];
+        Vertex& v = mesh.vertices[vertex];
+        v.Position = (va.Position + vb.Position) * 0.5f;
+        v.Normal = glm::normalize(va.Normal + vb.Normal);
+        v.TexCoords = (va.TexCoords + vb.TexCoords) * 0.5f;
+        v.Tangent = (va.Tangent + vb.Tangent) * 0.5f;
+        v.Bitangent = (va.Bitangent + vb.Bitangent) * 0.5f;
+        v.NeighboursNumber = 0;
+        if (this->capacities[vertex] == 0)
+        {
+            v.NeighboursIndex = (GLuint)mesh.neighbours.size();
+            mesh.neighbours.resize(mesh.neighbours.size() + MIN_CAPACITY * 2);
+            mesh.neighboursCorners.resize(mesh.neighboursCorners.size() + MIN_CAPACITY, (GLuint)-1);
+            this->capacities[vertex] = MIN_CAPACITY;
+        }
+
+        this->removed[vertex] = 0;
+        this->addedVertices.push_back(vertex);
+        return vertex;
+    }
+
+    // the vertex (without faces) is added to the free list; its range is kept for the next vertex using it
+    void removeVertex(GLuint vertex)
+    {
+        this->removed[vertex] = 1;
+        this->freeVertices.push_back(vertex);
+        this->removedVertices.push_back(vertex);
+    }
+
+    //////////////////////////////////////////
+
+    // split of the edge a - b (h is a half-edge of the edge, see sharedFaces): each face (u, w, x) with the edge u -> w becomes (u, m, x) and (m, w, x)
+    // it returns the new vertex m, or -1 if the edge has been skipped (no faces, or non-manifold edge)
+    GLuint split(Mesh& mesh, GLuint a, GLuint b, GLuint h)
+    {
+        GLuint shared[3];
+        GLuint count = this->sharedFaces(mesh, a, b, h, shared);
+        if (count == 0 || count > 2)
+            return (GLuint)-1;
+
+        GLuint middle = this->addVertex(mesh, a, b);
+        for (GLuint i = 0; i < count; i++)
+        {
+            GLuint triangle = shared[i] * 3;
+            GLuint p = 0;
+            while (!(mesh.indices[triangle + p] == a && mesh.indices[triangle + (p + 1) % 3] == b) &&
+                   !(mesh.indices[triangle + p] == b && mesh.indices[triangle + (p + 1) % 3] == a))
+                p++;
+
+            GLuint w = mesh.indices[triangle + (p + 1) % 3];
+            GLuint x = mesh.indices[triangle + (p + 2) % 3];
+            this->setCorner(mesh, triangle + (p + 1) % 3, middle);
+            this->addFace(mesh, middle, w, x);
+        }
+
+        return middle;
+    }
+
+    // collapse of the edge a - b in its middle point: the faces of the edge are removed, b is replaced by a in its other faces, and b is removed
+    // it returns false if a check of N.B. 3 fails
+    bool collapse(Mesh& mesh, GLuint a, GLuint b, GLuint h, float maxLength)
+    {
+        GLuint shared[3];
+        if (this->sharedFaces(mesh, a, b, h, shared) != 2 || boundary(mesh, a) || boundary(mesh, b))
+            return false;
+
+        // link condition: the common vertices of a and b are only the opposite vertices of the two faces
+        GLuint opposite[2];
+        for (int i = 0; i < 2; i++)
+        {
+            GLuint triangle = shared[i] * 3;
+            opposite[i] = mesh.indices[triangle] ^ mesh.indices[triangle + 1] ^ mesh.indices[triangle + 2] ^ a ^ b;
+            if (mesh.vertices[opposite[i]].NeighboursNumber / 2 <= 3)
+                return false;
+        }
+
+        // (the one-ring of a is marked, then the marked vertices of the one-ring of b are counted)
+        this->adjacent(mesh, a, this->adjacentA);
+        this->adjacent(mesh, b, this->adjacentB);
+        if (this->marks.size() < mesh.vertices.size())
+            this->marks.resize(mesh.vertices.size(), 0);
+        if (++this->stamp == 0)
+        {
+            fill(this->marks.begin(), this->marks.end(), 0);
+            this->stamp = 1;
+        }
+        for (size_t i = 0; i < this->adjacentA.size(); i++)
+            this->marks[this->adjacentA[i]] = this->stamp;
+        size_t common = 0;
+        for (size_t i = 0; i < this->adjacentB.size(); i++)
+            common += this->marks[this->adjacentB[i]] == this->stamp;
+        if (common != 2 || this->adjacentA.size() + this->adjacentB.size() - 4 < 3)
+            return false;
+
+        // the new edges are not too long
+        glm::vec3 middle = (mesh.vertices[a].Position + mesh.vertices[b].Position) * 0.5f;
+        for (int s = 0; s < 2; s++)
+        {
+            const vector<GLuint>& around = s == 0 ? this->adjacentA : this->adjacentB;
+            for (size_t i = 0; i < around.size(); i++)
+            {
+                glm::vec3 e = mesh.vertices[around[i]].Position - middle;
+                if (around[i] != a && around[i] != b && glm::dot(e, e) > maxLength)
+                    return false;
+            }
+        }
+
+        // no flipped faces
+        this->faces(mesh, a, this->facesA);
+        this->faces(mesh, b, this->facesB);
+        for (int s = 0; s < 2; s++)
+        {
+            const vector<GLuint>& around = s == 0 ? this->facesA : this->facesB;
+            for (size_t i = 0; i < around.size(); i++)
+            {
+                if (around[i] == shared[0] || around[i] == shared[1])
+                    continue;
+
+                glm::vec3 p[3], q[3];
+                for (int c = 0; c < 3; c++)
+                {
+                    GLuint vertex = mesh.indices[around[i] * 3 + c];
+                    p[c] = mesh.vertices[vertex].Position;
+                    q[c] = vertex == a || vertex == b ? middle : p[c];
+                }
+                if (glm::dot(glm::cross(p[1] - p[0], p[2] - p[0]), glm::cross(q[1] - q[0], q[2] - q[0])) <= 0.0f)
+                    return false;
+            }
+        }
+
+        this->removeFace(mesh, shared[0]);
+        this->removeFace(mesh, shared[1]);
+        for (size_t i = 0; i < this->facesB.size(); i++)
+        {
+            GLuint triangle = this->facesB[i] * 3;
+            if (this->facesB[i] == shared[0] || this->facesB[i] == shared[1])
+                continue;
+
+            GLuint p = 0;
+            while (mesh.indices[triangle + p] != b)
+                p++;
+            this->setCorner(mesh, triangle + p, a);
+        }
+
+        // the faces of a are changed by its new position
+        for (size_t i = 0; i < this->facesA.size(); i++)
+            this->changedFaces.push_back(this->facesA[i]);
+        this->recordVertex(mesh, a);
+        mesh.vertices[a].Normal = glm::normalize(mesh.vertices[a].Normal + mesh.vertices[b].Normal);
+        mesh.vertices[a].Position = middle;
+        this->touched.push_back(a);
+        this->removeVertex(b);
+
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // normals of the touched vertices (and of their neighbours), and final lists of the remeshing
+    void finishLists(Mesh& mesh, Sculptor& sculptor)
+    {
+        auto sortUnique = [](vector<GLuint>& list)
+        {
+            sort(list.begin(), list.end());
+            list.erase(unique(list.begin(), list.end()), list.end());
+        };
+
+        // a vertex could have been added and removed (or removed and added again) in the same remeshing
+        vector<GLuint> alive;
+        for (size_t i = 0; i < this->touched.size(); i++)
+        {
+            if (!this->removed[this->touched[i]])
+                alive.push_back(this->touched[i]);
+        }
+        sortUnique(alive);
+        sculptor.UpdateNormals(mesh, alive);
+
+        // the normals of the neighbours of the touched vertices have been changed too
+        this->changedVertices = alive;
+        for (size_t i = 0; i < alive.size(); i++)
+        {
+            const Vertex& v = mesh.vertices[alive[i]];
+            this->changedVertices.insert(this->changedVertices.end(), mesh.neighbours.begin() + v.NeighboursIndex, mesh.neighbours.begin() + v.NeighboursIndex + v.NeighboursNumber);
+        }
+        this->changedVertices.insert(this->changedVertices.end(), this->removedVertices.begin(), this->removedVertices.end());
+        sortUnique(this->changedVertices);
+        sortUnique(this->changedFaces);
+
+        vector<GLuint> added, removedList;
+        for (size_t i = 0; i < this->addedVertices.size(); i++)
+        {
+            if (!this->removed[this->addedVertices[i]])
+                added.push_back(this->addedVertices[i]);
+        }
+        for (size_t i = 0; i < this->removedVertices.size(); i++)
+        {
+            if (this->removed[this->removedVertices[i]])
+                removedList.push_back(this->removedVertices[i]);
+        }
+        sortUnique(added);
+        sortUnique(removedList);
+        this->addedVertices.swap(added);
+        this->removedVertices.swap(removedList);
+    }
+};
@@ -0,0 +1,288 @@
+/*
+HalfEdges class
+- index-based half-edge structure of a triangle mesh, built from Mesh::indices: the half-edge h is the corner h of the faces (index in indices),
+  going from the vertex of the corner to the vertex of the next corner of the same face
+- next, previous and face of a half-edge are implicit (h / 3 is the face), so only the twin of each half-edge (opposite half-edge of the adjacent face)
+  and the origin of each half-edge are stored: O(1) queries of the adjacent faces and edges, one-ring and boundary traversal around a position without searching
+- the half-edges connect the welded positions, each one identified by the vertex representing it (the first vertex with that position, see adjacency.h):
+  the vertices duplicated by the importer for different normals / texture coordinates are the same position, so a seam of texture coordinates is not a boundary
+- the neighbours array of the Mesh (and of the GPU buffer) is derived from the origins of the half-edges (BuildNeighbours)
+- the structure is kept by the Mesh (Mesh::halfEdges): the edits of the dynamic topology change the origins and the twins of the half-edges
+  of the changed faces (SetFace, SetOrigin, Link, Unlink), so the queries stay valid while the mesh is remeshed
+
+Twins:
+- the half-edges are sorted by their two positions (the smaller first), so no hash map of the edges is needed (like the welding):
+  an edge with two half-edges in opposite directions is an interior edge, otherwise (one half-edge, more than two, or the same direction) they have no twin
+- a half-edge without twin is on the boundary: a traversal visits all the faces around a position from a boundary edge to the other one,
+  or all the faces of a closed fan
+
+N.B.) the degenerate faces (two corners on the same position, e.g. the removed faces of the dynamic topology) have no twins and they are never visited
+by the traversals; at a non-manifold position (two or more fans of faces joined only by the position) the traversals visit only the fan of their first half-edge
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/layout.h>
+#include <usculpt/threadpool.h>
+
+/////////////////// HALFEDGES class ///////////////////////
+class HalfEdges
+{
+public:
+    // missing half-edge (twin of a boundary half-edge)
+    static const GLuint NO_HALFEDGE = (GLuint)-1;
+
+    //////////////////////////////////////////
+
+    // half-edges of the triangles of the mesh (the faces with other numbers of indices have to be triangulated before)
+    // welded[i] = position of the vertex i, in [0, positions) (e.g. from WeldVertices): the origins are the vertices representing the positions
+    void Build(const vector<GLuint>& indices, const vector<GLuint>& welded, GLuint positions, ThreadPool& pool = ThreadPool::Instance())
+    {
+        // the first vertex of each position represents it
+        vector<GLuint> representative(positions, (GLuint)NO_HALFEDGE);
+        this->welded.resize(welded.size());
+        for (GLuint i = 0; i < welded.size(); i++)
+        {
+            if (representative[welded[i]] == NO_HALFEDGE)
+                representative[welded[i]] = i;
+            this->welded[i] = representative[welded[i]];
+        }
+
+        size_t halfEdges = indices.size() / 3 * 3;
+        this->origins.resize(halfEdges);
+        pool.ParallelFor(0, halfEdges, 65536, [&](size_t first, size_t last)
+        {
+            for (size_t h = first; h < last; h++)
+                this->origins[h] = this->welded[indices[h]];
+        });
+
+        // the half-edges of the same edge are contiguous after the sort
+        // (the half-edges of the degenerate faces, with two corners on the same position, are moved at the end: they are never paired)
+        vector<glm::uvec3> sides(halfEdges);
+        pool.ParallelFor(0, halfEdges, 65536, [&](size_t first, size_t last)
+        {
+            for (size_t h = first; h < last; h++)
+            {
+                GLuint a = this->origins[h], b = this->origins[Next((GLuint)h)];
+                if (this->degenerate(Face((GLuint)h)))
+                    a = b = NO_HALFEDGE;
+                sides[h] = glm::uvec3(min(a, b), max(a, b), (GLuint)h);
+            }
+        });
+        pool.ParallelSort(sides.begin(), sides.end(), [](const glm::uvec3& a, const glm::uvec3& b)
+        {
+            if (a.x != b.x) return a.x < b.x;
+            if (a.y != b.y) return a.y < b.y;
+            return a.z < b.z;
+        });
+
+        this->twins.assign(halfEdges, (GLuint)NO_HALFEDGE);
+        pool.ParallelFor(0, sides.size(), 65536, [&](size_t first, size_t last)
+        {
+            for (size_t s = first; s < last; s++)
+            {
+                // only the first half-edge of an edge pairs it
+                if (sides[s].x == sides[s].y || (s > 0 && sides[s - 1].x == sides[s].x && sides[s - 1].y == sides[s].y))
+                    continue;
+                if (s + 1 >= sides.size() || sides[s + 1].x != sides[s].x || sides[s + 1].y != sides[s].y)
+                    continue;
+                if (s + 2 < sides.size() && sides[s + 2].x == sides[s].x && sides[s + 2].y == sides[s].y)
+                    continue;
+
+                GLuint h = sides[s].z, t = sides[s + 1].z;
+                if (this->origins[h] == this->origins[t])
+                    continue;
+                this->twins[h] = t;
+                this->twins[t] = h;
+            }
+        });
+    }
+
+    // the half-edges are dropped (e.g. the faces of the mesh have been replaced): they are built again at the next use
+    void Clear()
+    {
+        this->welded.clear();
+        this->origins.clear();
+        this->twins.clear();
+    }
+
+    //////////////////////////////////////////
+
+    // implicit connectivity of the half-edges of a face
+    static GLuint Next(GLuint h) { return h - h % 3 + (h + 1) % 3; }
+    static GLuint Prev(GLuint h) { return h - h % 3 + (h + 2) % 3; }
+    static GLuint Face(GLuint h) { return h / 3; }
+
+    GLuint Twin(GLuint h) const { return this->twins[h]; }
+    bool IsBoundary(GLuint h) const { return this->twins[h] == NO_HALFEDGE; }
+    // positions at the start and at the end of a half-edge
+    GLuint Origin(GLuint h) const { return this->origins[h]; }
+    GLuint Target(GLuint h) const { return this->origins[Next(h)]; }
+
+    // face on the other side of the side c of a face (NO_HALFEDGE on the boundary)
+    GLuint AdjacentFace(GLuint face, GLuint c) const
+    {
+        GLuint twin = this->twins[face * 3 + c];
+        return twin == NO_HALFEDGE ? twin : Face(twin);
+    }
+
+    // position of a vertex of the mesh (the vertex representing it), and number of half-edges
+    GLuint Position(GLuint vertex) const { return this->welded[vertex]; }
+    size_t Size() const { return this->origins.size(); }
+
+    //////////////////////////////////////////
+    // edits of the faces (see dyntopo.h): the changed half-edges lose their twins, which are paired again by the caller (Link)
+
+    // new vertices of the corners of a face (a new face after the last one, or a removed face with the same vertex in its corners)
+    void SetFace(GLuint face, GLuint a, GLuint b, GLuint c)
+    {
+        if (face * 3 >= this->origins.size())
+        {
+            this->origins.resize(face * 3 + 3);
+            this->twins.resize(face * 3 + 3, (GLuint)NO_HALFEDGE);
+        }
+
+        GLuint corners[3] = {a, b, c};
+        for (GLuint h = face * 3; h < face * 3 + 3; h++)
+        {
+            this->Unlink(h);
+            this->origins[h] = this->position(corners[h % 3]);
+        }
+    }
+
+    // new vertex of the corner h: the half-edges going out of it and coming into it lose their twins
+    void SetOrigin(GLuint h, GLuint vertex)
+    {
+        this->Unlink(h);
+        this->Unlink(Prev(h));
+        this->origins[h] = this->position(vertex);
+    }
+
+    void Link(GLuint h, GLuint t)
+    {
+        this->Unlink(h);
+        this->Unlink(t);
+        this->twins[h] = t;
+        this->twins[t] = h;
+    }
+
+    void Unlink(GLuint h)
+    {
+        if (this->twins[h] != NO_HALFEDGE)
+            this->twins[this->twins[h]] = NO_HALFEDGE;
+        this->twins[h] = NO_HALFEDGE;
+    }
+
+    //////////////////////////////////////////
+
+    // visit(h) for each half-edge going out of the origin of start in the fan of start, in the order of the faces (from the boundary, if any)
+    // it returns the number of visited half-edges
+    template<typename Visitor>
+    GLuint ForEachOutgoing(GLuint start, Visitor visit) const
+    {
+        // back to the first face of an open fan: the twin of a half-edge comes into the origin, and its next half-edge goes out of it in the previous face
+        GLuint first = start;
+        while (this->twins[first] != NO_HALFEDGE && Next(this->twins[first]) != start)
+            first = Next(this->twins[first]);
+        if (this->twins[first] != NO_HALFEDGE)
+            first = start;
+
+        GLuint h = first, visited = 0;
+        do
+        {
+            visit(h);
+            visited++;
+            // the previous half-edge of the face comes into the position: its twin goes out of it in the next face
+            h = this->twins[Prev(h)];
+        } while (h != NO_HALFEDGE && h != first);
+
+        return visited;
+    }
+
+    // visit(position, h) for each position of the one-ring in the fan of start, with a half-edge h of the edge
+    // (on the boundary, the origin of the last incoming half-edge too); it returns the number of visited faces
+    template<typename Visitor>
+    GLuint ForEachNeighbour(GLuint start, Visitor visit) const
+    {
+        GLuint last = NO_HALFEDGE;
+        GLuint faces = this->ForEachOutgoing(start, [&](GLuint h)
+        {
+            visit(this->Target(h), h);
+            last = h;
+        });
+        if (this->IsBoundary(Prev(last)))
+            visit(this->origins[Prev(last)], Prev(last));
+
+        return faces;
+    }
+
+    //////////////////////////////////////////
+
+    // neighbours array of the mesh (see adjacency.h), and NeighboursIndex / NeighboursNumber of each vertex:
+    // the couple of each half-edge going out of a position (the vertices of the next and of the previous corner of its face)
+    // the half-edges are visited in order, so the couples of each position are in the order of the faces without sorting them
+    void BuildNeighbours(vector<Vertex>& vertices, const vector<GLuint>& indices, vector<GLuint>& neighbours, ThreadPool& pool = ThreadPool::Instance()) const
+    {
+        // prefix sum of the half-edges of each position: first couple of each position
+        vector<GLuint> offsets(this->welded.size() + 1, 0);
+        for (size_t h = 0; h < this->origins.size(); h++)
+            offsets[this->origins[h] + 1]++;
+        for (size_t p = 0; p < this->welded.size(); p++)
+            offsets[p + 1] += offsets[p];
+
+        vector<GLuint> cursor(offsets.begin(), offsets.end() - 1);
+        neighbours.resize(this->origins.size() * 2);
+        for (GLuint h = 0; h < this->origins.size(); h++)
+        {
+            GLuint k = cursor[this->origins[h]]++;
+            neighbours[k * 2] = indices[Next(h)];
+            neighbours[k * 2 + 1] = indices[Prev(h)];
+        }
+
+        pool.ParallelFor(0, vertices.size(), 65536, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                GLuint p = this->welded[i];
+                vertices[i].NeighboursIndex = offsets[p] * 2;
+                vertices[i].NeighboursNumber = (offsets[p + 1] - offsets[p]) * 2;
+            }
+        });
+    }
+
+private:
+    // position (representative vertex) of each vertex
+    vector<GLuint> welded;
+    // position at the start of each half-edge, twin of each half-edge
+    vector<GLuint> origins;
+    vector<GLuint> twins;
+
+    //////////////////////////////////////////
+
+    // position of a vertex of an edit: the edited mesh has no duplicated vertices (see dyntopo.h), so the vertex represents its own position
+    // (also a vertex added after the build, or a duplicated vertex used again)
+    GLuint position(GLuint vertex)
+    {
+        while (this->welded.size() <= vertex)
+            this->welded.push_back((GLuint)this->welded.size());
+        this->welded[vertex] = vertex;
+        return vertex;
+    }
+
+    // face with two corners on the same position (e.g. the faces at the poles of a UV sphere): it is not part of the connectivity
+    bool degenerate(GLuint face) const
+    {
+        GLuint a = this->origins[face * 3], b = this->origins[face * 3 + 1], c = this->origins[face * 3 + 2];
+        return a == b || b == c || c == a;
+    }
+};
@@ -0,0 +1,215 @@
+/*
+HeadlessContext class
+- OpenGL context without a window, for the machines without a display (continuous integration, render nodes): EGL on the surfaceless
+  platform of Mesa (EGL_MESA_platform_surfaceless), which works with the Mesa GPU drivers and with the software rasterizer (llvmpipe)
+- the frames are rendered in a framebuffer object (color and depth renderbuffers) with the size of the window,
+  and they can be saved as PNG images (SavePNG, see png.h)
+
+N.B. 1) without the surfaceless platform, the default display of EGL is used with EGL_KHR_surfaceless_context (no surface is needed
+to make the context current, the framebuffer object is the target of the rendering).
+The context is created without a config when EGL_KHR_no_config_context (or EGL_MESA_configless_context) is supported, otherwise with a config
+of eglChooseConfig which can render with OpenGL
+
+N.B. 2) the shaders are compiled for OpenGL 4.6, while llvmpipe exposes OpenGL 4.5 (it has the features used by uSculpt):
+when they are not set, the version of Mesa is overridden by MESA_GL_VERSION_OVERRIDE and MESA_GLSL_VERSION_OVERRIDE before the initialization of EGL
+
+N.B. 3) EGL is used only when it is found by CMake (USCULPT_HEADLESS): otherwise Init prints an error and fails
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+
+#ifdef USCULPT_HEADLESS
+    // (without the X11 types of the native display, which are not used)
+    #define EGL_NO_X11
+    #define MESA_EGL_NO_X11_HEADERS
+    #include <EGL/egl.h>
+    #include <EGL/eglext.h>
+#endif
+
+#include <usculpt/png.h>
+
+/////////////////// HEADLESSCONTEXT class ///////////////////////
+class HeadlessContext
+{
+public:
+    //////////////////////////////////////////
+
+    // constructor (the context is created by Init)
+    HeadlessContext()
+        : framebuffer(0), colorBuffer(0), depthBuffer(0), width(0), height(0), start(chrono::steady_clock::now())
+    {
+#ifdef USCULPT_HEADLESS
+        this->display = EGL_NO_DISPLAY;
+        this->context = EGL_NO_CONTEXT;
+#endif
+    }
+
+    //////////////////////////////////////////
+
+    // OpenGL 4.6 core context current on this thread, without surfaces; false if EGL or the context are not available
+    bool Init(GLuint width, GLuint height)
+    {
+        this->width = width;
+        this->height = height;
+
+#ifndef USCULPT_HEADLESS
+        cout << "ERROR::HEADLESS:: USCULPT IS BUILT WITHOUT EGL" << endl;
+        return false;
+#else
+        // N.B. 2 (the variables set by the user are kept)
+        setenv("MESA_GL_VERSION_OVERRIDE", "4.6", 0);
+        setenv("MESA_GLSL_VERSION_OVERRIDE", "460", 0);
+
+        // surfaceless platform of Mesa, or the default display (N.B. 1)
+        const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless") && getPlatformDisplay)
+            this->display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (this->display == EGL_NO_DISPLAY)
+            this->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        EGLint major, minor;
+        if (this->display == EGL_NO_DISPLAY || !eglInitialize(this->display, &major, &minor))
+        {
+            cout << "ERROR::HEADLESS:: EGL IS NOT AVAILABLE" << endl;
+            this->display = EGL_NO_DISPLAY;
+            return false;
+        }
+        const char* extensions = eglQueryString(this->display, EGL_EXTENSIONS);
+        if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context"))
+        {
+            cout << "ERROR::HEADLESS:: EGL_KHR_surfaceless_context IS NOT SUPPORTED" << endl;
+            return false;
+        }
+
+        // no config when it is supported (the context has no surfaces), otherwise any config rendering with OpenGL (N.B. 1)
+        EGLConfig config = (EGLConfig)0;
+        if (!strstr(extensions, "EGL_KHR_no_config_context") && !strstr(extensions, "EGL_MESA_configless_context"))
+        {
+            // (any type of surface, the default is only the windows)
+            const EGLint configAttributes[] = { EGL_SURFACE_TYPE, 0, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+            EGLint configs = 0;
+            if (!eglChooseConfig(this->display, configAttributes, &config, 1, &configs) || configs < 1)
+            {
+                cout << "ERROR::HEADLESS:: NO EGL CONFIG RENDERING WITH OPENGL" << endl;
+                return false;
+            }
+        }
+
+        const EGLint attributes[] = { EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 6,
+                                      EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE };
+        eglBindAPI(EGL_OPENGL_API);
+        this->context = eglCreateContext(this->display, config, EGL_NO_CONTEXT, attributes);
+        if (this->context == EGL_NO_CONTEXT || !eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, this->context))
+        {
+            cout << "ERROR::HEADLESS:: CANNOT CREATE AN OPENGL 4.6 CONTEXT (EGL ERROR 0x" << hex << eglGetError() << dec << ")" << endl;
+            return false;
+        }
+        return true;
+#endif
+    }
+
+    // loader of the OpenGL functions (for glad)
+    GLADloadproc Loader() const
+    {
+#ifdef USCULPT_HEADLESS
+        return (GLADloadproc)eglGetProcAddress;
+#else
+        return nullptr;
+#endif
+    }
+
+    // framebuffer object of the frames (to be created after the loading of the OpenGL functions), bound as the target of the rendering
+    void InitFramebuffer()
+    {
+        glGenRenderbuffers(1, &this->colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, this->width, this->height);
+        glGenRenderbuffers(1, &this->depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, this->width, this->height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &this->framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, this->framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, this->colorBuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, this->depthBuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            cout << "ERROR::HEADLESS:: INCOMPLETE FRAMEBUFFER" << endl;
+    }
+
+    //////////////////////////////////////////
+
+    // seconds from the creation of the context (in place of glfwGetTime)
+    double Time() const
+    {
+        return chrono::duration<double>(chrono::steady_clock::now() - this->start).count();
+    }
+
+    // the current frame is saved as a PNG image (RGB, the rows of OpenGL are from the bottom), false if the file cannot be written
+    bool SavePNG(const string& path) const
+    {
+        vector<GLubyte> pixels((size_t)this->width * this->height * 3);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, this->framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, this->width, this->height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+
+        size_t row = (size_t)this->width * 3;
+        for (GLuint y = 0; y < this->height / 2; y++)
+            swap_ranges(pixels.begin() + y * row, pixels.begin() + (y + 1) * row, pixels.begin() + (this->height - 1 - y) * row);
+
+        if (!WritePNG(path, this->width, this->height, 3, &pixels[0]))
+        {
+            cout << "WARNING::HEADLESS:: CANNOT WRITE " << path << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // the framebuffer object and the context are deleted (in place of glfwTerminate)
+    void Delete()
+    {
+        if (this->framebuffer != 0)
+        {
+            glDeleteFramebuffers(1, &this->framebuffer);
+            glDeleteRenderbuffers(1, &this->colorBuffer);
+            glDeleteRenderbuffers(1, &this->depthBuffer);
+            this->framebuffer = this->colorBuffer = this->depthBuffer = 0;
+        }
+#ifdef USCULPT_HEADLESS
+        if (this->context != EGL_NO_CONTEXT)
+        {
+            eglMakeCurrent(this->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(this->display, this->context);
+            this->context = EGL_NO_CONTEXT;
+        }
+        if (this->display != EGL_NO_DISPLAY)
+        {
+            eglTerminate(this->display);
+            this->display = EGL_NO_DISPLAY;
+        }
+#endif
+    }
+
+private:
+#ifdef USCULPT_HEADLESS
+    EGLDisplay display;
+    EGLContext context;
+#endif
+    GLuint framebuffer, colorBuffer, depthBuffer;
+    GLuint width, height;
+    chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,805 @@
+/*
+StrokeHistory class
+- undo / redo of the strokes: each stroke stores only the positions of the vertices it has moved, not a snapshot of the mesh
+- the vertices are recorded before they are changed for the first time in the stroke (Record), then the stroke is encoded when it ends (EndStroke)
+- the normals are not stored: they depend only on the positions, so they are computed again around the restored vertices (Sculptor::UpdateNormals)
+- memory budget for the encoded strokes: when it is exceeded, the oldest strokes are moved to a spill file on disk (or dropped, without a spill file)
+- a stroke with edits of the topology (see dyntopo.h) stores also the faces, the vertices and the couples of neighbours changed by the edits
+  (recorded before their first change: RecordFace, RecordVertex, RecordCouple), and the ones added at the end of the arrays (N.B. 2)
+
+Encoding of a stroke:
+- indices of the vertices, sorted, as differences from the previous one (variable length integers: 1 byte for close vertices)
+- for each vertex, the bits of the old position XOR the bits of the new one: the sign, the exponent and the high bits of the mantissa
+  of a small displacement are the same, so most of the high bytes are 0 (the vertices whose position has not changed are skipped)
+- the XOR values are stored in byte planes (the first byte of every x, then the second byte, ...), so the zeros are contiguous,
+  then the block is compressed with LZCompress (see lz.h)
+
+N.B. 1) XOR is symmetric: the same stroke applied to the new values gives back the old values, and applied to the old values gives back the new ones,
+so undo and redo use the same encoded data (the stroke moves from the undo stack to the redo stack and back), and the values are restored exactly
+
+N.B. 2) the edits of the topology are stored after the byte planes (in the same compressed block): the sizes of the arrays before and after the stroke,
+the old and the new values of each changed face / vertex / couple, then the elements added by the stroke. Undo writes the old values and shrinks the arrays,
+redo grows them and writes the new values (the vertices changed by the edits are stored whole, so they are not in the XOR values).
+After a stroke with edits the faces have been changed (ChangedTopology): the GPU buffers, the BVH and the grid must be built again
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <deque>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+#include <usculpt/sculptor.h>
+#include <usculpt/lz.h>
+
+/////////////////// STROKEHISTORY class ///////////////////////
+class StrokeHistory
+{
+public:
+    // 32-bit words of a vertex stored by a stroke (position)
+    static const size_t VERTEX_WORDS = 3;
+
+    // the history owns the spill file, so it cannot be copied
+    StrokeHistory(const StrokeHistory& copy) = delete;
+    StrokeHistory& operator=(const StrokeHistory& copy) = delete;
+
+    // constructor
+    // memoryBudget = bytes of the encoded strokes kept in memory
+    // spillPath = file where the strokes exceeding the budget are moved (empty -> the oldest strokes are dropped)
+    StrokeHistory(size_t memoryBudget = 64 * 1024 * 1024, const string& spillPath = "")
+        : memoryBudget(memoryBudget), spillPath(spillPath), memoryUsage(0), spilledBytes(0), recording(false), stamp(0),
+          strokeVertices(0), strokeFaces(0), strokeCouples(0), changedTopology(false)
+    {
+    }
+
+    ~StrokeHistory()
+    {
+        this->closeSpillFile();
+    }
+
+    //////////////////////////////////////////
+
+    // start of a stroke
+    void BeginStroke(const Mesh& mesh)
+    {
+        this->recordedVertices.clear();
+        this->recordedValues.clear();
+        this->clearTopology();
+        this->strokeVertices = (GLuint)mesh.vertices.size();
+        this->strokeFaces = (GLuint)(mesh.indices.size() / 3);
+        this->strokeCouples = (GLuint)(mesh.neighbours.size() / 2);
+        this->stamps.resize(this->strokeVertices, 0);
+        this->slots.resize(this->strokeVertices);
+        this->vertexStamps.resize(this->strokeVertices, 0);
+        this->faceStamps.resize(this->strokeFaces, 0);
+        this->coupleStamps.resize(this->strokeCouples, 0);
+        if (++this->stamp == 0)
+        {
+            fill(this->stamps.begin(), this->stamps.end(), 0);
+            fill(this->vertexStamps.begin(), this->vertexStamps.end(), 0);
+            fill(this->faceStamps.begin(), this->faceStamps.end(), 0);
+            fill(this->coupleStamps.begin(), this->coupleStamps.end(), 0);
+            this->stamp = 1;
+        }
+        this->recording = true;
+    }
+
+    // the vertices which are going to be moved (e.g. the vertices inside the brush) are saved
+    // (each vertex is saved only the first time in the stroke, so it keeps its position before the stroke)
+    void Record(const Mesh& mesh, const vector<GLuint>& vertices)
+    {
+        if (!this->recording)
+            return;
+
+        for (size_t i = 0; i < vertices.size(); i++)
+            this->record(mesh, vertices[i]);
+    }
+
+    // a face, a vertex (all its data) or a couple of neighbours which is going to be changed by an edit of the topology is saved (see N.B. 2)
+    // (each one only the first time in the stroke; the ones added by the stroke are saved when it ends)
+    void RecordFace(const Mesh& mesh, GLuint face)
+    {
+        if (!this->recording || face >= this->strokeFaces || this->faceStamps[face] == this->stamp)
+            return;
+        this->faceStamps[face] = this->stamp;
+        this->topologyFaces.push_back(face);
+        this->faceValues.insert(this->faceValues.end(), mesh.indices.begin() + face * 3, mesh.indices.begin() + face * 3 + 3);
+    }
+
+    void RecordVertex(const Mesh& mesh, GLuint vertex)
+    {
+        if (!this->recording || vertex >= this->strokeVertices || this->vertexStamps[vertex] == this->stamp)
+            return;
+        this->vertexStamps[vertex] = this->stamp;
+
+        // (a vertex moved by the dabs of the stroke keeps the position recorded before them)
+        Vertex value = mesh.vertices[vertex];
+        if (this->stamps[vertex] == this->stamp)
+            memcpy(&value.Position, &this->recordedValues[this->slots[vertex] * VERTEX_WORDS], sizeof(glm::vec3));
+        this->topologyVertices.push_back(vertex);
+        this->vertexValues.push_back(value);
+    }
+
+    void RecordCouple(const Mesh& mesh, GLuint couple)
+    {
+        if (!this->recording || couple >= this->strokeCouples || this->coupleStamps[couple] == this->stamp)
+            return;
+        this->coupleStamps[couple] = this->stamp;
+        this->topologyCouples.push_back(couple);
+        GLuint value[3] = { mesh.neighbours[couple * 2], mesh.neighbours[couple * 2 + 1], mesh.neighboursCorners[couple] };
+        this->coupleValues.insert(this->coupleValues.end(), value, value + 3);
+    }
+
+    // end of the stroke: the moved vertices among the recorded ones are encoded and added to the undo stack (the redo stack is emptied)
+    // it returns false if the stroke has not changed the mesh
+    bool EndStroke(const Mesh& mesh)
+    {
+        if (!this->recording)
+            return false;
+        this->recording = false;
+
+        // recorded vertices in order, and the XOR of their old and new values (the unchanged vertices are skipped)
+        vector<GLuint> order(this->recordedVertices.size());
+        for (GLuint i = 0; i < order.size(); i++)
+            order[i] = i;
+        sort(order.begin(), order.end(), [&](GLuint a, GLuint b) { return this->recordedVertices[a] < this->recordedVertices[b]; });
+
+        vector<GLuint> changed;
+        vector<uint32_t> deltas;
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            GLuint vertex = this->recordedVertices[order[i]];
+            // (stored whole by the edits of the topology)
+            if (this->vertexStamps[vertex] == this->stamp)
+                continue;
+            uint32_t current[VERTEX_WORDS];
+            vertexWords(mesh.vertices[vertex], current);
+
+            uint32_t delta[VERTEX_WORDS];
+            bool unchanged = true;
+            for (size_t w = 0; w < VERTEX_WORDS; w++)
+            {
+                delta[w] = this->recordedValues[order[i] * VERTEX_WORDS + w] ^ current[w];
+                unchanged = unchanged && delta[w] == 0;
+            }
+            if (unchanged)
+                continue;
+
+            changed.push_back(vertex);
+            deltas.insert(deltas.end(), delta, delta + VERTEX_WORDS);
+        }
+
+        vector<uint8_t> topology;
+        if (!this->topologyVertices.empty() || !this->topologyFaces.empty() || !this->topologyCouples.empty() || mesh.vertices.size() != this->strokeVertices
+            || mesh.indices.size() / 3 != this->strokeFaces || mesh.neighbours.size() / 2 != this->strokeCouples)
+            this->encodeTopology(mesh, topology);
+
+        this->recordedVertices.clear();
+        this->recordedValues.clear();
+        this->clearTopology();
+        if (changed.empty() && topology.empty())
+            return false;
+
+        HistoryEntry entry;
+        encode(changed, deltas, topology, entry);
+
+        this->clearRedo();
+        this->memoryUsage += entry.data.size();
+        this->undoStack.push_back(std::move(entry));
+        this->enforceBudget();
+
+        return true;
+    }
+
+    // the last stroke is undone: changed receives the (sorted) indices of the restored vertices
+    // (their normals and the ones of their neighbours are computed again by the sculptor, as after a dab)
+    bool Undo(Mesh& mesh, Sculptor& sculptor, vector<GLuint>& changed)
+    {
+        changed.clear();
+        this->changedTopology = false;
+        if (this->undoStack.empty() || this->recording)
+            return false;
+
+        HistoryEntry entry = std::move(this->undoStack.back());
+        this->undoStack.pop_back();
+        if (!this->apply(mesh, entry, true, changed))
+        {
+            this->undoStack.push_back(std::move(entry));
+            return false;
+        }
+        sculptor.UpdateNormals(mesh, changed);
+
+        this->redoStack.push_back(std::move(entry));
+        this->enforceBudget();
+        return true;
+    }
+
+    // the last undone stroke is applied again
+    bool Redo(Mesh& mesh, Sculptor& sculptor, vector<GLuint>& changed)
+    {
+        changed.clear();
+        this->changedTopology = false;
+        if (this->redoStack.empty() || this->recording)
+            return false;
+
+        HistoryEntry entry = std::move(this->redoStack.back());
+        this->redoStack.pop_back();
+        if (!this->apply(mesh, entry, false, changed))
+        {
+            this->redoStack.push_back(std::move(entry));
+            return false;
+        }
+        sculptor.UpdateNormals(mesh, changed);
+
+        this->undoStack.push_back(std::move(entry));
+        this->enforceBudget();
+        return true;
+    }
+
+    // every stroke is removed (e.g. when the mesh is changed in another way)
+    void Clear()
+    {
+        this->undoStack.clear();
+        this->redoStack.clear();
+        this->recordedVertices.clear();
+        this->recordedValues.clear();
+        this->clearTopology();
+        this->recording = false;
+        this->memoryUsage = 0;
+        this->closeSpillFile();
+    }
+
+    // true if the last undo / redo has changed the faces of the mesh (see N.B. 2)
+    bool ChangedTopology() const { return this->changedTopology; }
+
+    size_t UndoSteps() const { return this->undoStack.size(); }
+    size_t RedoSteps() const { return this->redoStack.size(); }
+    // bytes of the encoded strokes in memory, and in the spill file
+    size_t MemoryUsage() const { return this->memoryUsage; }
+    size_t SpilledBytes() const { return this->spilledBytes; }
+
+private:
+    // words of the header of the edits of the topology: sizes before and after the stroke (vertices, faces, couples), numbers of changed vertices, faces, couples
+    static const size_t TOPOLOGY_HEADER = 9;
+
+    // an encoded stroke: in memory (data) or in the spill file (spillOffset, compressedSize)
+    struct HistoryEntry
+    {
+        vector<uint8_t> data;
+        bool topology;
+        size_t verticesNumber;
+        size_t rawSize;
+        size_t compressedSize;
+        bool spilled;
+        streamoff spillOffset;
+    };
+
+    size_t memoryBudget;
+    string spillPath;
+    fstream spillFile;
+
+    deque<HistoryEntry> undoStack;
+    vector<HistoryEntry> redoStack;
+    size_t memoryUsage, spilledBytes;
+
+    // vertices recorded in the current stroke, and their values before the stroke
+    bool recording;
+    vector<GLuint> recordedVertices;
+    vector<uint32_t> recordedValues;
+    // stroke which has recorded each vertex, and position of its values in recordedValues
+    vector<GLuint> stamps, slots;
+    GLuint stamp;
+
+    // edits of the topology of the current stroke: sizes of the arrays at its start, stroke which has recorded each element,
+    // changed elements and their values before the first change
+    GLuint strokeVertices, strokeFaces, strokeCouples;
+    vector<GLuint> vertexStamps, faceStamps, coupleStamps;
+    vector<GLuint> topologyVertices, topologyFaces, topologyCouples;
+    vector<Vertex> vertexValues;
+    vector<GLuint> faceValues, coupleValues;
+    bool changedTopology;
+
+    //////////////////////////////////////////
+
+    static void vertexWords(const Vertex& vertex, uint32_t* words)
+    {
+        memcpy(words, &vertex.Position, sizeof(glm::vec3));
+    }
+
+    void record(const Mesh& mesh, GLuint vertex)
+    {
+        // (the vertices added by the stroke are saved when it ends, the ones changed by the edits are saved whole)
+        if (vertex >= this->strokeVertices || this->stamps[vertex] == this->stamp || this->vertexStamps[vertex] == this->stamp)
+            return;
+        this->stamps[vertex] = this->stamp;
+        this->slots[vertex] = (GLuint)this->recordedVertices.size();
+
+        uint32_t words[VERTEX_WORDS];
+        vertexWords(mesh.vertices[vertex], words);
+        this->recordedVertices.push_back(vertex);
+        this->recordedValues.insert(this->recordedValues.end(), words, words + VERTEX_WORDS);
+    }
+
+    //////////////////////////////////////////
+
+    // the elements added and the edits of the topology of the current stroke are dropped
+    void clearTopology()
+    {
+        this->topologyVertices.clear();
+        this->topologyFaces.clear();
+        this->topologyCouples.clear();
+        this->vertexValues.clear();
+        this->faceValues.clear();
+        this->coupleValues.clear();
+    }
+
+    template<typename T>
+    static void appendValues(vector<uint8_t>& raw, const T* values, size_t count)
+    {
+        if (count > 0)
+            raw.insert(raw.end(), (const uint8_t*)values, (const uint8_t*)(values + count));
+    }
+
+    // values of the couples of neighbours: the two vertices and the corner of each couple
+    static void coupleWords(const Mesh& mesh, GLuint couple, GLuint* words)
+    {
+        words[0] = mesh.neighbours[couple * 2];
+        words[1] = mesh.neighbours[couple * 2 + 1];
+        words[2] = mesh.neighboursCorners[couple];
+    }
+
+    // edits of the topology of the stroke (see N.B. 2): header, then indices, old values and new values of the changed vertices, faces and couples,
+    // then the vertices, the indices and the couples added at the end of the arrays
+    void encodeTopology(const Mesh& mesh, vector<uint8_t>& raw) const
+    {
+        GLuint verticesNumber = (GLuint)mesh.vertices.size(), facesNumber = (GLuint)(mesh.indices.size() / 3), couplesNumber = (GLuint)(mesh.neighbours.size() / 2);
+        GLuint header[TOPOLOGY_HEADER] = { this->strokeVertices, verticesNumber, this->strokeFaces, facesNumber, this->strokeCouples, couplesNumber,
+                                           (GLuint)this->topologyVertices.size(), (GLuint)this->topologyFaces.size(), (GLuint)this->topologyCouples.size() };
+        appendValues(raw, header, TOPOLOGY_HEADER);
+
+        appendValues(raw, this->topologyVertices.data(), this->topologyVertices.size());
+        appendValues(raw, this->vertexValues.data(), this->vertexValues.size());
+        for (size_t i = 0; i < this->topologyVertices.size(); i++)
+            appendValues(raw, &mesh.vertices[this->topologyVertices[i]], 1);
+
+        appendValues(raw, this->topologyFaces.data(), this->topologyFaces.size());
+        appendValues(raw, this->faceValues.data(), this->faceValues.size());
+        for (size_t i = 0; i < this->topologyFaces.size(); i++)
+            appendValues(raw, &mesh.indices[this->topologyFaces[i] * 3], 3);
+
+        appendValues(raw, this->topologyCouples.data(), this->topologyCouples.size());
+        appendValues(raw, this->coupleValues.data(), this->coupleValues.size());
+        for (size_t i = 0; i < this->topologyCouples.size(); i++)
+        {
+            GLuint words[3];
+            coupleWords(mesh, this->topologyCouples[i], words);
+            appendValues(raw, words, 3);
+        }
+
+        appendValues(raw, mesh.vertices.data() + this->strokeVertices, verticesNumber - this->strokeVertices);
+        appendValues(raw, mesh.indices.data() + this->strokeFaces * 3, (facesNumber - this->strokeFaces) * 3);
+        for (GLuint c = this->strokeCouples; c < couplesNumber; c++)
+        {
+            GLuint words[3];
+            coupleWords(mesh, c, words);
+            appendValues(raw, words, 3);
+        }
+    }
+
+    // sorted indices as variable length differences, then the byte planes of the XOR values, then the edits of the topology (if any), compressed
+    static void encode(const vector<GLuint>& vertices, const vector<uint32_t>& deltas, const vector<uint8_t>& topology, HistoryEntry& entry)
+    {
+        vector<uint8_t> raw;
+        raw.reserve(vertices.size() * (2 + VERTEX_WORDS * 4));
+
+        GLuint previous = 0;
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            GLuint difference = vertices[i] - previous;
+            previous = vertices[i];
+            while (difference >= 0x80)
+            {
+                raw.push_back((uint8_t)(difference | 0x80));
+                difference >>= 7;
+            }
+            raw.push_back((uint8_t)difference);
+        }
+
+        size_t planes = raw.size();
+        raw.resize(planes + vertices.size() * VERTEX_WORDS * 4);
+        for (size_t w = 0; w < VERTEX_WORDS && !vertices.empty(); w++)
+        {
+            for (size_t b = 0; b < 4; b++)
+            {
+                uint8_t* plane = &raw[planes + (w * 4 + b) * vertices.size()];
+                for (size_t i = 0; i < vertices.size(); i++)
+                    plane[i] = (uint8_t)(deltas[i * VERTEX_WORDS + w] >> (b * 8));
+            }
+        }
+        raw.insert(raw.end(), topology.begin(), topology.end());
+
+        entry.data.clear();
+        LZCompress(&raw[0], raw.size(), entry.data);
+        entry.data.shrink_to_fit();
+        entry.topology = !topology.empty();
+        entry.verticesNumber = vertices.size();
+        entry.rawSize = raw.size();
+        entry.compressedSize = entry.data.size();
+        entry.spilled = false;
+        entry.spillOffset = 0;
+    }
+
+    // XOR of the stored values with the current positions of the vertices, then the edits of the topology are undone (old values) or done again (new values)
+    bool apply(Mesh& mesh, HistoryEntry& entry, bool undo, vector<GLuint>& changed)
+    {
+        if (entry.spilled && !this->load(entry))
+            return false;
+
+        vector<uint8_t> raw(entry.rawSize);
+        if (entry.data.empty() || raw.empty() || !LZDecompress(&entry.data[0], entry.data.size(), &raw[0], raw.size()))
+        {
+            cout << "ERROR::HISTORY:: CORRUPTED STROKE" << endl;
+            return false;
+        }
+
+        // the indices, the planes and the edits are checked before the mesh is changed (a corrupted stroke is not applied)
+        size_t position = 0;
+        GLuint previous = 0;
+        changed.resize(entry.verticesNumber);
+        for (size_t i = 0; i < entry.verticesNumber; i++)
+        {
+            GLuint difference = 0;
+            int shift = 0;
+            uint8_t byte;
+            do
+            {
+                if (position >= raw.size() || shift >= 32)
+                {
+                    cout << "ERROR::HISTORY:: CORRUPTED STROKE" << endl;
+                    return false;
+                }
+                byte = raw[position++];
+                difference |= (GLuint)(byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            previous += difference;
+            changed[i] = previous;
+            if (previous >= mesh.vertices.size())
+            {
+                cout << "ERROR::HISTORY:: CORRUPTED STROKE" << endl;
+                return false;
+            }
+        }
+
+        size_t n = entry.verticesNumber;
+        if ((raw.size() - position) / (VERTEX_WORDS * 4) < n)
+        {
+            cout << "ERROR::HISTORY:: CORRUPTED STROKE" << endl;
+            return false;
+        }
+
+        // (the XOR values are only for the vertices which were in the mesh before the stroke)
+        TopologyEdit edit;
+        if (entry.topology && (!readTopology(mesh, raw, position + n * VERTEX_WORDS * 4, undo, edit) || (n > 0 && changed.back() >= edit.Header[0])))
+        {
+            cout << "ERROR::HISTORY:: CORRUPTED STROKE" << endl;
+            return false;
+        }
+
+        const uint8_t* planes = raw.data() + position;
+        for (size_t i = 0; i < n; i++)
+        {
+            Vertex& vertex = mesh.vertices[changed[i]];
+            uint32_t words[VERTEX_WORDS];
+            vertexWords(vertex, words);
+            for (size_t w = 0; w < VERTEX_WORDS; w++)
+            {
+                const uint8_t* bytes = planes + w * 4 * n + i;
+                words[w] ^= (uint32_t)bytes[0] | (uint32_t)bytes[n] << 8 | (uint32_t)bytes[2 * n] << 16 | (uint32_t)bytes[3 * n] << 24;
+            }
+            memcpy(&vertex.Position, words, sizeof(glm::vec3));
+        }
+
+        this->changedTopology = entry.topology;
+        if (entry.topology)
+        {
+            applyTopology(mesh, edit, undo, changed);
+            sort(changed.begin(), changed.end());
+            changed.erase(unique(changed.begin(), changed.end()), changed.end());
+        }
+        return true;
+    }
+
+    //////////////////////////////////////////
+
+    // edits of the topology of a stroke, read from its block (see encodeTopology)
+    struct TopologyEdit
+    {
+        // sizes before and after the stroke (vertices, faces, couples), numbers of changed vertices, faces, couples
+        GLuint Header[TOPOLOGY_HEADER];
+        vector<GLuint> Vertices, Faces, Couples;
+        vector<Vertex> OldVertices, NewVertices, AddedVertices;
+        vector<GLuint> OldFaces, NewFaces, AddedIndices, OldCouples, NewCouples, AddedCouples;
+    };
+
+    // the block of the edits starting at position is read, and checked against the mesh: its arrays must have the sizes after the stroke (undo)
+    // or before it (redo), and the values to be written must refer to faces, vertices and couples of the mesh after the undo / redo
+    static bool readTopology(Mesh& mesh, const vector<uint8_t>& raw, size_t position, bool undo, TopologyEdit& edit)
+    {
+        if (raw.size() - position < TOPOLOGY_HEADER * sizeof(GLuint))
+            return false;
+        memcpy(edit.Header, &raw[position], TOPOLOGY_HEADER * sizeof(GLuint));
+        position += TOPOLOGY_HEADER * sizeof(GLuint);
+
+        const GLuint* h = edit.Header;
+        if (h[0] > h[1] || h[2] > h[3] || h[4] > h[5] || h[6] > h[0] || h[7] > h[2] || h[8] > h[4])
+            return false;
+        uint64_t size = (uint64_t)h[6] * (sizeof(GLuint) + 2 * sizeof(Vertex)) + (uint64_t)h[7] * 7 * sizeof(GLuint) + (uint64_t)h[8] * 7 * sizeof(GLuint)
+                      + (uint64_t)(h[1] - h[0]) * sizeof(Vertex) + (uint64_t)(h[3] - h[2]) * 3 * sizeof(GLuint) + (uint64_t)(h[5] - h[4]) * 3 * sizeof(GLuint);
+        if (size != raw.size() - position)
+            return false;
+
+        mesh.UpdateNeighboursCorners();
+        GLuint from = undo ? 1 : 0, to = undo ? 0 : 1;
+        if (mesh.vertices.size() != h[from] || mesh.indices.size() != (size_t)h[2 + from] * 3 || mesh.neighbours.size() != (size_t)h[4 + from] * 2
+            || mesh.neighboursCorners.size() != h[4 + from])
+            return false;
+
+        auto read = [&](void* values, size_t bytes)
+        {
+            if (bytes > 0)
+                memcpy(values, &raw[position], bytes);
+            position += bytes;
+        };
+        edit.Vertices.resize(h[6]);
+        edit.OldVertices.resize(h[6]);
+        edit.NewVertices.resize(h[6]);
+        edit.Faces.resize(h[7]);
+        edit.OldFaces.resize(h[7] * 3);
+        edit.NewFaces.resize(h[7] * 3);
+        edit.Couples.resize(h[8]);
+        edit.OldCouples.resize(h[8] * 3);
+        edit.NewCouples.resize(h[8] * 3);
+        edit.AddedVertices.resize(h[1] - h[0]);
+        edit.AddedIndices.resize((h[3] - h[2]) * 3);
+        edit.AddedCouples.resize((h[5] - h[4]) * 3);
+        read(edit.Vertices.data(), edit.Vertices.size() * sizeof(GLuint));
+        read(edit.OldVertices.data(), edit.OldVertices.size() * sizeof(Vertex));
+        read(edit.NewVertices.data(), edit.NewVertices.size() * sizeof(Vertex));
+        read(edit.Faces.data(), edit.Faces.size() * sizeof(GLuint));
+        read(edit.OldFaces.data(), edit.OldFaces.size() * sizeof(GLuint));
+        read(edit.NewFaces.data(), edit.NewFaces.size() * sizeof(GLuint));
+        read(edit.Couples.data(), edit.Couples.size() * sizeof(GLuint));
+        read(edit.OldCouples.data(), edit.OldCouples.size() * sizeof(GLuint));
+        read(edit.NewCouples.data(), edit.NewCouples.size() * sizeof(GLuint));
+        read(edit.AddedVertices.data(), edit.AddedVertices.size() * sizeof(Vertex));
+        read(edit.AddedIndices.data(), edit.AddedIndices.size() * sizeof(GLuint));
+        read(edit.AddedCouples.data(), edit.AddedCouples.size() * sizeof(GLuint));
+
+        // changed elements of the mesh before the stroke, and written values
+        for (size_t i = 0; i < edit.Vertices.size(); i++)
+        {
+            if (edit.Vertices[i] >= h[0])
+                return false;
+        }
+        for (size_t i = 0; i < edit.Faces.size(); i++)
+        {
+            if (edit.Faces[i] >= h[2])
+                return false;
+        }
+        for (size_t i = 0; i < edit.Couples.size(); i++)
+        {
+            if (edit.Couples[i] >= h[4])
+                return false;
+        }
+
+        GLuint vertices = h[to], corners = h[2 + to] * 3, neighbours = h[4 + to] * 2;
+        auto validVertex = [&](const Vertex& v) { return (uint64_t)v.NeighboursIndex + v.NeighboursNumber <= neighbours; };
+        auto validCouple = [&](const GLuint* c) { return c[0] < vertices && c[1] < vertices && (c[2] < corners || c[2] == (GLuint)-1); };
+        const vector<Vertex>& writtenVertices = undo ? edit.OldVertices : edit.NewVertices;
+        const vector<GLuint>& writtenFaces = undo ? edit.OldFaces : edit.NewFaces;
+        const vector<GLuint>& writtenCouples = undo ? edit.OldCouples : edit.NewCouples;
+        for (size_t i = 0; i < writtenVertices.size(); i++)
+        {
+            if (!validVertex(writtenVertices[i]))
+                return false;
+        }
+        for (size_t i = 0; i < writtenFaces.size(); i++)
+        {
+            if (writtenFaces[i] >= vertices)
+                return false;
+        }
+        for (size_t i = 0; i < writtenCouples.size(); i += 3)
+        {
+            if (!validCouple(&writtenCouples[i]))
+                return false;
+        }
+        for (size_t i = 0; !undo && i < edit.AddedVertices.size(); i++)
+        {
+            if (!validVertex(edit.AddedVertices[i]))
+                return false;
+        }
+        for (size_t i = 0; !undo && i < edit.AddedIndices.size(); i++)
+        {
+            if (edit.AddedIndices[i] >= vertices)
+                return false;
+        }
+        for (size_t i = 0; !undo && i < edit.AddedCouples.size(); i += 3)
+        {
+            if (!validCouple(&edit.AddedCouples[i]))
+                return false;
+        }
+        return true;
+    }
+
+    // undo: the old values are written, then the elements added by the stroke are removed; redo: they are added again, then the new values are written
+    // (changed receives the changed vertices and the vertices of the changed faces)
+    static void applyTopology(Mesh& mesh, const TopologyEdit& edit, bool undo, vector<GLuint>& changed)
+    {
+        const GLuint* h = edit.Header;
+        if (!undo)
+        {
+            mesh.vertices.insert(mesh.vertices.end(), edit.AddedVertices.begin(), edit.AddedVertices.end());
+            mesh.indices.insert(mesh.indices.end(), edit.AddedIndices.begin(), edit.AddedIndices.end());
+            for (size_t i = 0; i < edit.AddedCouples.size(); i += 3)
+            {
+                mesh.neighbours.push_back(edit.AddedCouples[i]);
+                mesh.neighbours.push_back(edit.AddedCouples[i + 1]);
+                mesh.neighboursCorners.push_back(edit.AddedCouples[i + 2]);
+            }
+            for (GLuint v = h[0]; v < h[1]; v++)
+                changed.push_back(v);
+        }
+
+        const vector<Vertex>& vertices = undo ? edit.OldVertices : edit.NewVertices;
+        const vector<GLuint>& faces = undo ? edit.OldFaces : edit.NewFaces;
+        const vector<GLuint>& couples = undo ? edit.OldCouples : edit.NewCouples;
+        for (size_t i = 0; i < edit.Vertices.size(); i++)
+        {
+            mesh.vertices[edit.Vertices[i]] = vertices[i];
+            changed.push_back(edit.Vertices[i]);
+        }
+        for (size_t i = 0; i < edit.Faces.size(); i++)
+        {
+            for (int c = 0; c < 3; c++)
+                mesh.indices[edit.Faces[i] * 3 + c] = faces[i * 3 + c];
+            changed.insert(changed.end(), faces.begin() + i * 3, faces.begin() + i * 3 + 3);
+        }
+        for (size_t i = 0; i < edit.Couples.size(); i++)
+        {
+            mesh.neighbours[edit.Couples[i] * 2] = couples[i * 3];
+            mesh.neighbours[edit.Couples[i] * 2 + 1] = couples[i * 3 + 1];
+            mesh.neighboursCorners[edit.Couples[i]] = couples[i * 3 + 2];
+        }
+
+        if (undo)
+        {
+            mesh.vertices.resize(h[0]);
+            mesh.indices.resize((size_t)h[2] * 3);
+            mesh.neighbours.resize((size_t)h[4] * 2);
+            mesh.neighboursCorners.resize(h[4]);
+        }
+        // (the half-edges of the faces are built again at their next use, see N.B. 4 of Mesh)
+        mesh.halfEdges.Clear();
+    }
+
+    //////////////////////////////////////////
+
+    // the oldest strokes in memory (undo stack, then the farthest redo) are moved to the spill file until the budget is respected
+    // (without a spill file, the oldest undo strokes are dropped; the last stroke is always kept)
+    void enforceBudget()
+    {
+        while (this->memoryUsage > this->memoryBudget)
+        {
+            HistoryEntry* oldest = nullptr;
+            for (size_t i = 0; i < this->undoStack.size() && !oldest; i++)
+                oldest = this->undoStack[i].spilled ? nullptr : &this->undoStack[i];
+            for (size_t i = 0; i < this->redoStack.size() && !oldest; i++)
+                oldest = this->redoStack[i].spilled ? nullptr : &this->redoStack[i];
+
+            if (!oldest || this->undoStack.size() + this->redoStack.size() <= 1)
+                return;
+
+            if (!this->spill(*oldest))
+            {
+                if (this->undoStack.size() <= 1)
+                    return;
+                if (this->undoStack.front().spilled)
+                    this->spilledBytes -= this->undoStack.front().compressedSize;
+                else
+                    this->memoryUsage -= this->undoStack.front().data.size();
+                this->undoStack.pop_front();
+            }
+        }
+    }
+
+    bool spill(HistoryEntry& entry)
+    {
+        if (this->spillPath.empty())
+            return false;
+
+        if (!this->spillFile.is_open())
+        {
+            this->spillFile.open(this->spillPath, ios::in | ios::out | ios::binary | ios::trunc);
+            if (!this->spillFile.is_open())
+            {
+                cout << "WARNING::HISTORY:: CANNOT OPEN THE SPILL FILE " << this->spillPath << " -> THE OLDEST STROKES ARE DROPPED" << endl;
+                this->spillPath.clear();
+                return false;
+            }
+        }
+
+        this->spillFile.seekp(0, ios::end);
+        entry.spillOffset = this->spillFile.tellp();
+        this->spillFile.write((const char*)&entry.data[0], entry.data.size());
+        if (!this->spillFile)
+        {
+            this->spillFile.clear();
+            return false;
+        }
+
+        this->memoryUsage -= entry.data.size();
+        this->spilledBytes += entry.data.size();
+        entry.data.clear();
+        entry.data.shrink_to_fit();
+        entry.spilled = true;
+        return true;
+    }
+
+    bool load(HistoryEntry& entry)
+    {
+        entry.data.resize(entry.compressedSize);
+        this->spillFile.seekg(entry.spillOffset);
+        this->spillFile.read((char*)&entry.data[0], entry.compressedSize);
+        if (!this->spillFile)
+        {
+            this->spillFile.clear();
+            cout << "ERROR::HISTORY:: CANNOT READ THE STROKE FROM THE SPILL FILE" << endl;
+            return false;
+        }
+
+        entry.spilled = false;
+        this->memoryUsage += entry.data.size();
+        this->spilledBytes -= entry.data.size();
+
+        // the file is emptied when no stroke is in it anymore
+        if (this->spilledBytes == 0)
+            this->closeSpillFile();
+        return true;
+    }
+
+    void clearRedo()
+    {
+        for (size_t i = 0; i < this->redoStack.size(); i++)
+        {
+            if (this->redoStack[i].spilled)
+                this->spilledBytes -= this->redoStack[i].compressedSize;
+            else
+                this->memoryUsage -= this->redoStack[i].data.size();
+        }
+        this->redoStack.clear();
+    }
+
+    void closeSpillFile()
+    {
+        if (this->spillFile.is_open())
+        {
+            this->spillFile.close();
+            remove(this->spillPath.c_str());
+        }
+        this->spilledBytes = 0;
+    }
+};
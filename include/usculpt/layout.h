@@ -0,0 +1,109 @@
+/*
+Shared layout of the GPU records
+- the records read and written both by the CPU and by the shaders (vertices, intersection and dabs of the brush) are declared once, here:
+  the file is included by mesh.h and by the shaders (#include "include/usculpt/layout.h", expanded by the Shader class)
+- the LAYOUT_* types are the C++ types (glm and GL) or the GLSL types with the same std430 layout:
+  LAYOUT_PACKED_VEC* are arrays of floats (tightly packed, 4 bytes aligned), LAYOUT_VEC3 is a vec3 (16 bytes aligned, followed by a scalar)
+- the offsets of the C++ records are checked at compile time against the std430 offsets of the shaders
+- the constants of the brushes used by both sides (BRUSH_STD_DEV) are defined here too
+
+N.B. 1) a GLSL bool is 4 bytes in a buffer, while a C++ bool is 1 byte: the flags are LAYOUT_BOOL, a 32-bit unsigned int in C++
+(with a C++ bool, the shaders read also the 3 bytes of padding after it)
+
+N.B. 2) the file is read by the C++ compiler and by the GLSL one: outside the __cplusplus blocks there are only comments,
+preprocessor directives and struct declarations with the LAYOUT_* types
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+#ifdef __cplusplus
+
+using namespace std;
+
+// Std. Includes
+#include <cstddef>
+
+#define LAYOUT_FLOAT float
+#define LAYOUT_UINT GLuint
+#define LAYOUT_BOOL GLuint
+#define LAYOUT_PACKED_VEC2 glm::vec2
+#define LAYOUT_PACKED_VEC3 glm::vec3
+#define LAYOUT_VEC3 glm::vec3
+
+#else
+
+#define LAYOUT_FLOAT float
+#define LAYOUT_UINT uint
+#define LAYOUT_BOOL bool
+#define LAYOUT_PACKED_VEC2 float[2]
+#define LAYOUT_PACKED_VEC3 float[3]
+#define LAYOUT_VEC3 vec3
+
+#endif
+
+// data structure for vertices (INTERLEAVED storage of the Mesh class)
+struct Vertex
+{
+    // vertex coordinates
+    LAYOUT_PACKED_VEC3 Position;
+    // Normal
+    LAYOUT_PACKED_VEC3 Normal;
+    // Texture coordinates
+    LAYOUT_PACKED_VEC2 TexCoords;
+    // Tangent
+    LAYOUT_PACKED_VEC3 Tangent;
+    // Bitangent
+    LAYOUT_PACKED_VEC3 Bitangent;
+
+    // neighbours data
+    LAYOUT_UINT NeighboursIndex;
+    LAYOUT_UINT NeighboursNumber;
+};
+
+// the intersection struct stores the intersection point in world coordinates and the indices of the vertices of the hitted primitive of the mesh
+// (hit is false if there is not intersection)
+struct Intersection
+{
+    LAYOUT_PACKED_VEC3 Position;
+    LAYOUT_PACKED_VEC3 Normal;
+    LAYOUT_BOOL hit;
+    LAYOUT_UINT idxv0, idxv1, idxv2;
+};
+
+// record of a dab of the brush: placed by the CPU for the batched brushing (see Sculptor::Brush and BATCHED_BRUSH in ShaderBrush.comp),
+// or the intersection of the frame with the parameters of the brush.
+// Center of the brush and normal of the surface, with the parameters of the brush, and movement of the stroke from the previous dab (grab brush, see brushes.h)
+struct BrushDab
+{
+    LAYOUT_VEC3 Position;
+    LAYOUT_FLOAT Radius;
+    LAYOUT_VEC3 Normal;
+    LAYOUT_FLOAT Strength;
+    LAYOUT_VEC3 Delta;
+    LAYOUT_FLOAT padding;
+};
+
+// standard deviation of the Gaussian brush and of the gaussian falloff, with the radius of the dab at 4 standard deviations (see brushes.h)
+#define BRUSH_STD_DEV 1.5f
+
+#ifdef __cplusplus
+
+// std430 offsets of the records in the shaders
+static_assert(sizeof(Vertex) == 64, "Vertex: the std430 size is 64 bytes");
+static_assert(offsetof(Vertex, Normal) == 12 && offsetof(Vertex, TexCoords) == 24 && offsetof(Vertex, Tangent) == 32 && offsetof(Vertex, Bitangent) == 44,
+              "Vertex: the attributes are tightly packed arrays of floats");
+static_assert(offsetof(Vertex, NeighboursIndex) == 56 && offsetof(Vertex, NeighboursNumber) == 60, "Vertex: wrong offset of the neighbours data");
+
+static_assert(sizeof(Intersection) == 40, "Intersection: the std430 size is 40 bytes");
+static_assert(offsetof(Intersection, Normal) == 12 && offsetof(Intersection, hit) == 24, "Intersection: wrong offset of the normal or of the flag");
+static_assert(sizeof(Intersection::hit) == 4, "Intersection: a GLSL bool is 4 bytes (see N.B. 1)");
+static_assert(offsetof(Intersection, idxv0) == 28 && offsetof(Intersection, idxv2) == 36, "Intersection: wrong offset of the vertices of the primitive");
+
+static_assert(sizeof(BrushDab) == 48, "BrushDab: the std430 size is 48 bytes (array stride of the dabs buffer)");
+static_assert(offsetof(BrushDab, Radius) == 12 && offsetof(BrushDab, Normal) == 16 && offsetof(BrushDab, Strength) == 28,
+              "BrushDab: each vec3 is 16 bytes aligned, and followed by a float");
+static_assert(offsetof(BrushDab, Delta) == 32, "BrushDab: wrong offset of the movement of the stroke");
+
+#endif
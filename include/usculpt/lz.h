@@ -0,0 +1,149 @@
+/*
+LZ block compression functions
+- byte-oriented LZ77 compression of a single block, in the style of LZ4: sequences of (literals, match) with no entropy coding,
+  so both compression and decompression run at memory speed
+- used for the stroke history (see history.h), whose blocks are mostly runs of zeros and repeated bytes
+
+Sequence format:
+- token: literals length (high 4 bits) and match length - 4 (low 4 bits); 15 means that the length continues in the next bytes (255 + ... + last byte < 255)
+- literals
+- match offset (2 bytes, little endian, 1..65535 bytes back), missing in the last sequence of the block
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+// minimum length of a match, and window of the matches
+static const size_t LZ_MIN_MATCH = 4;
+static const size_t LZ_MAX_OFFSET = 65535;
+// bits of the hash table of the compressor (positions of the last sequences of 4 bytes)
+static const int LZ_HASH_BITS = 14;
+
+inline void lzWriteLength(vector<uint8_t>& dst, size_t length)
+{
+    while (length >= 255)
+    {
+        dst.push_back(255);
+        length -= 255;
+    }
+    dst.push_back((uint8_t)length);
+}
+
+inline void lzWriteSequence(vector<uint8_t>& dst, const uint8_t* literals, size_t literalsLength, size_t matchLength, size_t offset)
+{
+    size_t matchCode = matchLength >= LZ_MIN_MATCH ? matchLength - LZ_MIN_MATCH : 0;
+    dst.push_back((uint8_t)((literalsLength < 15 ? literalsLength : 15) << 4 | (matchCode < 15 ? matchCode : 15)));
+    if (literalsLength >= 15)
+        lzWriteLength(dst, literalsLength - 15);
+    dst.insert(dst.end(), literals, literals + literalsLength);
+
+    // the last sequence has only literals
+    if (matchLength == 0)
+        return;
+
+    dst.push_back((uint8_t)(offset & 0xFF));
+    dst.push_back((uint8_t)(offset >> 8));
+    if (matchCode >= 15)
+        lzWriteLength(dst, matchCode - 15);
+}
+
+// the compressed block is appended to dst
+inline void LZCompress(const uint8_t* src, size_t size, vector<uint8_t>& dst)
+{
+    vector<uint32_t> table((size_t)1 << LZ_HASH_BITS, 0);
+    size_t anchor = 0;
+    size_t i = 0;
+
+    while (size >= LZ_MIN_MATCH && i + LZ_MIN_MATCH <= size)
+    {
+        uint32_t sequence;
+        memcpy(&sequence, src + i, sizeof(uint32_t));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+
+        // positions are stored + 1, so 0 is an empty slot
+        size_t candidate = table[hash];
+        table[hash] = (uint32_t)(i + 1);
+
+        if (candidate == 0 || i - (candidate - 1) > LZ_MAX_OFFSET || memcmp(src + candidate - 1, src + i, LZ_MIN_MATCH) != 0)
+        {
+            i++;
+            continue;
+        }
+
+        // the match is extended as far as possible
+        size_t match = candidate - 1;
+        size_t length = LZ_MIN_MATCH;
+        while (i + length < size && src[match + length] == src[i + length])
+            length++;
+
+        lzWriteSequence(dst, src + anchor, i - anchor, length, i - match);
+        i += length;
+        anchor = i;
+    }
+
+    lzWriteSequence(dst, src + anchor, size - anchor, 0, 0);
+}
+
+inline bool lzReadLength(const uint8_t*& src, const uint8_t* end, size_t& length)
+{
+    uint8_t byte;
+    do
+    {
+        if (src >= end)
+            return false;
+        byte = *src++;
+        length += byte;
+    } while (byte == 255);
+
+    return true;
+}
+
+// decompression of a block of known size: false if the block is corrupted
+inline bool LZDecompress(const uint8_t* src, size_t compressedSize, uint8_t* dst, size_t size)
+{
+    const uint8_t* end = src + compressedSize;
+    size_t written = 0;
+
+    while (src < end)
+    {
+        uint8_t token = *src++;
+
+        size_t literalsLength = token >> 4;
+        if (literalsLength == 15 && !lzReadLength(src, end, literalsLength))
+            return false;
+        if (literalsLength > (size_t)(end - src) || literalsLength > size - written)
+            return false;
+        memcpy(dst + written, src, literalsLength);
+        src += literalsLength;
+        written += literalsLength;
+
+        // last sequence
+        if (src == end)
+            break;
+
+        if (end - src < 2)
+            return false;
+        size_t offset = src[0] | (size_t)src[1] << 8;
+        src += 2;
+        size_t matchLength = token & 0x0F;
+        if (matchLength == 15 && !lzReadLength(src, end, matchLength))
+            return false;
+        matchLength += LZ_MIN_MATCH;
+        if (offset == 0 || offset > written || matchLength > size - written)
+            return false;
+
+        // byte by byte: the match can overlap the bytes it is writing (runs)
+        for (size_t k = 0; k < matchLength; k++, written++)
+            dst[written] = dst[written - offset];
+    }
+
+    return written == size;
+}
@@ -19,7 +19,31 @@ Moreover, we want to have, CPU-side, a Mesh instance, with associated GPU resour
 
 N.B. 2) no texturing in this version of the class
 
-N.B. 3) based on https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/mesh.h
+N.B. 3) GPU-side the vertices can be stored as an array of Vertex records (INTERLEAVED), or as separate streams (STREAMS):
+positions and normals in two tightly packed vec4 buffers (the only data read and written by the compute shaders), neighbours ranges and the other attributes in other buffers.
+With STREAMS, intersection and brushing move 16 bytes for each position instead of the whole 64 bytes record; the VAO reads the attributes from multiple bindings.
+CPU-side the vertices are always stored as Vertex records
+
+N.B. 4) the vertex normals are the sum of the normals of the faces around the vertex, weighted by the angles of the corners:
+the normal and the corner angles of each face are computed once (FaceNormal), then summed on its three vertices.
+The couples of the neighbours array are in the order of the faces, so the corner of each couple is found once at construction (neighboursCorners).
+The corners are found at the first use after the neighbours have been set (UpdateNeighboursCorners), e.g. not at all for a mesh loaded with its normals already updated and never sculpted
+The half-edges of the faces (halfEdges, see halfedge.h) are built by the model loader, or at their first use (UpdateHalfEdges), welding the vertices
+which share a neighbours range; the dynamic topology keeps them valid through its edits, the other changes of the faces drop them (ReplaceTopology, undo of a remeshing)
+
+N.B. 5) the intersection buffer is a ring of INTERSECTION_SLOTS slots, allocated once and persistently mapped (coherent):
+each frame uses the next slot (ResetIntersectionData), so the CPU resets and reads a slot while the GPU still works on the others.
+A fence marks the end of the commands of the frame which used a slot: it is waited before the slot is used again (normally it has been
+already signaled, because it is INTERSECTION_SLOTS - 1 frames old), and it tells when the hit of a frame can be read without a stall
+(LatestIntersection returns the most recent completed hit, with the index of its frame).
+The dabs placed by the CPU (see StrokeEngine) are not in the ring: they are copied all together in the dabs buffer (PlaceDabs),
+which is read by the batched pass of the brushing shader (BATCHED_BRUSH in ShaderBrush.comp)
+
+N.B. 6) the topology of the mesh can be changed CPU-side (see dyntopo.h): the GPU buffers have a capacity (in vertices, indices and neighbours),
+and they are reallocated with some spare space only when the mesh grows over it. Otherwise only the changed vertices, faces and neighbours ranges
+are copied (UploadTopology), in runs of close indices
+
+N.B. 7) based on https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/mesh.h
 
 author: Andrea Cipollini; based on RTGP course code by prof. Davide Gadia and by Michael Marchesan
 */
@@ -30,36 +54,44 @@ using namespace std;
 
 // Std. Includes
 #include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
 
-// data structure for vertices
-struct Vertex {
-    // vertex coordinates
-    glm::vec3 Position;
-    // Normal
-    glm::vec3 Normal;
-    // Texture coordinates
+// records shared with the shaders (Vertex, Intersection, BrushDab)
+#include <usculpt/layout.h>
+
+// half-edges of the faces
+#include <usculpt/halfedge.h>
+
+// vertex attributes not used by the compute shaders (GPU buffer of the STREAMS storage)
+struct VertexAttributes {
     glm::vec2 TexCoords;
-    // Tangent
     glm::vec3 Tangent;
-    // Bitangent
     glm::vec3 Bitangent;
-
-    // neighbours data
-    GLuint NeighboursIndex;
-    GLuint NeighboursNumber;
 };
 
 // different types of rendering
 enum RenderingType { TRIANGLES, LINES };
 
-// the intersection struct stores the intersection point in world coordinates and the index of the hitted primitive of the mesh
-// if the primitive index is equal to -1 -> there is not intersection
-struct Intersection
+// different layouts of the vertices in GPU memory (see N.B. 3)
+enum VertexStorage { INTERLEAVED, STREAMS };
+
+// content of the GPU intersection buffer: intersection data, followed by the key of the closest hit found by ShaderIntersection.comp
+// the two words of the key are read as a single 64-bit value (distance in the high word, triangle in the low word)
+struct IntersectionBufferData
+{
+    Intersection Data;
+    GLuint ClosestTriangle;
+    GLuint ClosestDistance;
+};
+static_assert(offsetof(IntersectionBufferData, ClosestTriangle) % 8 == 0, "IntersectionBufferData: the key of the closest hit is a 64-bit value");
+
+// data of a triangle for the vertex normals: normal of the face (not normalized, so the larger faces weigh more) and angle of each corner
+struct FaceNormal
 {
-    glm::vec3 Position;
     glm::vec3 Normal;
-    bool hit;
-    GLuint idxv0, idxv1, idxv2;
+    float Angles[3];
 };
 
 /////////////////// MESH class ///////////////////////
@@ -69,8 +101,19 @@ public:
     vector<Vertex> vertices;
     vector<GLuint> indices;
     vector<GLuint> neighbours;
+    // triangle corner (index in indices) of each couple of neighbours: the couple neighbours[2 * k], neighbours[2 * k + 1] belongs to the corner neighboursCorners[k]
+    vector<GLuint> neighboursCorners;
+    // half-edges of the faces (see N.B. 4): kept by the edits of the dynamic topology, built at the first use for other indices (UpdateHalfEdges)
+    HalfEdges halfEdges;
     // VAO
     GLuint VAO;
+    // layout of the vertices in GPU memory
+    VertexStorage Storage;
+
+    // number of slots of the ring of the intersection buffer (one for each frame in flight)
+    static const GLuint INTERSECTION_SLOTS = 3;
+    // maximum number of dabs of the batched brushing pass (records of the dabs buffer, see PlaceDabs)
+    static const GLuint MAX_DABS = 64;
 
     // We want Mesh to be a move-only class. We delete copy constructor and copy assignment
     // see:
@@ -86,16 +129,32 @@ public:
     // We use initializer list and std::move in order to avoid a copy of the arguments
     // This constructor empties the source vectors (vertices and indices)
     Mesh(vector<Vertex>& vertices, vector<GLuint>& indices) noexcept
-        : vertices(std::move(vertices)), indices(std::move(indices))
+        : vertices(std::move(vertices)), indices(std::move(indices)), Storage(INTERLEAVED)
     {
+        this->initIntersectionRing();
+        this->initUpdateBuffers();
+        UpdateNormals();
         this->setupMesh();
     }
 
     // Constructor
-    Mesh(vector<Vertex>& vertices, vector<GLuint>& indices, vector<GLuint>& neighbours) noexcept
-        : vertices(std::move(vertices)), indices(std::move(indices)), neighbours(std::move(neighbours))
+    // if setupGPU is false, the mesh data are kept only CPU-side (no OpenGL context is needed, e.g. for the CPU Sculptor on machines without GPU)
+    // if updateNormals is false, the normals of the vertices are used as they are (e.g. when they have been saved already updated, see meshcache.h)
+    Mesh(vector<Vertex>& vertices, vector<GLuint>& indices, vector<GLuint>& neighbours, bool setupGPU = true, VertexStorage storage = STREAMS, bool updateNormals = true) noexcept
+        : vertices(std::move(vertices)), indices(std::move(indices)), neighbours(std::move(neighbours)), Storage(storage)
     {
-        this->setupMesh();
+        this->initIntersectionRing();
+        this->initUpdateBuffers();
+        if (updateNormals)
+            UpdateNormals();
+
+        if (setupGPU)
+            this->setupMesh();
+        else
+        {
+            this->VAO = this->VBO = this->EBO = 0;
+            this->NormalsBuffer = this->NeighboursRangesBuffer = this->AttributesBuffer = 0;
+        }
     }
 
     // We implement a user-defined move constructor and move assignment
@@ -112,11 +171,16 @@ public:
     // In our case it will no longer imply ownership of the GPU resources and its vectors will be empty.
     Mesh(Mesh&& move) noexcept
         // Calls move for both vectors, which internally consists of a simple pointer swap between the new instance and the source one.
-        : vertices(std::move(move.vertices)), indices(std::move(move.indices)), neighbours(std::move(move.neighbours)),
-        VAO(move.VAO), VBO(move.VBO), EBO(move.EBO)
+        : vertices(std::move(move.vertices)), indices(std::move(move.indices)), neighbours(std::move(move.neighbours)), neighboursCorners(std::move(move.neighboursCorners)),
+        halfEdges(std::move(move.halfEdges)), VAO(move.VAO), Storage(move.Storage), VBO(move.VBO), EBO(move.EBO),
+        NormalsBuffer(move.NormalsBuffer), NeighboursRangesBuffer(move.NeighboursRangesBuffer), AttributesBuffer(move.AttributesBuffer)
     {
         move.VAO = 0; // We *could* set VBO and EBO to 0 too,
         // but since we bring all the 3 values around we can use just one of them to check ownership of the 3 resources.
+
+        // the intersection ring is owned separately (it is created by InitMeshUpdate)
+        this->moveIntersectionRing(move);
+        this->moveUpdateBuffers(move);
     }
 
     // Move assignment
@@ -125,14 +189,24 @@ public:
         // calls the function which will delete (if needed) the GPU resources for this instance
         freeGPUresources();
 
+        // the mesh data are moved also when the source instance has not GPU resources (CPU-only mesh)
+        vertices = std::move(move.vertices);
+        indices = std::move(move.indices);
+        neighbours = std::move(move.neighbours);
+        neighboursCorners = std::move(move.neighboursCorners);
+        halfEdges = std::move(move.halfEdges);
+        Storage = move.Storage;
+        this->moveIntersectionRing(move);
+        this->moveUpdateBuffers(move);
+
         if (move.VAO) // source instance has GPU resources
         {
-            vertices = std::move(move.vertices);
-            indices = std::move(move.indices);
-            neighbours = std::move(move.neighbours);
             VAO = move.VAO;
             VBO = move.VBO;
             EBO = move.EBO;
+            NormalsBuffer = move.NormalsBuffer;
+            NeighboursRangesBuffer = move.NeighboursRangesBuffer;
+            AttributesBuffer = move.AttributesBuffer;
 
             move.VAO = 0;
         }
@@ -179,17 +253,53 @@ public:
         glBindVertexArray(0);
     }
 
+    // definitions to add to the compute shaders, for the layout of the vertex buffers and the size of the dabs buffer
+    string ShaderDefines() const
+    {
+        return (this->Storage == STREAMS ? "#define VERTEX_STREAMS\n" : "") + string("#define MAX_DABS ") + to_string(MAX_DABS) + "\n";
+    }
+
     // bind mesh data on GPU shader buffer
     void InitMeshUpdate()
     {
-        // vertices
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->VAO);
+        // vertices (positions only, with STREAMS storage)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, this->VBO);
+        if (this->Storage == STREAMS)
+        {
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, this->NormalsBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, this->NeighboursRangesBuffer);
+        }
         // indices
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, this->EBO);
         // neighbours
         glGenBuffers(1, &this->NeighboursBuffer);
         glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, this->NeighboursBuffer);
         glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * this->neighbours.size(), &this->neighbours[0], GL_DYNAMIC_DRAW);
+        this->neighbourCapacity = (GLuint)this->neighbours.size();
+        // closest hit of each workgroup of the intersection shader (distance, triangle)
+        glGenBuffers(1, &this->IntersectionPartialsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, this->IntersectionPartialsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * workgroups(this->indexCapacity), NULL, GL_DYNAMIC_DRAW);
+        // lists of the vertices touched by a dab of the brushing shader: 4 words of header (indirect dispatch arguments and length), then the indices
+        // (the brush list has 4 more words: indirect dispatch arguments of the fused pass and bound of the dirty list length)
+        glGenBuffers(1, &this->BrushListBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, this->BrushListBuffer);
+        glGenBuffers(1, &this->DirtyListBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, this->DirtyListBuffer);
+        // stamps of the dirty list
+        glGenBuffers(1, &this->DirtyStampsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, this->DirtyStampsBuffer);
+        // vertices changed by the dabs of the current stroke: 4 words of header (first dab of the stroke and length), then the indices
+        glGenBuffers(1, &this->StrokeDirtyBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 12, this->StrokeDirtyBuffer);
+        // dabs of the batched brushing pass: 4 words of header (number of dabs), then the records
+        glGenBuffers(1, &this->DabsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, this->DabsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec4) + sizeof(BrushDab) * MAX_DABS, NULL, GL_DYNAMIC_DRAW);
+        // targets of the brushes reading the neighbours of the vertices (centroids of the rings of the smooth brush, see brushes.h)
+        glGenBuffers(1, &this->BrushTargetsBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, this->BrushTargetsBuffer);
+        this->allocateBrushLists();
 
         ResetIntersectionData();
 
@@ -209,62 +319,471 @@ public:
         */
     }
 
+    // start of a new frame for the intersection data: the next slot of the ring is reset (no hit) and bound to the shaders
+    // (the ring is allocated at the first call)
     void ResetIntersectionData()
     {
-        // create buffer object for intersection data
-        Intersection inter = {glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), false, (GLuint)-1, (GLuint)-1, (GLuint)-1};
-        glGenBuffers(1, &this->IntersectionBuffer);
-        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, this->IntersectionBuffer);
-        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Intersection), &inter, GL_DYNAMIC_DRAW);
+        if (!this->IntersectionBuffer)
+            this->setupIntersectionRing();
+        else
+        {
+            // all the commands using the current slot have been issued: the fence is signaled when the GPU has completed them
+            // (the barrier makes the writes of the shaders visible through the mapping)
+            glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+            this->intersectionFences[this->intersectionSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+            this->intersectionSlot = (this->intersectionSlot + 1) % INTERSECTION_SLOTS;
+            this->waitIntersectionFence(this->intersectionSlot);
+        }
+        this->intersectionFrames[this->intersectionSlot] = ++this->intersectionFrame;
+
+        // the closest hit key starts from the maximum value (no hit)
+        // (the padding bytes after the bool are set to zero too, because the shaders read hit as a 32-bit value)
+        IntersectionBufferData* inter = this->intersectionSlotData(this->intersectionSlot);
+        memset(inter, 0, sizeof(IntersectionBufferData));
+        inter->Data.idxv0 = inter->Data.idxv1 = inter->Data.idxv2 = (GLuint)-1;
+        inter->ClosestTriangle = inter->ClosestDistance = (GLuint)-1;
+
+        this->BindIntersectionData();
     }
 
-    void UpdateNormals()
+    // the slot of the current frame is bound to the shaders
+    void BindIntersectionData()
     {
-        for (int i = 0; i < this->vertices.size(); i++)
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, this->IntersectionBuffer, this->intersectionSlot * this->intersectionStride, sizeof(IntersectionBufferData));
+    }
+
+    // index of the current frame of the intersection data (1 for the first ResetIntersectionData)
+    GLuint64 IntersectionFrame() const { return this->intersectionFrame; }
+
+    // most recent intersection data already completed by the GPU, and index of its frame (false if no frame is completed yet)
+    // the CPU never waits: the fences are only tested, from the previous frame backwards
+    bool LatestIntersection(Intersection& inter, GLuint64& frame)
+    {
+        if (!this->IntersectionBuffer)
+            return false;
+
+        for (GLuint i = 1; i < INTERSECTION_SLOTS; i++)
         {
-            glm::vec3 newNormal = glm::vec3(0.0f, 0.0f, 0.0f);
-            for (int j = this->vertices[i].NeighboursIndex; j < this->vertices[i].NeighboursIndex + this->vertices[i].NeighboursNumber - 1; j += 2)
+            GLuint slot = (this->intersectionSlot + INTERSECTION_SLOTS - i) % INTERSECTION_SLOTS;
+            GLsync fence = this->intersectionFences[slot];
+            if (!fence)
+                return false;
+
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
             {
-                int k = this->neighbours[j];
-                int h = this->neighbours[j + 1];
-                glm::vec3 e1 = glm::vec3(this->vertices[k].Position.x, this->vertices[k].Position.y, this->vertices[k].Position.z) - this->vertices[i].Position;
-                glm::vec3 e2 = glm::vec3(this->vertices[h].Position.x, this->vertices[h].Position.y, this->vertices[h].Position.z) - this->vertices[i].Position;
+                inter = this->intersectionSlotData(slot)->Data;
+                frame = this->intersectionFrames[slot];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // dabs chosen by the CPU (e.g. placed by a StrokeEngine on the hits read by LatestIntersection) for the next batched brushing pass:
+    // the number of dabs and their records are copied with a single copy (at most MAX_DABS of them), and it returns the number of copied dabs
+    GLuint PlaceDabs(const vector<BrushDab>& dabs)
+    {
+        GLuint count = (GLuint)min(dabs.size(), (size_t)MAX_DABS);
+
+        vector<GLubyte> data(sizeof(glm::uvec4) + sizeof(BrushDab) * count, 0);
+        memcpy(&data[0], &count, sizeof(GLuint));
+        if (count > 0)
+            memcpy(&data[sizeof(glm::uvec4)], &dabs[0], sizeof(BrushDab) * count);
+
+        // (copy ordered with the previous commands, which can still be reading the dabs)
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->DabsBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, data.size(), &data[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        return count;
+    }
+
+    // number of workgroups (of 128 triangles) of the first stage of the intersection shader
+    GLuint IntersectionWorkgroups() const
+    {
+        return workgroups((GLuint)this->indices.size());
+    }
+
+    // intersection data computed CPU-side (e.g. by the BVH) are copied in the slot of the current frame
+    void SetIntersectionData(const Intersection& inter)
+    {
+        this->copyIntersection(inter, this->intersectionSlot);
+    }
+
+    // the brush and dirty lists are emptied before a dab (the number of workgroups of the indirect dispatches is 0 x 1 x 1)
+    void ResetBrushLists()
+    {
+        GLuint header[8] = {0, 1, 1, 0, 0, 1, 1, 0};
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->BrushListBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * 8, header);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->DirtyListBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * 4, header);
+    }
+
+    // indirect dispatches of the bound compute shader on the vertices of the brush list / of the dirty list
+    // (the number of workgroups has been written by the shader itself)
+    void DispatchBrushList()
+    {
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->BrushListBuffer);
+        glDispatchComputeIndirect(0);
+    }
+
+    void DispatchDirtyList()
+    {
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->DirtyListBuffer);
+        glDispatchComputeIndirect(0);
+    }
+
+    // indirect dispatch of the fused pass of the brushing shader: one workgroup for a small dab, none otherwise
+    void DispatchFusedBrush()
+    {
+        glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, this->BrushListBuffer);
+        glDispatchComputeIndirect(sizeof(GLuint) * 4);
+    }
 
-                glm::vec3 faceNormal = glm::cross(e1, e2);
-                float angleDot = glm::dot(e1, e2);
-                if (glm::dot(faceNormal, this->vertices[i].Normal) < .0f)
-                    faceNormal = -faceNormal;
+    // the vertices modified CPU-side (and their neighbours, whose normals could be changed) are copied in the GPU vertex buffer
+    // a single contiguous range of the buffer is updated
+    void UploadVertices(const vector<GLuint>& modified)
+    {
+        if (modified.empty())
+            return;
 
-                newNormal += faceNormal * glm::acos((e1 * e2) / (glm::length(e1) * glm::length(e2)));
+        GLuint first = this->vertices.size(), last = 0;
+        for (size_t i = 0; i < modified.size(); i++)
+        {
+            GLuint v = modified[i];
+            first = min(first, v);
+            last = max(last, v);
+            for (GLuint j = this->vertices[v].NeighboursIndex; j < this->vertices[v].NeighboursIndex + this->vertices[v].NeighboursNumber; j++)
+            {
+                first = min(first, this->neighbours[j]);
+                last = max(last, this->neighbours[j]);
             }
-            /*
-            int k = this->neighbours[this->vertices[i].NeighboursIndex + this->vertices[i].NeighboursNumber - 1];
-            int h = this->neighbours[this->vertices[i].NeighboursIndex];
-            glm::vec3 e1 = glm::vec3(this->vertices[k].Position.x, this->vertices[k].Position.y, this->vertices[k].Position.z) - this->vertices[i].Position;
-            glm::vec3 e2 = glm::vec3(this->vertices[h].Position.x, this->vertices[h].Position.y, this->vertices[h].Position.z) - this->vertices[i].Position;
+        }
+
+        this->uploadPositionsNormals(first, last - first + 1);
+    }
+
+    // the vertices modified by the compute shaders are copied back CPU-side
+    // (the compute shaders change only positions and normals)
+    void DownloadVertices()
+    {
+        this->downloadPositionsNormals(0, this->vertices.size());
+    }
+
+    // only the range of the GPU vertex buffer containing the modified vertices is copied back
+    void DownloadVertices(const vector<GLuint>& modified)
+    {
+        if (modified.empty())
+            return;
+
+        GLuint first = this->vertices.size(), last = 0;
+        for (size_t i = 0; i < modified.size(); i++)
+        {
+            first = min(first, modified[i]);
+            last = max(last, modified[i]);
+        }
 
-            glm::vec3 faceNormal = glm::cross(e1, e2);
-            float angleDot = glm::dot(e1, e2);
-            if (glm::dot(faceNormal, this->vertices[i].Normal) < .0f)
-                faceNormal = -faceNormal;
+        this->downloadPositionsNormals(first, last - first + 1);
+    }
 
-            newNormal += faceNormal; //* glm::acos((e1 * e2) / (glm::length(e1) * glm::length(e2)));
-            */
-            // check orientation before apply
-            float check = glm::dot(this->vertices[i].Normal, newNormal);
-            if (check < .0f)
-                newNormal = -newNormal;
+    // the GPU buffers are updated after an edit of the topology made CPU-side (see N.B. 6): positions, normals and neighbours ranges
+    // of the changed vertices, indices of the changed faces, and neighbours of the changed vertices (both lists must be sorted)
+    void UploadTopology(const vector<GLuint>& changedVertices, const vector<GLuint>& changedFaces)
+    {
+        if (!this->VAO)
+            return;
 
-            this->vertices[i].Normal = glm::normalize(newNormal);
+        if (this->vertices.size() > this->vertexCapacity)
+            this->allocateVertexBuffers();
+        else
+        {
+            forEachRun(changedVertices, [&](GLuint first, GLuint count)
+            {
+                this->uploadPositionsNormals(first, count);
+                if (this->Storage == STREAMS)
+                    this->uploadRangesAttributes(first, count);
+            });
+        }
+
+        if (this->indices.size() > this->indexCapacity)
+            this->allocateIndexBuffers();
+        else
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, this->EBO);
+            forEachRun(changedFaces, [&](GLuint first, GLuint count)
+            {
+                glBufferSubData(GL_COPY_WRITE_BUFFER, first * 3 * sizeof(GLuint), count * 3 * sizeof(GLuint), &this->indices[first * 3]);
+            });
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
         }
+
+        if (!this->NeighboursBuffer)
+            return;
+        if (this->neighbours.size() > this->neighbourCapacity)
+        {
+            this->allocateNeighboursBuffer();
+            return;
+        }
+
+        // ranges of the changed vertices, sorted and merged when they are close
+        vector<glm::uvec2> ranges;
+        for (size_t i = 0; i < changedVertices.size(); i++)
+        {
+            const Vertex& v = this->vertices[changedVertices[i]];
+            if (v.NeighboursNumber > 0)
+                ranges.push_back(glm::uvec2(v.NeighboursIndex, v.NeighboursIndex + v.NeighboursNumber));
+        }
+        sort(ranges.begin(), ranges.end(), [](const glm::uvec2& a, const glm::uvec2& b) { return a.x < b.x; });
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->NeighboursBuffer);
+        size_t i = 0;
+        while (i < ranges.size())
+        {
+            GLuint first = ranges[i].x, last = ranges[i].y;
+            for (i++; i < ranges.size() && ranges[i].x <= last + RUN_GAP; i++)
+                last = max(last, ranges[i].y);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(GLuint), (last - first) * sizeof(GLuint), &this->neighbours[first]);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // every GPU buffer is reallocated and filled again (e.g. after the welding or the compaction of the neighbours, see DynamicTopology)
+    void UploadTopology()
+    {
+        if (!this->VAO)
+            return;
+
+        this->allocateVertexBuffers();
+        this->allocateIndexBuffers();
+        if (this->NeighboursBuffer)
+            this->allocateNeighboursBuffer();
     }
 
+    // the mesh data are replaced by other vertices, indices and neighbours (e.g. a level of a Multires mesh): like the constructor, it empties the source vectors
+    void ReplaceTopology(vector<Vertex>& vertices, vector<GLuint>& indices, vector<GLuint>& neighbours, bool updateNormals = true)
+    {
+        this->vertices = std::move(vertices);
+        this->indices = std::move(indices);
+        this->neighbours = std::move(neighbours);
+        // (the corners and the half-edges of the previous topology, see N.B. 4)
+        this->neighboursCorners.clear();
+        this->halfEdges.Clear();
+        if (updateNormals)
+            UpdateNormals();
+
+        this->UploadTopology();
+    }
+
+    // start of a stroke whose first dab is firstDab: the stroke list is emptied, and the brushing shader appends to it
+    // each vertex added to the dirty list for the first time from the dab firstDab on
+    void BeginDirtyStroke(GLuint firstDab)
+    {
+        this->strokeFirstDab = firstDab;
+        GLuint header[4] = {firstDab, 0, 0, 0};
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->StrokeDirtyBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * 4, header);
+    }
+
+    // vertices of the stroke list (the vertices whose position or normal has been changed by the dabs of the stroke):
+    // only the length and the listed indices are read back, not a word for each vertex of the mesh
+    void StrokeDirtyVertices(vector<GLuint>& dirty)
+    {
+        GLuint header[4];
+        // (the list written by the brushing shader is visible to the read back only after the barrier)
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->StrokeDirtyBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * 4, header);
+
+        dirty.resize(min(header[1], this->vertexCapacity));
+        if (!dirty.empty())
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 4, dirty.size() * sizeof(GLuint), &dirty[0]);
+    }
+
+    // corners of the couples of neighbours, found if they have not been found yet for the current neighbours (see N.B. 4)
+    void UpdateNeighboursCorners()
+    {
+        if (this->neighboursCorners.size() != this->neighbours.size() / 2)
+            this->setupNeighboursCorners();
+    }
+
+    // half-edges of the faces, built if they are not valid for the current indices (see N.B. 4)
+    void UpdateHalfEdges()
+    {
+        if (this->halfEdges.Size() != this->indices.size() / 3 * 3)
+            this->setupHalfEdges();
+    }
+
+    void UpdateNormals()
+    {
+        // without neighbours (e.g. mesh built only from vertices and indices) the normals of the vertices are kept
+        this->UpdateNeighboursCorners();
+        if (this->neighboursCorners.empty())
+            return;
+
+        // each face is computed once, then its normal is summed on its vertices
+        vector<FaceNormal> faceNormals(this->indices.size() / 3);
+        for (GLuint f = 0; f < faceNormals.size(); f++)
+            faceNormals[f] = this->ComputeFaceNormal(f);
+
+        for (GLuint i = 0; i < this->vertices.size(); i++)
+            this->vertices[i].Normal = this->VertexNormal(i, [&](GLuint face) -> const FaceNormal& { return faceNormals[face]; });
+    }
+
+    // normal and corner angles of a triangle (the angles are computed with the same operations of SmoothNormal in ShaderBrush.comp)
+    FaceNormal ComputeFaceNormal(GLuint face) const
+    {
+        glm::vec3 p[3];
+        for (int c = 0; c < 3; c++)
+            p[c] = this->vertices[this->indices[face * 3 + c]].Position;
+
+        FaceNormal faceNormal;
+        faceNormal.Normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+        for (int c = 0; c < 3; c++)
+            faceNormal.Angles[c] = CornerAngle(p[(c + 1) % 3] - p[c], p[(c + 2) % 3] - p[c]);
+
+        return faceNormal;
+    }
+
+    // angle between two edges of a corner (0 for degenerate edges)
+    static float CornerAngle(glm::vec3 e1, glm::vec3 e2)
+    {
+        float lengths = glm::length(e1) * glm::length(e2);
+        if (lengths <= 0.0f)
+            return 0.0f;
+
+        return glm::acos(glm::clamp(glm::dot(e1, e2) / lengths, -1.0f, 1.0f));
+    }
+
+    // normal of a vertex: sum of the normals of the faces around it, weighted by the angle of the vertex corner
+    // faceNormal(face) returns the FaceNormal of a face (already computed for the current positions)
+    template<typename FaceNormalLookup>
+    glm::vec3 VertexNormal(GLuint vertex, FaceNormalLookup faceNormal) const
+    {
+        const Vertex& v = this->vertices[vertex];
+        glm::vec3 newNormal = glm::vec3(0.0f, 0.0f, 0.0f);
+
+        for (GLuint k = v.NeighboursIndex / 2; k < (v.NeighboursIndex + v.NeighboursNumber) / 2; k++)
+        {
+            GLuint corner = this->neighboursCorners[k];
+            // couple without a face (neighbours not matching the indices)
+            if (corner == (GLuint)-1)
+                continue;
+            const FaceNormal& face = faceNormal(corner / 3);
+
+            glm::vec3 normal = face.Normal;
+            if (glm::dot(normal, v.Normal) < .0f)
+                normal = -normal;
+
+            newNormal += normal * face.Angles[corner % 3];
+        }
+
+        // check orientation before apply
+        if (glm::dot(v.Normal, newNormal) < .0f)
+            newNormal = -newNormal;
+
+        return glm::normalize(newNormal);
+    }
+
+
 private:
 
     // VBO and EBO
-    GLuint VBO, EBO, IntersectionBuffer, NeighboursBuffer;
+    // with STREAMS storage the VBO contains only the positions, and the other attributes are in separate buffers
+    GLuint VBO, EBO, NormalsBuffer, NeighboursRangesBuffer, AttributesBuffer;
+    GLuint IntersectionBuffer, NeighboursBuffer, IntersectionPartialsBuffer;
+    GLuint BrushListBuffer, DirtyListBuffer, DirtyStampsBuffer, StrokeDirtyBuffer, DabsBuffer, BrushTargetsBuffer;
+    // capacity of the GPU buffers (see N.B. 6)
+    GLuint vertexCapacity, indexCapacity, neighbourCapacity;
+    // first dab of the current stroke (kept by the stroke list when the lists are allocated again)
+    GLuint strokeFirstDab;
+
+    // maximum gap between two changed elements copied by the same call (see UploadTopology)
+    static const GLuint RUN_GAP = 64;
+
+    // ring of the intersection buffer: distance between the slots (aligned for glBindBufferRange), slot of the current frame,
+    // persistent mapping, and fence of the last frame which has used each slot
+    GLsizeiptr intersectionStride;
+    GLuint intersectionSlot;
+    GLubyte* intersectionMapping;
+    GLsync intersectionFences[INTERSECTION_SLOTS];
+    // index of the current frame, and of the frame of each slot
+    GLuint64 intersectionFrame;
+    GLuint64 intersectionFrames[INTERSECTION_SLOTS];
 
     //////////////////////////////////////////
+    // corner of each couple of neighbours: the couples of a position are in the order of its corners in the faces (see adjacency.h),
+    // so the k-th corner of a position (visiting the indices in order) is the k-th couple of its range
+    void setupNeighboursCorners()
+    {
+        const GLuint unresolved = (GLuint)-1;
+        this->neighboursCorners.assign(this->neighbours.size() / 2, unresolved);
+        if (this->neighbours.empty())
+            return;
+
+        GLuint corners = (GLuint)(this->indices.size() / 3 * 3);
+
+        // couples already assigned in the range of each position (the range starts at NeighboursIndex / 2, shared by the vertices with the same position)
+        vector<GLuint> assigned(this->neighboursCorners.size(), 0);
+        size_t resolved = 0;
+        for (GLuint c = 0; c < corners; c++)
+        {
+            const Vertex& v = this->vertices[this->indices[c]];
+            GLuint k = v.NeighboursIndex / 2 + assigned[v.NeighboursIndex / 2];
+            if (k < (v.NeighboursIndex + v.NeighboursNumber) / 2 && this->neighbours[k * 2] == this->indices[c - c % 3 + (c + 1) % 3] && this->neighbours[k * 2 + 1] == this->indices[c - c % 3 + (c + 2) % 3])
+            {
+                this->neighboursCorners[k] = c;
+                assigned[v.NeighboursIndex / 2]++;
+                resolved++;
+            }
+        }
+        if (resolved == this->neighboursCorners.size())
+            return;
+
+        // neighbours built in another way (e.g. a range for each vertex, instead of each position):
+        // the corner of a couple (next, prev) is searched between the corners sorted by their (next, prev) vertices
+        vector<glm::uvec3> edges(corners);
+        for (GLuint c = 0; c < corners; c++)
+            edges[c] = glm::uvec3(this->indices[c - c % 3 + (c + 1) % 3], this->indices[c - c % 3 + (c + 2) % 3], c);
+        auto less = [](const glm::uvec3& a, const glm::uvec3& b) { return a.x != b.x ? a.x < b.x : a.y < b.y; };
+        sort(edges.begin(), edges.end(), less);
+
+        for (GLuint k = 0; k < this->neighboursCorners.size(); k++)
+        {
+            if (this->neighboursCorners[k] != unresolved)
+                continue;
+            glm::uvec3 edge(this->neighbours[k * 2], this->neighbours[k * 2 + 1], 0);
+            auto found = lower_bound(edges.begin(), edges.end(), edge, less);
+            if (found != edges.end() && found->x == edge.x && found->y == edge.y)
+                this->neighboursCorners[k] = found->z;
+        }
+    }
+
+    // half-edges welded by the neighbours ranges: the vertices with the same range are the same position (see adjacency.h),
+    // and a vertex without neighbours is a position by itself
+    void setupHalfEdges()
+    {
+        vector<GLuint> welded(this->vertices.size()), rangePosition(this->neighbours.size() / 2 + 1, (GLuint)-1);
+        GLuint positions = 0;
+        for (GLuint i = 0; i < this->vertices.size(); i++)
+        {
+            const Vertex& v = this->vertices[i];
+            if (v.NeighboursNumber == 0)
+                welded[i] = positions++;
+            else
+            {
+                GLuint& position = rangePosition[v.NeighboursIndex / 2];
+                if (position == (GLuint)-1)
+                    position = positions++;
+                welded[i] = position;
+            }
+        }
+
+        this->halfEdges.Build(this->indices, welded, positions);
+    }
+
     // buffer objects\arrays are initialized
     // a brief description of their role and how they are binded can be found at:
     // https://learnopengl.com/#!Getting-started/Hello-Triangle
@@ -272,52 +791,402 @@ private:
     // http://www.informit.com/articles/article.aspx?p=1377833&seqNum=8
     void setupMesh()
     {
-        UpdateNormals();
-
         // we create the buffers
         glGenVertexArrays(1, &this->VAO);
         glGenBuffers(1, &this->VBO);
         glGenBuffers(1, &this->EBO);
+        this->NormalsBuffer = this->NeighboursRangesBuffer = this->AttributesBuffer = 0;
 
         // VAO is made "active"
         glBindVertexArray(this->VAO);
-        // we copy data in the VBO - we must set the data dimension, and the pointer to the structure cointaining the data
-        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
-        glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_DYNAMIC_DRAW);
         // we copy data in the EBO - we must set the data dimension, and the pointer to the structure cointaining the data
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->EBO);
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_DYNAMIC_DRAW);
+        this->vertexCapacity = (GLuint)this->vertices.size();
+        this->indexCapacity = (GLuint)this->indices.size();
 
-        // we set in the VAO the pointers to the different vertex attributes (with the relative offsets inside the data structure)
-        // vertex positions
+        // we set in the VAO the format of the different vertex attributes (with the relative offsets inside their buffer), and the binding of the buffer they are read from
         // these will be the positions to use in the layout qualifiers in the shaders ("layout (location = ...)"")
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-        // Normals
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-        // Texture Coordinates
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-        // Tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Tangent));
-        // Bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Bitangent));
-        // Neighbours
-        glEnableVertexAttribArray(5);
-        glVertexAttribPointer(5, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, NeighboursIndex));
-        glEnableVertexAttribArray(6);
-        glVertexAttribPointer(6, 1, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, NeighboursNumber));
+        if (this->Storage == INTERLEAVED)
+        {
+            // we copy data in the VBO - we must set the data dimension, and the pointer to the structure cointaining the data
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_DYNAMIC_DRAW);
+
+            // a single binding for all the attributes
+            glBindVertexBuffer(0, this->VBO, 0, sizeof(Vertex));
+            setAttribute(0, 0, 3, offsetof(Vertex, Position));
+            setAttribute(1, 0, 3, offsetof(Vertex, Normal));
+            setAttribute(2, 0, 2, offsetof(Vertex, TexCoords));
+            setAttribute(3, 0, 3, offsetof(Vertex, Tangent));
+            setAttribute(4, 0, 3, offsetof(Vertex, Bitangent));
+            setIntegerAttribute(5, 0, offsetof(Vertex, NeighboursIndex));
+            setIntegerAttribute(6, 0, offsetof(Vertex, NeighboursNumber));
+        }
+        else
+        {
+            glGenBuffers(1, &this->NormalsBuffer);
+            glGenBuffers(1, &this->NeighboursRangesBuffer);
+            glGenBuffers(1, &this->AttributesBuffer);
+
+            // hot streams (positions and normals), allocated and filled by the upload
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, this->NormalsBuffer);
+            glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+            this->uploadPositionsNormals(0, this->vertices.size());
+
+            // cold streams (neighbours ranges and other attributes), never changed by the compute shaders
+            glBindBuffer(GL_ARRAY_BUFFER, this->NeighboursRangesBuffer);
+            glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(glm::uvec2), NULL, GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, this->AttributesBuffer);
+            glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(VertexAttributes), NULL, GL_STATIC_DRAW);
+            this->uploadRangesAttributes(0, this->vertices.size());
+
+            // one binding for each buffer
+            glBindVertexBuffer(0, this->VBO, 0, sizeof(glm::vec4));
+            glBindVertexBuffer(1, this->NormalsBuffer, 0, sizeof(glm::vec4));
+            glBindVertexBuffer(2, this->AttributesBuffer, 0, sizeof(VertexAttributes));
+            glBindVertexBuffer(3, this->NeighboursRangesBuffer, 0, sizeof(glm::uvec2));
+            setAttribute(0, 0, 3, 0);
+            setAttribute(1, 1, 3, 0);
+            setAttribute(2, 2, 2, offsetof(VertexAttributes, TexCoords));
+            setAttribute(3, 2, 3, offsetof(VertexAttributes, Tangent));
+            setAttribute(4, 2, 3, offsetof(VertexAttributes, Bitangent));
+            setIntegerAttribute(5, 3, 0);
+            setIntegerAttribute(6, 3, sizeof(GLuint));
+        }
 
         glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // float attribute of the bound VAO, read from the buffer of the binding
+    void setAttribute(GLuint location, GLuint binding, GLint size, size_t offset)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribFormat(location, size, GL_FLOAT, GL_FALSE, (GLuint)offset);
+        glVertexAttribBinding(location, binding);
+    }
+
+    // unsigned integer attribute of the bound VAO (neighbours data)
+    void setIntegerAttribute(GLuint location, GLuint binding, size_t offset)
+    {
+        glEnableVertexAttribArray(location);
+        glVertexAttribIFormat(location, 1, GL_UNSIGNED_INT, (GLuint)offset);
+        glVertexAttribBinding(location, binding);
+    }
+
+    // positions and normals of the vertices [first, first + count) are copied in the GPU buffers
+    void uploadPositionsNormals(size_t first, size_t count)
+    {
+        if (this->Storage == INTERLEAVED)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Vertex), count * sizeof(Vertex), &this->vertices[first]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            return;
+        }
+
+        vector<glm::vec4> positions(count), normals(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            positions[i] = glm::vec4(this->vertices[first + i].Position, 1.0f);
+            normals[i] = glm::vec4(this->vertices[first + i].Normal, 0.0f);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(glm::vec4), count * sizeof(glm::vec4), &positions[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, this->NormalsBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(glm::vec4), count * sizeof(glm::vec4), &normals[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    void downloadPositionsNormals(size_t first, size_t count)
+    {
+        // (the positions and normals written by the brushing shader are visible to the read back only after the barrier)
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+        if (this->Storage == INTERLEAVED)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glGetBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Vertex), count * sizeof(Vertex), &this->vertices[first]);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            return;
+        }
+
+        vector<glm::vec4> positions(count), normals(count);
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glGetBufferSubData(GL_ARRAY_BUFFER, first * sizeof(glm::vec4), count * sizeof(glm::vec4), &positions[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, this->NormalsBuffer);
+        glGetBufferSubData(GL_ARRAY_BUFFER, first * sizeof(glm::vec4), count * sizeof(glm::vec4), &normals[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        for (size_t i = 0; i < count; i++)
+        {
+            this->vertices[first + i].Position = glm::vec3(positions[i]);
+            this->vertices[first + i].Normal = glm::vec3(normals[i]);
+        }
+    }
+
+    // neighbours ranges and other attributes of the vertices [first, first + count) are copied in the cold streams (STREAMS storage)
+    void uploadRangesAttributes(size_t first, size_t count)
+    {
+        vector<glm::uvec2> ranges(count);
+        vector<VertexAttributes> attributes(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const Vertex& v = this->vertices[first + i];
+            ranges[i] = glm::uvec2(v.NeighboursIndex, v.NeighboursNumber);
+            attributes[i].TexCoords = v.TexCoords;
+            attributes[i].Tangent = v.Tangent;
+            attributes[i].Bitangent = v.Bitangent;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, this->NeighboursRangesBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(glm::uvec2), count * sizeof(glm::uvec2), &ranges[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, this->AttributesBuffer);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(VertexAttributes), count * sizeof(VertexAttributes), &attributes[0]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    //////////////////////////////////////////
+
+    // capacity for a buffer of size elements: 50% of spare space for the next edits of the topology
+    static GLuint capacity(size_t size)
+    {
+        return (GLuint)(size + size / 2);
+    }
+
+    static GLuint workgroups(GLuint indices)
+    {
+        return (indices / 3 + 127) / 128;
+    }
+
+    // f(first, count) for each run of a sorted list of indices (the elements in the small gaps between them are copied too, with fewer calls)
+    template<typename RunFunction>
+    static void forEachRun(const vector<GLuint>& sorted, RunFunction f)
+    {
+        size_t i = 0;
+        while (i < sorted.size())
+        {
+            GLuint first = sorted[i], last = sorted[i];
+            for (i++; i < sorted.size() && sorted[i] <= last + RUN_GAP; i++)
+                last = max(last, sorted[i]);
+            f(first, last - first + 1);
+        }
+    }
+
+    // the vertex buffers, and the buffers of the brushing shader (as large as the vertices), are reallocated with spare capacity and filled again
+    void allocateVertexBuffers()
+    {
+        this->vertexCapacity = capacity(this->vertices.size());
+
+        if (this->Storage == INTERLEAVED)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * sizeof(Vertex), NULL, GL_DYNAMIC_DRAW);
+        }
+        else
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, this->NormalsBuffer);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * sizeof(glm::vec4), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, this->NeighboursRangesBuffer);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * sizeof(glm::uvec2), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, this->AttributesBuffer);
+            glBufferData(GL_ARRAY_BUFFER, this->vertexCapacity * sizeof(VertexAttributes), NULL, GL_DYNAMIC_DRAW);
+            this->uploadRangesAttributes(0, this->vertices.size());
+        }
+        this->uploadPositionsNormals(0, this->vertices.size());
+
+        if (this->BrushListBuffer)
+            this->allocateBrushLists();
+    }
+
+    // brush list, dirty list and its stamps, stroke list and brush targets, for vertexCapacity vertices (the stamps start from 0, no dab:
+    // the stroke list is emptied, and the next dabs of the stroke add their vertices again)
+    void allocateBrushLists()
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->BrushListBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (8 + this->vertexCapacity), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->DirtyListBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (4 + this->vertexCapacity), NULL, GL_DYNAMIC_DRAW);
+        vector<GLuint> stamps(this->vertexCapacity, 0);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->DirtyStampsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * stamps.size(), &stamps[0], GL_DYNAMIC_DRAW);
+        GLuint header[4] = {this->strokeFirstDab, 0, 0, 0};
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->StrokeDirtyBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * (4 + this->vertexCapacity), NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint) * 4, header);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->BrushTargetsBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * this->vertexCapacity, NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // the element buffer (bound to the copy target: the element array binding belongs to the bound VAO) and the partials of the intersection shader
+    void allocateIndexBuffers()
+    {
+        this->indexCapacity = capacity(this->indices.size());
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, this->EBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, this->indexCapacity * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, 0, this->indices.size() * sizeof(GLuint), &this->indices[0]);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        if (this->IntersectionPartialsBuffer)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->IntersectionPartialsBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * 2 * workgroups(this->indexCapacity), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+    }
+
+    void allocateNeighboursBuffer()
+    {
+        this->neighbourCapacity = capacity(this->neighbours.size());
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->NeighboursBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, this->neighbourCapacity * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, this->neighbours.size() * sizeof(GLuint), &this->neighbours[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // buffers created by InitMeshUpdate
+    void initUpdateBuffers()
+    {
+        this->NeighboursBuffer = this->IntersectionPartialsBuffer = 0;
+        this->BrushListBuffer = this->DirtyListBuffer = this->DirtyStampsBuffer = this->StrokeDirtyBuffer = this->DabsBuffer = this->BrushTargetsBuffer = 0;
+        this->vertexCapacity = this->indexCapacity = this->neighbourCapacity = 0;
+        this->strokeFirstDab = 0;
+    }
+
+    void moveUpdateBuffers(Mesh& move)
+    {
+        this->NeighboursBuffer = move.NeighboursBuffer;
+        this->IntersectionPartialsBuffer = move.IntersectionPartialsBuffer;
+        this->BrushListBuffer = move.BrushListBuffer;
+        this->DirtyListBuffer = move.DirtyListBuffer;
+        this->DirtyStampsBuffer = move.DirtyStampsBuffer;
+        this->StrokeDirtyBuffer = move.StrokeDirtyBuffer;
+        this->DabsBuffer = move.DabsBuffer;
+        this->BrushTargetsBuffer = move.BrushTargetsBuffer;
+        this->vertexCapacity = move.vertexCapacity;
+        this->indexCapacity = move.indexCapacity;
+        this->neighbourCapacity = move.neighbourCapacity;
+        this->strokeFirstDab = move.strokeFirstDab;
+        move.initUpdateBuffers();
+    }
+
+    void freeUpdateBuffers()
+    {
+        GLuint buffers[] = { this->NeighboursBuffer, this->IntersectionPartialsBuffer, this->BrushListBuffer, this->DirtyListBuffer, this->DirtyStampsBuffer, this->StrokeDirtyBuffer, this->DabsBuffer, this->BrushTargetsBuffer };
+        for (int i = 0; i < 8; i++)
+        {
+            if (buffers[i])
+                glDeleteBuffers(1, &buffers[i]);
+        }
+        this->initUpdateBuffers();
+    }
+
+    //////////////////////////////////////////
+
+    void initIntersectionRing()
+    {
+        this->IntersectionBuffer = 0;
+        this->intersectionStride = 0;
+        this->intersectionSlot = 0;
+        this->intersectionMapping = nullptr;
+        this->intersectionFrame = 0;
+        for (GLuint i = 0; i < INTERSECTION_SLOTS; i++)
+        {
+            this->intersectionFences[i] = 0;
+            this->intersectionFrames[i] = 0;
+        }
+    }
+
+    void moveIntersectionRing(Mesh& move)
+    {
+        this->IntersectionBuffer = move.IntersectionBuffer;
+        this->intersectionStride = move.intersectionStride;
+        this->intersectionSlot = move.intersectionSlot;
+        this->intersectionMapping = move.intersectionMapping;
+        this->intersectionFrame = move.intersectionFrame;
+        for (GLuint i = 0; i < INTERSECTION_SLOTS; i++)
+        {
+            this->intersectionFences[i] = move.intersectionFences[i];
+            this->intersectionFrames[i] = move.intersectionFrames[i];
+        }
+        move.initIntersectionRing();
+    }
+
+    // immutable storage for all the slots of the ring, mapped once for the whole life of the mesh
+    void setupIntersectionRing()
+    {
+        GLint alignment = 1;
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        this->intersectionStride = (sizeof(IntersectionBufferData) + alignment - 1) / alignment * alignment;
+
+        GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &this->IntersectionBuffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->IntersectionBuffer);
+        // (dynamic storage for SetIntersectionData, which copies with glBufferSubData)
+        glBufferStorage(GL_SHADER_STORAGE_BUFFER, this->intersectionStride * INTERSECTION_SLOTS, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+        this->intersectionMapping = (GLubyte*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, this->intersectionStride * INTERSECTION_SLOTS, flags);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        this->intersectionSlot = 0;
+    }
+
+    // intersection data in a slot of the intersection buffer
+    void copyIntersection(const Intersection& inter, GLuint slot)
+    {
+        // (copy ordered with the previous commands, which can still be reading the slot)
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->IntersectionBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, slot * this->intersectionStride, sizeof(Intersection), &inter);
+    }
+
+    IntersectionBufferData* intersectionSlotData(GLuint slot)
+    {
+        return (IntersectionBufferData*)(this->intersectionMapping + slot * this->intersectionStride);
+    }
+
+    void waitIntersectionFence(GLuint slot)
+    {
+        GLsync& fence = this->intersectionFences[slot];
+        if (!fence)
+            return;
+
+        GLenum status;
+        do
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        while (status == GL_TIMEOUT_EXPIRED);
+
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    void freeIntersectionRing()
+    {
+        if (!this->IntersectionBuffer)
+            return;
+
+        for (GLuint i = 0; i < INTERSECTION_SLOTS; i++)
+        {
+            if (this->intersectionFences[i])
+                glDeleteSync(this->intersectionFences[i]);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->IntersectionBuffer);
+        glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        glDeleteBuffers(1, &this->IntersectionBuffer);
+        this->initIntersectionRing();
     }
 
     //////////////////////////////////////////
 
     void freeGPUresources()
     {
+        this->freeIntersectionRing();
+        this->freeUpdateBuffers();
+
         // If VAO is 0, this instance of Mesh has been through a move, and no longer owns GPU resources,
         // so there's no need for deleting.
         if (VAO)
@@ -325,6 +1194,12 @@ private:
             glDeleteVertexArrays(1, &this->VAO);
             glDeleteBuffers(1, &this->VBO);
             glDeleteBuffers(1, &this->EBO);
+            if (this->Storage == STREAMS)
+            {
+                glDeleteBuffers(1, &this->NormalsBuffer);
+                glDeleteBuffers(1, &this->NeighboursRangesBuffer);
+                glDeleteBuffers(1, &this->AttributesBuffer);
+            }
         }
     }
 };
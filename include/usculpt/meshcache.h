@@ -0,0 +1,412 @@
+/*
+Mesh cache functions
+- binary file with the final data of the meshes of a model (vertices with updated normals, indices, neighbours), saved after the first loading of the source file
+- the cache is loaded through a memory mapping of the file: the arrays are copied as they are in the vectors of the meshes, without any parsing or processing
+- the cache is valid only for the same source file (size, modification time and content hash) and for the same version of the format and of the Vertex struct
+
+File layout (native byte order):
+    MeshCacheHeader
+    MeshCacheEntry for each mesh
+    arrays of each mesh (vertices, indices, neighbours), each one aligned to CACHE_ALIGNMENT bytes
+
+N.B. 1) the content hash of the source file is computed only when its size is unchanged but its modification time is different (e.g. the file has been copied):
+with an unchanged file the loading does not read the source at all
+
+N.B. 2) a cache file can be truncated or corrupted: before the copy of the arrays, their offsets and sizes are checked against the size of the file
+(without overflows) and their alignment, and the indices and the neighbours are checked against the number of vertices
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// memory mapping of files
+#ifdef _WIN32
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/mman.h>
+#endif
+
+#include <usculpt/mesh.h>
+
+// the version must be increased when the format, or the processing of the meshes in Model class, are changed
+const GLuint MESH_CACHE_VERSION = 1;
+// alignment of the arrays in the file
+const uint64_t CACHE_ALIGNMENT = 64;
+
+struct MeshCacheHeader
+{
+    char Magic[8];
+    GLuint Version;
+    // size of the Vertex struct when the file has been saved
+    GLuint VertexSize;
+    GLuint MeshesNumber;
+    GLuint Padding;
+    // source file data
+    uint64_t SourceSize;
+    int64_t SourceTime;
+    uint64_t SourceHash;
+};
+
+// offsets (in bytes, from the start of the file) and number of elements of the arrays of a mesh
+struct MeshCacheEntry
+{
+    uint64_t VerticesOffset, VerticesNumber;
+    uint64_t IndicesOffset, IndicesNumber;
+    uint64_t NeighboursOffset, NeighboursNumber;
+};
+
+/////////////////// MAPPEDFILE class ///////////////////////
+// read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    const unsigned char* Data;
+    size_t Size;
+
+    MappedFile(const MappedFile& copy) = delete;
+    MappedFile& operator=(const MappedFile& copy) = delete;
+
+    MappedFile()
+        : Data(nullptr), Size(0)
+    {
+#ifdef _WIN32
+        this->file = INVALID_HANDLE_VALUE;
+        this->mapping = NULL;
+#else
+        this->file = -1;
+#endif
+    }
+
+    ~MappedFile()
+    {
+        this->Close();
+    }
+
+    // it returns false if the file cannot be opened or mapped (an empty file cannot be mapped)
+    bool Open(const string& path)
+    {
+        this->Close();
+
+#ifdef _WIN32
+        this->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (this->file == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(this->file, &size) || size.QuadPart == 0)
+        {
+            this->Close();
+            return false;
+        }
+        this->Size = (size_t)size.QuadPart;
+
+        this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (this->mapping == NULL)
+        {
+            this->Close();
+            return false;
+        }
+        this->Data = (const unsigned char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        this->file = open(path.c_str(), O_RDONLY);
+        if (this->file < 0)
+            return false;
+
+        struct stat info;
+        if (fstat(this->file, &info) != 0 || info.st_size == 0)
+        {
+            this->Close();
+            return false;
+        }
+        this->Size = (size_t)info.st_size;
+
+        void* data = mmap(NULL, this->Size, PROT_READ, MAP_PRIVATE, this->file, 0);
+        if (data == MAP_FAILED)
+        {
+            this->Close();
+            return false;
+        }
+        // the file is read once, from the start to the end
+        madvise(data, this->Size, MADV_SEQUENTIAL);
+        this->Data = (const unsigned char*)data;
+#endif
+
+        if (!this->Data)
+        {
+            this->Close();
+            return false;
+        }
+        return true;
+    }
+
+    void Close()
+    {
+#ifdef _WIN32
+        if (this->Data)
+            UnmapViewOfFile(this->Data);
+        if (this->mapping != NULL)
+            CloseHandle(this->mapping);
+        if (this->file != INVALID_HANDLE_VALUE)
+            CloseHandle(this->file);
+        this->file = INVALID_HANDLE_VALUE;
+        this->mapping = NULL;
+#else
+        if (this->Data)
+            munmap((void*)this->Data, this->Size);
+        if (this->file >= 0)
+            close(this->file);
+        this->file = -1;
+#endif
+        this->Data = nullptr;
+        this->Size = 0;
+    }
+
+private:
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int file;
+#endif
+};
+
+//////////////////////////////////////////
+
+// 64-bit hash of the content of a file (FNV-1a on 8 bytes words, then a final mix of the bits)
+inline uint64_t HashBytes(const unsigned char* data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(uint64_t));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; i++)
+        hash = (hash ^ data[i]) * 1099511628211ull;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdull;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ull;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// size and modification time of a file; it returns false if the file does not exist
+inline bool SourceInfo(const string& path, uint64_t& size, int64_t& time)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+        return false;
+
+    size = (uint64_t)info.st_size;
+    time = (int64_t)info.st_mtime;
+    return true;
+}
+
+// hash of the content of a file (0 if it cannot be read)
+inline uint64_t SourceHash(const string& path)
+{
+    MappedFile source;
+    if (!source.Open(path))
+        return 0;
+
+    return HashBytes(source.Data, source.Size);
+}
+
+//////////////////////////////////////////
+
+// the array of number elements of elementSize bytes at the offset is inside the file, and aligned as saved by SaveMeshCache (N.B. 2)
+inline bool CacheArrayFits(uint64_t offset, uint64_t number, uint64_t elementSize, uint64_t fileSize)
+{
+    if (offset % CACHE_ALIGNMENT != 0 || offset > fileSize)
+        return false;
+    // (number * elementSize <= fileSize - offset, without overflow)
+    return number <= (fileSize - offset) / elementSize;
+}
+
+// the indices of the triangles and the neighbours of the vertices refer to existing vertices and to existing ranges of the neighbours (N.B. 2)
+inline bool CacheMeshValid(const MeshCacheEntry& e, const Vertex* vertices, const GLuint* indices, const GLuint* neighbours)
+{
+    if (e.IndicesNumber % 3 != 0)
+        return false;
+    for (uint64_t i = 0; i < e.IndicesNumber; i++)
+        if (indices[i] >= e.VerticesNumber)
+            return false;
+    for (uint64_t n = 0; n < e.NeighboursNumber; n++)
+        if (neighbours[n] >= e.VerticesNumber)
+            return false;
+    for (uint64_t v = 0; v < e.VerticesNumber; v++)
+        if (vertices[v].NeighboursIndex > e.NeighboursNumber || vertices[v].NeighboursNumber > e.NeighboursNumber - vertices[v].NeighboursIndex)
+            return false;
+    return true;
+}
+
+// the meshes saved in the cache file are added to the vector, if the cache is valid for the source file
+// it returns false (and the vector is unchanged) if the cache is missing, outdated or corrupted
+inline bool LoadMeshCache(const string& cachePath, const string& sourcePath, vector<Mesh>& meshes, VertexStorage storage, bool setupGPU = true)
+{
+    uint64_t sourceSize;
+    int64_t sourceTime;
+    if (!SourceInfo(sourcePath, sourceSize, sourceTime))
+        return false;
+
+    MappedFile cache;
+    if (!cache.Open(cachePath) || cache.Size < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    memcpy(&header, cache.Data, sizeof(MeshCacheHeader));
+    if (memcmp(header.Magic, "USCULPT", 8) != 0 || header.Version != MESH_CACHE_VERSION || header.VertexSize != sizeof(Vertex))
+        return false;
+    if (header.SourceSize != sourceSize)
+        return false;
+    if (header.SourceTime != sourceTime && header.SourceHash != SourceHash(sourcePath))
+        return false;
+
+    // the whole table of the meshes, and all the arrays, must be inside the file (N.B. 2)
+    uint64_t tableEnd = sizeof(MeshCacheHeader) + (uint64_t)header.MeshesNumber * sizeof(MeshCacheEntry);
+    if (tableEnd > cache.Size)
+        return false;
+    vector<MeshCacheEntry> entries(header.MeshesNumber);
+    if (header.MeshesNumber > 0)
+        memcpy(&entries[0], cache.Data + sizeof(MeshCacheHeader), header.MeshesNumber * sizeof(MeshCacheEntry));
+    for (size_t m = 0; m < entries.size(); m++)
+    {
+        const MeshCacheEntry& e = entries[m];
+        if (!CacheArrayFits(e.VerticesOffset, e.VerticesNumber, sizeof(Vertex), cache.Size)
+            || !CacheArrayFits(e.IndicesOffset, e.IndicesNumber, sizeof(GLuint), cache.Size)
+            || !CacheArrayFits(e.NeighboursOffset, e.NeighboursNumber, sizeof(GLuint), cache.Size))
+            return false;
+        if (!CacheMeshValid(e, (const Vertex*)(cache.Data + e.VerticesOffset), (const GLuint*)(cache.Data + e.IndicesOffset),
+                            (const GLuint*)(cache.Data + e.NeighboursOffset)))
+            return false;
+    }
+
+    // the arrays are copied directly from the mapped file
+    for (size_t m = 0; m < entries.size(); m++)
+    {
+        const MeshCacheEntry& e = entries[m];
+        const Vertex* v = (const Vertex*)(cache.Data + e.VerticesOffset);
+        const GLuint* i = (const GLuint*)(cache.Data + e.IndicesOffset);
+        const GLuint* n = (const GLuint*)(cache.Data + e.NeighboursOffset);
+        vector<Vertex> vertices(v, v + e.VerticesNumber);
+        vector<GLuint> indices(i, i + e.IndicesNumber);
+        vector<GLuint> neighbours(n, n + e.NeighboursNumber);
+
+        // the saved normals are already updated
+        meshes.emplace_back(vertices, indices, neighbours, setupGPU, storage, false);
+    }
+
+    return true;
+}
+
+// the meshes are saved in the cache file, with the data of the source file
+// the file is written with a temporary name, then renamed: a cache file is always complete
+inline bool SaveMeshCache(const string& cachePath, const string& sourcePath, const vector<Mesh>& meshes)
+{
+    MeshCacheHeader header;
+    memset(&header, 0, sizeof(MeshCacheHeader));
+    memcpy(header.Magic, "USCULPT", 8);
+    header.Version = MESH_CACHE_VERSION;
+    header.VertexSize = sizeof(Vertex);
+    header.MeshesNumber = (GLuint)meshes.size();
+    if (!SourceInfo(sourcePath, header.SourceSize, header.SourceTime))
+        return false;
+    header.SourceHash = SourceHash(sourcePath);
+
+    // layout of the arrays
+    vector<MeshCacheEntry> entries(meshes.size());
+    uint64_t offset = sizeof(MeshCacheHeader) + meshes.size() * sizeof(MeshCacheEntry);
+    for (size_t m = 0; m < meshes.size(); m++)
+    {
+        MeshCacheEntry& e = entries[m];
+        e.VerticesNumber = meshes[m].vertices.size();
+        e.IndicesNumber = meshes[m].indices.size();
+        e.NeighboursNumber = meshes[m].neighbours.size();
+
+        offset = (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+        e.VerticesOffset = offset;
+        offset += e.VerticesNumber * sizeof(Vertex);
+        offset = (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+        e.IndicesOffset = offset;
+        offset += e.IndicesNumber * sizeof(GLuint);
+        offset = (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+        e.NeighboursOffset = offset;
+        offset += e.NeighboursNumber * sizeof(GLuint);
+    }
+
+    string temporaryPath = cachePath + ".tmp";
+    {
+        ofstream file(temporaryPath.c_str(), ios::binary | ios::trunc);
+        if (!file)
+        {
+            cout << "WARNING::MESH_CACHE:: CANNOT WRITE " << temporaryPath << endl;
+            return false;
+        }
+
+        file.write((const char*)&header, sizeof(MeshCacheHeader));
+        if (!entries.empty())
+            file.write((const char*)&entries[0], entries.size() * sizeof(MeshCacheEntry));
+
+        // padding up to the offset of the next array
+        const char zeros[CACHE_ALIGNMENT] = {};
+        uint64_t position = sizeof(MeshCacheHeader) + entries.size() * sizeof(MeshCacheEntry);
+        for (size_t m = 0; m < meshes.size(); m++)
+        {
+            const MeshCacheEntry& e = entries[m];
+            uint64_t offsets[3] = {e.VerticesOffset, e.IndicesOffset, e.NeighboursOffset};
+            uint64_t sizes[3] = {e.VerticesNumber * sizeof(Vertex), e.IndicesNumber * sizeof(GLuint), e.NeighboursNumber * sizeof(GLuint)};
+            const char* arrays[3] = {(const char*)meshes[m].vertices.data(), (const char*)meshes[m].indices.data(), (const char*)meshes[m].neighbours.data()};
+            for (int a = 0; a < 3; a++)
+            {
+                file.write(zeros, (streamsize)(offsets[a] - position));
+                if (sizes[a] > 0)
+                    file.write(arrays[a], (streamsize)sizes[a]);
+                position = offsets[a] + sizes[a];
+            }
+        }
+
+        if (!file)
+        {
+            cout << "WARNING::MESH_CACHE:: CANNOT WRITE " << temporaryPath << endl;
+            file.close();
+            remove(temporaryPath.c_str());
+            return false;
+        }
+    }
+
+    // rename() does not replace an existing file on Windows
+    remove(cachePath.c_str());
+    if (rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+    {
+        remove(temporaryPath.c_str());
+        return false;
+    }
+    return true;
+}
@@ -6,6 +6,7 @@ Universita' degli Studi di Milano
 Model class
 - OBJ models loading using Assimp library
 - the class converts data from Assimp data structure to a OpenGL-compatible data structure (Mesh class in mesh_v1.h)
+- the converted meshes are saved in a binary cache file (<model path>.uscache, or another path), loaded instead of the model when it is valid
 
 N.B. 1)  
 Model and Mesh classes follow RAII principles (https://en.cppreference.com/w/cpp/language/raii).
@@ -26,6 +27,10 @@ using namespace std;
 // we use GLM data structures to convert data in the Assimp data structures in a data structures suited for VBO, VAO and EBO buffers
 #include <glm/glm.hpp>
 
+// Std. Includes
+#include <algorithm>
+#include <limits>
+
 // Assimp includes
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
@@ -34,11 +39,12 @@ using namespace std;
 // we include the Mesh class, which manages the "OpenGL side" (= creation and allocation of VBO, VAO, EBO buffers) of the loading of models
 #include <usculpt/mesh.h>
 
-// include for hash map
-#include <unordered_map>
+// welding of the vertices and neighbours of the positions
+#include <usculpt/adjacency.h>
+#include <usculpt/halfedge.h>
 
-// include for sets
-#include <set>
+// binary cache of the processed meshes
+#include <usculpt/meshcache.h>
 
 /////////////////// MODEL class ///////////////////////
 class Model
@@ -74,9 +80,13 @@ public:
     // to notice that Model class is not strictly following the Rules of 5 
     // https://en.cppreference.com/w/cpp/language/rule_of_three
     // because we are not writing a user-defined destructor.
-    Model(const string& path)
+    // storage = layout of the vertices of the meshes in GPU memory (see Mesh class)
+    // setupGPU = false -> the meshes are kept only CPU-side (no OpenGL context is needed, e.g. for benchmarks on machines without GPU)
+    // cachePath = file of the binary cache (empty -> <path>.uscache, next to the model)
+    Model(const string& path, VertexStorage storage = STREAMS, bool setupGPU = true, const string& cachePath = "")
+        : storage(storage), setupGPU(setupGPU)
     {
-        this->loadModel(path);
+        this->loadModel(path, cachePath.empty() ? path + ".uscache" : cachePath);
     }
 
     //////////////////////////////////////////
@@ -98,11 +108,19 @@ public:
 
 
 private:
+    // layout of the vertices in GPU memory
+    VertexStorage storage;
+    bool setupGPU;
 
     //////////////////////////////////////////
     // loading of the model using Assimp library. Nodes are processed to build a vector of Mesh class instances
-    void loadModel(string path)
+    void loadModel(string path, const string& cachePath)
     {
+        // the processed meshes are saved in a binary cache (see meshcache.h), by default next to the source file:
+        // when the cache is valid, the source file is not parsed at all
+        if (LoadMeshCache(cachePath, path, this->meshes, this->storage, this->setupGPU))
+            return;
+
         // loading using Assimp
         // N.B.: it is possible to set, if needed, some operations to be performed by Assimp after the loading.
         // Details on the different flags to use are available at: http://assimp.sourceforge.net/lib_html/postprocess_8h.html#a64795260b95f5a4b3f3dc1be4f52e410
@@ -120,6 +138,9 @@ private:
 
         // we start the recursive processing of nodes in the Assimp data structure
         this->processNode(scene->mRootNode, scene);
+
+        // cache for the next loadings
+        SaveMeshCache(cachePath, path, this->meshes);
     }
 
     //////////////////////////////////////////
@@ -155,169 +176,88 @@ private:
     Mesh processMesh(aiMesh* mesh)
     {
         // data structures for vertices and indices of vertices (for faces)
-        vector<Vertex> vertices;
+        vector<Vertex> vertices(mesh->mNumVertices);
         vector<GLuint> indices;
-
-        // neighborhood map for vertex's neighbours
-        unordered_map<glm::vec3, vector<GLuint>, GlmMap, GlmMap> Nmap;
-        // indices referring to the same vertex
-        unordered_map<glm::vec3, set<GLuint>, GlmMap, GlmMap> Vmap;
         vector<GLuint> neighbours;
 
         // scale factor for inscription in a cube of 1x1x1
         float scale_factor = this->InUnitCube(mesh);
 
-        for(GLuint i = 0; i < mesh->mNumVertices; i++)
-        {
-            Vertex vertex;
-            // the vector data type used by Assimp is different than the GLM vector needed to allocate the OpenGL buffers
-            // I need to convert the data structures (from Assimp to GLM, which are fully compatible to the OpenGL)
-            glm::vec3 vector;
-            // vertices coordinates
-            vector.x = mesh->mVertices[i].x * scale_factor;
-            vector.y = mesh->mVertices[i].y * scale_factor;
-            vector.z = mesh->mVertices[i].z * scale_factor;
-            vertex.Position = vector;
-            // Normals
-            vector.x = mesh->mNormals[i].x;
-            vector.y = mesh->mNormals[i].y;
-            vector.z = mesh->mNormals[i].z;
-            vertex.Normal = vector;
-            // Texture Coordinates
-            // if the model has texture coordinates, than we assign them to a GLM data structure, otherwise we set them at 0
-            // if texture coordinates are present, than Assimp can calculate tangents and bitangents, otherwise we set them at 0 too
-            if(mesh->mTextureCoords[0])
-            {
-                glm::vec2 vec;
-                // in this example we assume the model has only one set of texture coordinates. Actually, a vertex can have up to 8 different texture coordinates. For other models and formats, this code needs to be adapted and modified.
-                vec.x = mesh->mTextureCoords[0][i].x;
-                vec.y = mesh->mTextureCoords[0][i].y;
-                vertex.TexCoords = vec;
-
-                // Tangents
-                vector.x = mesh->mTangents[i].x;
-                vector.y = mesh->mTangents[i].y;
-                vector.z = mesh->mTangents[i].z;
-                vertex.Tangent = vector;
-                // Bitangents
-                vector.x = mesh->mBitangents[i].x;
-                vector.y = mesh->mBitangents[i].y;
-                vector.z = mesh->mBitangents[i].z;
-                vertex.Bitangent = vector;
-            }
-            else
-            {
-                vertex.TexCoords = glm::vec2(0.0f, 0.0f);
-            }
-
-            // save indices of vertex duplicates
-            if (Vmap.find(vertex.Position) == Vmap.end())
-            {
-                Vmap[vertex.Position] = set<GLuint>();
-            }
-            Vmap[vertex.Position].insert(i);
-
-            // we add the vertex to the list
-            vertices.push_back(vertex);
-        }
-        // warning if there are not uv coords
-        if (!mesh->mTextureCoords[0])
-            cout << "WARNING::ASSIMP:: MODEL WITHOUT UV COORDINATES -> TANGENT AND BITANGENT ARE = 0" << endl;
-
-        // for each face of the mesh, we retrieve the indices of its vertices , and we store them in a vector data structure
-        // for each face of the mesh, we retrieve also vertex's neighbours
-        for(GLuint i = 0; i < mesh->mNumFaces; i++)
+        // the vertices are converted in parallel (each one is independent from the others)
+        ThreadPool::Instance().ParallelFor(0, mesh->mNumVertices, 65536, [&](size_t first, size_t last)
         {
-            aiFace face = mesh->mFaces[i];
-            for(GLuint j = 0; j < face.mNumIndices; j++)
+            for(size_t i = first; i < last; i++)
             {
-                indices.push_back(face.mIndices[j]);
-
-                // check if the position is a new one
-                if (Nmap.find(vertices[face.mIndices[j]].Position) == Nmap.end())
-                {
-                    Nmap[vertices[face.mIndices[j]].Position] = vector<GLuint>();
-                }
-
-                // add neighbours indices to current position
-                // neighbours are stored like couples of each face (ex: {1, 2, 2, 3, 3, 4, 4, 1})
-                for(GLuint k = (j + 1) % face.mNumIndices; k != j; k = (k + 1) % face.mNumIndices)
-                {
-                    Nmap[vertices[face.mIndices[j]].Position].push_back(face.mIndices[k]);
-                }
-
-                /*
-                // new vertex explored
-                if (Nmap.find(indexV) == Nmap.end())
+                Vertex& vertex = vertices[i];
+                // the vector data type used by Assimp is different than the GLM vector needed to allocate the OpenGL buffers
+                // I need to convert the data structures (from Assimp to GLM, which are fully compatible to the OpenGL)
+                glm::vec3 vector;
+                // vertices coordinates
+                vector.x = mesh->mVertices[i].x * scale_factor;
+                vector.y = mesh->mVertices[i].y * scale_factor;
+                vector.z = mesh->mVertices[i].z * scale_factor;
+                vertex.Position = vector;
+                // Normals
+                vector.x = mesh->mNormals[i].x;
+                vector.y = mesh->mNormals[i].y;
+                vector.z = mesh->mNormals[i].z;
+                vertex.Normal = vector;
+                // Texture Coordinates
+                // if the model has texture coordinates, than we assign them to a GLM data structure, otherwise we set them at 0
+                // if texture coordinates are present, than Assimp can calculate tangents and bitangents, otherwise we set them at 0 too
+                if(mesh->mTextureCoords[0])
                 {
-                    if (Vmap.find(vertices[indexV].Position) == Vmap.end())
-                    {
-                        // key not present
-                        Nmap[indexV] = set<GLuint>();
-                    }
-                    else
-                    {
-                        // add key and copy already known neighbours
-                        Nmap[indexV] = Nmap[*Vmap[vertices[indexV].Position].begin()];
-                    }
-                }
-
-                // check vertex index
-                if (Vmap.find(vertices[indexV].Position) == Vmap.end())
-                {
-                    // key not present
-                    Vmap[vertices[indexV].Position] = indexV;
+                    glm::vec2 vec;
+                    // in this example we assume the model has only one set of texture coordinates. Actually, a vertex can have up to 8 different texture coordinates. For other models and formats, this code needs to be adapted and modified.
+                    vec.x = mesh->mTextureCoords[0][i].x;
+                    vec.y = mesh->mTextureCoords[0][i].y;
+                    vertex.TexCoords = vec;
+
+                    // Tangents
+                    vector.x = mesh->mTangents[i].x;
+                    vector.y = mesh->mTangents[i].y;
+                    vector.z = mesh->mTangents[i].z;
+                    vertex.Tangent = vector;
+                    // Bitangents
+                    vector.x = mesh->mBitangents[i].x;
+                    vector.y = mesh->mBitangents[i].y;
+                    vector.z = mesh->mBitangents[i].z;
+                    vertex.Bitangent = vector;
                 }
                 else
                 {
-                    // get already saved index
-                    indexV = Vmap[vertices[indexV].Position];
+                    vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                    vertex.Tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+                    vertex.Bitangent = glm::vec3(0.0f, 0.0f, 0.0f);
                 }
-
-                // other face indices added as current index neighbours
-                for(GLuint k = (j + 1) % face.mNumIndices; k != j; k = (k + 1) % face.mNumIndices)
-                {
-                    int indexN = face.mIndices[k];
-
-                    // check neighbour's index
-                    if (Vmap.find(vertices[indexN].Position) != Vmap.end())
-                    {
-                        // get already saved index
-                        indexN = Vmap[vertices[indexN].Position];
-                    }
-
-                    Nmap[indexV].insert(indexN);
-                }
-                */
             }
-        }
+        });
+        // warning if there are not uv coords
+        if (!mesh->mTextureCoords[0])
+            cout << "WARNING::ASSIMP:: MODEL WITHOUT UV COORDINATES -> TANGENT AND BITANGENT ARE = 0" << endl;
 
-        // create neighbours vector and save neighborood data for vertices
-        vertices[0].NeighboursIndex = 0;
-        vertices[0].NeighboursNumber = Nmap[vertices[0].Position].size();
-        neighbours.insert(neighbours.end(), Nmap[vertices[0].Position].begin(), Nmap[vertices[0].Position].end());
-        for (GLuint i = 1; i < vertices.size(); i++)
+        // for each face of the mesh, we retrieve the indices of its vertices , and we store them in a vector data structure
+        // (after the triangulation, only points and lines can have a different number of indices: they are not rendered as triangles, so they are skipped)
+        indices.reserve(mesh->mNumFaces * 3);
+        for(GLuint i = 0; i < mesh->mNumFaces; i++)
         {
-            vertices[i].NeighboursIndex = vertices[i - 1].NeighboursIndex + vertices[i - 1].NeighboursNumber;
-            vertices[i].NeighboursNumber = Nmap[vertices[i].Position].size();
-            neighbours.insert(neighbours.end(), Nmap[vertices[i].Position].begin(), Nmap[vertices[i].Position].end());
+            const aiFace& face = mesh->mFaces[i];
+            if (face.mNumIndices == 3)
+                indices.insert(indices.end(), face.mIndices, face.mIndices + 3);
         }
 
-        /*
-        // convert map in to a vector
-        vertices[0].NeighboursIndex = 0;
-        vertices[0].NeighboursNumber = Nmap[0].size();
-        neighbours.insert(neighbours.end(), Nmap[0].begin(), Nmap[0].end());
-        for (GLuint i = 1; i < vertices.size(); i++)
-        {
-            vertices[i].NeighboursIndex = vertices[i - 1].NeighboursIndex + vertices[i - 1].NeighboursNumber;
-            vertices[i].NeighboursNumber = Nmap[i].size();
-            neighbours.insert(neighbours.end(), Nmap[i].begin(), Nmap[i].end());
-        }
-        */
-        
-        // we return an instance of the Mesh class created using the vertices and faces data structures we have created above.
-        return Mesh(vertices, indices, neighbours);
+        // vertices with the same position are welded in the half-edges, and the neighbours of each position are derived from them (see halfedge.h)
+        vector<GLuint> welded;
+        GLuint positions = WeldVertices(vertices, welded);
+        HalfEdges halfEdges;
+        halfEdges.Build(indices, welded, positions);
+        halfEdges.BuildNeighbours(vertices, indices, neighbours);
+
+        // we return an instance of the Mesh class created using the vertices and faces data structures we have created above
+        // (the mesh keeps the half-edges, see N.B. 4 of Mesh)
+        Mesh result(vertices, indices, neighbours, this->setupGPU, this->storage);
+        result.halfEdges = std::move(halfEdges);
+        return result;
     }
 
     // setting the mesh in a cube of 1x1x1 dimensions, for consistency with the sculpting params
@@ -348,18 +288,4 @@ private:
 
         return 1 / maxExtension;
     }
-
-    struct GlmMap
-    {
-        size_t operator()(const glm::vec3& k)const
-        {
-            return std::hash<float>()(k.x) ^ std::hash<float>()(k.y) ^ std::hash<float>()(k.z);
-        }
-
-        bool operator()(const glm::vec3& a, const glm::vec3& b)const
-        {
-            return a == b;
-        }
-    };
-    
 };
@@ -0,0 +1,460 @@
+/*
+Multires class
+- multiresolution mesh: a coarse base cage, and subdivision levels generated on demand (Subdivide), each one with 4 times the faces of the previous one
+- the levels are computed with the Loop subdivision scheme (the meshes are triangulated, see Model class): each face is split in 4 faces by a new vertex
+  on each edge, and the positions of the new level are a weighted average of the positions of the previous one (smooth surface)
+- each level stores the displacement of its vertices from the subdivided positions of the previous level: a level is sculpted like any other mesh,
+  then its positions are stored as displacements when the level is changed (Store), so the finer levels follow the edits of the coarser ones
+- the Mesh shows a single level (SetLevel): it is rendered, picked and sculpted at that level of detail, so the edits of the large shapes
+  move only the vertices of a coarse level, and the finer levels are computed again only when they are shown
+
+Loop rules (edges (a, b) with the opposite vertices c and d of their two faces):
+- new vertex of an edge: 3/8 (a + b) + 1/8 (c + d), or 1/2 (a + b) for a crease (boundary or non-manifold edge)
+- old vertex with n neighbours: (1 - n beta) v + beta (sum of the neighbours), beta = 3 / (8 n) (3 / 16 for n = 3) (Warren's weights),
+  or 3/4 v + 1/8 (sum of its two crease neighbours) on a crease, or v on a corner (more than two crease edges)
+
+N.B. 1) the displacements are stored in the local frame of each vertex (normal of the subdivided surface, tangent towards its first neighbour):
+when a coarser level is sculpted, the details of the finer levels are rotated with the surface instead of being moved in world space
+
+N.B. 2) the vertices of the base cage are welded (like in DynamicTopology), so the levels have no seams of texture coordinates:
+the attributes of a new vertex are the average of the ones of its edge
+
+N.B. 3) changing the level replaces the faces of the Mesh (Mesh::ReplaceTopology): the StrokeHistory, the BVH and the SpatialGrid of the mesh
+must be built again, and the topology of the levels cannot be edited (DynamicTopology)
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+#include <usculpt/adjacency.h>
+#include <usculpt/threadpool.h>
+
+// a level of the multiresolution mesh
+struct MultiresLevel
+{
+    // vertices (positions, attributes and neighbours ranges), faces and neighbours (a range for each vertex, see adjacency.h)
+    vector<Vertex> Vertices;
+    vector<GLuint> Indices;
+    vector<GLuint> Neighbours;
+    // displacement of each vertex from the subdivided positions of the previous level, in its local frame (empty for the base cage)
+    vector<glm::vec3> Displacements;
+    // edges (a, b, c, d) for the next level: vertices a < b, opposite vertices c and d of its two faces (d = Multires::NO_VERTEX for a crease)
+    // the new vertex of the edge e is the vertex Vertices.size() + e of the next level
+    vector<glm::uvec4> Edges;
+    // the positions have to be computed again from the previous level (it has been sculpted)
+    bool Dirty;
+    // the normals of the vertices are the ones computed by the mesh for the positions of the level (see Multires::Store),
+    // so the mesh does not compute them again when it shows the level
+    bool MeshNormals;
+};
+
+/////////////////// MULTIRES class ///////////////////////
+class Multires
+{
+public:
+    // maximum number of levels (base cage included): the last one has 4^(MAX_LEVELS - 1) times the faces of the base cage
+    static const GLuint MAX_LEVELS = 6;
+    // missing opposite vertex of a crease edge
+    static const GLuint NO_VERTEX = (GLuint)-1;
+    // vertices processed by each task of the thread pool
+    static const size_t GRAIN = 16384;
+
+    //////////////////////////////////////////
+
+    // constructor
+    Multires(ThreadPool& pool = ThreadPool::Instance())
+        : pool(pool), level(0)
+    {
+    }
+
+    //////////////////////////////////////////
+
+    // the mesh becomes the base cage (level 0) of new levels: its vertices are welded, and the vertices without faces are removed
+    // it returns false if the mesh has no faces (the mesh is not changed)
+    bool Build(Mesh& mesh)
+    {
+        vector<GLuint> welded;
+        GLuint positions = WeldVertices(mesh.vertices, welded, this->pool);
+
+        // faces of the welded positions (the faces with two equal vertices are dropped)
+        vector<GLuint> indices;
+        indices.reserve(mesh.indices.size() / 3 * 3);
+        for (size_t f = 0; f + 2 < mesh.indices.size(); f += 3)
+        {
+            GLuint a = welded[mesh.indices[f]], b = welded[mesh.indices[f + 1]], c = welded[mesh.indices[f + 2]];
+            if (a == b || b == c || c == a)
+                continue;
+            indices.push_back(a);
+            indices.push_back(b);
+            indices.push_back(c);
+        }
+        if (indices.empty())
+        {
+            cout << "WARNING::MULTIRES:: MESH WITHOUT FACES" << endl;
+            return false;
+        }
+
+        // the used positions are numbered in the order of their first vertex, which gives its attributes
+        vector<GLuint> renumber(positions, (GLuint)NO_VERTEX);
+        for (size_t c = 0; c < indices.size(); c++)
+            renumber[indices[c]] = 0;
+        MultiresLevel base;
+        for (GLuint i = 0; i < mesh.vertices.size(); i++)
+        {
+            if (renumber[welded[i]] != 0)
+                continue;
+            renumber[welded[i]] = (GLuint)base.Vertices.size() + 1;
+            base.Vertices.push_back(mesh.vertices[i]);
+        }
+        for (size_t c = 0; c < indices.size(); c++)
+            indices[c] = renumber[indices[c]] - 1;
+
+        base.Indices = std::move(indices);
+        this->buildNeighbours(base);
+        // (the normals of the welded vertices are the ones of their first vertex)
+        base.Dirty = base.MeshNormals = false;
+
+        this->levels.clear();
+        this->levels.push_back(std::move(base));
+        this->level = 0;
+        this->load(mesh);
+        return true;
+    }
+
+    // a new finest level is added, subdividing the last one, and it is shown by the mesh (the edits of the current level are stored before)
+    // it returns false if there is not a base cage, or if the maximum number of levels has been reached
+    bool Subdivide(Mesh& mesh)
+    {
+        if (this->levels.empty())
+            return false;
+        if (this->levels.size() >= MAX_LEVELS)
+        {
+            cout << "WARNING::MULTIRES:: MAXIMUM NUMBER OF LEVELS (" << MAX_LEVELS << ") REACHED" << endl;
+            return false;
+        }
+
+        this->Store(mesh);
+        GLuint finest = (GLuint)this->levels.size() - 1;
+        this->update(finest);
+
+        // new vertex on each edge of the last level (the corners give the edge of each side of the faces)
+        vector<GLuint> cornerEdges;
+        this->buildEdges(this->levels[finest], cornerEdges);
+        const MultiresLevel& coarse = this->levels[finest];
+        GLuint coarseVertices = (GLuint)coarse.Vertices.size();
+
+        MultiresLevel fine;
+        fine.Vertices.resize(coarseVertices + coarse.Edges.size());
+        vector<glm::vec3> positions;
+        this->subdividePositions(coarse, positions);
+        this->pool.ParallelFor(0, fine.Vertices.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                // the new vertices take the average of the attributes of their edge
+                Vertex& v = fine.Vertices[i];
+                if (i < coarseVertices)
+                    v = coarse.Vertices[i];
+                else
+                {
+                    const Vertex& a = coarse.Vertices[coarse.Edges[i - coarseVertices].x];
+                    const Vertex& b = coarse.Vertices[coarse.Edges[i - coarseVertices].y];
+                    v.Normal = a.Normal + b.Normal;
+                    v.TexCoords = (a.TexCoords + b.TexCoords) * 0.5f;
+                    v.Tangent = (a.Tangent + b.Tangent) * 0.5f;
+                    v.Bitangent = (a.Bitangent + b.Bitangent) * 0.5f;
+                }
+                v.Position = positions[i];
+            }
+        });
+
+        // each face (v0, v1, v2) is split in 4 faces by the vertices m0, m1, m2 of its edges (v0, v1), (v1, v2), (v2, v0), with the same orientation
+        GLuint faces = (GLuint)(coarse.Indices.size() / 3);
+        fine.Indices.resize(faces * 12);
+        this->pool.ParallelFor(0, faces, GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t f = first; f < last; f++)
+            {
+                const GLuint* v = &coarse.Indices[f * 3];
+                GLuint m[3];
+                for (int c = 0; c < 3; c++)
+                    m[c] = coarseVertices + cornerEdges[f * 3 + c];
+
+                GLuint split[12] = { v[0], m[0], m[2], v[1], m[1], m[0], v[2], m[2], m[1], m[0], m[1], m[2] };
+                copy(split, split + 12, fine.Indices.begin() + f * 12);
+            }
+        });
+
+        this->buildNeighbours(fine);
+        fine.Displacements.assign(fine.Vertices.size(), glm::vec3(0.0f));
+        fine.Dirty = fine.MeshNormals = false;
+
+        this->levels.push_back(std::move(fine));
+        this->level = finest + 1;
+        this->load(mesh);
+        return true;
+    }
+
+    // the mesh shows another level: the edits of the current level are stored, then the finer levels changed by them are computed again
+    void SetLevel(Mesh& mesh, GLuint level)
+    {
+        if (level >= this->levels.size() || level == this->level)
+            return;
+
+        this->Store(mesh);
+        this->update(level);
+        this->level = level;
+        this->load(mesh);
+    }
+
+    // the positions of the mesh (sculpted at the current level) are stored as the displacements of the level, and the finer levels become dirty
+    void Store(const Mesh& mesh)
+    {
+        if (this->levels.empty())
+            return;
+
+        MultiresLevel& current = this->levels[this->level];
+        if (mesh.vertices.size() != current.Vertices.size())
+        {
+            cout << "WARNING::MULTIRES:: THE MESH IS NOT THE LEVEL " << this->level << " (" << mesh.vertices.size() << " VERTICES INSTEAD OF " << current.Vertices.size() << ")" << endl;
+            return;
+        }
+
+        for (size_t i = 0; i < current.Vertices.size(); i++)
+        {
+            current.Vertices[i].Position = mesh.vertices[i].Position;
+            current.Vertices[i].Normal = mesh.vertices[i].Normal;
+        }
+        current.MeshNormals = true;
+
+        if (this->level > 0)
+        {
+            vector<glm::vec3> smooth, normals;
+            this->subdividePositions(this->levels[this->level - 1], smooth);
+            this->computeNormals(current, smooth, normals);
+            this->pool.ParallelFor(0, current.Vertices.size(), GRAIN, [&](size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; i++)
+                    current.Displacements[i] = glm::transpose(this->frame(current, (GLuint)i, smooth, normals)) * (current.Vertices[i].Position - smooth[i]);
+            });
+        }
+
+        for (GLuint l = this->level + 1; l < this->levels.size(); l++)
+            this->levels[l].Dirty = true;
+    }
+
+    //////////////////////////////////////////
+
+    // number of levels (0 before Build), and level shown by the mesh
+    GLuint Levels() const { return (GLuint)this->levels.size(); }
+    GLuint Level() const { return this->level; }
+
+    size_t LevelVertices(GLuint level) const { return this->levels[level].Vertices.size(); }
+    size_t LevelFaces(GLuint level) const { return this->levels[level].Indices.size() / 3; }
+
+private:
+    ThreadPool& pool;
+    vector<MultiresLevel> levels;
+    GLuint level;
+
+    //////////////////////////////////////////
+
+    // the positions of the dirty levels up to the level are computed again: subdivided positions of the previous level + displacements
+    void update(GLuint level)
+    {
+        for (GLuint l = 1; l <= level; l++)
+        {
+            MultiresLevel& current = this->levels[l];
+            if (!current.Dirty)
+                continue;
+
+            vector<glm::vec3> smooth, normals;
+            this->subdividePositions(this->levels[l - 1], smooth);
+            this->computeNormals(current, smooth, normals);
+            this->pool.ParallelFor(0, current.Vertices.size(), GRAIN, [&](size_t first, size_t last)
+            {
+                for (size_t i = first; i < last; i++)
+                {
+                    current.Vertices[i].Position = smooth[i] + this->frame(current, (GLuint)i, smooth, normals) * current.Displacements[i];
+                    // orientation of the normal computed by the mesh (see Mesh::VertexNormal)
+                    current.Vertices[i].Normal = normals[i];
+                }
+            });
+            current.Dirty = current.MeshNormals = false;
+        }
+    }
+
+    // the mesh data are replaced by a copy of the current level (with its normals, when they are the ones of the mesh)
+    void load(Mesh& mesh) const
+    {
+        const MultiresLevel& current = this->levels[this->level];
+        vector<Vertex> vertices = current.Vertices;
+        vector<GLuint> indices = current.Indices;
+        vector<GLuint> neighbours = current.Neighbours;
+        mesh.ReplaceTopology(vertices, indices, neighbours, !current.MeshNormals);
+    }
+
+    // neighbours of a level: its vertices are already welded, so each vertex is a different position
+    void buildNeighbours(MultiresLevel& level) const
+    {
+        vector<GLuint> identity(level.Vertices.size());
+        for (GLuint i = 0; i < identity.size(); i++)
+            identity[i] = i;
+
+        BuildNeighbours(level.Vertices, level.Indices, level.Neighbours, identity, (GLuint)identity.size(), this->pool);
+    }
+
+    // edges of a level (sorted by their vertices), and the edge of each corner c of the faces (side from the vertex of the corner to the next one)
+    // the sides are sorted by their vertices, so no hash map of the edges is needed (like the welding, see adjacency.h)
+    void buildEdges(MultiresLevel& level, vector<GLuint>& cornerEdges) const
+    {
+        // sides (a, b, opposite vertex, corner) with a < b
+        size_t corners = level.Indices.size() / 3 * 3;
+        vector<glm::uvec4> sides(corners);
+        this->pool.ParallelFor(0, corners, 65536, [&](size_t first, size_t last)
+        {
+            for (size_t c = first; c < last; c++)
+            {
+                size_t face = c - c % 3;
+                GLuint a = level.Indices[c], b = level.Indices[face + (c + 1) % 3];
+                sides[c] = glm::uvec4(min(a, b), max(a, b), level.Indices[face + (c + 2) % 3], (GLuint)c);
+            }
+        });
+        this->pool.ParallelSort(sides.begin(), sides.end(), [](const glm::uvec4& a, const glm::uvec4& b)
+        {
+            if (a.x != b.x) return a.x < b.x;
+            if (a.y != b.y) return a.y < b.y;
+            return a.w < b.w;
+        });
+
+        // the sides of an edge are contiguous: two sides give the two opposite vertices, one side or more than two is a crease
+        level.Edges.clear();
+        cornerEdges.resize(corners);
+        for (size_t s = 0; s < sides.size();)
+        {
+            size_t next = s + 1;
+            while (next < sides.size() && sides[next].x == sides[s].x && sides[next].y == sides[s].y)
+                next++;
+
+            GLuint opposite = next - s == 2 ? sides[s + 1].z : (GLuint)NO_VERTEX;
+            for (size_t k = s; k < next; k++)
+                cornerEdges[sides[k].w] = (GLuint)level.Edges.size();
+            level.Edges.push_back(glm::uvec4(sides[s].x, sides[s].y, sides[s].z, opposite));
+            s = next;
+        }
+    }
+
+    // positions of the vertices of the next level (old vertices, then a vertex for each edge) with the Loop rules
+    void subdividePositions(const MultiresLevel& coarse, vector<glm::vec3>& positions) const
+    {
+        size_t vertices = coarse.Vertices.size();
+        positions.resize(vertices + coarse.Edges.size());
+
+        // sums of the neighbours of each old vertex, and of its crease neighbours
+        vector<glm::vec3> ring(vertices, glm::vec3(0.0f)), creaseRing(vertices, glm::vec3(0.0f));
+        vector<GLuint> valence(vertices, 0), creaseValence(vertices, 0);
+        for (size_t e = 0; e < coarse.Edges.size(); e++)
+        {
+            GLuint a = coarse.Edges[e].x, b = coarse.Edges[e].y;
+            glm::vec3 pa = coarse.Vertices[a].Position, pb = coarse.Vertices[b].Position;
+            ring[a] += pb;
+            ring[b] += pa;
+            valence[a]++;
+            valence[b]++;
+            if (coarse.Edges[e].w == NO_VERTEX)
+            {
+                creaseRing[a] += pb;
+                creaseRing[b] += pa;
+                creaseValence[a]++;
+                creaseValence[b]++;
+            }
+        }
+
+        this->pool.ParallelFor(0, vertices, GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                glm::vec3 p = coarse.Vertices[i].Position;
+                if (creaseValence[i] == 0 && valence[i] > 0)
+                {
+                    float n = (float)valence[i];
+                    float beta = valence[i] == 3 ? 3.0f / 16.0f : 3.0f / (8.0f * n);
+                    positions[i] = p * (1.0f - n * beta) + ring[i] * beta;
+                }
+                else if (creaseValence[i] == 2)
+                    positions[i] = p * 0.75f + creaseRing[i] * 0.125f;
+                else
+                    positions[i] = p;
+            }
+        });
+
+        this->pool.ParallelFor(0, coarse.Edges.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t e = first; e < last; e++)
+            {
+                const glm::uvec4& edge = coarse.Edges[e];
+                glm::vec3 ab = coarse.Vertices[edge.x].Position + coarse.Vertices[edge.y].Position;
+                if (edge.w == NO_VERTEX)
+                    positions[vertices + e] = ab * 0.5f;
+                else
+                    positions[vertices + e] = ab * 0.375f + (coarse.Vertices[edge.z].Position + coarse.Vertices[edge.w].Position) * 0.125f;
+            }
+        });
+    }
+
+    // normals of the faces of a level with other positions (the subdivided ones), summed on their vertices
+    // (not normalized face normals: the larger faces weigh more)
+    void computeNormals(const MultiresLevel& level, const vector<glm::vec3>& positions, vector<glm::vec3>& normals) const
+    {
+        normals.assign(positions.size(), glm::vec3(0.0f));
+        for (size_t f = 0; f + 2 < level.Indices.size(); f += 3)
+        {
+            GLuint a = level.Indices[f], b = level.Indices[f + 1], c = level.Indices[f + 2];
+            glm::vec3 normal = glm::cross(positions[b] - positions[a], positions[c] - positions[a]);
+            normals[a] += normal;
+            normals[b] += normal;
+            normals[c] += normal;
+        }
+
+        this->pool.ParallelFor(0, normals.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                float length = glm::length(normals[i]);
+                normals[i] = length > 0.0f ? normals[i] / length : glm::vec3(0.0f, 0.0f, 1.0f);
+            }
+        });
+    }
+
+    // local frame of a vertex for its displacement (see N.B. 1): columns tangent, bitangent, normal
+    // the tangent goes towards the first neighbour of the vertex, projected on the plane of the normal
+    glm::mat3 frame(const MultiresLevel& level, GLuint vertex, const vector<glm::vec3>& positions, const vector<glm::vec3>& normals) const
+    {
+        glm::vec3 normal = normals[vertex];
+        glm::vec3 tangent = glm::vec3(0.0f);
+        const Vertex& v = level.Vertices[vertex];
+        if (v.NeighboursNumber > 0)
+        {
+            glm::vec3 edge = positions[level.Neighbours[v.NeighboursIndex]] - positions[vertex];
+            tangent = edge - normal * glm::dot(edge, normal);
+        }
+        // degenerate edge: any direction orthogonal to the normal
+        if (glm::dot(tangent, tangent) <= 1e-20f)
+            tangent = glm::cross(normal, abs(normal.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f));
+        tangent = glm::normalize(tangent);
+
+        return glm::mat3(tangent, glm::cross(normal, tangent), normal);
+    }
+};
@@ -0,0 +1,223 @@
+/*
+PNG writer
+- 8 bits RGB or RGBA images (e.g. the frames of the headless mode, see headless.h), with the rows from the top to the bottom
+- the image data are compressed by deflate with the fixed Huffman codes: the matches are searched only at the previous pixel and
+  at the same pixel of the previous row, which are the repetitions of a rendered frame (background, flat shading)
+
+N.B. 1) the filter of each row is "none": the matches with the previous row do the work of the "up" filter
+
+N.B. 2) deflate format: https://www.rfc-editor.org/rfc/rfc1951, PNG format: https://www.w3.org/TR/png/
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// window of the deflate matches, and maximum length of a match
+static const size_t PNG_MAX_DISTANCE = 32768;
+static const size_t PNG_MAX_MATCH = 258;
+
+// base lengths and base distances of the deflate codes, with their extra bits
+static const uint16_t PNG_LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const uint8_t PNG_LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const uint16_t PNG_DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const uint8_t PNG_DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+// stream of bits of deflate (the first bit is the lowest one of each byte)
+struct PngBitStream
+{
+    vector<uint8_t>& Data;
+    uint32_t Buffer;
+    int Count;
+};
+
+inline void pngWriteBits(PngBitStream& stream, uint32_t value, int bits)
+{
+    stream.Buffer |= value << stream.Count;
+    stream.Count += bits;
+    while (stream.Count >= 8)
+    {
+        stream.Data.push_back((uint8_t)(stream.Buffer & 0xFF));
+        stream.Buffer >>= 8;
+        stream.Count -= 8;
+    }
+}
+
+// the Huffman codes are written from their highest bit
+inline void pngWriteCode(PngBitStream& stream, uint32_t code, int bits)
+{
+    uint32_t reversed = 0;
+    for (int b = 0; b < bits; b++)
+        reversed |= ((code >> b) & 1) << (bits - 1 - b);
+    pngWriteBits(stream, reversed, bits);
+}
+
+// fixed Huffman code of a literal / length symbol (0..287)
+inline void pngWriteSymbol(PngBitStream& stream, uint32_t symbol)
+{
+    if (symbol < 144)
+        pngWriteCode(stream, 0x30 + symbol, 8);
+    else if (symbol < 256)
+        pngWriteCode(stream, 0x190 + symbol - 144, 9);
+    else if (symbol < 280)
+        pngWriteCode(stream, symbol - 256, 7);
+    else
+        pngWriteCode(stream, 0xC0 + symbol - 280, 8);
+}
+
+inline void pngWriteMatch(PngBitStream& stream, size_t length, size_t distance)
+{
+    int code = 28;
+    while (PNG_LENGTH_BASE[code] > length)
+        code--;
+    pngWriteSymbol(stream, 257 + code);
+    pngWriteBits(stream, (uint32_t)(length - PNG_LENGTH_BASE[code]), PNG_LENGTH_EXTRA[code]);
+
+    code = 29;
+    while (PNG_DISTANCE_BASE[code] > distance)
+        code--;
+    pngWriteCode(stream, code, 5);
+    pngWriteBits(stream, (uint32_t)(distance - PNG_DISTANCE_BASE[code]), PNG_DISTANCE_EXTRA[code]);
+}
+
+// length of the match at distance back from position i
+inline size_t pngMatchLength(const uint8_t* src, size_t size, size_t i, size_t distance)
+{
+    if (distance == 0 || distance > i || distance > PNG_MAX_DISTANCE)
+        return 0;
+
+    size_t length = 0;
+    while (i + length < size && length < PNG_MAX_MATCH && src[i + length] == src[i + length - distance])
+        length++;
+    return length;
+}
+
+inline uint32_t pngAdler32(const uint8_t* data, size_t size)
+{
+    uint32_t a = 1, b = 0;
+    while (size > 0)
+    {
+        // (no overflow of b before the modulo)
+        size_t block = size < 5552 ? size : 5552;
+        for (size_t i = 0; i < block; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (b << 16) | a;
+}
+
+inline uint32_t pngCRC32(const uint8_t* data, size_t size, uint32_t crc = 0)
+{
+    static uint32_t table[256] = { 0 };
+    if (table[1] == 0)
+    {
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+// zlib stream of the data (a single deflate block with the fixed codes): the matches are tried at the two distances
+inline void pngDeflate(const uint8_t* src, size_t size, size_t pixelDistance, size_t rowDistance, vector<uint8_t>& dst)
+{
+    // zlib header (deflate, 32K window, no dictionary)
+    dst.push_back(0x78);
+    dst.push_back(0x01);
+
+    PngBitStream stream = { dst, 0, 0 };
+    // last block, fixed Huffman codes
+    pngWriteBits(stream, 1, 1);
+    pngWriteBits(stream, 1, 2);
+
+    for (size_t i = 0; i < size;)
+    {
+        size_t pixelMatch = pngMatchLength(src, size, i, pixelDistance);
+        size_t rowMatch = pngMatchLength(src, size, i, rowDistance);
+        size_t length = max(pixelMatch, rowMatch);
+        if (length >= 3)
+        {
+            pngWriteMatch(stream, length, rowMatch > pixelMatch ? rowDistance : pixelDistance);
+            i += length;
+        }
+        else
+            pngWriteSymbol(stream, src[i++]);
+    }
+    pngWriteSymbol(stream, 256);
+    if (stream.Count > 0)
+        pngWriteBits(stream, 0, 8 - stream.Count);
+
+    uint32_t adler = pngAdler32(src, size);
+    for (int b = 3; b >= 0; b--)
+        dst.push_back((uint8_t)(adler >> (8 * b)));
+}
+
+inline void pngWriteUint32(vector<uint8_t>& dst, uint32_t value)
+{
+    for (int b = 3; b >= 0; b--)
+        dst.push_back((uint8_t)(value >> (8 * b)));
+}
+
+// chunk: length, type, data and CRC of type and data
+inline void pngWriteChunk(vector<uint8_t>& dst, const char* type, const vector<uint8_t>& data)
+{
+    pngWriteUint32(dst, (uint32_t)data.size());
+    size_t start = dst.size();
+    dst.insert(dst.end(), type, type + 4);
+    dst.insert(dst.end(), data.begin(), data.end());
+    pngWriteUint32(dst, pngCRC32(&dst[start], dst.size() - start));
+}
+
+// the image (channels = 3 -> RGB, 4 -> RGBA) is saved in the file, it returns false if the file cannot be written
+inline bool WritePNG(const string& path, uint32_t width, uint32_t height, uint32_t channels, const uint8_t* pixels)
+{
+    // rows with the filter byte (N.B. 1)
+    size_t rowSize = (size_t)width * channels + 1;
+    vector<uint8_t> rows(rowSize * height, 0);
+    for (uint32_t y = 0; y < height; y++)
+        memcpy(&rows[y * rowSize + 1], pixels + (size_t)y * width * channels, rowSize - 1);
+
+    vector<uint8_t> header;
+    pngWriteUint32(header, width);
+    pngWriteUint32(header, height);
+    // bit depth, color type (2 -> RGB, 6 -> RGBA), compression, filter and interlace methods
+    const uint8_t format[] = { 8, (uint8_t)(channels == 4 ? 6 : 2), 0, 0, 0 };
+    header.insert(header.end(), format, format + 5);
+
+    vector<uint8_t> data;
+    pngDeflate(rows.empty() ? nullptr : &rows[0], rows.size(), channels, rowSize, data);
+
+    const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    vector<uint8_t> file(signature, signature + 8);
+    pngWriteChunk(file, "IHDR", header);
+    pngWriteChunk(file, "IDAT", data);
+    pngWriteChunk(file, "IEND", vector<uint8_t>());
+
+    ofstream output(path.c_str(), ios::binary | ios::trunc);
+    output.write((const char*)&file[0], file.size());
+    return (bool)output;
+}
@@ -0,0 +1,365 @@
+/*
+Profiler class
+- timings of the stages of the frame: CPU time of each stage (ProfileScope, from its creation to the end of its block) and GPU time of
+  the passes (intersection, brush, rendering, gui), measured by GL_TIME_ELAPSED queries
+- the queries of a frame are read QUERY_FRAMES frames later, when the GPU has completed them: the results are not waited during the frames,
+  a query which is not completed yet when its slot is used again is dropped (see DroppedQueries), and the GPU sample of its stage in that frame is missing
+  (it is skipped by History and Average, instead of counting as 0 ms). Finish waits for the queries still pending (e.g. before ExportTrace at the exit)
+- the samples of each stage (milliseconds per frame) are kept for the last HISTORY_FRAMES frames (rolling graphs of the gui),
+  and the timed scopes are recorded as a trace exported in the trace event format of Chrome (chrome://tracing, Perfetto)
+
+N.B. 1) the GL_TIME_ELAPSED queries cannot be nested: a GPU scope inside another one is timed only on the CPU
+
+N.B. 2) a GPU query measures a duration, so in the trace the GPU scopes are placed at the time of their submission by the CPU (on the GPU track)
+
+N.B. 3) nothing is timed or recorded while the profiler is not enabled (the scopes only check the flag)
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <deque>
+#include <string>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+/////////////////// PROFILER class ///////////////////////
+class Profiler
+{
+public:
+    // latency (in frames) of the readback of the GPU queries
+    static constexpr GLuint QUERY_FRAMES = 4;
+    // frames of the rolling samples
+    static constexpr GLuint HISTORY_FRAMES = 240;
+    // maximum number of events of the trace (the oldest ones are dropped)
+    static constexpr size_t MAX_TRACE_EVENTS = 262144;
+
+    // the stages are timed only when the profiler is enabled (see N.B. 3)
+    bool Enabled;
+
+    //////////////////////////////////////////
+
+    // constructor (the query objects are created when they are needed, while the OpenGL context exists)
+    Profiler()
+        : Enabled(false), frame(0), completed(0), gpuActive(false), droppedQueries(0), start(chrono::steady_clock::now())
+    {
+    }
+
+    //////////////////////////////////////////
+
+    // start of a frame: the queries of QUERY_FRAMES frames ago are read, and the samples of the new frame are cleared
+    void BeginFrame()
+    {
+        this->frame++;
+        this->readQueries(this->slots[this->frame % QUERY_FRAMES]);
+
+        if (this->frame > QUERY_FRAMES)
+            this->completed = max(this->completed, this->frame - QUERY_FRAMES);
+
+        GLuint sample = this->frame % HISTORY_FRAMES;
+        for (size_t s = 0; s < this->stages.size(); s++)
+        {
+            this->stages[s].CpuSamples[sample] = this->stages[s].GpuSamples[sample] = 0.0f;
+            this->stages[s].GpuMissing[sample] = false;
+        }
+    }
+
+    // the queries still pending are read waiting for their results: all the frames are completed
+    void Finish()
+    {
+        for (GLuint s = 1; s <= QUERY_FRAMES; s++)
+            this->readQueries(this->slots[(this->frame + s) % QUERY_FRAMES], true);
+        this->completed = this->frame;
+    }
+
+    // index of the stage with the name (created at its first use)
+    GLuint Stage(const char* name)
+    {
+        map<string, GLuint>::iterator stage = this->stageIndices.find(name);
+        if (stage != this->stageIndices.end())
+            return stage->second;
+
+        ProfilerStage newStage = { name, false, vector<float>(HISTORY_FRAMES, 0.0f), vector<float>(HISTORY_FRAMES, 0.0f), vector<bool>(HISTORY_FRAMES, false) };
+        this->stages.push_back(newStage);
+        this->stageIndices[name] = (GLuint)this->stages.size() - 1;
+        return (GLuint)this->stages.size() - 1;
+    }
+
+    // microseconds from the creation of the profiler
+    double Now() const
+    {
+        return chrono::duration<double, micro>(chrono::steady_clock::now() - this->start).count();
+    }
+
+    // GPU time of the commands until EndGPU (started is the CPU time of the submission), false if another GPU scope is active (see N.B. 1)
+    bool BeginGPU(GLuint stage, double started)
+    {
+        if (this->gpuActive)
+            return false;
+
+        QuerySlot& slot = this->slots[this->frame % QUERY_FRAMES];
+        if (slot.Pending.size() == slot.Queries.size())
+        {
+            GLuint query;
+            glGenQueries(1, &query);
+            slot.Queries.push_back(query);
+        }
+        PendingQuery pending = { stage, this->frame, started };
+        slot.Pending.push_back(pending);
+        this->stages[stage].Gpu = true;
+
+        glBeginQuery(GL_TIME_ELAPSED, slot.Queries[slot.Pending.size() - 1]);
+        this->gpuActive = true;
+        return true;
+    }
+
+    void EndGPU()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        this->gpuActive = false;
+    }
+
+    // CPU time of a scope of the stage
+    void AddCpuSample(GLuint stage, double started, double ended)
+    {
+        this->stages[stage].CpuSamples[this->frame % HISTORY_FRAMES] += (float)((ended - started) / 1000.0);
+        this->addEvent(stage, false, started, ended - started);
+    }
+
+    //////////////////////////////////////////
+
+    GLuint Stages() const
+    {
+        return (GLuint)this->stages.size();
+    }
+
+    const string& StageName(GLuint stage) const
+    {
+        return this->stages[stage].Name;
+    }
+
+    // the stage has GPU samples
+    bool StageGPU(GLuint stage) const
+    {
+        return this->stages[stage].Gpu;
+    }
+
+    // samples (milliseconds per frame) of the completed frames, from the oldest to the most recent one (without the missing GPU samples)
+    void History(GLuint stage, bool gpu, vector<float>& values) const
+    {
+        values.clear();
+        if (this->completed == 0)
+            return;
+
+        const ProfilerStage& profiled = this->stages[stage];
+        const vector<float>& samples = gpu ? profiled.GpuSamples : profiled.CpuSamples;
+        GLuint64 last = this->completed;
+        // (the oldest QUERY_FRAMES samples of the history are the ones of the frames still pending)
+        GLuint64 count = min<GLuint64>(last, HISTORY_FRAMES - QUERY_FRAMES);
+        for (GLuint64 f = last - count + 1; f <= last; f++)
+        {
+            if (!gpu || !profiled.GpuMissing[f % HISTORY_FRAMES])
+                values.push_back(samples[f % HISTORY_FRAMES]);
+        }
+    }
+
+    // mean of the samples of the completed frames
+    float Average(GLuint stage, bool gpu) const
+    {
+        vector<float> values;
+        this->History(stage, gpu, values);
+        float sum = 0.0f;
+        for (size_t i = 0; i < values.size(); i++)
+            sum += values[i];
+        return values.empty() ? 0.0f : sum / values.size();
+    }
+
+    // GPU queries not completed after QUERY_FRAMES frames (missing samples)
+    GLuint64 DroppedQueries() const
+    {
+        return this->droppedQueries;
+    }
+
+    size_t TraceEvents() const
+    {
+        return this->trace.size();
+    }
+
+    // the recorded events are saved in the trace event format (complete events, one track for the CPU and one for the GPU),
+    // it returns false if the file cannot be written
+    bool ExportTrace(const string& path) const
+    {
+        ofstream file(path.c_str(), ios::trunc);
+        if (!file)
+        {
+            cout << "WARNING::PROFILER:: CANNOT WRITE " << path << endl;
+            return false;
+        }
+
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}}," << endl;
+        file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}";
+        file.setf(ios::fixed);
+        file.precision(3);
+        for (deque<TraceEvent>::const_iterator event = this->trace.begin(); event != this->trace.end(); event++)
+        {
+            file << "," << endl << "{\"name\":\"" << escape(this->stages[event->Stage].Name) << "\",\"cat\":\"" << (event->Gpu ? "gpu" : "cpu")
+                 << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << (event->Gpu ? 2 : 1) << ",\"ts\":" << event->Start << ",\"dur\":" << event->Duration << "}";
+        }
+        file << endl << "]}" << endl;
+        return (bool)file;
+    }
+
+    // the query objects are deleted (the trace is kept)
+    void Delete()
+    {
+        for (GLuint s = 0; s < QUERY_FRAMES; s++)
+        {
+            if (!this->slots[s].Queries.empty())
+                glDeleteQueries((GLsizei)this->slots[s].Queries.size(), &this->slots[s].Queries[0]);
+            this->slots[s].Queries.clear();
+            this->slots[s].Pending.clear();
+        }
+    }
+
+private:
+    // name of the stage, and its samples (milliseconds per frame) indexed by frame % HISTORY_FRAMES
+    // (GpuMissing: a query of the stage in the frame has been dropped)
+    struct ProfilerStage
+    {
+        string Name;
+        bool Gpu;
+        vector<float> CpuSamples;
+        vector<float> GpuSamples;
+        vector<bool> GpuMissing;
+    };
+
+    // GPU scope of a frame, waiting for the result of its query
+    struct PendingQuery
+    {
+        GLuint Stage;
+        GLuint64 Frame;
+        double Start;
+    };
+
+    // queries of a frame (reused every QUERY_FRAMES frames)
+    struct QuerySlot
+    {
+        vector<GLuint> Queries;
+        vector<PendingQuery> Pending;
+    };
+
+    // scope of the trace (in microseconds)
+    struct TraceEvent
+    {
+        GLuint Stage;
+        bool Gpu;
+        double Start;
+        double Duration;
+    };
+
+    vector<ProfilerStage> stages;
+    map<string, GLuint> stageIndices;
+
+    QuerySlot slots[QUERY_FRAMES];
+    // current frame, and last frame whose queries have been read
+    GLuint64 frame, completed;
+    bool gpuActive;
+    GLuint64 droppedQueries;
+
+    deque<TraceEvent> trace;
+    chrono::steady_clock::time_point start;
+
+    //////////////////////////////////////////
+
+    static string escape(const string& name)
+    {
+        string escaped;
+        for (size_t i = 0; i < name.size(); i++)
+        {
+            if (name[i] == '"' || name[i] == '\\')
+                escaped += '\\';
+            escaped += name[i];
+        }
+        return escaped;
+    }
+
+    void addEvent(GLuint stage, bool gpu, double started, double duration)
+    {
+        TraceEvent event = { stage, gpu, started, duration };
+        this->trace.push_back(event);
+        if (this->trace.size() > MAX_TRACE_EVENTS)
+            this->trace.pop_front();
+    }
+
+    // the completed queries of the slot are read (without waiting, unless wait is true), then the slot is free for the current frame
+    void readQueries(QuerySlot& slot, bool wait = false)
+    {
+        for (size_t q = 0; q < slot.Pending.size(); q++)
+        {
+            const PendingQuery& pending = slot.Pending[q];
+            GLint available = 0;
+            if (!wait)
+                glGetQueryObjectiv(slot.Queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!wait && !available)
+            {
+                this->droppedQueries++;
+                this->stages[pending.Stage].GpuMissing[pending.Frame % HISTORY_FRAMES] = true;
+                continue;
+            }
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(slot.Queries[q], GL_QUERY_RESULT, &elapsed);
+            // (the samples of the frame are still in the history, HISTORY_FRAMES > QUERY_FRAMES)
+            this->stages[pending.Stage].GpuSamples[pending.Frame % HISTORY_FRAMES] += (float)(elapsed / 1000000.0);
+            this->addEvent(pending.Stage, true, pending.Start, elapsed / 1000.0);
+        }
+        slot.Pending.clear();
+    }
+};
+
+/////////////////// PROFILESCOPE class ///////////////////////
+// timer of a stage, from its creation to the end of its block: CPU time, and GPU time of the commands submitted inside it when gpu is true
+class ProfileScope
+{
+public:
+    ProfileScope(Profiler& profiler, const char* name, bool gpu = false)
+        : profiler(profiler), active(profiler.Enabled), gpu(false), stage(0), start(0.0)
+    {
+        if (!this->active)
+            return;
+
+        this->stage = profiler.Stage(name);
+        this->start = profiler.Now();
+        if (gpu)
+            this->gpu = profiler.BeginGPU(this->stage, this->start);
+    }
+
+    ~ProfileScope()
+    {
+        if (!this->active)
+            return;
+
+        if (this->gpu)
+            this->profiler.EndGPU();
+        this->profiler.AddCpuSample(this->stage, this->start, this->profiler.Now());
+    }
+
+    // the scope is timed once
+    ProfileScope(const ProfileScope& copy) = delete;
+    ProfileScope& operator=(const ProfileScope& copy) = delete;
+
+private:
+    Profiler& profiler;
+    bool active, gpu;
+    GLuint stage;
+    double start;
+};
@@ -0,0 +1,150 @@
+/*
+Ray casting functions
+- CPU version of the ray-triangle intersection test of ShaderIntersection.comp
+- conversion of the camera ray in model coordinates
+- brute force closest hit on the thread pool, with the same deterministic (distance, triangle) reduction of the GPU
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+// we use GLM data structures for rays and triangles
+#include <glm/glm.hpp>
+
+// Std. Includes
+#include <cstring>
+#include <mutex>
+
+#include <usculpt/mesh.h>
+#include <usculpt/camera.h>
+#include <usculpt/threadpool.h>
+
+// the camera ray is brought in model coordinates, instead of moving the whole mesh in world coordinates
+inline Ray3 ModelRay(const Ray3& ray, const glm::mat4& invModelMatrix)
+{
+    Ray3 modelRay;
+    modelRay.origin = glm::vec3(invModelMatrix * glm::vec4(ray.origin, 1.0f));
+    modelRay.direction = glm::vec3(invModelMatrix * glm::vec4(ray.direction, 0.0f));
+
+    return modelRay;
+}
+
+// ray-triangle intersection test
+// Möller–Trumbore intersection algorithm (from "Fast, Minimum Storage Ray/Triangle Intersection" paper by Tomas Möller and Ben Trumbore)
+// same tests (and culling of back faces) of ShaderIntersection.comp: if the triangle is hit, t is the distance on the ray from its origin
+inline bool RayTriangleIntersection(const Ray3& ray, glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, float& t)
+{
+    // small value for numerical stability in directions test
+    const float epsilon = 0.0000001f;
+
+    // triangle edges
+    glm::vec3 e1 = v1 - v0;
+    glm::vec3 e2 = v2 - v0;
+
+    // directions test (culling test): the ray must hit the front of the triangle
+    glm::vec3 triangleNormal = glm::normalize(glm::cross(e1, e2));
+    if (glm::dot(ray.direction, triangleNormal) > epsilon)
+        return false;
+
+    // determinant calculation: if it is near zero the ray is on the plane of the triangle
+    glm::vec3 h = glm::cross(ray.direction, e2);
+    float a = glm::dot(e1, h);
+    if (a > -epsilon && a < epsilon)
+        return false;
+
+    // barycentric coordinates tests
+    float f = 1.0f / a;
+    glm::vec3 s = ray.origin - v0;
+    float u = f * glm::dot(s, h);
+    if (u < 0.0f || u > 1.0f)
+        return false;
+
+    glm::vec3 q = glm::cross(s, e1);
+    float v = f * glm::dot(ray.direction, q);
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+
+    t = f * glm::dot(e2, q);
+    return t > epsilon;
+}
+
+// intersection data of the triangle with first index = triangle * 3, hit at distance t on the ray
+inline Intersection TriangleIntersection(const Ray3& ray, const Mesh& mesh, GLuint triangle, float t)
+{
+    GLuint idv0 = mesh.indices[triangle * 3];
+    GLuint idv1 = mesh.indices[triangle * 3 + 1];
+    GLuint idv2 = mesh.indices[triangle * 3 + 2];
+    glm::vec3 v0 = mesh.vertices[idv0].Position;
+    glm::vec3 v1 = mesh.vertices[idv1].Position;
+    glm::vec3 v2 = mesh.vertices[idv2].Position;
+
+    Intersection inter;
+    inter.Position = ray.origin + ray.direction * t;
+    inter.Normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+    inter.hit = true;
+    inter.idxv0 = idv0;
+    inter.idxv1 = idv1;
+    inter.idxv2 = idv2;
+
+    return inter;
+}
+
+// intersection data when the ray does not hit the mesh
+inline Intersection NoIntersection()
+{
+    Intersection inter = {glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 0.0f), false, (GLuint)-1, (GLuint)-1, (GLuint)-1};
+    return inter;
+}
+
+// key of a hit for the closest hit reduction: distance bits in the high word, triangle in the low word
+// the distance is positive, so the order of its bits is the order of the floats: the minimum key is the closest hit,
+// and between hits at the same distance the lowest triangle wins (the same result of ShaderIntersection.comp, on every run)
+inline unsigned long long HitKey(float t, GLuint triangle)
+{
+    GLuint bits;
+    memcpy(&bits, &t, sizeof(GLuint));
+    return ((unsigned long long)bits << 32) | triangle;
+}
+
+// brute force closest hit of the ray on every triangle of the mesh: each chunk of triangles keeps its own closest hit,
+// then the chunks minima are reduced under a lock (the minimum does not depend on the order of the chunks)
+inline bool ClosestHit(const Mesh& mesh, const Ray3& ray, float& t, GLuint& triangle, ThreadPool& pool = ThreadPool::Instance())
+{
+    const unsigned long long noHit = ~0ull;
+    unsigned long long closest = noHit;
+    mutex closestLock;
+
+    pool.ParallelFor(0, mesh.indices.size() / 3, 4096, [&](size_t first, size_t last)
+    {
+        unsigned long long chunkClosest = noHit;
+        for (size_t i = first; i < last; i++)
+        {
+            float hitT;
+            if (RayTriangleIntersection(ray, mesh.vertices[mesh.indices[i * 3]].Position, mesh.vertices[mesh.indices[i * 3 + 1]].Position, mesh.vertices[mesh.indices[i * 3 + 2]].Position, hitT))
+                chunkClosest = min(chunkClosest, HitKey(hitT, (GLuint)i));
+        }
+
+        lock_guard<mutex> lock(closestLock);
+        closest = min(closest, chunkClosest);
+    });
+
+    if (closest == noHit)
+        return false;
+
+    GLuint bits = (GLuint)(closest >> 32);
+    memcpy(&t, &bits, sizeof(float));
+    triangle = (GLuint)(closest & 0xFFFFFFFFu);
+    return true;
+}
+
+// intersection data of the closest hit of the ray on the mesh (brute force)
+inline Intersection ClosestIntersection(const Mesh& mesh, const Ray3& ray, ThreadPool& pool = ThreadPool::Instance())
+{
+    float t;
+    GLuint triangle;
+    if (!ClosestHit(mesh, ray, t, triangle, pool))
+        return NoIntersection();
+
+    return TriangleIntersection(ray, mesh, triangle, t);
+}
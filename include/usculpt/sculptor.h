@@ -0,0 +1,707 @@
+/*
+Sculptor class
+- CPU implementation of the brushing operations of ShaderBrush.comp, working directly on Mesh::vertices and Mesh::neighbours
+- it is the reference for the GPU kernels, and it makes it possible to sculpt without an OpenGL context (tests, batch processing, build machines without GPU)
+
+N.B. 1) the brushing is split in two passes, like two compute dispatches separated by a memory barrier:
+the displacement of the positions, then the update of the normals, which reads only the final positions
+
+N.B. 2) only the vertices inside the brush radius are displaced, and only the normals of the moved vertices and of their neighbours (dirty vertices) are updated:
+the faces around the dirty vertices are computed once (normal and corner angles, see Mesh::ComputeFaceNormal), then summed on the dirty vertices.
+The cost of a dab depends on the brush footprint (when the vertices inside the brush are found by a SpatialGrid), not on the size of the mesh
+
+N.B. 3) both passes are distributed on the shared ThreadPool; the Gaussian falloff is evaluated with SSE (4 vertices) or AVX2 (8 vertices) instructions when available.
+exp() is evaluated with the same polynomial approximation in the SIMD and in the scalar code, so the result of a vertex does not depend on how the vertices are split among threads
+
+N.B. 4) the dabs placed in one frame are brushed in a single pass (BrushDab records, like the dabs buffer of the batched brushing shader):
+each tile of vertices applies only the dabs touching its bounding sphere, so many close dabs cost little more than one
+
+N.B. 5) the brush and the falloff (see brushes.h) are chosen by SetBrush: the displacement kernel of the couple is a template instance, selected once
+(a function pointer called for each chunk of vertices), so the loop on the vertices has no branches on the brush.
+The draw brush with the gaussian falloff is the Gaussian brush of N.B. 3), with the SIMD kernel
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+#include <usculpt/brushes.h>
+#include <usculpt/threadpool.h>
+
+// SIMD intrinsics
+#if defined(__AVX2__)
+    #include <immintrin.h>
+    #define USCULPT_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define USCULPT_SSE2
+#endif
+
+/////////////////// SCULPTOR class ///////////////////////
+class Sculptor
+{
+public:
+    // vertices processed by each task of the thread pool
+    static const size_t GRAIN = 4096;
+    // vertices of a tile of the batched brushing, with a bounding sphere to cull the dabs (same of a workgroup of ShaderBrush.comp)
+    static const size_t TILE = 128;
+
+    //////////////////////////////////////////
+
+    // displacement kernel of a brush with a falloff on the vertices ids[0 .. count), with the targets of the brushes reading the rings (see brushes.h)
+    typedef void (*BrushKernelFunction)(vector<Vertex>& vertices, const GLuint* ids, size_t count, const BrushDab& dab, const vector<glm::vec3>& targets, vector<GLuint>& moved);
+
+    //////////////////////////////////////////
+
+    // constructor
+    Sculptor(ThreadPool& pool = ThreadPool::Instance())
+        : pool(pool), stamp(0)
+    {
+        this->SetBrush(DRAW_BRUSH, GAUSSIAN_FALLOFF);
+    }
+
+    //////////////////////////////////////////
+
+    // brush and falloff of the next dabs (the draw brush with the gaussian falloff by default)
+    void SetBrush(BrushType brush, FalloffType falloff)
+    {
+        this->brush = brush;
+        this->falloff = falloff;
+        this->kernel = selectKernel(brush, falloff);
+    }
+
+    BrushType CurrentBrush() const
+    {
+        return this->brush;
+    }
+
+    FalloffType CurrentFalloff() const
+    {
+        return this->falloff;
+    }
+
+    //////////////////////////////////////////
+
+    // Gaussian Distribution function applied to a pair of vertices with distribution height = strength and distribution "range" = radius
+    // (same of ShaderBrush.comp)
+    static float GaussianDistribution(glm::vec3 origin, glm::vec3 position, float strength, float radius)
+    {
+        float dx = (origin.x - position.x) * 4.0f / radius;
+        float dy = (origin.y - position.y) * 4.0f / radius;
+        float dz = (origin.z - position.z) * 4.0f / radius;
+        float E = ((dx * dx) + (dy * dy) + (dz * dz)) / (2.0f * BRUSH_STD_DEV * BRUSH_STD_DEV);
+
+        return BrushHeight(strength, radius) * Exp(-E);
+    }
+
+    // the vertex is moved along the normal of the intersected triangle (draw brush with the gaussian falloff, see BrushOffset in ShaderBrush.comp)
+    static glm::vec3 GaussianBrush(glm::vec3 position, const Intersection& intersection, float strength, float radius)
+    {
+        return position + intersection.Normal * GaussianDistribution(intersection.Position, position, strength, radius);
+    }
+
+    // the vertex normal is the sum of the normals of the faces around it, weighted by the angles (same of SmoothNormal in ShaderBrush.comp)
+    // N.B.) it computes again the faces shared with the other vertices: the UpdateNormals methods compute each face once (same result)
+    static glm::vec3 SmoothNormal(const vector<Vertex>& vertices, const vector<GLuint>& neighbours, glm::vec3 position, glm::vec3 normal, GLuint index, GLuint neighboursNumber)
+    {
+        glm::vec3 newNormal = glm::vec3(0.0f, 0.0f, 0.0f);
+
+        for (GLuint i = index; i + 1 < index + neighboursNumber; i += 2)
+        {
+            glm::vec3 e1 = vertices[neighbours[i]].Position - position;
+            glm::vec3 e2 = vertices[neighbours[i + 1]].Position - position;
+
+            glm::vec3 faceNormal = glm::cross(e1, e2);
+            if (glm::dot(faceNormal, normal) < 0.0f)
+                faceNormal = -faceNormal;
+
+            newNormal = newNormal + faceNormal * Mesh::CornerAngle(e1, e2);
+        }
+
+        // check orientation
+        if (glm::dot(normal, newNormal) < 0.0f)
+            newNormal = -newNormal;
+
+        return glm::normalize(newNormal);
+    }
+
+    // a vertex is touched by the brush if it is at distance <= radius from the intersection point (same test of the cull stage of ShaderBrush.comp)
+    static bool InBrush(glm::vec3 origin, glm::vec3 position, float radius)
+    {
+        return glm::distance(origin, position) <= radius;
+    }
+
+    //////////////////////////////////////////
+
+    // a single dab of the brush, testing every vertex of the mesh
+    // if moved is not null, it receives the (sorted) indices of the vertices whose position has changed
+    void Brush(Mesh& mesh, const Intersection& intersection, float strength, float radius, vector<GLuint>* moved = nullptr)
+    {
+        if (moved)
+            moved->clear();
+        if (!intersection.hit)
+            return;
+
+        this->Cull(mesh, intersection.Position, radius, this->inside);
+        this->Brush(mesh, intersection, strength, radius, this->inside, moved);
+    }
+
+    // a single dab of the brush on the vertices inside it (e.g. found by a SpatialGrid query):
+    // displacement of the vertices, then update of the normals of the moved vertices and of their neighbours
+    void Brush(Mesh& mesh, const Intersection& intersection, float strength, float radius, const vector<GLuint>& inside, vector<GLuint>* moved = nullptr)
+    {
+        vector<GLuint>& displaced = moved ? *moved : this->displaced;
+        displaced.clear();
+        if (!intersection.hit)
+            return;
+
+        this->Displace(mesh, intersection, strength, radius, inside, displaced);
+        this->UpdateNormals(mesh, displaced);
+    }
+
+    // dab record of an intersection, with the parameters of the brush and the movement of the stroke from the previous dab
+    // (the grab brush moves the vertices around the previous dab by the movement, the other brushes ignore it)
+    BrushDab Dab(const Intersection& intersection, float strength, float radius, glm::vec3 delta = glm::vec3(0.0f)) const
+    {
+        BrushDab dab = { intersection.Position, radius, intersection.Normal, strength, glm::vec3(0.0f), 0.0f };
+        if (BrushUsesDelta(this->brush))
+        {
+            dab.Position -= delta;
+            dab.Delta = delta;
+        }
+        return dab;
+    }
+
+    // the dabs placed in one frame (see StrokeEngine), in a single pass on every vertex of the mesh (same of BATCHED_BRUSH in ShaderBrush.comp)
+    void Brush(Mesh& mesh, const vector<BrushDab>& dabs, vector<GLuint>* moved = nullptr)
+    {
+        this->all.resize(mesh.vertices.size());
+        for (size_t i = 0; i < this->all.size(); i++)
+            this->all[i] = (GLuint)i;
+
+        this->Brush(mesh, dabs, this->all, moved);
+    }
+
+    // the dabs placed in one frame, in a single parallel pass on the vertices inside any of them (sorted, e.g. found by SpatialGrid queries):
+    // the vertices are split in tiles of TILE vertices, and each tile applies in order only the dabs touching its bounding sphere (see cullDabs),
+    // testing the radius on the positions moved by the previous dabs: the result is the one of the dabs applied one after the other,
+    // and the normals are updated once, at the end
+    // N.B.) the targets of the smooth brush and the normals of the inflate brush are the ones before the pass (like in the batched brushing shader),
+    // so for those brushes the result is close to the one of the dabs applied one after the other, but not the same
+    void Brush(Mesh& mesh, const vector<BrushDab>& dabs, const vector<GLuint>& inside, vector<GLuint>* moved = nullptr)
+    {
+        vector<GLuint>& displaced = moved ? *moved : this->displaced;
+        vector<Vertex>& vertices = mesh.vertices;
+        BrushKernelFunction kernel = this->kernel;
+        mutex movedLock;
+        displaced.clear();
+        if (dabs.empty())
+            return;
+
+        // maximum displacement of each dab (see cullDabs)
+        this->reaches.resize(dabs.size());
+        for (size_t d = 0; d < dabs.size(); d++)
+            this->reaches[d] = BrushReach(this->brush, dabs[d]);
+        if (BrushUsesRing(this->brush))
+            this->ringTargets(mesh, inside);
+
+        this->pool.ParallelFor(0, (inside.size() + TILE - 1) / TILE, GRAIN / TILE, [&](size_t first, size_t last)
+        {
+            vector<GLuint> tileDabs, tileInside, chunkMoved;
+            for (size_t tile = first; tile < last; tile++)
+            {
+                const GLuint* ids = &inside[tile * TILE];
+                size_t count = min((size_t)TILE, inside.size() - tile * TILE);
+
+                cullDabs(vertices, ids, count, dabs, this->reaches, tileDabs);
+                for (size_t d = 0; d < tileDabs.size(); d++)
+                {
+                    const BrushDab& dab = dabs[tileDabs[d]];
+                    tileInside.clear();
+                    for (size_t i = 0; i < count; i++)
+                    {
+                        if (InBrush(dab.Position, vertices[ids[i]].Position, dab.Radius))
+                            tileInside.push_back(ids[i]);
+                    }
+                    if (!tileInside.empty())
+                        kernel(vertices, &tileInside[0], tileInside.size(), dab, this->targets, chunkMoved);
+                }
+            }
+
+            if (!chunkMoved.empty())
+            {
+                lock_guard<mutex> lock(movedLock);
+                displaced.insert(displaced.end(), chunkMoved.begin(), chunkMoved.end());
+            }
+        });
+
+        // a vertex moved by more dabs is in the list once
+        sort(displaced.begin(), displaced.end());
+        displaced.erase(unique(displaced.begin(), displaced.end()), displaced.end());
+        this->UpdateNormals(mesh, displaced);
+    }
+
+    // sorted indices of the vertices inside the brush, testing the whole mesh
+    void Cull(const Mesh& mesh, glm::vec3 center, float radius, vector<GLuint>& inside)
+    {
+        const vector<Vertex>& vertices = mesh.vertices;
+        mutex insideLock;
+        inside.clear();
+
+        this->pool.ParallelFor(0, vertices.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            vector<GLuint> chunkInside;
+            for (size_t i = first; i < last; i++)
+            {
+                if (InBrush(center, vertices[i].Position, radius))
+                    chunkInside.push_back((GLuint)i);
+            }
+
+            if (!chunkInside.empty())
+            {
+                lock_guard<mutex> lock(insideLock);
+                inside.insert(inside.end(), chunkInside.begin(), chunkInside.end());
+            }
+        });
+
+        // the chunks are completed in any order
+        sort(inside.begin(), inside.end());
+    }
+
+    // first pass: displacement of the vertices inside the brush
+    // moved receives the (sorted) indices of the vertices whose position has changed
+    void Displace(Mesh& mesh, const Intersection& intersection, float strength, float radius, const vector<GLuint>& inside, vector<GLuint>& moved)
+    {
+        vector<Vertex>& vertices = mesh.vertices;
+        BrushKernelFunction kernel = this->kernel;
+        BrushDab dab = this->Dab(intersection, strength, radius);
+        mutex movedLock;
+        moved.clear();
+
+        if (BrushUsesRing(this->brush))
+            this->ringTargets(mesh, inside);
+
+        this->pool.ParallelFor(0, inside.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            vector<GLuint> chunkMoved;
+            kernel(vertices, &inside[first], last - first, dab, this->targets, chunkMoved);
+
+            if (!chunkMoved.empty())
+            {
+                lock_guard<mutex> lock(movedLock);
+                moved.insert(moved.end(), chunkMoved.begin(), chunkMoved.end());
+            }
+        });
+
+        sort(moved.begin(), moved.end());
+    }
+
+    // second pass: normals update from the displaced positions, for every vertex of the mesh
+    void UpdateNormals(Mesh& mesh)
+    {
+        vector<Vertex>& vertices = mesh.vertices;
+        mesh.UpdateNeighboursCorners();
+        if (mesh.neighboursCorners.empty())
+            return;
+
+        vector<FaceNormal>& faceNormals = this->faceNormals;
+        faceNormals.resize(mesh.indices.size() / 3);
+        this->pool.ParallelFor(0, faceNormals.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t f = first; f < last; f++)
+                faceNormals[f] = mesh.ComputeFaceNormal((GLuint)f);
+        });
+
+        this->pool.ParallelFor(0, vertices.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+                vertices[i].Normal = mesh.VertexNormal((GLuint)i, [&](GLuint face) -> const FaceNormal& { return faceNormals[face]; });
+        });
+    }
+
+    // second pass: normals update only for the moved vertices and their neighbours (the only normals which can change)
+    // the faces around them are computed once, even if they are shared by up to three dirty vertices
+    void UpdateNormals(Mesh& mesh, const vector<GLuint>& moved)
+    {
+        vector<Vertex>& vertices = mesh.vertices;
+        const vector<GLuint>& neighbours = mesh.neighbours;
+        mesh.UpdateNeighboursCorners();
+        const vector<GLuint>& corners = mesh.neighboursCorners;
+        if (corners.empty())
+            return;
+
+        // a vertex / face is added once to the dirty lists, when its stamp is not the one of the current update (same of MarkDirty in ShaderBrush.comp)
+        // (the stamps and the slots are as large as the mesh, but only the ones of the current dirty region are written and read)
+        this->vertexStamps.resize(vertices.size(), 0);
+        this->faceStamps.resize(mesh.indices.size() / 3, 0);
+        this->faceSlots.resize(mesh.indices.size() / 3);
+        if (++this->stamp == 0)
+        {
+            fill(this->vertexStamps.begin(), this->vertexStamps.end(), 0);
+            fill(this->faceStamps.begin(), this->faceStamps.end(), 0);
+            this->stamp = 1;
+        }
+
+        // dirty vertices
+        this->dirty.clear();
+        for (size_t i = 0; i < moved.size(); i++)
+        {
+            this->markDirty(moved[i]);
+            const Vertex& v = vertices[moved[i]];
+            for (GLuint j = v.NeighboursIndex; j < v.NeighboursIndex + v.NeighboursNumber; j++)
+                this->markDirty(neighbours[j]);
+        }
+
+        // faces around the dirty vertices, and their position in faceNormals
+        this->dirtyFaces.clear();
+        for (size_t i = 0; i < this->dirty.size(); i++)
+        {
+            const Vertex& v = vertices[this->dirty[i]];
+            for (GLuint k = v.NeighboursIndex / 2; k < (v.NeighboursIndex + v.NeighboursNumber) / 2; k++)
+            {
+                GLuint face = corners[k] / 3;
+                if (corners[k] != (GLuint)-1 && this->faceStamps[face] != this->stamp)
+                {
+                    this->faceStamps[face] = this->stamp;
+                    this->faceSlots[face] = (GLuint)this->dirtyFaces.size();
+                    this->dirtyFaces.push_back(face);
+                }
+            }
+        }
+
+        this->faceNormals.resize(this->dirtyFaces.size());
+        const vector<GLuint>& dirty = this->dirty;
+        const vector<GLuint>& dirtyFaces = this->dirtyFaces;
+        const vector<GLuint>& faceSlots = this->faceSlots;
+        vector<FaceNormal>& faceNormals = this->faceNormals;
+
+        this->pool.ParallelFor(0, dirtyFaces.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+                faceNormals[i] = mesh.ComputeFaceNormal(dirtyFaces[i]);
+        });
+
+        this->pool.ParallelFor(0, dirty.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+                vertices[dirty[i]].Normal = mesh.VertexNormal(dirty[i], [&](GLuint face) -> const FaceNormal& { return faceNormals[faceSlots[face]]; });
+        });
+    }
+
+private:
+    ThreadPool& pool;
+
+    // brush, falloff and their displacement kernel
+    BrushType brush;
+    FalloffType falloff;
+    BrushKernelFunction kernel;
+
+    // buffers reused by each dab (so a Sculptor must be used by one thread at a time)
+    vector<GLuint> inside, all, displaced, dirty, dirtyFaces;
+    vector<float> reaches;
+    // targets of the smooth brush (centroid of the ring of each vertex inside the brush, see ringTargets)
+    vector<glm::vec3> targets;
+    vector<FaceNormal> faceNormals;
+    // last normals update which has added each vertex / face to the dirty lists, and position of each dirty face in faceNormals
+    vector<GLuint> vertexStamps, faceStamps, faceSlots;
+    GLuint stamp;
+
+    //////////////////////////////////////////
+
+    // the vertex is added to the dirty list, if it is not already there
+    void markDirty(GLuint vertex)
+    {
+        if (this->vertexStamps[vertex] != this->stamp)
+        {
+            this->vertexStamps[vertex] = this->stamp;
+            this->dirty.push_back(vertex);
+        }
+    }
+
+    //////////////////////////////////////////
+
+    // centroids of the rings of the vertices inside the brush, from the positions before the displacement (see N.B. 2 in brushes.h)
+    void ringTargets(const Mesh& mesh, const vector<GLuint>& inside)
+    {
+        const vector<Vertex>& vertices = mesh.vertices;
+        const vector<GLuint>& neighbours = mesh.neighbours;
+        vector<glm::vec3>& targets = this->targets;
+        targets.resize(vertices.size());
+
+        this->pool.ParallelFor(0, inside.size(), GRAIN, [&](size_t first, size_t last)
+        {
+            for (size_t i = first; i < last; i++)
+            {
+                const Vertex& v = vertices[inside[i]];
+                glm::vec3 centroid = v.Position;
+                if (v.NeighboursNumber > 0)
+                {
+                    centroid = glm::vec3(0.0f, 0.0f, 0.0f);
+                    for (GLuint j = v.NeighboursIndex; j < v.NeighboursIndex + v.NeighboursNumber; j++)
+                        centroid += vertices[neighbours[j]].Position;
+                    centroid /= (float)v.NeighboursNumber;
+                }
+                targets[inside[i]] = centroid;
+            }
+        });
+    }
+
+    //////////////////////////////////////////
+
+    // exp() approximation (Cephes library), with the same operations of the SIMD versions below
+
+    static float Exp(float x)
+    {
+        x = min(x, 88.3762626647949f);
+        x = max(x, -88.3762626647949f);
+
+        // exp(x) = 2^n * exp(g), with n = floor(x / log(2) + 0.5)
+        float fx = floor(x * 1.44269504088896341f + 0.5f);
+        x = x - fx * 0.693359375f;
+        x = x - fx * -2.12194440e-4f;
+
+        float z = x * x;
+        float y = 1.9875691500E-4f;
+        y = y * x + 1.3981999507E-3f;
+        y = y * x + 8.3334519073E-3f;
+        y = y * x + 4.1665795894E-2f;
+        y = y * x + 1.6666665459E-1f;
+        y = y * x + 5.0000001201E-1f;
+        y = y * z + x + 1.0f;
+
+        // 2^n built directly in the exponent bits
+        GLint n = ((GLint)fx + 127) << 23;
+        float pow2n;
+        memcpy(&pow2n, &n, sizeof(float));
+        return y * pow2n;
+    }
+
+#ifdef USCULPT_SSE2
+    static __m128 Exp(__m128 x)
+    {
+        x = _mm_min_ps(x, _mm_set1_ps(88.3762626647949f));
+        x = _mm_max_ps(x, _mm_set1_ps(-88.3762626647949f));
+
+        __m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)), _mm_set1_ps(0.5f));
+        // floor without SSE4.1: truncation, then -1 where the truncation rounded up
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(fx));
+        fx = _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, fx), _mm_set1_ps(1.0f)));
+        x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(0.693359375f)));
+        x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(-2.12194440e-4f)));
+
+        __m128 z = _mm_mul_ps(x, x);
+        __m128 y = _mm_set1_ps(1.9875691500E-4f);
+        y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.3981999507E-3f));
+        y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(8.3334519073E-3f));
+        y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(4.1665795894E-2f));
+        y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(1.6666665459E-1f));
+        y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(5.0000001201E-1f));
+        y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(y, z), x), _mm_set1_ps(1.0f));
+
+        // 2^n built directly in the exponent bits
+        __m128i n = _mm_add_epi32(_mm_cvttps_epi32(fx), _mm_set1_epi32(127));
+        return _mm_mul_ps(y, _mm_castsi128_ps(_mm_slli_epi32(n, 23)));
+    }
+#endif
+
+#ifdef USCULPT_AVX2
+    static __m256 Exp(__m256 x)
+    {
+        x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+        x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+        __m256 fx = _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504088896341f)), _mm256_set1_ps(0.5f));
+        fx = _mm256_floor_ps(fx);
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(0.693359375f)));
+        x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(-2.12194440e-4f)));
+
+        __m256 z = _mm256_mul_ps(x, x);
+        __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.3981999507E-3f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(8.3334519073E-3f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(4.1665795894E-2f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(1.6666665459E-1f));
+        y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(5.0000001201E-1f));
+        y = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(y, z), x), _mm256_set1_ps(1.0f));
+
+        __m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127));
+        return _mm256_mul_ps(y, _mm256_castsi256_ps(_mm256_slli_epi32(n, 23)));
+    }
+#endif
+
+    //////////////////////////////////////////
+
+    // the vertex is moved by the offset; it is added to the moved list if its position has changed
+    static void move(vector<Vertex>& vertices, size_t i, glm::vec3 offset, vector<GLuint>& moved)
+    {
+        glm::vec3 position = vertices[i].Position + offset;
+        if (position != vertices[i].Position)
+        {
+            vertices[i].Position = position;
+            moved.push_back((GLuint)i);
+        }
+    }
+
+    // the vertex is moved by the displacement along the direction
+    static void move(vector<Vertex>& vertices, size_t i, glm::vec3 direction, float displacement, vector<GLuint>& moved)
+    {
+        move(vertices, i, direction * displacement, moved);
+    }
+
+    // dabs touching the tile ids[0 .. count): the tile is bounded by the sphere around the center of its box,
+    // which grows by the maximum displacement of each dab touching it (reaches, a vertex moved by a dab can reach the following ones)
+    static void cullDabs(const vector<Vertex>& vertices, const GLuint* ids, size_t count, const vector<BrushDab>& dabs, const vector<float>& reaches, vector<GLuint>& tileDabs)
+    {
+        glm::vec3 minimum = vertices[ids[0]].Position, maximum = minimum;
+        for (size_t i = 1; i < count; i++)
+        {
+            minimum = glm::min(minimum, vertices[ids[i]].Position);
+            maximum = glm::max(maximum, vertices[ids[i]].Position);
+        }
+        glm::vec3 center = (minimum + maximum) * 0.5f;
+        float tileRadius = glm::distance(center, maximum);
+
+        tileDabs.clear();
+        for (size_t d = 0; d < dabs.size(); d++)
+        {
+            if (glm::distance(center, dabs[d].Position) <= tileRadius + dabs[d].Radius)
+            {
+                tileDabs.push_back((GLuint)d);
+                tileRadius += reaches[d];
+            }
+        }
+    }
+
+    // Gaussian displacement of the vertices ids[0 .. count) along the direction
+    static void displaceVertices(vector<Vertex>& vertices, const GLuint* ids, size_t count, glm::vec3 origin, glm::vec3 direction, float strength, float radius, vector<GLuint>& moved)
+    {
+        float height = BrushHeight(strength, radius);
+        size_t i = 0;
+
+#ifdef USCULPT_AVX2
+        {
+            // the positions are gathered from the Vertex records: the offset of a vertex is its index * sizeof(Vertex) / sizeof(float)
+            // (32-bit offsets: up to 2^27 vertices)
+            const __m256i stride = _mm256_set1_epi32((int)(sizeof(Vertex) / sizeof(float)));
+            const float* base = &vertices[0].Position.x;
+            const __m256 ox = _mm256_set1_ps(origin.x), oy = _mm256_set1_ps(origin.y), oz = _mm256_set1_ps(origin.z);
+            const __m256 four = _mm256_set1_ps(4.0f), r = _mm256_set1_ps(radius);
+            const __m256 den = _mm256_set1_ps(2.0f * BRUSH_STD_DEV * BRUSH_STD_DEV), h = _mm256_set1_ps(height);
+
+            for (; i + 8 <= count; i += 8)
+            {
+                __m256i offsets = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*)&ids[i]), stride);
+                __m256 px = _mm256_i32gather_ps(base, offsets, 4);
+                __m256 py = _mm256_i32gather_ps(base + 1, offsets, 4);
+                __m256 pz = _mm256_i32gather_ps(base + 2, offsets, 4);
+
+                __m256 dx = _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(ox, px), four), r);
+                __m256 dy = _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(oy, py), four), r);
+                __m256 dz = _mm256_div_ps(_mm256_mul_ps(_mm256_sub_ps(oz, pz), four), r);
+                __m256 E = _mm256_div_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz)), den);
+
+                float displacement[8];
+                _mm256_storeu_ps(displacement, _mm256_mul_ps(h, Exp(_mm256_sub_ps(_mm256_setzero_ps(), E))));
+                for (int k = 0; k < 8; k++)
+                    move(vertices, ids[i + k], direction, displacement[k], moved);
+            }
+        }
+#endif
+
+#ifdef USCULPT_SSE2
+        {
+            const __m128 ox = _mm_set1_ps(origin.x), oy = _mm_set1_ps(origin.y), oz = _mm_set1_ps(origin.z);
+            const __m128 four = _mm_set1_ps(4.0f), r = _mm_set1_ps(radius);
+            const __m128 den = _mm_set1_ps(2.0f * BRUSH_STD_DEV * BRUSH_STD_DEV), h = _mm_set1_ps(height);
+
+            for (; i + 4 <= count; i += 4)
+            {
+                const Vertex& v0 = vertices[ids[i]];
+                const Vertex& v1 = vertices[ids[i + 1]];
+                const Vertex& v2 = vertices[ids[i + 2]];
+                const Vertex& v3 = vertices[ids[i + 3]];
+                __m128 px = _mm_setr_ps(v0.Position.x, v1.Position.x, v2.Position.x, v3.Position.x);
+                __m128 py = _mm_setr_ps(v0.Position.y, v1.Position.y, v2.Position.y, v3.Position.y);
+                __m128 pz = _mm_setr_ps(v0.Position.z, v1.Position.z, v2.Position.z, v3.Position.z);
+
+                __m128 dx = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(ox, px), four), r);
+                __m128 dy = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(oy, py), four), r);
+                __m128 dz = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(oz, pz), four), r);
+                __m128 E = _mm_div_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)), den);
+
+                float displacement[4];
+                _mm_storeu_ps(displacement, _mm_mul_ps(h, Exp(_mm_sub_ps(_mm_setzero_ps(), E))));
+                for (int k = 0; k < 4; k++)
+                    move(vertices, ids[i + k], direction, displacement[k], moved);
+            }
+        }
+#endif
+
+        // remaining vertices
+        for (; i < count; i++)
+            move(vertices, ids[i], direction, GaussianDistribution(origin, vertices[ids[i]].Position, strength, radius), moved);
+    }
+
+    //////////////////////////////////////////
+    // displacement kernels (see BrushKernelFunction)
+
+    // draw brush with the gaussian falloff: Gaussian displacement along the normal of the dab, with SIMD instructions
+    static void displaceGaussian(vector<Vertex>& vertices, const GLuint* ids, size_t count, const BrushDab& dab, const vector<glm::vec3>&, vector<GLuint>& moved)
+    {
+        displaceVertices(vertices, ids, count, dab.Position, dab.Normal, dab.Strength, dab.Radius, moved);
+    }
+
+    // any brush with any falloff: the branches on the brush and on the falloff are resolved at compile time
+    template<BrushType B, FalloffType F>
+    static void displaceBrush(vector<Vertex>& vertices, const GLuint* ids, size_t count, const BrushDab& dab, const vector<glm::vec3>& targets, vector<GLuint>& moved)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            const Vertex& v = vertices[ids[i]];
+            float t = min(glm::distance(dab.Position, v.Position) / dab.Radius, 1.0f);
+            glm::vec3 centroid = BrushUsesRing(B) ? targets[ids[i]] : v.Position;
+            move(vertices, ids[i], BrushKernel<B>::Offset(v.Position, v.Normal, centroid, dab, FalloffCurve<F>::Weight(t)), moved);
+        }
+    }
+
+    template<BrushType B>
+    static BrushKernelFunction selectFalloff(FalloffType falloff)
+    {
+        switch (falloff)
+        {
+            case SMOOTH_FALLOFF: return &displaceBrush<B, SMOOTH_FALLOFF>;
+            case SPHERE_FALLOFF: return &displaceBrush<B, SPHERE_FALLOFF>;
+            case SHARP_FALLOFF: return &displaceBrush<B, SHARP_FALLOFF>;
+            case LINEAR_FALLOFF: return &displaceBrush<B, LINEAR_FALLOFF>;
+            case CONSTANT_FALLOFF: return &displaceBrush<B, CONSTANT_FALLOFF>;
+            default: return &displaceBrush<B, GAUSSIAN_FALLOFF>;
+        }
+    }
+
+    static BrushKernelFunction selectKernel(BrushType brush, FalloffType falloff)
+    {
+        switch (brush)
+        {
+            case INFLATE_BRUSH: return selectFalloff<INFLATE_BRUSH>(falloff);
+            case SMOOTH_BRUSH: return selectFalloff<SMOOTH_BRUSH>(falloff);
+            case FLATTEN_BRUSH: return selectFalloff<FLATTEN_BRUSH>(falloff);
+            case PINCH_BRUSH: return selectFalloff<PINCH_BRUSH>(falloff);
+            case GRAB_BRUSH: return selectFalloff<GRAB_BRUSH>(falloff);
+            case CREASE_BRUSH: return selectFalloff<CREASE_BRUSH>(falloff);
+            default: return falloff == GAUSSIAN_FALLOFF ? &displaceGaussian : selectFalloff<DRAW_BRUSH>(falloff);
+        }
+    }
+};
@@ -5,8 +5,34 @@ Universita' degli Studi di Milano
 
 Shader class
 - loading Shader source code, Shader Program creation
+- after the linking, the active uniforms, uniform blocks and subroutines of the program are queried once, and their locations / indices are cached
+  (the render loop does not need glGetUniformLocation and glGetSubroutineIndex)
+- program binary cache (see InitCompilation): after the first linking, the binary of the program is saved in the cache directory,
+  and the next launches load it with glProgramBinary instead of compiling the sources
+- parallel compilation (GL_KHR_parallel_shader_compile, or the ARB version): the programs created between BeginBatch and EndBatch
+  only start their compilation, so the driver compiles them at the same time, and each one is completed by Finish
 
-N.B. ) adaptation of https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/shader.h
+N.B. 1) a cached binary is found by a hash of the source code of each stage (with the defines), of the transform feedback outputs
+and of the driver (vendor, renderer and version strings): a binary of another driver, or of changed sources, is never used.
+If the driver refuses a binary (e.g. after an update with the same version string), the program is compiled from the sources, and the binary is saved again.
+The hash is only the name of the file: its header keeps the length of the key string and a second hash of it (FNV-1a), checked at the loading,
+so a collision of the two hashes is needed to load the binary of another program.
+The cache is limited to PROGRAM_CACHE_BYTES: an index file lists the binaries from the least recently used one, which is removed first
+
+N.B. 2) the Shader objects are copied by value (Program is a name of OpenGL): a program created in a batch must be completed by Finish
+on the copy which is used (the errors of the compilation are printed by Finish, and the uniforms are queried by it)
+
+N.B. 3) the source code of each stage is preprocessed before the compilation: the #include "file" directives are expanded
+(path relative to the directory of the including file, or to the working directory), so the shaders share the layout of their records
+with the C++ code (see layout.h). The conditional directives are evaluated with the known macros (defines of the constructor and #define
+of the sources): an #include in a group excluded by them is skipped, while the conditions on macros of the driver (GL_*, __VERSION__) or with
+other operators are left to the GLSL compiler (and the #include inside them is expanded, with an include guard). Each file is included
+once in a stage, and a #line directive gives its index in the source files of the program (printed with the compilation errors)
+
+N.B. 4) a Shader keeps the paths of its stages and its defines: Reload creates the program again from the current source files
+(hot reload, see ShaderWatcher class), and the new program replaces the old one only if Finish tells that it is linked
+
+N.B. 5) adaptation of https://github.com/JoeyDeVries/LearnOpenGL/blob/master/includes/learnopengl/shader.h
 
 author: Andrea Cipollini; based on RTGP course code by prof. Davide Gadia
 */
@@ -21,6 +47,47 @@ using namespace std;
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <map>
+#include <unordered_map>
+#include <cstdlib>
+#include <cctype>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+    #include <direct.h>
+#endif
+
+// GL_KHR_parallel_shader_compile (not loaded by glad: InitCompilation loads its function, the ARB version has the same values)
+#ifndef GL_MAX_SHADER_COMPILER_THREADS_KHR
+    #define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+    #define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+typedef void (APIENTRYP PFNMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+// the version must be increased when the format of the cached binaries is changed
+const GLuint PROGRAM_CACHE_VERSION = 2;
+// maximum size of the cached binaries (see N.B. 1)
+const uint64_t PROGRAM_CACHE_BYTES = 64 * 1024 * 1024;
+
+// header of a cached program binary, followed by the binary
+// (KeyLength and Digest: length of the key string of the program, and its second hash, see N.B. 1)
+struct ProgramCacheHeader
+{
+    char Magic[8];
+    GLuint Version;
+    GLenum Format;
+    uint64_t Key;
+    uint64_t KeyLength;
+    uint64_t Digest;
+    uint64_t Length;
+};
 
 /////////////////// SHADER class ///////////////////////
 class Shader
@@ -63,39 +130,14 @@ public:
             cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
         }
 
-        // Convert strings to char pointers
-        const GLchar* vShaderCode = vertexCode.c_str();
-        const GLchar * fShaderCode = fragmentCode.c_str();
-
-        // Step 2: we compile the shaders
-        GLuint vertex, fragment;
-
-        // Vertex Shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        // check compilation errors
-        checkCompileErrors(vertex, "VERTEX");
-
-        // Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        // check compilation errors
-        checkCompileErrors(fragment, "FRAGMENT");
-
-        // Step 3: Shader Program creation
-        this->Program = glCreateProgram();
-        glAttachShader(this->Program, vertex);
-        glAttachShader(this->Program, fragment);
-
-        glLinkProgram(this->Program);
-        // check linking errors
-        checkCompileErrors(this->Program, "PROGRAM");
+        this->paths = { vertexPath, fragmentPath };
+        vertexCode = this->preprocess(vertexCode, vertexPath);
+        fragmentCode = this->preprocess(fragmentCode, fragmentPath);
 
-        // Step 4: we delete the shaders because they are linked to the Shader Program, and we do not need them anymore
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
+        // Steps 2,3,4: shaders compilation + link to Shader Program (or loading of the program binary from the cache)
+        const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+        const string codes[] = { vertexCode, fragmentCode };
+        this->build(types, codes, 2);
     }
 
     //constructor
@@ -138,58 +180,22 @@ public:
             cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
         }
 
-        // Convert strings to char pointers
-        const GLchar* vShaderCode = vertexCode.c_str();
-        const GLchar* fShaderCode = fragmentCode.c_str();
-        const GLchar* gShaderCode = geometryCode.c_str();
-
-        // Step 2: we compile the shaders
-        GLuint vertex, fragment, geometry;
-
-        // Vertex Shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        // check compilation errors
-        checkCompileErrors(vertex, "VERTEX");
-
-        // Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        // check compilation errors
-        checkCompileErrors(fragment, "FRAGMENT");
-
-        // Geometry Shader
-        geometry = glCreateShader(GL_GEOMETRY_SHADER);
-        glShaderSource(geometry, 1, &gShaderCode, NULL);
-        glCompileShader(geometry);
-        // check compilation errors
-        checkCompileErrors(geometry, "GEOMETRY");
-
-        // Step 3: Shader Program creation
-        this->Program = glCreateProgram(); // create the program object
-        glAttachShader(this->Program, vertex); // attach the shader to the program object
-        glAttachShader(this->Program, fragment); // attach the shader to the program object
-        glAttachShader(this->Program, geometry); // attach the shader to the program object
+        this->paths = { vertexPath, fragmentPath, geometryPath };
+        vertexCode = this->preprocess(vertexCode, vertexPath);
+        fragmentCode = this->preprocess(fragmentCode, fragmentPath);
+        geometryCode = this->preprocess(geometryCode, geometryPath);
 
+        // Steps 2,3,4: shaders compilation + link to Shader Program (or loading of the program binary from the cache)
         // just before linking the shader, the relationship between buffers and shader output variables is defined
+        const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+        const string codes[] = { vertexCode, fragmentCode, geometryCode };
         const char* outputNames[] = { "newPosition", "newNormal", "newTexCoords", "newTangent", "newBitangent" };
-        glTransformFeedbackVaryings(this->Program, 5, outputNames, GL_INTERLEAVED_ATTRIBS);
-
-        // linking shaders
-        glLinkProgram(this->Program);
-        // check linking errors
-        checkCompileErrors(this->Program, "PROGRAM");
-
-        // Step 4: we delete the shaders because they are linked to the Shader Program, and we do not need them anymore
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-        glDeleteShader(geometry);
+        this->build(types, codes, 3, outputNames, 5);
     }
 
     // Compute Shader constructor
-    Shader(GLchar* computePath)
+    // the defines (e.g. "#define NAME\n") are added to the source code after the #version directive (see N.B. 3)
+    Shader(GLchar* computePath, const string& defines = "")
     {
         // Step 1: we retrieve shaders source code from provided filepaths
         string computeCode;
@@ -218,28 +224,124 @@ public:
             cout << "ERROR::COMPUTE_SHADER::FILE_NOT_SUCCESFULLY_READ" << endl;
         }
 
-        // Shader Program creation
-        this->Program = glCreateProgram();
+        this->paths = { computePath };
+        this->defines = defines;
+        computeCode = this->preprocess(computeCode, computePath, defines);
 
-        // Steps 2,3: shader compilation + link to Shader Program
-        GLuint compute;
+        // Steps 2,3,4: shader compilation + link to Shader Program (or loading of the program binary from the cache)
+        const GLenum types[] = { GL_COMPUTE_SHADER };
+        this->build(types, &computeCode, 1);
+    }
 
-        // Compute Shaders
-        const GLchar* cShaderCode;
-        cShaderCode = computeCode.c_str();
-        compute = glCreateShader(GL_COMPUTE_SHADER);
-        glShaderSource(compute, 1, &cShaderCode, NULL);
-        glCompileShader(compute);
-        // check compilation errors
-        checkCompileErrors(compute, "COMPUTE");
-        glAttachShader(this->Program, compute);
+    // source files of the program (the top file of each stage and the included ones), in the order of their #line indices
+    const vector<string>& SourceFiles() const
+    {
+        return this->sourceFiles;
+    }
 
-        glLinkProgram(this->Program);
-        // check linking errors
-        checkCompileErrors(this->Program, "PROGRAM");
+    //////////////////////////////////////////
+
+    // program binary cache in the directory (created if missing; empty -> no cache), and parallel compilation if the driver supports it
+    // (to be called after the loading of OpenGL, with the loader given to glad)
+    static void InitCompilation(GLADloadproc load, const string& cacheDirectory)
+    {
+        CompilationSettings& settings = compilationSettings();
+
+        // the binaries are useful only if the driver can load at least one format
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        settings.Formats.assign(formats, 0);
+        if (formats > 0)
+            glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &settings.Formats[0]);
+        settings.CacheDirectory = formats > 0 ? cacheDirectory : "";
+        if (!settings.CacheDirectory.empty())
+        {
+#ifdef _WIN32
+            _mkdir(settings.CacheDirectory.c_str());
+#else
+            mkdir(settings.CacheDirectory.c_str(), 0755);
+#endif
+        }
 
-        // Step 4: we delete the shaders because they are linked to the Shader Program, and we do not need them anymore
-        glDeleteShader(compute);
+        const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION };
+        settings.Driver.clear();
+        for (int i = 0; i < 4; i++)
+        {
+            const GLubyte* value = glGetString(strings[i]);
+            settings.Driver += (value ? (const char*)value : "") + string("\n");
+        }
+
+        // the driver uses as many threads as it wants
+        PFNMAXSHADERCOMPILERTHREADSPROC maxThreads = nullptr;
+        GLint extensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &extensions);
+        for (GLint i = 0; i < extensions && !maxThreads; i++)
+        {
+            string extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+            if (extension == "GL_KHR_parallel_shader_compile")
+                maxThreads = (PFNMAXSHADERCOMPILERTHREADSPROC)load("glMaxShaderCompilerThreadsKHR");
+            else if (extension == "GL_ARB_parallel_shader_compile")
+                maxThreads = (PFNMAXSHADERCOMPILERTHREADSPROC)load("glMaxShaderCompilerThreadsARB");
+        }
+        settings.Parallel = maxThreads != nullptr;
+        if (maxThreads)
+            maxThreads(0xFFFFFFFF);
+    }
+
+    // the programs created until EndBatch only start their compilation (see N.B. 2)
+    static void BeginBatch() { compilationSettings().Batch = true; }
+    static void EndBatch() { compilationSettings().Batch = false; }
+
+    // the compilation and the link are completed (without waiting for them, when the compilation is parallel)
+    bool Ready() const
+    {
+        if (this->finished || !compilationSettings().Parallel)
+            return true;
+
+        GLint completed = GL_TRUE;
+        glGetProgramiv(this->Program, GL_COMPLETION_STATUS_KHR, &completed);
+        return completed == GL_TRUE;
+    }
+
+    // end of the creation of the program: errors check, binary saved in the cache, and query of the uniforms
+    // (called by the constructor, outside the batches). It returns false if the program is not linked
+    bool Finish()
+    {
+        if (this->finished)
+            return this->linked;
+        this->finished = true;
+
+        this->linked = this->cached;
+        if (!this->cached)
+        {
+            for (size_t i = 0; i < this->stages.size(); i++)
+                checkCompileErrors(this->stages[i], stageName(this->stageTypes[i]));
+            this->linked = checkCompileErrors(this->Program, "PROGRAM");
+            if (this->linked)
+                this->saveBinary();
+
+            // we delete the shaders because they are linked to the Shader Program, and we do not need them anymore
+            for (size_t i = 0; i < this->stages.size(); i++)
+                glDeleteShader(this->stages[i]);
+            this->stages.clear();
+        }
+
+        this->reflect();
+        return this->linked;
+    }
+
+    // new program from the current source files of the shader (see N.B. 4): its compilation is only started, as in a batch,
+    // and it must be completed by Finish
+    Shader Reload() const
+    {
+        CompilationSettings& settings = compilationSettings();
+        bool batch = settings.Batch;
+        settings.Batch = true;
+        Shader shader = this->paths.size() == 1 ? Shader(const_cast<GLchar*>(this->paths[0].c_str()), this->defines)
+                      : this->paths.size() == 2 ? Shader(this->paths[0].c_str(), this->paths[1].c_str())
+                      : Shader(this->paths[0].c_str(), this->paths[1].c_str(), this->paths[2].c_str());
+        settings.Batch = batch;
+        return shader;
     }
 
     //////////////////////////////////////////
@@ -250,11 +352,714 @@ public:
     // We delete the Shader Program when application closes
     void Delete() { glDeleteProgram(this->Program); }
 
+    //////////////////////////////////////////
+
+    // location of an active uniform outside the uniform blocks (-1 if it is not active: the glUniform* calls ignore it, as for glGetUniformLocation)
+    GLint Uniform(const string& name) const
+    {
+        unordered_map<string, GLint>::const_iterator uniform = this->uniforms.find(name);
+        return uniform == this->uniforms.end() ? -1 : uniform->second;
+    }
+
+    // index of an active uniform block (GL_INVALID_INDEX if it is not active)
+    GLuint UniformBlock(const string& name) const
+    {
+        unordered_map<string, UniformBlockInfo>::const_iterator block = this->blocks.find(name);
+        return block == this->blocks.end() ? GL_INVALID_INDEX : block->second.Index;
+    }
+
+    // size in bytes of an active uniform block (0 if it is not active), to check the layout of the CPU-side data
+    GLint UniformBlockSize(const string& name) const
+    {
+        unordered_map<string, UniformBlockInfo>::const_iterator block = this->blocks.find(name);
+        return block == this->blocks.end() ? 0 : block->second.Size;
+    }
+
+    // index of a subroutine of a stage (e.g. GL_FRAGMENT_SHADER), GL_INVALID_INDEX if it is not active
+    GLuint SubroutineIndex(GLenum stage, const string& name) const
+    {
+        map<GLenum, unordered_map<string, GLuint>>::const_iterator subroutines = this->subroutines.find(stage);
+        if (subroutines == this->subroutines.end())
+            return GL_INVALID_INDEX;
+
+        unordered_map<string, GLuint>::const_iterator subroutine = subroutines->second.find(name);
+        return subroutine == subroutines->second.end() ? GL_INVALID_INDEX : subroutine->second;
+    }
+
 private:
+    struct UniformBlockInfo
+    {
+        GLuint Index;
+        GLint Size;
+    };
+
+    // settings shared by all the programs (see InitCompilation)
+    struct CompilationSettings
+    {
+        string CacheDirectory;
+        // vendor, renderer and versions of the driver, and formats of the program binaries
+        string Driver;
+        vector<GLint> Formats;
+        bool Parallel;
+        bool Batch;
+    };
+
+    // result of a condition of the preprocessor: the macros of the driver are not known (see N.B. 3)
+    enum Condition { CONDITION_FALSE, CONDITION_TRUE, CONDITION_UNKNOWN };
+
+    // conditional group (#if, #ifdef, #ifndef ... #endif): condition of the current branch, and if one of the branches is taken
+    struct ConditionalGroup
+    {
+        Condition Branch;
+        Condition Taken;
+    };
+
+    // state of the preprocessing of a stage
+    struct PreprocessorState
+    {
+        map<string, string> Macros;
+        vector<ConditionalGroup> Groups;
+        vector<string> Included;
+        bool Comment;
+    };
+
+    // source files of the program (see N.B. 3), paths of the stages and defines of the constructor (see N.B. 4)
+    vector<string> sourceFiles;
+    vector<string> paths;
+    string defines;
+
+    // shaders of the program until Finish (none if the program is loaded from the cache), key of the program in the cache
+    vector<GLuint> stages;
+    vector<GLenum> stageTypes;
+    uint64_t key, keyLength, digest;
+    bool cached, finished, linked;
+
+    // reflection of the linked program
+    unordered_map<string, GLint> uniforms;
+    unordered_map<string, UniformBlockInfo> blocks;
+    map<GLenum, unordered_map<string, GLuint>> subroutines;
+
+    //////////////////////////////////////////
+
+    // name of a resource of the program interface
+    string resourceName(GLenum programInterface, GLuint index, GLint length)
+    {
+        string name(length, '\0');
+        glGetProgramResourceName(this->Program, programInterface, index, length, NULL, &name[0]);
+        name.resize(length > 0 ? length - 1 : 0);
+        return name;
+    }
+
+    // active uniforms, uniform blocks and subroutines of the program (program interface query, OpenGL 4.3)
+    void reflect()
+    {
+        GLint count = 0;
+
+        // uniforms (the ones inside the blocks have no location)
+        const GLenum uniformProperties[] = { GL_NAME_LENGTH, GL_LOCATION, GL_BLOCK_INDEX };
+        glGetProgramInterfaceiv(this->Program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint values[3];
+            glGetProgramResourceiv(this->Program, GL_UNIFORM, i, 3, uniformProperties, 3, NULL, values);
+            if (values[2] != -1 || values[1] == -1)
+                continue;
+
+            string name = this->resourceName(GL_UNIFORM, i, values[0]);
+            this->uniforms[name] = values[1];
+            // the arrays are listed as "name[0]": they are found also by their name
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+                this->uniforms[name.substr(0, name.size() - 3)] = values[1];
+        }
+
+        // uniform blocks
+        const GLenum blockProperties[] = { GL_NAME_LENGTH, GL_BUFFER_DATA_SIZE };
+        glGetProgramInterfaceiv(this->Program, GL_UNIFORM_BLOCK, GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint values[2];
+            glGetProgramResourceiv(this->Program, GL_UNIFORM_BLOCK, i, 2, blockProperties, 2, NULL, values);
+            UniformBlockInfo block = { (GLuint)i, values[1] };
+            this->blocks[this->resourceName(GL_UNIFORM_BLOCK, i, values[0])] = block;
+        }
+
+        // subroutines of each stage
+        const GLenum stages[] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER, GL_COMPUTE_SHADER };
+        const GLenum subroutineInterfaces[] = { GL_VERTEX_SUBROUTINE, GL_GEOMETRY_SUBROUTINE, GL_FRAGMENT_SUBROUTINE, GL_COMPUTE_SUBROUTINE };
+        const GLenum nameLength = GL_NAME_LENGTH;
+        for (int s = 0; s < 4; s++)
+        {
+            glGetProgramInterfaceiv(this->Program, subroutineInterfaces[s], GL_ACTIVE_RESOURCES, &count);
+            for (GLint i = 0; i < count; i++)
+            {
+                GLint length;
+                glGetProgramResourceiv(this->Program, subroutineInterfaces[s], i, 1, &nameLength, 1, NULL, &length);
+                string name = this->resourceName(subroutineInterfaces[s], i, length);
+                this->subroutines[stages[s]][name] = glGetSubroutineIndex(this->Program, stages[s], name.c_str());
+            }
+        }
+    }
+
+    //////////////////////////////////////////
+
+    static CompilationSettings& compilationSettings()
+    {
+        static CompilationSettings settings = { "", "", vector<GLint>(), false, false };
+        return settings;
+    }
+
+    static string stageName(GLenum type)
+    {
+        switch (type)
+        {
+            case GL_VERTEX_SHADER: return "VERTEX";
+            case GL_FRAGMENT_SHADER: return "FRAGMENT";
+            case GL_GEOMETRY_SHADER: return "GEOMETRY";
+            default: return "COMPUTE";
+        }
+    }
+
+    // the program is loaded from the cache, or its stages are compiled and linked (the link is completed by Finish)
+    void build(const GLenum* types, const string* codes, int stagesNumber, const char* const* varyings = nullptr, int varyingsNumber = 0)
+    {
+        const CompilationSettings& settings = compilationSettings();
+        this->finished = this->cached = this->linked = false;
+
+        // key of the program (see N.B. 1)
+        string program = settings.Driver;
+        for (int s = 0; s < stagesNumber; s++)
+            program += stageName(types[s]) + "\n" + codes[s] + "\n";
+        for (int v = 0; v < varyingsNumber; v++)
+            program += string(varyings[v]) + "\n";
+        this->key = (uint64_t)hash<string>()(program);
+        this->keyLength = program.size();
+        this->digest = fnv1a(program);
+
+        this->Program = glCreateProgram();
+        if (this->loadBinary())
+        {
+            this->cached = true;
+            this->Finish();
+            return;
+        }
+
+        for (int s = 0; s < stagesNumber; s++)
+        {
+            const GLchar* code = codes[s].c_str();
+            GLuint shader = glCreateShader(types[s]);
+            glShaderSource(shader, 1, &code, NULL);
+            glCompileShader(shader);
+            glAttachShader(this->Program, shader);
+            this->stages.push_back(shader);
+            this->stageTypes.push_back(types[s]);
+        }
+        if (varyingsNumber > 0)
+            glTransformFeedbackVaryings(this->Program, varyingsNumber, varyings, GL_INTERLEAVED_ATTRIBS);
+        if (!settings.CacheDirectory.empty())
+            glProgramParameteri(this->Program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+        glLinkProgram(this->Program);
+        if (!settings.Batch)
+            this->Finish();
+    }
+
+    // second hash of the key string of a program (64 bits FNV-1a, see N.B. 1)
+    static uint64_t fnv1a(const string& text)
+    {
+        uint64_t digest = 14695981039346656037ULL;
+        for (size_t i = 0; i < text.size(); i++)
+        {
+            digest ^= (unsigned char)text[i];
+            digest *= 1099511628211ULL;
+        }
+        return digest;
+    }
+
+    // name of the binary of the program in the cache
+    string binaryName() const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)this->key);
+        return name;
+    }
+
+    // path of the binary of the program in the cache
+    string binaryPath() const
+    {
+        return compilationSettings().CacheDirectory + "/" + this->binaryName();
+    }
+
+    // the binary of the program becomes the most recently used one of the index of the cache (size 0: it is removed from the index),
+    // then the least recently used binaries are removed until the cache is smaller than PROGRAM_CACHE_BYTES (see N.B. 1)
+    void useBinary(uint64_t size) const
+    {
+        string indexPath = compilationSettings().CacheDirectory + "/index.txt";
+        string name = this->binaryName();
+
+        // lines of the index: name and size of a binary, from the least recently used one
+        vector<pair<string, uint64_t>> binaries;
+        {
+            ifstream index(indexPath.c_str());
+            string binaryName;
+            unsigned long long binarySize;
+            while (index >> binaryName >> binarySize)
+            {
+                if (binaryName != name)
+                    binaries.push_back(make_pair(binaryName, (uint64_t)binarySize));
+            }
+        }
+        if (size > 0)
+            binaries.push_back(make_pair(name, size));
+
+        uint64_t total = 0;
+        for (size_t i = 0; i < binaries.size(); i++)
+            total += binaries[i].second;
+        size_t removed = 0;
+        // (the binary of the program is kept, even if it is larger than the cache)
+        while (total > PROGRAM_CACHE_BYTES && removed + 1 < binaries.size())
+        {
+            remove((compilationSettings().CacheDirectory + "/" + binaries[removed].first).c_str());
+            total -= binaries[removed].second;
+            removed++;
+        }
+
+        string temporaryPath = indexPath + ".tmp";
+        {
+            ofstream index(temporaryPath.c_str(), ios::trunc);
+            for (size_t i = removed; i < binaries.size(); i++)
+                index << binaries[i].first << " " << (unsigned long long)binaries[i].second << "\n";
+            if (!index)
+            {
+                index.close();
+                remove(temporaryPath.c_str());
+                return;
+            }
+        }
+        remove(indexPath.c_str());
+        if (rename(temporaryPath.c_str(), indexPath.c_str()) != 0)
+            remove(temporaryPath.c_str());
+    }
+
+    // it returns false if the cached binary is missing, or it is refused by the driver (the program is created again, without the binary)
+    bool loadBinary()
+    {
+        const CompilationSettings& settings = compilationSettings();
+        if (settings.CacheDirectory.empty())
+            return false;
+
+        ifstream file(this->binaryPath().c_str(), ios::binary);
+        ProgramCacheHeader header;
+        if (!file || !file.read((char*)&header, sizeof(ProgramCacheHeader)))
+            return false;
+        if (memcmp(header.Magic, "USCULPT", 8) != 0 || header.Version != PROGRAM_CACHE_VERSION || header.Key != this->key || header.Length == 0)
+            return false;
+        // (another program with the same hash, see N.B. 1)
+        if (header.KeyLength != this->keyLength || header.Digest != this->digest)
+            return false;
+        if (find(settings.Formats.begin(), settings.Formats.end(), (GLint)header.Format) == settings.Formats.end())
+            return false;
+
+        vector<char> binary((size_t)header.Length);
+        if (!file.read(&binary[0], (streamsize)binary.size()))
+            return false;
+
+        glProgramBinary(this->Program, header.Format, &binary[0], (GLsizei)binary.size());
+        GLint success;
+        glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(this->Program);
+            this->Program = glCreateProgram();
+            return false;
+        }
+        this->useBinary(sizeof(ProgramCacheHeader) + header.Length);
+        return true;
+    }
+
+    // the binary of the linked program is saved in the cache (written with a temporary name, then renamed: a cached binary is always complete)
+    void saveBinary()
+    {
+        if (compilationSettings().CacheDirectory.empty())
+            return;
+
+        GLint length = 0;
+        glGetProgramiv(this->Program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+
+        ProgramCacheHeader header;
+        memset(&header, 0, sizeof(ProgramCacheHeader));
+        memcpy(header.Magic, "USCULPT", 8);
+        header.Version = PROGRAM_CACHE_VERSION;
+        header.Key = this->key;
+        header.KeyLength = this->keyLength;
+        header.Digest = this->digest;
+        vector<char> binary(length);
+        glGetProgramBinary(this->Program, length, &length, &header.Format, &binary[0]);
+        header.Length = (uint64_t)length;
+
+        string path = this->binaryPath();
+        string temporaryPath = path + ".tmp";
+        {
+            ofstream file(temporaryPath.c_str(), ios::binary | ios::trunc);
+            file.write((const char*)&header, sizeof(ProgramCacheHeader));
+            file.write(&binary[0], length);
+            if (!file)
+            {
+                cout << "WARNING::SHADER:: CANNOT WRITE " << temporaryPath << endl;
+                file.close();
+                remove(temporaryPath.c_str());
+                return;
+            }
+        }
+
+        // rename() does not replace an existing file on Windows
+        remove(path.c_str());
+        if (rename(temporaryPath.c_str(), path.c_str()) != 0)
+        {
+            remove(temporaryPath.c_str());
+            this->useBinary(0);
+            return;
+        }
+        this->useBinary(sizeof(ProgramCacheHeader) + (uint64_t)length);
+    }
+
+    //////////////////////////////////////////
+
+    // source code of a stage after the preprocessing (see N.B. 3): the defines are inserted in the line after the #version directive
+    // (which must be the first directive of the shader), and the #include directives are expanded
+    string preprocess(const string& code, const string& path, const string& defines = "")
+    {
+        PreprocessorState state;
+        state.Comment = false;
+        state.Included.push_back(path);
+
+        string source;
+        if (code.find("#version") == string::npos)
+        {
+            this->expand(defines, "", "", state, source);
+            source += "#line 1 " + to_string(this->sourceIndex(path)) + "\n";
+            this->expand(code, path, "", state, source);
+        }
+        else
+            this->expand(code, path, defines, state, source);
+        return source;
+    }
+
+    // index of a source file in the #line directives
+    GLuint sourceIndex(const string& path)
+    {
+        vector<string>::iterator file = find(this->sourceFiles.begin(), this->sourceFiles.end(), path);
+        if (file != this->sourceFiles.end())
+            return (GLuint)(file - this->sourceFiles.begin());
+
+        this->sourceFiles.push_back(path);
+        return (GLuint)this->sourceFiles.size() - 1;
+    }
+
+    // the lines of a file are added to the source, with the defines after its #version directive (no path -> no #line directives)
+    void expand(const string& code, const string& path, const string& defines, PreprocessorState& state, string& source)
+    {
+        string index = path.empty() ? "" : to_string(this->sourceIndex(path));
+        istringstream lines(code);
+        string line;
+        for (GLuint number = 1; getline(lines, line); number++)
+        {
+            // the directives are found outside the block comments
+            bool comment = state.Comment;
+            string code = line;
+            skipComments(code, state.Comment);
+            size_t first = code.find_first_not_of(" \t");
+            if (comment || first == string::npos || code[first] != '#')
+            {
+                source += line + "\n";
+                continue;
+            }
+
+            istringstream directive(code.substr(first + 1));
+            string name, rest;
+            directive >> name;
+            getline(directive, rest);
+
+            if (name == "version")
+            {
+                source += line + "\n";
+                this->expand(defines, "", "", state, source);
+                if (!path.empty())
+                    source += "#line " + to_string(number + 1) + " " + index + "\n";
+            }
+            else if (name == "include")
+            {
+                string file = this->includedFile(rest, path, state);
+                string included;
+                if (!file.empty() && readSource(file, included))
+                {
+                    // the guard keeps a file once also when the GLSL compiler takes more groups with the same #include
+                    string guard = "USCULPT_INCLUDED_" + to_string(this->sourceIndex(file));
+                    if (activeCondition(state) == CONDITION_TRUE)
+                        state.Included.push_back(file);
+                    source += "#ifndef " + guard + "\n#define " + guard + "\n#line 1 " + to_string(this->sourceIndex(file)) + "\n";
+                    this->expand(included, file, "", state, source);
+                    source += "#endif\n#line " + to_string(number + 1) + " " + index + "\n";
+                }
+                else
+                    source += "\n";
+            }
+            // (not known by the GLSL compiler: the files are included once)
+            else if (name == "pragma" && rest.find("once") != string::npos)
+                source += "\n";
+            else
+            {
+                preprocessDirective(name, rest, state);
+                source += line + "\n";
+            }
+        }
+    }
+
+    // path of the file of an #include directive: empty if the directive is in an excluded group, or the file is already included
+    // (outside the groups with unknown conditions)
+    string includedFile(const string& directive, const string& path, const PreprocessorState& state)
+    {
+        if (activeCondition(state) == CONDITION_FALSE)
+            return "";
+
+        size_t begin = directive.find_first_of("\"<");
+        size_t end = begin == string::npos ? string::npos : directive.find_first_of("\">", begin + 1);
+        if (end == string::npos)
+        {
+            cout << "ERROR::SHADER::WRONG_INCLUDE_DIRECTIVE: " << directive << endl;
+            return "";
+        }
+        string name = directive.substr(begin + 1, end - begin - 1);
+
+        // relative to the directory of the including file, or to the working directory
+        size_t separator = path.find_last_of("/\\");
+        string file = separator == string::npos ? name : path.substr(0, separator + 1) + name;
+        if (!ifstream(file.c_str()))
+            file = name;
+        if (!ifstream(file.c_str()))
+        {
+            cout << "ERROR::SHADER::INCLUDE_NOT_FOUND: " << name << " (included by " << path << ")" << endl;
+            return "";
+        }
+
+        return find(state.Included.begin(), state.Included.end(), file) == state.Included.end() ? file : "";
+    }
+
+    static bool readSource(const string& path, string& code)
+    {
+        ifstream file(path.c_str());
+        if (!file)
+            return false;
+
+        stringstream stream;
+        stream << file.rdbuf();
+        code = stream.str();
+        return true;
+    }
+
+    // the block comments of a line are blanked, and the state tells if the line ends inside a block comment
+    static void skipComments(string& line, bool& comment)
+    {
+        for (size_t i = 0; i < line.size(); i++)
+        {
+            if (comment)
+            {
+                bool end = line.compare(i, 2, "*/") == 0;
+                line[i] = ' ';
+                if (end)
+                {
+                    line[++i] = ' ';
+                    comment = false;
+                }
+            }
+            else if (line.compare(i, 2, "//") == 0)
+                return;
+            else if (line.compare(i, 2, "/*") == 0)
+            {
+                comment = true;
+                line[i] = ' ';
+                line[++i] = ' ';
+            }
+        }
+    }
+
+    // macros and conditional groups of a directive (the directive is left in the source for the GLSL compiler)
+    static void preprocessDirective(const string& name, const string& rest, PreprocessorState& state)
+    {
+        istringstream arguments(rest);
+        string macro, value;
+        arguments >> macro;
+        getline(arguments, value);
+        value = value.substr(min(value.size(), value.find_first_not_of(" \t")));
+
+        if (name == "define" && activeCondition(state) != CONDITION_FALSE)
+            state.Macros[macro] = value;
+        else if (name == "undef" && activeCondition(state) != CONDITION_FALSE)
+            state.Macros.erase(macro);
+        else if (name == "ifdef" || name == "ifndef" || name == "if")
+        {
+            Condition condition = name == "if" ? evaluateCondition(rest, state) : definedMacro(macro, state);
+            if (name == "ifndef")
+                condition = notCondition(condition);
+            ConditionalGroup group = { condition, condition };
+            state.Groups.push_back(group);
+        }
+        else if (name == "elif" && !state.Groups.empty())
+        {
+            ConditionalGroup& group = state.Groups.back();
+            Condition condition = evaluateCondition(rest, state);
+            group.Branch = andCondition(notCondition(group.Taken), condition);
+            group.Taken = orCondition(group.Taken, condition);
+        }
+        else if (name == "else" && !state.Groups.empty())
+        {
+            ConditionalGroup& group = state.Groups.back();
+            group.Branch = notCondition(group.Taken);
+            group.Taken = CONDITION_TRUE;
+        }
+        else if (name == "endif" && !state.Groups.empty())
+            state.Groups.pop_back();
+    }
+
+    //////////////////////////////////////////
+
+    static Condition notCondition(Condition a)
+    {
+        return a == CONDITION_UNKNOWN ? a : (a == CONDITION_TRUE ? CONDITION_FALSE : CONDITION_TRUE);
+    }
+
+    static Condition andCondition(Condition a, Condition b)
+    {
+        if (a == CONDITION_FALSE || b == CONDITION_FALSE)
+            return CONDITION_FALSE;
+        return a == CONDITION_UNKNOWN || b == CONDITION_UNKNOWN ? CONDITION_UNKNOWN : CONDITION_TRUE;
+    }
+
+    static Condition orCondition(Condition a, Condition b)
+    {
+        return notCondition(andCondition(notCondition(a), notCondition(b)));
+    }
+
+    // condition of the current line (all the enclosing groups)
+    static Condition activeCondition(const PreprocessorState& state)
+    {
+        Condition condition = CONDITION_TRUE;
+        for (size_t i = 0; i < state.Groups.size(); i++)
+            condition = andCondition(condition, state.Groups[i].Branch);
+        return condition;
+    }
+
+    // the macros of the driver are unknown (the extensions and the profiles, GL_*), the other ones are defined only by the sources
+    // (with the predefined macros of GLSL: __cplusplus is never defined, so the C++ part of a shared header is skipped)
+    static Condition definedMacro(const string& macro, const PreprocessorState& state)
+    {
+        if (state.Macros.count(macro) || macro == "__LINE__" || macro == "__FILE__" || macro == "__VERSION__")
+            return CONDITION_TRUE;
+        return macro.compare(0, 3, "GL_") == 0 ? CONDITION_UNKNOWN : CONDITION_FALSE;
+    }
+
+    // condition of #if and #elif: defined(), !, &&, || and parentheses of macros and integers (other operators -> unknown)
+    static Condition evaluateCondition(const string& expression, const PreprocessorState& state)
+    {
+        vector<string> tokens;
+        for (size_t i = 0; i < expression.size();)
+        {
+            char c = expression[i];
+            if (isspace((unsigned char)c))
+                i++;
+            else if (expression.compare(i, 2, "//") == 0)
+                break;
+            else if (isalnum((unsigned char)c) || c == '_')
+            {
+                size_t end = i;
+                while (end < expression.size() && (isalnum((unsigned char)expression[end]) || expression[end] == '_'))
+                    end++;
+                tokens.push_back(expression.substr(i, end - i));
+                i = end;
+            }
+            else if (expression.compare(i, 2, "&&") == 0 || expression.compare(i, 2, "||") == 0)
+            {
+                tokens.push_back(expression.substr(i, 2));
+                i += 2;
+            }
+            else if ((c == '!' && expression.compare(i, 2, "!=") != 0) || c == '(' || c == ')')
+            {
+                tokens.push_back(string(1, c));
+                i++;
+            }
+            else
+                return CONDITION_UNKNOWN;
+        }
+
+        size_t position = 0;
+        Condition condition = orExpression(tokens, position, state);
+        return position == tokens.size() ? condition : CONDITION_UNKNOWN;
+    }
+
+    static Condition orExpression(const vector<string>& tokens, size_t& position, const PreprocessorState& state)
+    {
+        Condition condition = andExpression(tokens, position, state);
+        while (position < tokens.size() && tokens[position] == "||")
+            condition = orCondition(condition, andExpression(tokens, ++position, state));
+        return condition;
+    }
+
+    static Condition andExpression(const vector<string>& tokens, size_t& position, const PreprocessorState& state)
+    {
+        Condition condition = unaryExpression(tokens, position, state);
+        while (position < tokens.size() && tokens[position] == "&&")
+            condition = andCondition(condition, unaryExpression(tokens, ++position, state));
+        return condition;
+    }
+
+    static Condition unaryExpression(const vector<string>& tokens, size_t& position, const PreprocessorState& state)
+    {
+        if (position >= tokens.size())
+            return CONDITION_UNKNOWN;
+
+        const string& token = tokens[position++];
+        if (token == "!")
+            return notCondition(unaryExpression(tokens, position, state));
+        if (token == "(")
+        {
+            Condition condition = orExpression(tokens, position, state);
+            if (position >= tokens.size() || tokens[position++] != ")")
+                return CONDITION_UNKNOWN;
+            return condition;
+        }
+        if (token == "defined")
+        {
+            bool parenthesis = position < tokens.size() && tokens[position] == "(";
+            position += parenthesis ? 1 : 0;
+            if (position >= tokens.size())
+                return CONDITION_UNKNOWN;
+            Condition condition = definedMacro(tokens[position++], state);
+            if (parenthesis && (position >= tokens.size() || tokens[position++] != ")"))
+                return CONDITION_UNKNOWN;
+            return condition;
+        }
+
+        // integer, or a macro with an integer value (an undefined macro is 0)
+        string value = token;
+        if (!isdigit((unsigned char)token[0]))
+        {
+            map<string, string>::const_iterator macro = state.Macros.find(token);
+            if (macro == state.Macros.end())
+                return definedMacro(token, state) == CONDITION_FALSE ? CONDITION_FALSE : CONDITION_UNKNOWN;
+            value = macro->second;
+        }
+        char* end = nullptr;
+        long number = strtol(value.c_str(), &end, 0);
+        if (value.empty() || *end != '\0')
+            return CONDITION_UNKNOWN;
+        return number != 0 ? CONDITION_TRUE : CONDITION_FALSE;
+    }
+
     //////////////////////////////////////////
 
-    // Check compilation and linking errors
-    void checkCompileErrors(GLuint shader, string type)
+    // Check compilation and linking errors (it returns false if there are errors)
+    bool checkCompileErrors(GLuint shader, string type)
 	{
 		GLint success;
 		GLchar infoLog[1024];
@@ -265,6 +1070,9 @@ private:
 			{
 				glGetShaderInfoLog(shader, 1024, NULL, infoLog);
                 cout << "| ERROR::::SHADER-COMPILATION-ERROR of type: " << type << "|\n" << infoLog << "\n| -- --------------------------------------------------- -- |" << endl;
+                // the numbers of the source files in the errors (see N.B. 3)
+                for (size_t i = 0; i < this->sourceFiles.size() && this->sourceFiles.size() > 1; i++)
+                    cout << "| " << i << ": " << this->sourceFiles[i] << endl;
 			}
 		}
 		else
@@ -276,5 +1084,6 @@ private:
                 cout << "| ERROR::::PROGRAM-LINKING-ERROR of type: " << type << "|\n" << infoLog << "\n| -- --------------------------------------------------- -- |" << endl;
 			}
 		}
+		return success == GL_TRUE;
 	}
 };
@@ -0,0 +1,272 @@
+/*
+ShaderWatcher class
+- hot reload of the shaders: the source files of the watched shaders (the files of the stages and the included ones, see Shader::SourceFiles)
+  are watched, and when one of them is saved the shaders using it are created again from the sources (Shader::Reload)
+- the new programs are compiled in the background (parallel compilation of the driver, see Shader::BeginBatch), and Update,
+  called once per frame before the shaders are used, swaps a shader with its new program only when the program is linked:
+  each frame uses either the old or the new program of a shader, and a source with errors keeps the old program (the errors are printed)
+- the mesh and the GPU buffers are not touched: the new programs use the same binding points of the buffers
+
+N.B. 1) on Linux the directories of the source files are watched by inotify (the editors often save a file by writing another one
+and renaming it, so the events of the directory are used instead of the ones of the file); on the other systems, or if inotify is not available,
+the modification times of the files are polled every POLL_INTERVAL seconds
+
+N.B. 2) the watcher references the watched Shader objects, so they must live as long as it. Before assigning a new program to a watched shader
+(e.g. the shaders of a new brush) the application drops its reload in progress (Drop), which would replace the new program with the old sources
+
+N.B. 3) without GL_KHR_parallel_shader_compile the reload is still made at a frame boundary, but that frame waits for the compilation
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <string>
+#include <map>
+#include <set>
+#include <chrono>
+#include <iostream>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <unistd.h>
+#endif
+
+#include <usculpt/shader.h>
+
+/////////////////// SHADERWATCHER class ///////////////////////
+class ShaderWatcher
+{
+public:
+    // interval (in seconds) of the polling of the modification times (see N.B. 1)
+    static constexpr float POLL_INTERVAL = 0.5f;
+
+    //////////////////////////////////////////
+
+    // constructor
+    ShaderWatcher()
+        : notify(-1), lastPoll(chrono::steady_clock::now())
+    {
+#ifdef __linux__
+        this->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (this->notify < 0)
+            cout << "WARNING::SHADERWATCHER:: INOTIFY IS NOT AVAILABLE, THE SOURCE FILES ARE POLLED" << endl;
+#endif
+    }
+
+    // the watches are released by the destructor: no copies
+    ShaderWatcher(const ShaderWatcher& copy) = delete;
+    ShaderWatcher& operator=(const ShaderWatcher& copy) = delete;
+
+    // destructor (the programs of the reloads in progress are deleted by Delete, while the OpenGL context exists)
+    ~ShaderWatcher()
+    {
+#ifdef __linux__
+        if (this->notify >= 0)
+            close(this->notify);
+#endif
+    }
+
+    //////////////////////////////////////////
+
+    // the shader is reloaded when one of its source files is changed (see N.B. 2)
+    void Watch(Shader& shader)
+    {
+        this->shaders.push_back(&shader);
+    }
+
+    // frame boundary: the changed shaders start their compilation, and the linked ones replace the old programs
+    // it returns the number of replaced programs (e.g. the application queries again the indices of the new programs)
+    GLuint Update()
+    {
+        set<string> changed;
+        this->watchFiles();
+        this->changedFiles(changed);
+
+        // a reload in progress is started again with the new sources
+        for (size_t i = 0; i < this->shaders.size(); i++)
+        {
+            if (!usesFiles(*this->shaders[i], changed))
+                continue;
+
+            this->Drop(*this->shaders[i]);
+            this->reloads.insert(make_pair(this->shaders[i], this->shaders[i]->Reload()));
+        }
+
+        GLuint swapped = 0;
+        for (map<Shader*, Shader>::iterator reload = this->reloads.begin(); reload != this->reloads.end();)
+        {
+            Shader& shader = *reload->first;
+            Shader& next = reload->second;
+
+            // the compilation is not completed yet
+            if (!next.Ready())
+            {
+                reload++;
+                continue;
+            }
+
+            if (next.Finish())
+            {
+                shader.Delete();
+                shader = next;
+                swapped++;
+                cout << "SHADERWATCHER:: RELOADED " << shader.SourceFiles()[0] << endl;
+            }
+            else
+            {
+                next.Delete();
+                cout << "WARNING::SHADERWATCHER:: " << shader.SourceFiles()[0] << " NOT RELOADED, THE PREVIOUS PROGRAM IS KEPT" << endl;
+            }
+            reload = this->reloads.erase(reload);
+        }
+
+        return swapped;
+    }
+
+    // the reload in progress of the shader is dropped (see N.B. 2)
+    void Drop(Shader& shader)
+    {
+        map<Shader*, Shader>::iterator reload = this->reloads.find(&shader);
+        if (reload == this->reloads.end())
+            return;
+
+        reload->second.Delete();
+        this->reloads.erase(reload);
+    }
+
+    // number of shaders which are compiled again
+    GLuint Reloading() const
+    {
+        return (GLuint)this->reloads.size();
+    }
+
+    // the programs of the reloads in progress are deleted
+    void Delete()
+    {
+        for (map<Shader*, Shader>::iterator reload = this->reloads.begin(); reload != this->reloads.end(); reload++)
+            reload->second.Delete();
+        this->reloads.clear();
+    }
+
+private:
+    // watched shaders, and the new program of the ones which are compiled again
+    vector<Shader*> shaders;
+    map<Shader*, Shader> reloads;
+
+    // inotify instance and watched directories (see N.B. 1)
+    int notify;
+    map<int, string> directories;
+    set<string> watchedDirectories;
+
+    // modification times of the polled files
+    map<string, time_t> modificationTimes;
+    chrono::steady_clock::time_point lastPoll;
+
+    //////////////////////////////////////////
+
+    // directory of a file ("." for a file in the working directory)
+    static string directory(const string& path)
+    {
+        size_t separator = path.find_last_of("/\\");
+        if (separator == string::npos)
+            return ".";
+        return separator == 0 ? "/" : path.substr(0, separator);
+    }
+
+    // the same file has the same key in the events of the directories and in the source files of the shaders
+    static string fileKey(const string& path)
+    {
+        size_t separator = path.find_last_of("/\\");
+        return directory(path) + "/" + (separator == string::npos ? path : path.substr(separator + 1));
+    }
+
+    static time_t modificationTime(const string& path)
+    {
+        struct stat status;
+        return stat(path.c_str(), &status) == 0 ? status.st_mtime : 0;
+    }
+
+    static bool usesFiles(const Shader& shader, const set<string>& files)
+    {
+        const vector<string>& sources = shader.SourceFiles();
+        for (size_t i = 0; i < sources.size(); i++)
+            if (files.count(fileKey(sources[i])))
+                return true;
+        return false;
+    }
+
+    //////////////////////////////////////////
+
+    // the directories (or the files, when polled) of the source files of the shaders are watched, also the files included after a reload
+    void watchFiles()
+    {
+        for (size_t i = 0; i < this->shaders.size(); i++)
+        {
+            const vector<string>& sources = this->shaders[i]->SourceFiles();
+            for (size_t s = 0; s < sources.size(); s++)
+            {
+#ifdef __linux__
+                if (this->notify >= 0)
+                {
+                    string watched = directory(sources[s]);
+                    if (!this->watchedDirectories.insert(watched).second)
+                        continue;
+                    int watch = inotify_add_watch(this->notify, watched.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+                    if (watch >= 0)
+                        this->directories[watch] = watched;
+                    else
+                        cout << "WARNING::SHADERWATCHER:: CANNOT WATCH " << watched << endl;
+                    continue;
+                }
+#endif
+                string key = fileKey(sources[s]);
+                if (!this->modificationTimes.count(key))
+                    this->modificationTimes[key] = modificationTime(sources[s]);
+            }
+        }
+    }
+
+    // keys of the files changed from the previous Update
+    void changedFiles(set<string>& changed)
+    {
+#ifdef __linux__
+        if (this->notify >= 0)
+        {
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(this->notify, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* e = buffer; e < buffer + length; e += sizeof(inotify_event) + ((inotify_event*)e)->len)
+                {
+                    const inotify_event* event = (const inotify_event*)e;
+                    map<int, string>::const_iterator watched = this->directories.find(event->wd);
+                    if (event->len > 0 && watched != this->directories.end())
+                        changed.insert(watched->second + "/" + event->name);
+                }
+            }
+            return;
+        }
+#endif
+        chrono::steady_clock::time_point now = chrono::steady_clock::now();
+        if (chrono::duration<float>(now - this->lastPoll).count() < POLL_INTERVAL)
+            return;
+        this->lastPoll = now;
+
+        // (the keys are paths of the files)
+        for (map<string, time_t>::iterator file = this->modificationTimes.begin(); file != this->modificationTimes.end(); file++)
+        {
+            time_t time = modificationTime(file->first);
+            if (time != file->second)
+            {
+                file->second = time;
+                changed.insert(file->first);
+            }
+        }
+    }
+};
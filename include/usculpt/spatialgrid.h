@@ -0,0 +1,204 @@
+/*
+SpatialGrid class
+- hashed uniform grid over the positions of the vertices of a mesh
+- the cell size is close to the brush radius (from radius / 2 to 2 * radius, see Fits), so the vertices touched by a brush are found visiting a few cells
+  instead of the whole mesh: at most 3 x 3 x 3 cells when the radius is the cell size (as after Build), up to 5 x 5 x 5 before the grid is rebuilt
+- the grid is updated incrementally: only the moved vertices which have changed cell are moved to another bucket
+- the vertices added and removed by an edit of the topology (see dyntopo.h) are inserted / removed one by one; the vertices without faces are never in the grid
+
+N.B.) the cells are hashed in a fixed number of buckets, so a bucket can contain the vertices of different (far) cells:
+the query always tests the distance of the candidates
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+
+/////////////////// SPATIALGRID class ///////////////////////
+class SpatialGrid
+{
+public:
+    // constructor
+    SpatialGrid()
+        : cellSize(0.0f)
+    {
+    }
+
+    //////////////////////////////////////////
+
+    // the vertices of the mesh are inserted in the cells of size cellSize
+    void Build(const Mesh& mesh, float cellSize)
+    {
+        this->cellSize = cellSize;
+
+        // about 4 vertices for each bucket (a power of two, so the hash is reduced with a mask)
+        size_t bucketsNumber = 1;
+        while (bucketsNumber * 4 < mesh.vertices.size())
+            bucketsNumber *= 2;
+
+        this->buckets.assign(bucketsNumber, vector<GLuint>());
+        this->vertexBucket.assign(mesh.vertices.size(), (GLuint)NO_BUCKET);
+        this->vertexSlot.resize(mesh.vertices.size());
+
+        for (size_t i = 0; i < mesh.vertices.size(); i++)
+        {
+            if (hasFaces(mesh, (GLuint)i))
+                this->insert((GLuint)i, this->bucket(this->cell(mesh.vertices[i].Position)));
+        }
+    }
+
+    // true if the grid has been built for the mesh with a cell size good for brushes of this radius
+    // (a radius up to 2 cells, whose query covers at most 5 x 5 x 5 cells)
+    bool Fits(const Mesh& mesh, float radius) const
+    {
+        return this->cellSize > 0.0f && this->vertexBucket.size() == mesh.vertices.size() && radius <= this->cellSize * 2.0f && radius >= this->cellSize * 0.5f;
+    }
+
+    float CellSize() const { return this->cellSize; }
+
+    //////////////////////////////////////////
+
+    // sorted indices of the vertices at distance <= radius from center (same test of Sculptor::InBrush)
+    void Query(const Mesh& mesh, glm::vec3 center, float radius, vector<GLuint>& result) const
+    {
+        result.clear();
+
+        glm::ivec3 minCell = this->cell(center - glm::vec3(radius));
+        glm::ivec3 maxCell = this->cell(center + glm::vec3(radius));
+
+        // buckets of the cells overlapping the sphere, without repetitions (different cells can share a bucket)
+        vector<GLuint> visited;
+        double cellsNumber = (double)(maxCell.x - minCell.x + 1) * (maxCell.y - minCell.y + 1) * (maxCell.z - minCell.z + 1);
+        if (cellsNumber >= (double)this->buckets.size())
+        {
+            // the sphere is large compared to the cells: every bucket is visited
+            for (size_t b = 0; b < this->buckets.size(); b++)
+                visited.push_back((GLuint)b);
+        }
+        else
+        {
+            for (int x = minCell.x; x <= maxCell.x; x++)
+                for (int y = minCell.y; y <= maxCell.y; y++)
+                    for (int z = minCell.z; z <= maxCell.z; z++)
+                        visited.push_back(this->bucket(glm::ivec3(x, y, z)));
+
+            sort(visited.begin(), visited.end());
+            visited.erase(unique(visited.begin(), visited.end()), visited.end());
+        }
+
+        for (size_t b = 0; b < visited.size(); b++)
+        {
+            const vector<GLuint>& content = this->buckets[visited[b]];
+            for (size_t i = 0; i < content.size(); i++)
+            {
+                if (glm::distance(center, mesh.vertices[content[i]].Position) <= radius)
+                    result.push_back(content[i]);
+            }
+        }
+
+        sort(result.begin(), result.end());
+    }
+
+    // the moved vertices which have left their cell are moved in the bucket of the new cell
+    // (the vertices not in the grid, e.g. added by an edit of the topology, are inserted)
+    void Update(const Mesh& mesh, const vector<GLuint>& moved)
+    {
+        for (size_t i = 0; i < moved.size(); i++)
+        {
+            if (moved[i] >= this->vertexBucket.size() || this->vertexBucket[moved[i]] == NO_BUCKET)
+            {
+                this->Insert(mesh, moved[i]);
+                continue;
+            }
+
+            GLuint newBucket = this->bucket(this->cell(mesh.vertices[moved[i]].Position));
+            if (newBucket != this->vertexBucket[moved[i]])
+            {
+                this->remove(moved[i]);
+                this->insert(moved[i], newBucket);
+            }
+        }
+    }
+
+    // a vertex added to the mesh (or a removed vertex used again) is inserted in the bucket of its cell
+    void Insert(const Mesh& mesh, GLuint vertex)
+    {
+        if (vertex >= this->vertexBucket.size())
+        {
+            this->vertexBucket.resize(vertex + 1, (GLuint)NO_BUCKET);
+            this->vertexSlot.resize(vertex + 1);
+        }
+        if (this->vertexBucket[vertex] != NO_BUCKET)
+            this->remove(vertex);
+
+        this->insert(vertex, this->bucket(this->cell(mesh.vertices[vertex].Position)));
+    }
+
+    // a vertex removed from the mesh is not returned by the queries anymore
+    void Remove(GLuint vertex)
+    {
+        if (vertex < this->vertexBucket.size() && this->vertexBucket[vertex] != NO_BUCKET)
+            this->remove(vertex);
+    }
+
+private:
+    // bucket of the vertices which are not in the grid
+    static const GLuint NO_BUCKET = (GLuint)-1;
+
+    float cellSize;
+
+    // vertices of each bucket
+    vector<vector<GLuint>> buckets;
+    // bucket of each vertex, and its position in the bucket (for removals in constant time)
+    vector<GLuint> vertexBucket;
+    vector<GLuint> vertexSlot;
+
+    //////////////////////////////////////////
+
+    glm::ivec3 cell(glm::vec3 position) const
+    {
+        return glm::ivec3(glm::floor(position / this->cellSize));
+    }
+
+    // spatial hash of the cell coordinates (from "Optimized Spatial Hashing for Collision Detection of Deformable Objects" paper by Teschner et al.)
+    GLuint bucket(glm::ivec3 cell) const
+    {
+        GLuint hash = ((GLuint)cell.x * 73856093u) ^ ((GLuint)cell.y * 19349663u) ^ ((GLuint)cell.z * 83492791u);
+        return hash & (GLuint)(this->buckets.size() - 1);
+    }
+
+    void insert(GLuint vertex, GLuint bucket)
+    {
+        this->vertexBucket[vertex] = bucket;
+        this->vertexSlot[vertex] = (GLuint)this->buckets[bucket].size();
+        this->buckets[bucket].push_back(vertex);
+    }
+
+    // the last vertex of the bucket takes the place of the removed one
+    void remove(GLuint vertex)
+    {
+        vector<GLuint>& content = this->buckets[this->vertexBucket[vertex]];
+        GLuint last = content.back();
+        content[this->vertexSlot[vertex]] = last;
+        this->vertexSlot[last] = this->vertexSlot[vertex];
+        content.pop_back();
+        this->vertexBucket[vertex] = NO_BUCKET;
+    }
+
+    // a vertex without faces (e.g. removed by DynamicTopology) is not sculpted (meshes without neighbours keep every vertex)
+    static bool hasFaces(const Mesh& mesh, GLuint vertex)
+    {
+        return mesh.neighbours.empty() || mesh.vertices[vertex].NeighboursNumber > 0;
+    }
+};
@@ -0,0 +1,207 @@
+/*
+StrokeEngine class
+- placement of the dabs of a stroke at a fixed spacing along the path of the cursor, independently of the frame rate:
+  the positions of the cursor are sampled by the GLFW callbacks (more than one for each frame), and the dabs are placed on the surface
+  every spacing (a fraction of the brush radius) along the hits of the path
+- lazy mouse stabilizer: the brush follows the cursor like pulled by a string of length LazyRadius (in pixels),
+  so it moves only when the cursor is farther than LazyRadius, and the small shakes of the hand are filtered
+- the path of the brush is split in points STEP pixels far from each other; each frame the points are cast on the mesh (NextPoint),
+  and the hits are walked in world space (AddHit), so the dabs of a frame are placed all together and they are brushed in a single pass
+
+N.B. 1) at most MAX_DABS dabs (the records of the dabs buffer, see Mesh class) and MAX_POINTS points are used in a frame:
+the rest of the path is kept for the next frames, so the cost of a frame is bounded even for a very fast cursor
+
+N.B. 2) the dabs between two hits are interpolated (position and normal), with the triangle of the closest hit: when a point misses the mesh
+the walk starts again from the next hit, which places a dab
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <deque>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include <usculpt/mesh.h>
+#include <usculpt/raycast.h>
+
+/////////////////// STROKEENGINE class ///////////////////////
+class StrokeEngine
+{
+public:
+    // maximum number of dabs and of points of the path used in a frame
+    static const GLuint MAX_DABS = Mesh::MAX_DABS;
+    static const GLuint MAX_POINTS = 1024;
+    // distance (in pixels) between the points of the path cast on the mesh
+    static constexpr float STEP = 2.0f;
+
+    // length of the string of the lazy mouse (in pixels, 0 -> the brush is the cursor)
+    float LazyRadius;
+
+    //////////////////////////////////////////
+
+    // constructor
+    StrokeEngine(float lazyRadius = 15.0f)
+        : LazyRadius(lazyRadius), stroking(false), travelled(0.0f), frameDabs(0), framePoints(0)
+    {
+        this->lastHit = NoIntersection();
+    }
+
+    //////////////////////////////////////////
+
+    // start of a stroke: the brush is on the cursor, and the first point of the path is there
+    void Begin(GLfloat mouseX, GLfloat mouseY)
+    {
+        this->stroking = true;
+        this->brushPosition = glm::vec2(mouseX, mouseY);
+        this->path.clear();
+        this->path.push_back(this->brushPosition);
+        this->lastHit = NoIntersection();
+        this->travelled = 0.0f;
+    }
+
+    // end of the stroke: the points not reached yet are dropped
+    void End()
+    {
+        this->stroking = false;
+        this->path.clear();
+        this->lastHit = NoIntersection();
+    }
+
+    bool Stroking() const
+    {
+        return this->stroking;
+    }
+
+    // position of the brush on the screen, after the lazy mouse
+    glm::vec2 BrushPosition() const
+    {
+        return this->brushPosition;
+    }
+
+    //////////////////////////////////////////
+
+    // new position of the cursor (from the GLFW callback): the brush is pulled by the string, and its movement is added to the path
+    void AddSample(GLfloat mouseX, GLfloat mouseY)
+    {
+        if (!this->stroking)
+            return;
+
+        glm::vec2 cursor(mouseX, mouseY);
+        glm::vec2 offset = cursor - this->brushPosition;
+        float distance = glm::length(offset);
+        if (distance <= this->LazyRadius)
+            return;
+
+        // the brush reaches the end of the string, then the segment is split in points STEP pixels far from each other
+        glm::vec2 target = this->brushPosition + offset * ((distance - this->LazyRadius) / distance);
+        float length = distance - this->LazyRadius;
+        GLuint steps = (GLuint)ceil(length / STEP);
+        for (GLuint s = 1; s <= steps; s++)
+            this->path.push_back(this->brushPosition + (target - this->brushPosition) * ((float)s / (float)steps));
+
+        this->brushPosition = target;
+    }
+
+    //////////////////////////////////////////
+
+    // start of a frame: the limits of N.B. 1) are for each frame
+    void NewFrame()
+    {
+        this->frameDabs = 0;
+        this->framePoints = 0;
+    }
+
+    // next point of the path to cast on the mesh, false when the path is empty or the limits of the frame are reached
+    bool NextPoint(glm::vec2& point)
+    {
+        if (this->path.empty() || this->frameDabs >= MAX_DABS || this->framePoints >= MAX_POINTS)
+            return false;
+
+        point = this->path.front();
+        this->path.pop_front();
+        this->framePoints++;
+        return true;
+    }
+
+    // the path is dropped (e.g. the hits come from the GPU, for the brush position of each frame, see AddHit)
+    void SkipPath()
+    {
+        this->path.clear();
+    }
+
+    // hit of the next point of the path: the dabs every spacing along the segment from the previous hit are added to dabs
+    void AddHit(const Intersection& hit, float spacing, vector<Intersection>& dabs)
+    {
+        if (!hit.hit)
+        {
+            this->lastHit = NoIntersection();
+            return;
+        }
+
+        // the first hit of the stroke (or after a miss) is a dab
+        if (!this->lastHit.hit)
+        {
+            this->place(hit, dabs);
+            this->lastHit = hit;
+            this->travelled = 0.0f;
+            return;
+        }
+
+        float length = glm::distance(this->lastHit.Position, hit.Position);
+        float walked = 0.0f;
+        while (this->travelled + length - walked >= spacing && spacing > 0.0f)
+        {
+            // the frame is full: the walk goes on from the last dab in the next frame
+            if (this->frameDabs >= MAX_DABS)
+            {
+                this->lastHit = dabs.back();
+                this->travelled = 0.0f;
+                return;
+            }
+
+            walked += spacing - this->travelled;
+            this->travelled = 0.0f;
+            this->place(interpolate(this->lastHit, hit, walked / length), dabs);
+        }
+
+        this->travelled += length - walked;
+        this->lastHit = hit;
+    }
+
+private:
+    bool stroking;
+    glm::vec2 brushPosition;
+    // points of the path not cast yet
+    deque<glm::vec2> path;
+    // last hit of the path, and distance walked on the surface from the last dab
+    Intersection lastHit;
+    float travelled;
+    // dabs and points of the current frame
+    GLuint frameDabs, framePoints;
+
+    //////////////////////////////////////////
+
+    void place(const Intersection& dab, vector<Intersection>& dabs)
+    {
+        dabs.push_back(dab);
+        this->frameDabs++;
+    }
+
+    // intersection at t in [0, 1] on the segment between two hits
+    static Intersection interpolate(const Intersection& a, const Intersection& b, float t)
+    {
+        Intersection dab = t < 0.5f ? a : b;
+        dab.Position = a.Position + (b.Position - a.Position) * t;
+        glm::vec3 normal = a.Normal + (b.Normal - a.Normal) * t;
+        if (glm::dot(normal, normal) > 0.0f)
+            dab.Normal = glm::normalize(normal);
+        return dab;
+    }
+};
@@ -0,0 +1,264 @@
+/*
+ThreadPool class
+- fixed set of worker threads, one work queue for each of them
+- work stealing: a thread pops tasks from the back of its own queue, and when it is empty it steals from the front of the other queues
+- ParallelFor splits a range of indices in chunks and waits for their completion, while the calling thread takes part to the work
+- ParallelSort sorts chunks of a range in parallel, then merges them
+
+N.B.) the pool is shared by the CPU-side algorithms of the application (ThreadPool::Instance()), so nested ParallelFor calls are allowed:
+a worker waiting for its chunks keeps executing (or stealing) tasks instead of sleeping
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+
+/////////////////// THREADPOOL class ///////////////////////
+class ThreadPool
+{
+public:
+    // the pool owns its threads, so it cannot be copied
+    ThreadPool(const ThreadPool& copy) = delete;
+    ThreadPool& operator=(const ThreadPool& copy) = delete;
+
+    // constructor
+    // threadsNumber = 0 -> one thread for each hardware core
+    // the calling thread is counted as one of the threads, so (threadsNumber - 1) workers are spawned
+    ThreadPool(unsigned int threadsNumber = 0)
+        : stop(false), pending(0)
+    {
+        if (threadsNumber == 0)
+            threadsNumber = max(1u, thread::hardware_concurrency());
+
+        // queue 0 is used by threads which do not belong to the pool (e.g. the main thread)
+        for (unsigned int i = 0; i < threadsNumber; i++)
+            this->queues.emplace_back(new WorkQueue());
+
+        for (unsigned int i = 1; i < threadsNumber; i++)
+            this->workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    // destructor
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(this->sleepLock);
+            this->stop = true;
+        }
+        this->wakeUp.notify_all();
+
+        for (size_t i = 0; i < this->workers.size(); i++)
+            this->workers[i].join();
+    }
+
+    // shared pool of the application
+    static ThreadPool& Instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // number of threads working on a ParallelFor (workers + calling thread)
+    unsigned int ThreadsNumber() const { return (unsigned int)this->queues.size(); }
+
+    //////////////////////////////////////////
+
+    // it calls body(first, last) on chunks of [begin, end) of at least grain indices, and returns when every chunk has been executed
+    void ParallelFor(size_t begin, size_t end, size_t grain, const function<void(size_t, size_t)>& body)
+    {
+        if (end <= begin)
+            return;
+
+        size_t count = end - begin;
+        grain = max<size_t>(grain, 1);
+
+        // a few chunks for each thread, so that faster threads can steal the remaining work
+        size_t chunks = min((count + grain - 1) / grain, (size_t)this->queues.size() * 4);
+        if (chunks <= 1)
+        {
+            body(begin, end);
+            return;
+        }
+        size_t chunkSize = (count + chunks - 1) / chunks;
+        chunks = (count + chunkSize - 1) / chunkSize;
+
+        atomic<size_t> remaining(chunks);
+        unsigned int own = this->ownQueue();
+
+        // the first chunk is kept by the calling thread, the others are pushed on its own queue (free to be stolen)
+        for (size_t c = chunks - 1; c > 0; c--)
+        {
+            size_t first = begin + c * chunkSize;
+            size_t last = min(end, first + chunkSize);
+            this->push(own, [&body, &remaining, first, last]()
+            {
+                body(first, last);
+                remaining.fetch_sub(1, memory_order_acq_rel);
+            });
+        }
+
+        body(begin, min(end, begin + chunkSize));
+        remaining.fetch_sub(1, memory_order_acq_rel);
+
+        // we keep working until all the chunks of this loop are done
+        while (remaining.load(memory_order_acquire) > 0)
+        {
+            if (!this->runOne(own))
+                this_thread::yield();
+        }
+    }
+
+    // parallel sort of [begin, end): the chunks are sorted by the threads, then merged in pairs (the merges of each level are parallel too)
+    template <typename Iterator, typename Compare>
+    void ParallelSort(Iterator begin, Iterator end, Compare less, size_t grain = 65536)
+    {
+        size_t count = end - begin;
+        size_t chunkSize = max<size_t>(grain, (count + this->queues.size() * 4 - 1) / (this->queues.size() * 4));
+        size_t chunks = (count + chunkSize - 1) / chunkSize;
+
+        this->ParallelFor(0, chunks, 1, [&](size_t first, size_t last)
+        {
+            for (size_t c = first; c < last; c++)
+                sort(begin + c * chunkSize, begin + min(count, (c + 1) * chunkSize), less);
+        });
+
+        for (size_t width = chunkSize; width < count; width *= 2)
+        {
+            size_t merges = (count + 2 * width - 1) / (2 * width);
+            this->ParallelFor(0, merges, 1, [&](size_t first, size_t last)
+            {
+                for (size_t m = first; m < last; m++)
+                {
+                    size_t low = m * 2 * width;
+                    size_t middle = min(count, low + width);
+                    size_t high = min(count, low + 2 * width);
+                    inplace_merge(begin + low, begin + middle, begin + high, less);
+                }
+            });
+        }
+    }
+
+private:
+    typedef function<void()> Task;
+
+    // a queue of tasks with its own lock
+    struct WorkQueue
+    {
+        mutex lock;
+        deque<Task> tasks;
+    };
+
+    vector<unique_ptr<WorkQueue>> queues;
+    vector<thread> workers;
+
+    // sleeping of the idle workers
+    mutex sleepLock;
+    condition_variable wakeUp;
+    bool stop;
+    atomic<size_t> pending;
+
+    //////////////////////////////////////////
+
+    // queue owned by the calling thread, and its pool (a worker belongs to a single pool: the threads outside it use the queue 0)
+    struct OwnedQueue
+    {
+        const ThreadPool* pool;
+        unsigned int index;
+    };
+
+    static OwnedQueue& currentQueue()
+    {
+        static thread_local OwnedQueue owned = { nullptr, 0 };
+        return owned;
+    }
+
+    unsigned int ownQueue()
+    {
+        const OwnedQueue& owned = currentQueue();
+        return owned.pool == this && owned.index < this->queues.size() ? owned.index : 0;
+    }
+
+    void push(unsigned int queue, Task task)
+    {
+        {
+            lock_guard<mutex> lock(this->queues[queue]->lock);
+            this->queues[queue]->tasks.push_back(std::move(task));
+        }
+        {
+            lock_guard<mutex> lock(this->sleepLock);
+            this->pending.fetch_add(1, memory_order_release);
+        }
+        this->wakeUp.notify_one();
+    }
+
+    // it pops a task from the back of the own queue, or steals a task from the front of another queue
+    bool pop(unsigned int own, Task& task)
+    {
+        {
+            lock_guard<mutex> lock(this->queues[own]->lock);
+            if (!this->queues[own]->tasks.empty())
+            {
+                task = std::move(this->queues[own]->tasks.back());
+                this->queues[own]->tasks.pop_back();
+                this->pending.fetch_sub(1, memory_order_acq_rel);
+                return true;
+            }
+        }
+
+        for (size_t i = 1; i < this->queues.size(); i++)
+        {
+            WorkQueue& victim = *this->queues[(own + i) % this->queues.size()];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                this->pending.fetch_sub(1, memory_order_acq_rel);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool runOne(unsigned int own)
+    {
+        Task task;
+        if (!this->pop(own, task))
+            return false;
+
+        task();
+        return true;
+    }
+
+    void workerLoop(unsigned int index)
+    {
+        OwnedQueue& owned = currentQueue();
+        owned.pool = this;
+        owned.index = index;
+
+        while (true)
+        {
+            if (this->runOne(index))
+                continue;
+
+            unique_lock<mutex> lock(this->sleepLock);
+            this->wakeUp.wait(lock, [this]() { return this->stop || this->pending.load(memory_order_acquire) > 0; });
+            if (this->stop)
+                return;
+        }
+    }
+};
@@ -0,0 +1,86 @@
+/*
+UniformBuffer class
+- uniform buffer object (UBO) with the data of a uniform block of the shaders, bound to a fixed binding point (layout(std140, binding = N) in the shaders)
+- the data are set CPU-side during the frame (Set), and copied on the GPU once per frame (Upload) only if they have changed (dirty flag)
+
+N.B.) T must follow the std140 layout of the block: vec3 and vec4 aligned to 16 bytes (a vec3 followed by a float uses the same 16 bytes),
+mat4 as 4 vec4, and the size rounded to 16 bytes (see the blocks in uSculpt.cpp)
+
+author: Andrea Cipollini
+*/
+
+#pragma once
+
+using namespace std;
+
+// Std. Includes
+#include <string>
+#include <cstring>
+#include <iostream>
+
+#include <usculpt/shader.h>
+
+/////////////////// UNIFORMBUFFER class ///////////////////////
+template <typename T>
+class UniformBuffer
+{
+public:
+    GLuint UBO;
+
+    //////////////////////////////////////////
+
+    // constructor: buffer allocation and binding to the binding point of the block
+    UniformBuffer(GLuint binding)
+        : binding(binding), dirty(true)
+    {
+        memset(&this->data, 0, sizeof(T));
+
+        glGenBuffers(1, &this->UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &this->data, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, this->binding, this->UBO);
+    }
+
+    //////////////////////////////////////////
+
+    // new data of the block: the buffer is marked dirty only if they are different from the current ones
+    void Set(const T& data)
+    {
+        if (memcmp(&data, &this->data, sizeof(T)) == 0)
+            return;
+
+        this->data = data;
+        this->dirty = true;
+    }
+
+    const T& Get() const { return this->data; }
+
+    // copy on the GPU of the changed data (once per frame, before the draw calls and the dispatches which read the block)
+    void Upload()
+    {
+        if (!this->dirty)
+            return;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, this->UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &this->data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        this->dirty = false;
+    }
+
+    // the size of T is checked against the block of a shader (a different size means a different layout)
+    void CheckLayout(const Shader& shader, const string& block) const
+    {
+        GLint size = shader.UniformBlockSize(block);
+        if (size > 0 && (size_t)size != sizeof(T))
+            cout << "WARNING::UNIFORMBUFFER:: BLOCK " << block << " OF " << size << " BYTES, CPU DATA OF " << sizeof(T) << " BYTES" << endl;
+    }
+
+    // We delete the buffer when application closes
+    void Delete() { glDeleteBuffers(1, &this->UBO); }
+
+private:
+    GLuint binding;
+    T data;
+    bool dirty;
+};
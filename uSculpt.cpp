@@ -18,6 +18,7 @@ Main Class
 #include <string>
 #include <stdlib.h>
 #include <iomanip>
+#include <sstream>
 
 // Loader estensioni OpenGL
 // http://glad.dav1d.de/
@@ -42,8 +43,25 @@ Main Class
 
 // classes developed during lab lectures to manage shaders, to load models, for FPS camera, and for physical simulation
 #include <usculpt/shader.h>
+#include <usculpt/shaderwatcher.h>
+// uniform buffers for the per-frame parameters of the shaders
+#include <usculpt/uniformbuffer.h>
 #include <usculpt/model.h>
 #include <usculpt/camera.h>
+// CPU-side sculpting: brushing kernels and acceleration structure for picking
+#include <usculpt/sculptor.h>
+#include <usculpt/brushes.h>
+#include <usculpt/bvh.h>
+#include <usculpt/spatialgrid.h>
+// undo/redo of the strokes
+#include <usculpt/history.h>
+#include <usculpt/stroke.h>
+#include <usculpt/dyntopo.h>
+#include <usculpt/multires.h>
+// context without a window for the headless mode, and PNG images of the frames
+#include <usculpt/headless.h>
+// timers of the stages of the frame (GPU queries and CPU scopes)
+#include <usculpt/profiler.h>
 //#include <usculpt/texture.h>
 
 // glm is a robust library to manage matrix and vector operations (with matrix and vector classes ready-to-use) -> use glm namespace!
@@ -79,6 +97,11 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void mouse_key_callback(GLFWwindow* window, int button, int action, int mods);
 // if one of the WASD keys is pressed, we call the corresponding method of the Camera class
 void apply_camera_movements();
+// options of the command line, and scripted input of the headless mode
+bool parse_arguments(int argc, char* argv[]);
+void headless_stroke(int frame);
+// window of the rolling graphs of the profiler
+void draw_profiler(Profiler& profiler);
 
 #pragma endregion FUNCTION DECLARATIONS
 
@@ -97,6 +120,10 @@ bool firstMouse = true;
 bool brush = false;
 bool rotation = false;
 
+// keyboard flags for undo (CTRL+Z) and redo (CTRL+Y or CTRL+SHIFT+Z)
+bool undo = false;
+bool redo = false;
+
 #pragma endregion EVENT PARAMETERS
 
 #pragma region FRAME PARAMETERS
@@ -134,6 +161,52 @@ GLfloat alpha = 1.0f;
 // Fresnel reflectance at 0 degree (Schlik's approximation)
 GLfloat F0 = 0.1f;
 
+// per-frame parameters of the shaders, in uniform blocks (std140 layout, same order of the blocks in the shaders)
+// each vec3 is followed by a float, which uses the last 4 bytes of its 16 bytes (see UniformBuffer class)
+
+// camera data (binding point 0): rendering and intersection shaders
+struct CameraData
+{
+    glm::mat4 ProjectionMatrix;
+    glm::mat4 ViewMatrix;
+    glm::vec3 RayOrigin;
+    float padding0;
+    glm::vec3 RayDirection;
+    float padding1;
+};
+
+// model transformations (binding point 1): rendering and intersection shaders
+struct ModelData
+{
+    glm::mat4 ModelMatrix;
+    glm::mat4 NormalMatrix;
+    glm::mat4 InvModelMatrix;
+};
+
+// light and material parameters (binding point 2): rendering shaders
+struct MaterialData
+{
+    glm::vec3 PointLightPosition;
+    float Ka;
+    glm::vec3 ambientColor;
+    float Kd;
+    glm::vec3 diffuseColor;
+    float Ks;
+    glm::vec3 specularColor;
+    float shininess;
+    float alpha;
+    float F0;
+    float padding[2];
+};
+
+// brush parameters (binding point 3): rendering and brushing shaders
+struct BrushData
+{
+    float Radius;
+    float Strength;
+    float padding[2];
+};
+
 #pragma endregion SHADER UNIFORMS
 
 #pragma region MODEL PARAMETERS
@@ -158,48 +231,139 @@ glm::mat4 modelMatrix = glm::mat4(1.0f);
 float radius = 0.25f;
 float strength = 1.0f;
 
+// brush and falloff (see brushes.h): the brushing shaders are compiled again for each brush, and the Sculptor selects its kernel
+// (the grab brush moves the vertices by the movement between the dabs, known only when they are placed by the CPU)
+int brushType = DRAW_BRUSH;
+int brushFalloff = GAUSSIAN_FALLOFF;
+
+// CPU sculpting: picking with the BVH and brushing with the Sculptor, then the modified vertices are copied on the GPU
+bool cpuSculpting = false;
+
+// GPU sculpting: the small dabs are brushed by a single workgroup (displacement and normals in one dispatch, separated by a workgroup barrier)
+bool fusedBrush = true;
+// maximum number of dirty vertices (listed vertices + their neighbours) of a fused dab: a few vertices for each invocation of the workgroup
+const GLuint fusedBrushLimit = 1024;
+
+// GPU sculpting: placement of the dabs
+// - GPU_PLACEMENT -> each frame the dab uses the hit of the intersection shader of the same frame (no latency, but the CPU does not know where the dab is:
+//   one dab per frame, so the density of the stroke depends on the frame rate)
+// - CPU_PLACEMENT -> the dabs are placed by the stroke engine along the most recent hits read back without stalls (one or more frames old):
+//   the CPU knows the position of each dab, so the dabs are dabSpacing * radius far from each other whatever the frame rate
+// CPU_PLACEMENT is the default, since the same stroke gives the same surface at any frame rate (as the CPU sculpting)
+enum BrushPlacement { GPU_PLACEMENT, CPU_PLACEMENT };
+int brushPlacement = CPU_PLACEMENT;
+float dabSpacing = 0.25f;
+
+// stroke engine: the cursor positions of the mouse callback are stabilized by the lazy mouse, and the dabs of the CPU sculpting (and of the CPU placement)
+// are placed at a fixed spacing along the path of the brush (see StrokeEngine class): all the dabs of a frame are brushed in a single pass
+StrokeEngine strokeEngine;
+
+// CPU sculpting with dynamic topology: after each dab the edges around the brush are split / collapsed to keep their length close to detailSize * radius
+// (the edits change the faces of the mesh, so they clear the undo/redo history)
+bool dynamicTopology = false;
+float detailSize = 0.1f;
+
+// multiresolution: the loaded mesh is the base cage of subdivision levels (see Multires class), and the mesh is rendered, picked and sculpted
+// at the chosen level (the levels replace the faces of the mesh, so they clear the undo/redo history and they disable the dynamic topology)
+int multiresLevel = 0;
+bool subdivide = false;
+
+// memory for the undo/redo history (in MB): the oldest strokes exceeding it are moved to the spill file
+int historyBudget = 64;
+const string historySpillPath = "usculpt.history";
+
+// directory of the program binaries (see Shader class)
+const string shaderCachePath = "shadercache";
+
+// hot reload of the shaders: the saved sources are compiled again, and they replace the programs without restarting (see ShaderWatcher class)
+bool hotReload = false;
+
 #pragma endregion SCULPTING PARAMETERS
 
+#pragma region PROFILER
+
+// timers of the stages of the frame (see Profiler class): rolling graphs in the gui, and trace of the frames exported as JSON in tracePath
+// (--profile <file>: the profiler is enabled from the start, and at the exit the averages are printed and the trace is exported)
+bool profiling = false;
+string tracePath = "usculpt_trace.json";
+
+#pragma endregion PROFILER
+
+#pragma region HEADLESS
+
+// headless mode (--headless): the OpenGL context is created without a window (see HeadlessContext class), and the frames are rendered in a framebuffer object.
+// The input is a scripted stroke (see headless_stroke): the application renders headlessFrames frames of the whole pipeline (intersection, brush, rendering),
+// prints the time per frame and saves the frames as PNG images in headlessOutput (every headlessDump frames, and the last one)
+bool headless = false;
+int headlessFrames = 120;
+int headlessDump = 0;
+string headlessOutput = ".";
+
+// parity check of the brushes (--parity, headless mode): the dabs of the batched brushing shader are applied also by the CPU Sculptor to a copy
+// of the mesh, then the positions and the normals read back from the GPU are compared with the CPU ones (the application fails if they differ
+// by more than the tolerances: the positions in units of the brush radius, small enough for the slow moves of the smooth brush on a sphere)
+bool parity = false;
+const float parityPositionTolerance = 1e-5f;
+const float parityNormalTolerance = 1e-4f;
+
+#pragma endregion HEADLESS
+
 ////////////////// MAIN function ///////////////////////
 // until the game loop, here we enter the application stage
-int main()
+int main(int argc, char* argv[])
 {
+    if (!parse_arguments(argc, argv))
+        return -1;
+
     #pragma region WINDOW AND CONTEXT INIT
 
-    // Initialization of OpenGL context using GLFW
-    glfwInit();
-    // We set OpenGL specifications required for this application
-    // In this case: 4.1 Core (me: i modified the core version to follow the cookbook specs)
-    // If not supported by your graphics HW, the context will not be created and the application will close
-    // N.B.) creating GLAD code to load extensions, try to take into account the specifications and any extensions you want to use,
-    // in relation also to the values indicated in these GLFW commands
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-    // we set if the window is resizable
-    glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
-
-    // we create the application's window that we can use for GLFW's functions
-    GLFWwindow* window = glfwCreateWindow(screenWidth, screenHeight, "uSculpt", nullptr, nullptr);
-    if (!window)
+    // headless mode: context without a window, and without GLFW
+    GLFWwindow* window = nullptr;
+    HeadlessContext headlessContext;
+    GLADloadproc loader = (GLADloadproc)glfwGetProcAddress;
+    if (headless)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        if (!headlessContext.Init(screenWidth, screenHeight))
+            return -1;
+        loader = headlessContext.Loader();
     }
-    glfwMakeContextCurrent(window);
+    else
+    {
+        // Initialization of OpenGL context using GLFW
+        glfwInit();
+        // We set OpenGL specifications required for this application
+        // In this case: 4.1 Core (me: i modified the core version to follow the cookbook specs)
+        // If not supported by your graphics HW, the context will not be created and the application will close
+        // N.B.) creating GLAD code to load extensions, try to take into account the specifications and any extensions you want to use,
+        // in relation also to the values indicated in these GLFW commands
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        // we set if the window is resizable
+        glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+
+        // we create the application's window that we can use for GLFW's functions
+        window = glfwCreateWindow(screenWidth, screenHeight, "uSculpt", nullptr, nullptr);
+        if (!window)
+        {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return -1;
+        }
+        glfwMakeContextCurrent(window);
 
-    // we put in relation the window and the callbacks to handle events of user commands
-    glfwSetKeyCallback(window, key_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetMouseButtonCallback(window, mouse_key_callback);
+        // we put in relation the window and the callbacks to handle events of user commands
+        glfwSetKeyCallback(window, key_callback);
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetMouseButtonCallback(window, mouse_key_callback);
 
-    // we could disable the mouse cursor
-    //glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        // we could disable the mouse cursor
+        //glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    }
 
-    // GLAD tries to load the context set by GLFW
-    if (!gladLoadGLLoader((GLADloadproc) glfwGetProcAddress))
+    // GLAD tries to load the context set by GLFW (or by EGL)
+    if (!gladLoadGLLoader(loader))
     {
         std::cout << "Failed to initialize OpenGL context" << std::endl;
         return -1;
@@ -219,11 +383,18 @@ int main()
     printf("GL Version (integer)    :%d.%d\n", major, minor);
     printf("GLSL version            :%s\n", glslversion);
 
+    // programs loaded from the binary cache, or compiled in parallel when the driver supports it
+    Shader::InitCompilation(loader, shaderCachePath);
+
     #pragma endregion WINDOW AND CONTEXT INIT
 
     // we define the viewport dimensions and position compared to the window
-    int width, height;
-    glfwGetFramebufferSize(window, &width, &height);
+    // (the headless frames are rendered in the framebuffer object of the context, with the size of the window)
+    int width = screenWidth, height = screenHeight;
+    if (headless)
+        headlessContext.InitFramebuffer();
+    else
+        glfwGetFramebufferSize(window, &width, &height);
     glViewport(0, 0, width, height);
 
     // we enable Z test
@@ -254,7 +425,8 @@ int main()
     #pragma region MODEL INIT
 
     // loading of an initial standard sphere mesh
-    Model model("models/sphere1000k.obj");
+    // (a coarse mesh: the resolution for the details is added by the subdivision levels)
+    Model model("models/sphere_blender.obj");
 
     // Model and Normal transformation matrices for the model
     modelMatrix = glm::translate(glm::mat4(1.0f), model_pos);
@@ -263,15 +435,54 @@ int main()
 
     #pragma endregion MODEL INIT
 
+    // the programs are independent: the driver compiles them at the same time, then each one is completed
+    Shader::BeginBatch();
+
     // the choose Shader Program for the objects used in the application
     //Shader shader = Shader("ShaderBrushing.vert", "ShaderRendering.frag");
     Shader renderingShader = Shader("ShaderVertex.vert", "ShaderFragment.frag");
 
     // compute shaders for brushing operations
-    Shader brushingShader = Shader("ShaderBrush.comp");
+    // (compiled for the layout of the vertex buffers of the model, and for the brush)
+    string brushDefines = model.meshes[0].ShaderDefines() + BrushShaderDefines((BrushType)brushType, (FalloffType)brushFalloff);
+    Shader brushingShader = Shader("ShaderBrush.comp", brushDefines);
+    Shader fusedBrushingShader = Shader("ShaderBrush.comp", brushDefines + "#define FUSED_BRUSH\n");
+    Shader batchedBrushingShader = Shader("ShaderBrush.comp", brushDefines + "#define BATCHED_BRUSH\n");
 
     // compute shader for intersection tests
-    Shader intersectionShader = Shader("ShaderIntersection.comp");
+    Shader intersectionShader = Shader("ShaderIntersection.comp", model.meshes[0].ShaderDefines());
+
+    Shader::EndBatch();
+    renderingShader.Finish();
+    brushingShader.Finish();
+    fusedBrushingShader.Finish();
+    batchedBrushingShader.Finish();
+    intersectionShader.Finish();
+
+    // uniform buffers of the per-frame parameters, shared by all the shaders
+    UniformBuffer<CameraData> cameraBuffer(0);
+    UniformBuffer<ModelData> modelBuffer(1);
+    UniformBuffer<MaterialData> materialBuffer(2);
+    UniformBuffer<BrushData> brushBuffer(3);
+    cameraBuffer.CheckLayout(renderingShader, "CameraData");
+    modelBuffer.CheckLayout(renderingShader, "ModelData");
+    materialBuffer.CheckLayout(renderingShader, "MaterialData");
+    brushBuffer.CheckLayout(brushingShader, "BrushData");
+
+    // illumination model used by the rendering shader (the subroutine uniforms are reset by glUseProgram, so it is set at each frame)
+    GLuint illuminationModel = renderingShader.SubroutineIndex(GL_FRAGMENT_SHADER, "GGX");
+
+    // the shaders replaced by the hot reload
+    ShaderWatcher shaderWatcher;
+    shaderWatcher.Watch(renderingShader);
+    shaderWatcher.Watch(brushingShader);
+    shaderWatcher.Watch(fusedBrushingShader);
+    shaderWatcher.Watch(batchedBrushingShader);
+    shaderWatcher.Watch(intersectionShader);
+
+    // timers of the stages of the frame (enabled by the gui, or from the start with --profile)
+    Profiler profiler;
+    profiler.Enabled = profiling;
 
     // Projection matrix: FOV angle, aspect ratio, near and far planes (all setted in camera class to retrieve the matrix if needed)
     projection = camera.GetProjectionMatrix();
@@ -295,26 +506,77 @@ int main()
     // mesh data bind on GPU shaders
     model.meshes[0].InitMeshUpdate();
 
+    // CPU sculpting data
+    // the BVH and the grid are built when the CPU sculpting is activated, because the compute shaders could have changed the mesh
+    Sculptor sculptor;
+    sculptor.SetBrush((BrushType)brushType, (FalloffType)brushFalloff);
+
+    // CPU copy of the mesh of the parity check
+    vector<Mesh> parityMeshes;
+    if (parity)
+    {
+        vector<Vertex> parityVertices = model.meshes[0].vertices;
+        vector<GLuint> parityIndices = model.meshes[0].indices;
+        vector<GLuint> parityNeighbours = model.meshes[0].neighbours;
+        parityMeshes.emplace_back(parityVertices, parityIndices, parityNeighbours, false, model.meshes[0].Storage, false);
+    }
+    BVH bvh;
+    SpatialGrid grid;
+    bool bvhReady = false;
+    Intersection cpuIntersection = NoIntersection();
+    vector<GLuint> brushVertices, movedVertices;
+    DynamicTopology dyntopo;
+    Multires multires;
+
+    // GPU sculpting data: index of the last dab, for the stamps of the dirty list of the brushing shader
+    GLuint dab = 0;
+    // most recent hit read back from the GPU (and its frame), and frame of the last hit given to the stroke engine
+    Intersection latestHit = NoIntersection();
+    GLuint64 latestHitFrame = 0, placedHitFrame = 0;
+    // dabs placed by the stroke engine in the current frame, and their records for the batched brushing
+    vector<Intersection> strokeDabs;
+    vector<BrushDab> brushDabs;
+    vector<GLuint> dabVertices;
+    // last dab of the stroke, for the movement of the grab brush
+    Intersection previousDab = NoIntersection();
+
+    // undo/redo history: the stroke starts when the brush is pressed and ends when it is released
+    StrokeHistory history(historyBudget * 1024 * 1024, historySpillPath);
+    bool stroking = false;
+    GLuint strokeFirstDab = 0;
+    vector<GLuint> historyVertices;
+
     #pragma region GUI INIT
 
-    // gui init
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
-    ImGui::StyleColorsDark();
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 460");
+    // gui init (no gui in the headless mode)
+    if (!headless)
+    {
+        IMGUI_CHECKVERSION();
+        ImGui::CreateContext();
+        ImGuiIO& io = ImGui::GetIO(); (void)io;
+        ImGui::StyleColorsDark();
+        ImGui_ImplGlfw_InitForOpenGL(window, true);
+        ImGui_ImplOpenGL3_Init("#version 460");
+    }
 
     #pragma endregion GUI INIT
 
+    // headless mode: number of the frame, and time of the frames (without the PNG images)
+    int headlessFrame = 0;
+    double headlessTime = 0.0;
+
     // Rendering loop: this code is executed at each frame
-    while(!glfwWindowShouldClose(window))
+    while(headless ? headlessFrame < headlessFrames : !glfwWindowShouldClose(window))
     {
+        // timers of the frame (the GPU queries of the previous frames are read)
+        profiler.BeginFrame();
+        ProfileScope frameScope(profiler, "Frame");
+
         #pragma region FRAME TIME
 
         // we determine the time passed from the beginning
         // and we calculate time difference between current frame rendering and the previous one
-        GLfloat currentFrame = glfwGetTime();
+        GLfloat currentFrame = headless ? headlessContext.Time() : glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
@@ -332,20 +594,101 @@ int main()
 
         #pragma region GUI RENDERING
 
-        // gui
-        ImGui_ImplOpenGL3_NewFrame();
-        ImGui_ImplGlfw_NewFrame();
-        ImGui::NewFrame();
-        ImGui::Begin("Sculpting parameters"); 
-        ImGui::SliderFloat("Radius", &radius, 0.01f, 0.5f);
-        ImGui::SliderFloat("Strength", &strength, 0.1f, 3.0f);
-        ImGui::End();
-        ImGui::Render();
+        // gui (in the headless mode the parameters are the ones of the command line)
+        bool brushChanged = false;
+        if (!headless)
+        {
+            ProfileScope guiScope(profiler, "GUI");
+            ImGui_ImplOpenGL3_NewFrame();
+            ImGui_ImplGlfw_NewFrame();
+            ImGui::NewFrame();
+            ImGui::Begin("Sculpting parameters"); 
+            ImGui::SliderFloat("Radius", &radius, 0.01f, 0.5f);
+            ImGui::SliderFloat("Strength", &strength, 0.1f, 3.0f);
+            brushChanged = ImGui::Combo("Brush", &brushType, BrushNames(), BRUSH_TYPES);
+            brushChanged = ImGui::Combo("Falloff", &brushFalloff, FalloffNames(), FALLOFF_TYPES) || brushChanged;
+            ImGui::Checkbox("CPU sculpting", &cpuSculpting);
+            ImGui::Checkbox("Dynamic topology", &dynamicTopology);
+            ImGui::SliderFloat("Detail size", &detailSize, 0.02f, 0.5f);
+            // the levels of the multiresolution mesh cannot be edited by the dynamic topology
+            if (multires.Levels() > 0)
+                dynamicTopology = false;
+            // the edits of the topology are made on the CPU copy of the mesh
+            if (dynamicTopology)
+                cpuSculpting = true;
+            if (ImGui::Button("Subdivide"))
+                subdivide = true;
+            ImGui::SameLine();
+            ImGui::SliderInt("Level", &multiresLevel, 0, max((int)multires.Levels() - 1, 0));
+            ImGui::Checkbox("Fused small dabs", &fusedBrush);
+            ImGui::RadioButton("GPU dab placement", &brushPlacement, GPU_PLACEMENT);
+            ImGui::SameLine();
+            ImGui::RadioButton("CPU dab placement", &brushPlacement, CPU_PLACEMENT);
+            // the movement of the grab brush is known only for the dabs placed by the CPU
+            if (BrushUsesDelta((BrushType)brushType))
+                brushPlacement = CPU_PLACEMENT;
+            ImGui::SliderFloat("Dab spacing", &dabSpacing, 0.05f, 1.0f);
+            ImGui::SliderFloat("Lazy radius", &strokeEngine.LazyRadius, 0.0f, 100.0f);
+            ImGui::Checkbox("Hot reload shaders", &hotReload);
+            if (hotReload && shaderWatcher.Reloading() > 0)
+            {
+                ImGui::SameLine();
+                ImGui::Text("(compiling %d)", (int)shaderWatcher.Reloading());
+            }
+            ImGui::Checkbox("Profiler", &profiler.Enabled);
+            ImGui::Text("Hit readback latency: %d frames", (int)(model.meshes[0].IntersectionFrame() - latestHitFrame));
+            ImGui::Text("History: %d undo, %d redo, %.2f MB (%.2f MB on disk)", (int)history.UndoSteps(), (int)history.RedoSteps(),
+                history.MemoryUsage() / (1024.0f * 1024.0f), history.SpilledBytes() / (1024.0f * 1024.0f));
+            ImGui::Text("Mesh: %d vertices, %d triangles (%d / %d free)", (int)(model.meshes[0].vertices.size() - dyntopo.FreeVertices()),
+                (int)(model.meshes[0].indices.size() / 3 - dyntopo.FreeFaces()), (int)dyntopo.FreeVertices(), (int)dyntopo.FreeFaces());
+            ImGui::End();
+            if (profiler.Enabled)
+                draw_profiler(profiler);
+            ImGui::Render();
+        }
 
         #pragma endregion GUI RENDERING
 
-        // Check if an I/O event is happening
-        glfwPollEvents();
+        // the brushing shaders of the new brush
+        if (brushChanged)
+        {
+            sculptor.SetBrush((BrushType)brushType, (FalloffType)brushFalloff);
+            // (a reload of the old sources would replace the new programs, see ShaderWatcher N.B. 2)
+            shaderWatcher.Drop(brushingShader);
+            shaderWatcher.Drop(fusedBrushingShader);
+            shaderWatcher.Drop(batchedBrushingShader);
+            brushingShader.Delete();
+            fusedBrushingShader.Delete();
+            batchedBrushingShader.Delete();
+            brushDefines = model.meshes[0].ShaderDefines() + BrushShaderDefines((BrushType)brushType, (FalloffType)brushFalloff);
+            Shader::BeginBatch();
+            brushingShader = Shader("ShaderBrush.comp", brushDefines);
+            fusedBrushingShader = Shader("ShaderBrush.comp", brushDefines + "#define FUSED_BRUSH\n");
+            batchedBrushingShader = Shader("ShaderBrush.comp", brushDefines + "#define BATCHED_BRUSH\n");
+            Shader::EndBatch();
+            brushingShader.Finish();
+            fusedBrushingShader.Finish();
+            batchedBrushingShader.Finish();
+        }
+
+        // the shaders with new sources are replaced at the start of the frame: the indices of the new programs are queried again
+        if (hotReload && shaderWatcher.Update() > 0)
+        {
+            cameraBuffer.CheckLayout(renderingShader, "CameraData");
+            modelBuffer.CheckLayout(renderingShader, "ModelData");
+            materialBuffer.CheckLayout(renderingShader, "MaterialData");
+            brushBuffer.CheckLayout(brushingShader, "BrushData");
+            illuminationModel = renderingShader.SubroutineIndex(GL_FRAGMENT_SHADER, "GGX");
+        }
+
+        // Check if an I/O event is happening (or the scripted input of the headless mode)
+        {
+            ProfileScope eventsScope(profiler, "Events");
+            if (headless)
+                headless_stroke(headlessFrame);
+            else
+                glfwPollEvents();
+        }
 
         // we apply camera movements
         apply_camera_movements();
@@ -363,106 +706,361 @@ int main()
         else
             glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
-        // Mouse ray update for intersection test
-        camera.UpdateCameraRay(lastX, lastY);
+        // Mouse ray update for intersection test (during a stroke the brush follows the cursor with the lazy mouse)
+        glm::vec2 brushCursor = strokeEngine.Stroking() ? strokeEngine.BrushPosition() : glm::vec2(lastX, lastY);
+        camera.UpdateCameraRay(brushCursor.x, brushCursor.y);
 
-        #pragma region INTERSECTION SHADER
+        #pragma region UNIFORM BUFFERS
 
-        // intersection shader
-        // for delete intersection when the ray doesnt intersect the model
-        model.meshes[0].ResetIntersectionData();
-        intersectionShader.Use();
-        
-        // uniforms
+        // per-frame parameters: only the changed blocks are copied on the GPU
+        CameraData cameraData = { projection, view, camera.CameraRay.origin, 0.0f, camera.CameraRay.direction, 0.0f };
+        cameraBuffer.Set(cameraData);
 
-        // indices number
-        glUniform1ui(glGetUniformLocation(intersectionShader.Program, "IndicesNumber"), model.meshes[0].indices.size());
+        ModelData modelData = { modelMatrix, normalmatrix, glm::inverse(modelMatrix) };
+        modelBuffer.Set(modelData);
 
-        // model matrix for movements
-        // passing the inverse of the matrix because the approach is to inverse rotate the intersection point and normal instead of rotate the model
-        glUniformMatrix4fv(glGetUniformLocation(intersectionShader.Program, "InvModelMatrix"), 1, GL_FALSE, glm::value_ptr(glm::inverse(modelMatrix)));
+        MaterialData materialData = { pointLightPosition, 0.0f, glm::make_vec3(ambientColor), Kd, glm::make_vec3(diffuseColor), 0.0f, glm::make_vec3(specularColor), 0.0f, alpha, F0, { 0.0f, 0.0f } };
+        materialBuffer.Set(materialData);
 
-        // camera ray data
-        glUniform3fv(glGetUniformLocation(intersectionShader.Program, "RayOrigin"), 1, glm::value_ptr(camera.CameraRay.origin));
-        glUniform3fv(glGetUniformLocation(intersectionShader.Program, "RayDirection"), 1, glm::value_ptr(camera.CameraRay.direction));
+        BrushData brushData = { radius, strength, { 0.0f, 0.0f } };
+        brushBuffer.Set(brushData);
 
-        glDispatchCompute(ceil((model.meshes[0].indices.size() / 3) / 128), 1, 1);
-        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        cameraBuffer.Upload();
+        modelBuffer.Upload();
+        materialBuffer.Upload();
+        brushBuffer.Upload();
 
-        #pragma endregion INTERSECTION SHADER
+        #pragma endregion UNIFORM BUFFERS
 
-        #pragma region BRUSH SHADER
+        #pragma region INTERSECTION SHADER
 
-        // when brush command is called -> intersection shader + brushing shader, then rendering
-        if (brush)
+        // intersection shader
+        // for delete intersection when the ray doesnt intersect the model (next slot of the intersection ring, see Mesh class)
+        model.meshes[0].ResetIntersectionData();
+
+        // hit of the last frame completed by the GPU (the fences are tested, never waited)
+        model.meshes[0].LatestIntersection(latestHit, latestHitFrame);
+
+        if (cpuSculpting)
+        {
+            ProfileScope pickingScope(profiler, "Picking");
+
+            // the BVH needs the current positions of the vertices (the compute shaders could have changed them)
+            if (!bvhReady)
+            {
+                // the GPU dabs of the current stroke are recorded before their values replace the CPU copy
+                if (stroking && dab >= strokeFirstDab)
+                {
+                    model.meshes[0].StrokeDirtyVertices(historyVertices);
+                    history.Record(model.meshes[0], historyVertices);
+                }
+                model.meshes[0].DownloadVertices();
+                bvh.Build(model.meshes[0]);
+                grid.Build(model.meshes[0], radius);
+                bvhReady = true;
+            }
+
+            // the vertices with the same position are welded before the first edit of the topology
+            if (dynamicTopology && !dyntopo.Attached(model.meshes[0]) && dyntopo.Attach(model.meshes[0]))
+            {
+                model.meshes[0].UploadTopology();
+                bvh.Build(model.meshes[0]);
+                grid.Build(model.meshes[0], radius);
+            }
+
+            // BVH traversal with the camera ray in model coordinates
+            cpuIntersection = bvh.Intersect(model.meshes[0], ModelRay(camera.CameraRay, glm::inverse(modelMatrix)));
+            model.meshes[0].SetIntersectionData(cpuIntersection);
+        }
+        else
         {
-            // select the shader
-            brushingShader.Use();
+            ProfileScope intersectionScope(profiler, "Intersection", true);
+            intersectionShader.Use();
 
             // uniforms
+            // (the camera ray and the inverse of the model matrix are in the uniform buffers:
+            // passing the inverse of the matrix because the approach is to inverse rotate the intersection point and normal instead of rotate the model)
 
-            // sculpting params
-            glUniform1f(glGetUniformLocation(brushingShader.Program, "Radius"), radius);
-            glUniform1f(glGetUniformLocation(brushingShader.Program, "Strength"), strength);
+            // indices number
+            glUniform1ui(intersectionShader.Uniform("IndicesNumber"), model.meshes[0].indices.size());
 
-            // temp intersection data
-            //glUniform3fv(glGetUniformLocation(brushingShader.Program, "IntersectionPoint"), 1, glm::value_ptr(model.meshes[0].vertices[0].Position));
-            //glUniform3fv(glGetUniformLocation(brushingShader.Program, "IntersectionNormal"), 1, glm::value_ptr(model.meshes[0].vertices[0].Normal));
-
-            // vertices number
-            glUniform1ui(glGetUniformLocation(brushingShader.Program, "VerticesNumber"), model.meshes[0].vertices.size());
+            // first stage: closest hit of each workgroup
+            glUniform1ui(intersectionShader.Uniform("Stage"), 0);
+            glDispatchCompute(model.meshes[0].IntersectionWorkgroups(), 1, 1);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-            glDispatchCompute(ceil(model.meshes[0].vertices.size() / 128), 1, 1);
+            // second stage: closest hit of the mesh, and its intersection data
+            glUniform1ui(intersectionShader.Uniform("Stage"), 1);
+            glDispatchCompute(1, 1, 1);
             glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
         }
 
-        #pragma endregion BRUSH SHADER
+        #pragma endregion INTERSECTION SHADER
 
-        // select the shader to use
-        renderingShader.Use();
+        #pragma region HISTORY
 
-        // We search inside the Shader Program the name of a subroutine, and we get the numerical index
-        GLuint index = glGetSubroutineIndex(renderingShader.Program, GL_FRAGMENT_SHADER, "GGX");
-        // we activate the subroutine using the index
-        glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &index);
+        // start of a stroke: the CPU dabs record the vertices before changing them, the GPU dabs are recorded at the end of the stroke
+        if (brush && !stroking)
+        {
+            history.BeginStroke(model.meshes[0]);
+            strokeFirstDab = dab + 1;
+            model.meshes[0].BeginDirtyStroke(strokeFirstDab);
+            stroking = true;
+        }
+        // end of the stroke: the vertices changed by the GPU dabs (the stroke list filled by the brushing shader) are recorded
+        // with their values in the CPU copy, which is still the one before the stroke, then the CPU copy is updated
+        else if (!brush && stroking)
+        {
+            if (dab >= strokeFirstDab)
+            {
+                model.meshes[0].StrokeDirtyVertices(historyVertices);
+                history.Record(model.meshes[0], historyVertices);
+                model.meshes[0].DownloadVertices(historyVertices);
+            }
+            history.EndStroke(model.meshes[0]);
+            stroking = false;
+
+            // the vertices and faces removed by the edits of the topology are dropped (the mesh is renumbered)
+            if (dynamicTopology && dyntopo.Compact(model.meshes[0]))
+            {
+                history.Clear();
+                model.meshes[0].UploadTopology();
+                bvh.Build(model.meshes[0]);
+                grid.Build(model.meshes[0], radius);
+            }
+        }
 
-        #pragma region UNIFORMS
+        // undo/redo on the CPU copy, then the restored vertices (and their neighbours, whose normals change too) are copied on the GPU
+        // (a stroke with edits of the topology changes the faces too: the whole mesh is copied, and the BVH and the grid are built again)
+        if ((undo || redo) && !stroking)
+        {
+            bool changed = undo ? history.Undo(model.meshes[0], sculptor, historyVertices) : history.Redo(model.meshes[0], sculptor, historyVertices);
+            if (changed && history.ChangedTopology())
+            {
+                dyntopo.Resync(model.meshes[0]);
+                model.meshes[0].UploadTopology();
+                if (bvhReady)
+                {
+                    bvh.Build(model.meshes[0]);
+                    grid.Build(model.meshes[0], radius);
+                }
+            }
+            else if (changed)
+            {
+                model.meshes[0].UploadVertices(historyVertices);
+                if (bvhReady)
+                {
+                    bvh.Refit(model.meshes[0], historyVertices);
+                    grid.Update(model.meshes[0], historyVertices);
+                }
+            }
+        }
+        undo = redo = false;
 
-        // projection and view matrix for intersection and rendering
-        glUniformMatrix4fv(glGetUniformLocation(renderingShader.Program, "ProjectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
-        glUniformMatrix4fv(glGetUniformLocation(renderingShader.Program, "ViewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-        glUniform1f(glGetUniformLocation(renderingShader.Program, "Radius"), radius);
+        #pragma endregion HISTORY
+
+        #pragma region MULTIRES
+
+        // new subdivision level, or another level shown by the mesh (the CPU copy has the GPU dabs of the last stroke, see HISTORY):
+        // the edits of the current level are stored, then the faces of the mesh are replaced by the ones of the new level
+        if (!stroking && (subdivide || (multires.Levels() > 0 && (GLuint)multiresLevel != multires.Level())))
+        {
+            if (multires.Levels() == 0 && multires.Build(model.meshes[0]))
+                dyntopo.Detach();
+            if (subdivide)
+                multires.Subdivide(model.meshes[0]);
+            else
+                multires.SetLevel(model.meshes[0], multiresLevel);
+            multiresLevel = multires.Level();
+
+            // the history, the BVH and the grid refer to the vertices of the old level
+            history.Clear();
+            bvhReady = false;
+        }
+        subdivide = false;
+
+        #pragma endregion MULTIRES
+
+        #pragma region BRUSH SHADER
+
+        // dabs of the frame placed by the stroke engine:
+        // - CPU sculpting -> the points of the path of the brush are cast on the BVH
+        // - CPU placement of the GPU dabs -> the read back hits (one for each frame, at the brush position of its frame) are used only if they are new
+        strokeEngine.NewFrame();
+        strokeDabs.clear();
+        if (brush && cpuSculpting)
+        {
+            glm::vec2 point;
+            while (strokeEngine.NextPoint(point))
+                strokeEngine.AddHit(bvh.Intersect(model.meshes[0], ModelRay(camera.ScreenRay(point.x, point.y), glm::inverse(modelMatrix))), dabSpacing * radius, strokeDabs);
+        }
+        else if (brush)
+        {
+            // (the GPU dabs use the ray of the brush position of the frame)
+            strokeEngine.SkipPath();
+            if (brushPlacement == CPU_PLACEMENT && latestHitFrame > placedHitFrame)
+            {
+                strokeEngine.AddHit(latestHit, dabSpacing * radius, strokeDabs);
+                placedHitFrame = latestHitFrame;
+            }
+        }
+        // (the movement of each dab from the previous one of the stroke is used by the grab brush)
+        brushDabs.clear();
+        if (!brush)
+            previousDab = NoIntersection();
+        for (size_t d = 0; d < strokeDabs.size(); d++)
+        {
+            glm::vec3 delta = previousDab.hit ? strokeDabs[d].Position - previousDab.Position : glm::vec3(0.0f);
+            brushDabs.push_back(sculptor.Dab(strokeDabs[d], strength, radius, delta));
+            previousDab = strokeDabs[d];
+        }
 
-        // colors, light and illumination
-        glUniform3fv(glGetUniformLocation(renderingShader.Program, "diffuseColor"), 1, diffuseColor);
-        glUniform3fv(glGetUniformLocation(renderingShader.Program, "PointLightPosition"), 1, glm::value_ptr(pointLightPosition));
-        glUniform1f(glGetUniformLocation(renderingShader.Program, "Kd"), Kd);
-        glUniform1f(glGetUniformLocation(renderingShader.Program, "alpha"), alpha);
-        glUniform1f(glGetUniformLocation(renderingShader.Program, "F0"), F0);
-        glUniform3fv(glGetUniformLocation(renderingShader.Program, "ambientColor"), 1, ambientColor);
-        glUniform3fv(glGetUniformLocation(renderingShader.Program, "specularColor"), 1, specularColor);
+        // when brush command is called -> intersection shader + brushing shader, then rendering
+        if (brush && cpuSculpting && !strokeDabs.empty())
+        {
+            ProfileScope sculptingScope(profiler, "Sculpting");
+
+            // the cells of the grid are rebuilt when the brush radius is changed too much
+            if (!grid.Fits(model.meshes[0], radius))
+                grid.Build(model.meshes[0], radius);
+
+            // CPU dabs of the frame on the vertices inside them (in a single pass), then update of the BVH, of the grid and of the GPU buffer only for the moved vertices
+            brushVertices.clear();
+            for (size_t d = 0; d < strokeDabs.size(); d++)
+            {
+                grid.Query(model.meshes[0], brushDabs[d].Position, radius, dabVertices);
+                brushVertices.insert(brushVertices.end(), dabVertices.begin(), dabVertices.end());
+            }
+            sort(brushVertices.begin(), brushVertices.end());
+            brushVertices.erase(unique(brushVertices.begin(), brushVertices.end()), brushVertices.end());
+
+            history.Record(model.meshes[0], brushVertices);
+            sculptor.Brush(model.meshes[0], brushDabs, brushVertices, &movedVertices);
+            bvh.Refit(model.meshes[0], movedVertices);
+            grid.Update(model.meshes[0], movedVertices);
+            model.meshes[0].UploadVertices(movedVertices);
+
+            // dynamic topology: split / collapse of the edges around each dab (recorded by the history of the stroke), then update of the BVH,
+            // of the grid and of the GPU buffers only for the changed vertices and faces
+            for (size_t d = 0; dynamicTopology && d < strokeDabs.size(); d++)
+            {
+                grid.Query(model.meshes[0], strokeDabs[d].Position, radius, dabVertices);
+                if (dyntopo.Remesh(model.meshes[0], sculptor, dabVertices, strokeDabs[d].Position, radius, detailSize * radius, &history))
+                {
+                    grid.Update(model.meshes[0], dyntopo.ChangedVertices());
+                    for (size_t i = 0; i < dyntopo.RemovedVertices().size(); i++)
+                        grid.Remove(dyntopo.RemovedVertices()[i]);
+                    bvh.UpdateTriangles(model.meshes[0], dyntopo.ChangedFaces());
+                    model.meshes[0].UploadTopology(dyntopo.ChangedVertices(), dyntopo.ChangedFaces());
+                }
+            }
+        }
+        else if (brush && !cpuSculpting && (brushPlacement == GPU_PLACEMENT || !strokeDabs.empty()))
+        {
+            ProfileScope brushScope(profiler, "Brush", true);
+
+            // the CPU data are not valid anymore
+            bvhReady = false;
+
+            // the dabs placed by the CPU are brushed all together by the batched pass: each vertex is displaced by all of them,
+            // then the normals of the dirty list are updated (one dispatch and one barrier for each pass, whatever the number of dabs)
+            if (brushPlacement == CPU_PLACEMENT)
+            {
+                model.meshes[0].PlaceDabs(brushDabs);
+                batchedBrushingShader.Use();
+                glUniform1ui(batchedBrushingShader.Uniform("VerticesNumber"), model.meshes[0].vertices.size());
+                glUniform1ui(batchedBrushingShader.Uniform("Dab"), ++dab);
+
+                model.meshes[0].ResetBrushLists();
+                // the smooth brush reads the rings from the positions before the pass
+                if (BrushUsesRing((BrushType)brushType))
+                {
+                    glUniform1ui(batchedBrushingShader.Uniform("Stage"), 4);
+                    glDispatchCompute((model.meshes[0].vertices.size() + 127) / 128, 1, 1);
+                    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                }
+                glUniform1ui(batchedBrushingShader.Uniform("Stage"), 0);
+                glDispatchCompute((model.meshes[0].vertices.size() + 127) / 128, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                glUniform1ui(batchedBrushingShader.Uniform("Stage"), 1);
+                glDispatchCompute(1, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+                glUniform1ui(batchedBrushingShader.Uniform("Stage"), 3);
+                model.meshes[0].DispatchDirtyList();
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+                // the same dabs on the CPU copy of the mesh
+                if (parity)
+                    sculptor.Brush(parityMeshes[0], brushDabs);
+            }
+            else
+            {
+                // select the shader
+                brushingShader.Use();
+
+                // uniforms
+                // (the sculpting params are in the brush uniform buffer)
+
+                // temp intersection data
+                //glUniform3fv(glGetUniformLocation(brushingShader.Program, "IntersectionPoint"), 1, glm::value_ptr(model.meshes[0].vertices[0].Position));
+                //glUniform3fv(glGetUniformLocation(brushingShader.Program, "IntersectionNormal"), 1, glm::value_ptr(model.meshes[0].vertices[0].Normal));
+
+                // vertices number
+                glUniform1ui(brushingShader.Uniform("VerticesNumber"), model.meshes[0].vertices.size());
+                glUniform1ui(brushingShader.Uniform("Dab"), ++dab);
+                glUniform1ui(brushingShader.Uniform("FusedLimit"), fusedBrush ? fusedBrushLimit : 0);
+
+                // cull: list of the vertices inside the brush
+                // (the number of workgroups computed by stage 1 selects the fused pass or the separate passes: the dispatches of the other path are empty)
+                model.meshes[0].ResetBrushLists();
+                glUniform1ui(brushingShader.Uniform("Stage"), 0);
+                glDispatchCompute((model.meshes[0].vertices.size() + 127) / 128, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                glUniform1ui(brushingShader.Uniform("Stage"), 1);
+                glDispatchCompute(1, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+                // small dab: displacement and normals in a single workgroup
+                fusedBrushingShader.Use();
+                glUniform1ui(fusedBrushingShader.Uniform("Dab"), dab);
+                model.meshes[0].DispatchFusedBrush();
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                brushingShader.Use();
+
+                // displacement of the listed vertices, which fills the dirty list
+                // the normals are computed by a separate dispatch: the barrier between the two makes every displaced position visible to every workgroup
+                glUniform1ui(brushingShader.Uniform("Stage"), 2);
+                model.meshes[0].DispatchBrushList();
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+                glUniform1ui(brushingShader.Uniform("Stage"), 1);
+                glDispatchCompute(1, 1, 1);
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+                // normals of the dirty vertices, from the final positions
+                glUniform1ui(brushingShader.Uniform("Stage"), 3);
+                model.meshes[0].DispatchDirtyList();
+                glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+            }
+        }
 
-        // camera ray data
-        //glUniform3fv(glGetUniformLocation(shader.Program, "rayOrigin"), 1, glm::value_ptr(camera.CameraRay.origin));
-        //glUniform3fv(glGetUniformLocation(shader.Program, "rayDir"), 1, glm::value_ptr(camera.CameraRay.direction));
+        #pragma endregion BRUSH SHADER
 
-        // update normal matrix of the model basing on current view matrix
-        //normalmatrix = glm::inverseTranspose(glm::mat3(view * modelMatrix));
+        {
+            ProfileScope renderScope(profiler, "Render", true);
 
-        // transform matrices
-        glUniformMatrix4fv(glGetUniformLocation(renderingShader.Program, "ModelMatrix"), 1, GL_FALSE, glm::value_ptr(modelMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(renderingShader.Program, "NormalMatrix"), 1, GL_FALSE, glm::value_ptr(normalmatrix));
+            // select the shader to use
+            renderingShader.Use();
 
-        // default stage: rendering
-        //glUniform1i(glGetUniformLocation(shader.Program, "stage"), 2);
+            // we activate the subroutine using the index (found in the Shader Program after the linking)
+            glUniformSubroutinesuiv( GL_FRAGMENT_SHADER, 1, &illuminationModel);
 
-        // sculpting params
-        glUniform1f(glGetUniformLocation(renderingShader.Program, "radius"), radius);
-        glUniform1f(glGetUniformLocation(renderingShader.Program, "strength"), strength);
+            // the uniforms of the rendering shader (camera, model transformations, light and material, brush radius) are in the uniform buffers
 
-        #pragma endregion UNIFORMS
+            // update normal matrix of the model basing on current view matrix
+            //normalmatrix = glm::inverseTranspose(glm::mat3(view * modelMatrix));
 
-        model.Draw();
+            model.Draw();
+        }
 
         /*
         if (brush) // BRUSHING BY TRANSFORM FEEDBACK
@@ -500,16 +1098,89 @@ int main()
 
         //UnitCube.Draw();
 
+        if (headless)
+        {
+            ProfileScope finishScope(profiler, "Finish");
+
+            // the frame is completed by the GPU before its time is taken, then it is saved
+            glFinish();
+            headlessTime += headlessContext.Time() - currentFrame;
+            headlessFrame++;
+            if ((headlessDump > 0 && headlessFrame % headlessDump == 0) || headlessFrame == headlessFrames)
+            {
+                stringstream path;
+                path << headlessOutput << "/frame_" << setw(4) << setfill('0') << headlessFrame << ".png";
+                headlessContext.SavePNG(path.str());
+            }
+            continue;
+        }
+
         // gui cleaning
-        ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        {
+            ProfileScope imguiScope(profiler, "ImGui", true);
+            ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        }
 
         // swap between back and front buffer
-        glfwSwapBuffers(window);
+        {
+            ProfileScope swapScope(profiler, "Swap");
+            glfwSwapBuffers(window);
+        }
+    }
+
+    if (headless)
+        cout << "\rHEADLESS:: " << headlessFrames << " frames, " << dab << " GPU dabs, " << fixed << setprecision(3)
+             << 1000.0 * headlessTime / max(headlessFrames, 1) << " ms/frame" << endl;
+
+    // maximum distance between the GPU and the CPU positions (in units of the radius) and normals
+    bool parityFailed = false;
+    if (parity)
+    {
+        model.meshes[0].DownloadVertices();
+        float positionError = 0.0f, normalError = 0.0f;
+        for (size_t i = 0; i < parityMeshes[0].vertices.size(); i++)
+        {
+            positionError = max(positionError, glm::distance(model.meshes[0].vertices[i].Position, parityMeshes[0].vertices[i].Position) / radius);
+            normalError = max(normalError, glm::distance(model.meshes[0].vertices[i].Normal, parityMeshes[0].vertices[i].Normal));
+        }
+        parityFailed = positionError > parityPositionTolerance || normalError > parityNormalTolerance;
+        cout << "PARITY:: " << BrushNames()[brushType] << " brush, " << FalloffNames()[brushFalloff] << " falloff: position error " << scientific << positionError
+             << ", normal error " << normalError << fixed << (parityFailed ? " -> FAILED" : " -> OK") << endl;
+    }
+
+    // averages of the stages (milliseconds per frame), and trace of the frames
+    if (profiling)
+    {
+        // (the queries of the last frames are waited, so that their GPU times are in the averages and in the trace)
+        profiler.Finish();
+        for (GLuint s = 0; s < profiler.Stages(); s++)
+        {
+            cout << "PROFILER:: " << profiler.StageName(s) << ": CPU " << fixed << setprecision(3) << profiler.Average(s, false) << " ms";
+            if (profiler.StageGPU(s))
+                cout << ", GPU " << profiler.Average(s, true) << " ms";
+            cout << endl;
+        }
+        if (profiler.ExportTrace(tracePath))
+            cout << "PROFILER:: trace of " << profiler.TraceEvents() << " events saved in " << tracePath << endl;
     }
 
     // when I exit from the graphics loop, it is because the application is closing
     // we delete the Shader Programs
     renderingShader.Delete();
+    shaderWatcher.Delete();
+    // the queries of the profiler
+    profiler.Delete();
+    // and the uniform buffers
+    cameraBuffer.Delete();
+    modelBuffer.Delete();
+    materialBuffer.Delete();
+    brushBuffer.Delete();
+
+    if (headless)
+    {
+        headlessContext.Delete();
+        return parityFailed ? 1 : 0;
+    }
 
     // gui delete
     ImGui_ImplOpenGL3_Shutdown();
@@ -550,6 +1221,15 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
     if(key == GLFW_KEY_L && action == GLFW_PRESS)
         wireframe=!wireframe;
 
+    // CTRL+Z -> undo of the last stroke, CTRL+Y or CTRL+SHIFT+Z -> redo
+    if (action == GLFW_PRESS && (mode & GLFW_MOD_CONTROL))
+    {
+        if (key == GLFW_KEY_Z && !(mode & GLFW_MOD_SHIFT))
+            undo = true;
+        else if (key == GLFW_KEY_Y || key == GLFW_KEY_Z)
+            redo = true;
+    }
+
     // we keep trace of the pressed keys
     // with this method, we can manage 2 keys pressed at the same time:
     // many I/O managers often consider only 1 key pressed at the time (the first pressed, until it is released)
@@ -583,6 +1263,10 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos)
     lastX = xpos;
     lastY = ypos;
 
+    // every position of the cursor during a stroke is a sample of its path (there can be many for each frame)
+    if (brush)
+        strokeEngine.AddSample(lastX, lastY);
+
     // using mouse offset to move the model (0.2f is the sensitivity -> add a parameter)
     xoffset *= 0.01f;
     yoffset *= 0.01f;
@@ -610,6 +1294,12 @@ void mouse_key_callback(GLFWwindow* window, int button, int action, int mods)
     else
         brush = false;
 
+    // the path of the stroke starts from the cursor
+    if (brush)
+        strokeEngine.Begin(lastX, lastY);
+    else
+        strokeEngine.End();
+
     if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS)
         rotation = true;
     else
@@ -617,3 +1307,140 @@ void mouse_key_callback(GLFWwindow* window, int button, int action, int mods)
 }
 
 #pragma endregion CALLBACKS
+
+#pragma region HEADLESS
+
+//////////////////////////////////////////
+// options of the command line:
+// usage: usculpt [--headless] [--frames N] [--dump K] [--output <folder>] [--cpu] [--gpu-placement] [--profile <file.json>] [--brush <name>] [--falloff <name>] [--parity]
+// - --frames, --dump and --output are the frames, the interval of the PNG images and their folder of the headless mode
+// - --profile enables the profiler, and the trace is saved in the file at the exit
+// - --cpu -> CPU sculpting, --gpu-placement -> GPU sculpting with one dab per frame at the hit of the intersection shader (without the batched brushing)
+// - --brush and --falloff are the brush and the falloff of the stroke, by their names in the gui (e.g. --brush smooth --falloff sphere)
+// - --parity compares the GPU sculpting (dabs placed by the CPU) with the CPU Sculptor applying the same dabs
+bool parse_arguments(int argc, char* argv[])
+{
+    // index of a name (case insensitive) in the names of the brushes or of the falloffs, -1 if it is not found
+    auto findName = [](string value, const char* const* names, int count) -> int
+    {
+        transform(value.begin(), value.end(), value.begin(), ::tolower);
+        for (int n = 0; n < count; n++)
+        {
+            string name = names[n];
+            transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name == value)
+                return n;
+        }
+        return -1;
+    };
+
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        if (argument == "--headless")
+            headless = true;
+        else if (argument == "--cpu")
+            cpuSculpting = true;
+        else if (argument == "--gpu-placement")
+            brushPlacement = GPU_PLACEMENT;
+        else if (argument == "--parity")
+            parity = true;
+        else if (argument == "--frames" || argument == "--dump" || argument == "--output" || argument == "--profile" || argument == "--brush" || argument == "--falloff")
+        {
+            if (i + 1 >= argc)
+            {
+                cout << "ERROR::USCULPT:: MISSING VALUE OF " << argument << endl;
+                return false;
+            }
+            string value = argv[++i];
+            if (argument == "--frames")
+                headlessFrames = max(1, atoi(value.c_str()));
+            else if (argument == "--dump")
+                headlessDump = max(0, atoi(value.c_str()));
+            else if (argument == "--output")
+                headlessOutput = value;
+            else if (argument == "--brush" || argument == "--falloff")
+            {
+                bool brush = argument == "--brush";
+                int index = brush ? findName(value, BrushNames(), BRUSH_TYPES) : findName(value, FalloffNames(), FALLOFF_TYPES);
+                if (index < 0)
+                {
+                    cout << "ERROR::USCULPT:: UNKNOWN " << (brush ? "BRUSH " : "FALLOFF ") << value << endl;
+                    return false;
+                }
+                (brush ? brushType : brushFalloff) = index;
+            }
+            else
+            {
+                profiling = true;
+                tracePath = value;
+            }
+        }
+        else
+        {
+            cout << "ERROR::USCULPT:: UNKNOWN ARGUMENT " << argument << endl;
+            return false;
+        }
+    }
+
+    // the movement of the grab brush is known only for the dabs placed by the CPU (as in the gui)
+    if (BrushUsesDelta((BrushType)brushType))
+        brushPlacement = CPU_PLACEMENT;
+    // the parity check needs the headless mode and the dabs of the batched brushing
+    if (parity && (!headless || cpuSculpting))
+    {
+        cout << "ERROR::USCULPT:: --parity NEEDS THE HEADLESS MODE AND THE GPU SCULPTING" << endl;
+        return false;
+    }
+    if (parity)
+        brushPlacement = CPU_PLACEMENT;
+
+    return true;
+}
+
+//////////////////////////////////////////
+// scripted input of the headless mode: a stroke through the callbacks of the mouse, along the horizontal line in the middle of the window
+// (from 35% to 65% of its width), pressed at the first frame and released at the last one
+void headless_stroke(int frame)
+{
+    float t = headlessFrames > 1 ? frame / (float)(headlessFrames - 1) : 0.0f;
+    mouse_callback(nullptr, screenWidth * (0.35f + 0.3f * t), screenHeight * 0.5f);
+
+    if (frame == 0)
+        mouse_key_callback(nullptr, GLFW_MOUSE_BUTTON_LEFT, GLFW_PRESS, 0);
+    else if (frame == headlessFrames - 1)
+        mouse_key_callback(nullptr, GLFW_MOUSE_BUTTON_LEFT, GLFW_RELEASE, 0);
+}
+
+#pragma endregion HEADLESS
+
+#pragma region PROFILER
+
+//////////////////////////////////////////
+// rolling graphs of the CPU and GPU times of the stages (milliseconds per frame, with their average), and export of the trace
+void draw_profiler(Profiler& profiler)
+{
+    static vector<float> samples;
+
+    ImGui::Begin("Profiler");
+    for (GLuint s = 0; s < profiler.Stages(); s++)
+    {
+        for (int gpu = 0; gpu <= (profiler.StageGPU(s) ? 1 : 0); gpu++)
+        {
+            profiler.History(s, gpu == 1, samples);
+
+            char overlay[32];
+            snprintf(overlay, sizeof(overlay), "%.3f ms", profiler.Average(s, gpu == 1));
+            string label = profiler.StageName(s) + (gpu == 1 ? " GPU" : " CPU");
+            ImGui::PlotLines(label.c_str(), samples.empty() ? nullptr : &samples[0], (int)samples.size(), 0, overlay, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+        }
+    }
+    ImGui::Text("Trace: %d events, %d GPU queries dropped", (int)profiler.TraceEvents(), (int)profiler.DroppedQueries());
+    if (ImGui::Button("Export trace"))
+        profiler.ExportTrace(tracePath);
+    ImGui::SameLine();
+    ImGui::Text("%s", tracePath.c_str());
+    ImGui::End();
+}
+
+#pragma endregion PROFILER
@@ -0,0 +1,679 @@
+/*
+Headless benchmark of the CPU-side stages of uSculpt
+
+- loading of the models in the models folder (Assimp import + processing, then from the binary cache)
+- procedurally generated spheres from 10K to 10M triangles
+- ray picking (BVH build, BVH traversal, brute force closest hit)
+- scripted stroke of N dabs (same CPU path of the application: grid query, Sculptor brush, BVH refit, grid update),
+  one dab at a time and in batches of 16 dabs (batched Sculptor brush, like the dabs placed in a frame by the stroke engine)
+- normals update of the whole mesh (Mesh::UpdateNormals and the parallel Sculptor::UpdateNormals)
+
+Each stage is timed independently: the results (p50 / p99 of the samples and throughput) are written as JSON,
+so the performance of the CPU-side code can be tracked also on CI machines without GPU (no OpenGL context is created)
+
+usage: usculpt_bench [--models <folder>] [--sizes <triangles>,<triangles>,...] [--dabs N] [--rays N] [--brute-rays N]
+                     [--repeat N] [--radius R] [--strength S] [--brush <name>] [--falloff <name>] [--output <file.json>]
+- an empty --models or --sizes disables the models or the spheres
+- --brush and --falloff are the brush and the falloff of the stroke, by their names in the gui (the grab brush moves the vertices only
+  in the batches, where each dab has the movement from the previous one)
+
+author: Andrea Cipollini
+*/
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <cstdlib>
+
+#ifdef _WIN32
+    #define APIENTRY __stdcall
+#endif
+
+// the Mesh class references the OpenGL functions, but no OpenGL context is created: the meshes are kept only CPU-side
+#include <glad.h>
+
+#ifdef _WINDOWS_
+    #error windows.h was included!
+#endif
+
+#include <usculpt/model.h>
+#include <usculpt/adjacency.h>
+#include <usculpt/halfedge.h>
+#include <usculpt/sculptor.h>
+#include <usculpt/bvh.h>
+#include <usculpt/spatialgrid.h>
+#include <usculpt/raycast.h>
+#include <usculpt/threadpool.h>
+
+#include <glm/glm.hpp>
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <dirent.h>
+#endif
+
+using namespace std;
+
+/////////////////// BENCHMARK SETTINGS ///////////////////////
+struct BenchSettings
+{
+    string ModelsFolder = "models";
+    vector<size_t> Sizes = { 10000, 100000, 1000000, 10000000 };
+    int Dabs = 100;
+    int Rays = 1000;
+    int BruteRays = 10;
+    int Repeat = 5;
+    float Radius = 0.1f;
+    float Strength = 1.0f;
+    BrushType Brush = DRAW_BRUSH;
+    FalloffType Falloff = GAUSSIAN_FALLOFF;
+    string Output;
+};
+
+/////////////////// STAGE TIMINGS ///////////////////////
+// samples (milliseconds) of a stage, and the number of items processed by each sample (for the throughput)
+struct StageTimings
+{
+    string Name;
+    vector<double> Samples;
+    double Items;
+    string Unit;
+};
+
+typedef chrono::steady_clock Clock;
+
+static double ElapsedMs(Clock::time_point start)
+{
+    return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+// nearest-rank percentile of the sorted samples
+static double Percentile(const vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)ceil(p * sorted.size());
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static string JsonString(const string& value)
+{
+    string escaped = "\"";
+    for (size_t i = 0; i < value.size(); i++)
+    {
+        if (value[i] == '"' || value[i] == '\\')
+            escaped += '\\';
+        escaped += value[i];
+    }
+    return escaped + "\"";
+}
+
+static void WriteStage(ostream& out, const StageTimings& stage)
+{
+    vector<double> sorted = stage.Samples;
+    sort(sorted.begin(), sorted.end());
+    double total = 0.0;
+    for (size_t i = 0; i < sorted.size(); i++)
+        total += sorted[i];
+    double mean = sorted.empty() ? 0.0 : total / sorted.size();
+
+    out << "        " << JsonString(stage.Name) << ": { "
+        << "\"samples\": " << sorted.size() << ", "
+        << "\"p50_ms\": " << Percentile(sorted, 0.5) << ", "
+        << "\"p99_ms\": " << Percentile(sorted, 0.99) << ", "
+        << "\"mean_ms\": " << mean << ", "
+        << "\"min_ms\": " << (sorted.empty() ? 0.0 : sorted.front()) << ", "
+        << "\"max_ms\": " << (sorted.empty() ? 0.0 : sorted.back()) << ", "
+        << "\"throughput\": " << (mean > 0.0 ? stage.Items * 1000.0 / mean : 0.0) << ", "
+        << "\"throughput_unit\": " << JsonString(stage.Unit + "/s") << " }";
+}
+
+/////////////////// BENCHMARK RESULT ///////////////////////
+struct MeshResult
+{
+    string Name;
+    size_t Vertices;
+    size_t Triangles;
+    vector<StageTimings> Stages;
+};
+
+static void WriteResults(ostream& out, const BenchSettings& settings, const vector<MeshResult>& results)
+{
+    out << "{\n";
+    out << "    \"threads\": " << ThreadPool::Instance().ThreadsNumber() << ",\n";
+#ifdef __AVX2__
+    out << "    \"avx2\": true,\n";
+#else
+    out << "    \"avx2\": false,\n";
+#endif
+    out << "    \"dabs\": " << settings.Dabs << ",\n";
+    out << "    \"radius\": " << settings.Radius << ",\n";
+    out << "    \"strength\": " << settings.Strength << ",\n";
+    out << "    \"brush\": " << JsonString(BrushNames()[settings.Brush]) << ",\n";
+    out << "    \"falloff\": " << JsonString(FalloffNames()[settings.Falloff]) << ",\n";
+    out << "    \"meshes\": [\n";
+    for (size_t m = 0; m < results.size(); m++)
+    {
+        out << "    {\n";
+        out << "        \"name\": " << JsonString(results[m].Name) << ",\n";
+        out << "        \"vertices\": " << results[m].Vertices << ",\n";
+        out << "        \"triangles\": " << results[m].Triangles << ",\n";
+        out << "        \"stages\": {\n";
+        for (size_t s = 0; s < results[m].Stages.size(); s++)
+        {
+            out << "    ";
+            WriteStage(out, results[m].Stages[s]);
+            out << (s + 1 < results[m].Stages.size() ? ",\n" : "\n");
+        }
+        out << "        }\n";
+        out << "    }" << (m + 1 < results.size() ? ",\n" : "\n");
+    }
+    out << "    ]\n";
+    out << "}\n";
+}
+
+/////////////////// PROCEDURAL SPHERES ///////////////////////
+// UV sphere of diameter 1 (same size of the models inscribed in the unit cube) with about the requested number of triangles:
+// a single vertex for each pole and no seam, so every vertex is shared by all its faces and there are no degenerate triangles
+static void SphereData(size_t triangles, vector<Vertex>& vertices, vector<GLuint>& indices)
+{
+    // triangles = 2 * slices * (stacks - 1), with slices = 2 * stacks
+    GLuint stacks = max<GLuint>(3, (GLuint)sqrt((double)triangles / 4.0) + 1);
+    GLuint slices = stacks * 2;
+    const float pi = 3.14159265358979f;
+
+    vertices.assign((stacks - 1) * slices + 2, Vertex());
+    // the vertices of the rings are computed in parallel
+    ThreadPool::Instance().ParallelFor(0, vertices.size(), 65536, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; i++)
+        {
+            glm::vec3 direction;
+            if (i == 0)
+                direction = glm::vec3(0.0f, 1.0f, 0.0f);
+            else if (i == vertices.size() - 1)
+                direction = glm::vec3(0.0f, -1.0f, 0.0f);
+            else
+            {
+                float theta = pi * (float)((i - 1) / slices + 1) / stacks;
+                float phi = 2.0f * pi * (float)((i - 1) % slices) / slices;
+                direction = glm::vec3(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+            }
+            vertices[i].Position = direction * 0.5f;
+            vertices[i].Normal = direction;
+        }
+    });
+
+    // counter-clockwise triangles seen from outside
+    GLuint south = (GLuint)vertices.size() - 1;
+    indices.clear();
+    indices.reserve((size_t)slices * (stacks - 1) * 6);
+    for (GLuint s = 0; s < slices; s++)
+    {
+        GLuint next = (s + 1) % slices;
+        GLuint polar[6] = { 0, 1 + next, 1 + s, south, 1 + (stacks - 2) * slices + s, 1 + (stacks - 2) * slices + next };
+        indices.insert(indices.end(), polar, polar + 6);
+    }
+    for (GLuint r = 0; r + 2 < stacks; r++)
+    {
+        for (GLuint s = 0; s < slices; s++)
+        {
+            GLuint next = (s + 1) % slices;
+            GLuint a = 1 + r * slices + s, b = 1 + r * slices + next;
+            GLuint c = a + slices, d = b + slices;
+            GLuint quad[6] = { a, b, c, b, d, c };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+/////////////////// MODELS FOLDER ///////////////////////
+// OBJ files of the folder, in alphabetical order
+static vector<string> ListModels(const string& folder)
+{
+    vector<string> files;
+    if (folder.empty())
+        return files;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((folder + "\\*.obj").c_str(), &data);
+    if (find != INVALID_HANDLE_VALUE)
+    {
+        do
+            files.push_back(folder + "/" + data.cFileName);
+        while (FindNextFileA(find, &data));
+        FindClose(find);
+    }
+#else
+    DIR* dir = opendir(folder.c_str());
+    if (dir)
+    {
+        while (dirent* entry = readdir(dir))
+        {
+            string name = entry->d_name;
+            if (name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0)
+                files.push_back(folder + "/" + name);
+        }
+        closedir(dir);
+    }
+#endif
+    if (files.empty())
+        cout << "WARNING::BENCHMARK:: NO OBJ MODELS IN " << folder << endl;
+    sort(files.begin(), files.end());
+    return files;
+}
+
+/////////////////// STAGES ///////////////////////
+// bounding sphere of the positions of the mesh (the rays are generated around it)
+static void MeshBounds(const Mesh& mesh, glm::vec3& center, float& radius)
+{
+    glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+    for (size_t i = 0; i < mesh.vertices.size(); i++)
+    {
+        minimum = glm::min(minimum, mesh.vertices[i].Position);
+        maximum = glm::max(maximum, mesh.vertices[i].Position);
+    }
+    center = (minimum + maximum) * 0.5f;
+    radius = max(glm::length(maximum - minimum) * 0.5f, 0.0001f);
+}
+
+// ray from a point of the sphere of directions around the mesh, towards (about) its center
+static Ray3 BoundsRay(glm::vec3 center, float radius, glm::vec3 direction, glm::vec3 jitter)
+{
+    Ray3 ray;
+    ray.origin = center + glm::normalize(direction) * radius * 2.0f;
+    ray.direction = glm::normalize(center + jitter * radius * 0.25f - ray.origin);
+    return ray;
+}
+
+static void BenchPicking(const BenchSettings& settings, Mesh& mesh, BVH& bvh, MeshResult& result)
+{
+    double triangles = (double)(mesh.indices.size() / 3);
+
+    StageTimings build = { "bvh_build", vector<double>(), triangles, "triangles" };
+    for (int r = 0; r < settings.Repeat; r++)
+    {
+        Clock::time_point start = Clock::now();
+        bvh.Build(mesh);
+        build.Samples.push_back(ElapsedMs(start));
+    }
+    result.Stages.push_back(build);
+
+    glm::vec3 center;
+    float radius;
+    MeshBounds(mesh, center, radius);
+
+    // the same rays on every run
+    mt19937 generator(1234);
+    normal_distribution<float> gaussian(0.0f, 1.0f);
+    vector<Ray3> rays(max(settings.Rays, settings.BruteRays));
+    for (size_t i = 0; i < rays.size(); i++)
+    {
+        glm::vec3 direction(gaussian(generator), gaussian(generator), gaussian(generator));
+        glm::vec3 jitter(gaussian(generator), gaussian(generator), gaussian(generator));
+        rays[i] = BoundsRay(center, radius, direction + glm::vec3(0.0f, 0.0f, 0.001f), jitter);
+    }
+
+    StageTimings pick = { "pick_bvh", vector<double>(), 1.0, "rays" };
+    size_t hits = 0;
+    for (int i = 0; i < settings.Rays; i++)
+    {
+        Clock::time_point start = Clock::now();
+        Intersection inter = bvh.Intersect(mesh, rays[i]);
+        pick.Samples.push_back(ElapsedMs(start));
+        hits += inter.hit ? 1 : 0;
+    }
+    result.Stages.push_back(pick);
+
+    StageTimings brute = { "pick_brute_force", vector<double>(), 1.0, "rays" };
+    for (int i = 0; i < settings.BruteRays; i++)
+    {
+        Clock::time_point start = Clock::now();
+        Intersection inter = ClosestIntersection(mesh, rays[i]);
+        brute.Samples.push_back(ElapsedMs(start));
+        hits += inter.hit ? 1 : 0;
+    }
+    result.Stages.push_back(brute);
+
+    if (hits == 0 && (settings.Rays > 0 || settings.BruteRays > 0))
+        cout << "WARNING::BENCHMARK:: NO RAY HAS HIT " << result.Name << endl;
+}
+
+// scripted stroke: the dabs follow an arc around the vertical axis of the mesh, each one picked with the BVH (not timed)
+// and applied with the same CPU path of the application
+static void BenchStroke(const BenchSettings& settings, Mesh& mesh, BVH& bvh, MeshResult& result)
+{
+    glm::vec3 center;
+    float radius;
+    MeshBounds(mesh, center, radius);
+
+    Sculptor sculptor;
+    sculptor.SetBrush(settings.Brush, settings.Falloff);
+    SpatialGrid grid;
+    vector<GLuint> brushVertices, movedVertices;
+
+    StageTimings gridBuild = { "grid_build", vector<double>(), (double)mesh.vertices.size(), "vertices" };
+    Clock::time_point start = Clock::now();
+    grid.Build(mesh, settings.Radius);
+    gridBuild.Samples.push_back(ElapsedMs(start));
+    result.Stages.push_back(gridBuild);
+
+    StageTimings dabs = { "stroke_dab", vector<double>(), 1.0, "dabs" };
+    size_t movedTotal = 0;
+    for (int d = 0; d < settings.Dabs; d++)
+    {
+        float angle = 1.5f * (float)d / max(settings.Dabs - 1, 1);
+        glm::vec3 direction(sin(angle), 0.3f * sin(angle * 4.0f), cos(angle));
+        Intersection inter = bvh.Intersect(mesh, BoundsRay(center, radius, direction, glm::vec3(0.0f)));
+        if (!inter.hit)
+            continue;
+
+        start = Clock::now();
+        grid.Query(mesh, inter.Position, settings.Radius, brushVertices);
+        sculptor.Brush(mesh, inter, settings.Strength, settings.Radius, brushVertices, &movedVertices);
+        bvh.Refit(mesh, movedVertices);
+        grid.Update(mesh, movedVertices);
+        dabs.Samples.push_back(ElapsedMs(start));
+        movedTotal += movedVertices.size();
+    }
+    result.Stages.push_back(dabs);
+
+    // throughput of the stroke as displaced vertices per second
+    double totalMs = 0.0;
+    for (size_t i = 0; i < dabs.Samples.size(); i++)
+        totalMs += dabs.Samples[i];
+    StageTimings stroke = { "stroke", vector<double>(1, totalMs), (double)movedTotal, "vertices" };
+    result.Stages.push_back(stroke);
+
+    // the same stroke in batches of dabs: the vertices inside any dab of the batch are brushed in a single pass
+    const int batchSize = 16;
+    StageTimings batches = { "stroke_batch", vector<double>(), (double)batchSize, "dabs" };
+    vector<BrushDab> batch;
+    vector<GLuint> dabVertices;
+    Intersection previous = NoIntersection();
+    for (int d = 0; d < settings.Dabs; d++)
+    {
+        float angle = 1.5f * (float)d / max(settings.Dabs - 1, 1);
+        glm::vec3 direction(sin(angle), 0.3f * sin(angle * 4.0f), cos(angle));
+        Intersection inter = bvh.Intersect(mesh, BoundsRay(center, radius, direction, glm::vec3(0.0f)));
+        if (inter.hit)
+        {
+            batch.push_back(sculptor.Dab(inter, settings.Strength, settings.Radius, previous.hit ? inter.Position - previous.Position : glm::vec3(0.0f)));
+            previous = inter;
+        }
+        if ((int)batch.size() < batchSize && d + 1 < settings.Dabs)
+            continue;
+        if (batch.empty())
+            break;
+
+        start = Clock::now();
+        brushVertices.clear();
+        for (size_t b = 0; b < batch.size(); b++)
+        {
+            grid.Query(mesh, batch[b].Position, settings.Radius, dabVertices);
+            brushVertices.insert(brushVertices.end(), dabVertices.begin(), dabVertices.end());
+        }
+        sort(brushVertices.begin(), brushVertices.end());
+        brushVertices.erase(unique(brushVertices.begin(), brushVertices.end()), brushVertices.end());
+        sculptor.Brush(mesh, batch, brushVertices, &movedVertices);
+        bvh.Refit(mesh, movedVertices);
+        grid.Update(mesh, movedVertices);
+        batches.Samples.push_back(ElapsedMs(start));
+        batch.clear();
+    }
+    result.Stages.push_back(batches);
+}
+
+static void BenchNormals(const BenchSettings& settings, Mesh& mesh, MeshResult& result)
+{
+    double vertices = (double)mesh.vertices.size();
+
+    StageTimings sequential = { "normals_mesh", vector<double>(), vertices, "vertices" };
+    for (int r = 0; r < settings.Repeat; r++)
+    {
+        Clock::time_point start = Clock::now();
+        mesh.UpdateNormals();
+        sequential.Samples.push_back(ElapsedMs(start));
+    }
+    result.Stages.push_back(sequential);
+
+    Sculptor sculptor;
+    StageTimings parallel = { "normals_sculptor", vector<double>(), vertices, "vertices" };
+    for (int r = 0; r < settings.Repeat; r++)
+    {
+        Clock::time_point start = Clock::now();
+        sculptor.UpdateNormals(mesh);
+        parallel.Samples.push_back(ElapsedMs(start));
+    }
+    result.Stages.push_back(parallel);
+}
+
+// picking, stroke and normals stages on a loaded / generated mesh
+static void BenchMesh(const BenchSettings& settings, Mesh& mesh, MeshResult& result)
+{
+    result.Vertices = mesh.vertices.size();
+    result.Triangles = mesh.indices.size() / 3;
+
+    BVH bvh;
+    BenchPicking(settings, mesh, bvh, result);
+    BenchStroke(settings, mesh, bvh, result);
+    BenchNormals(settings, mesh, result);
+}
+
+// cache file of the benchmark for a model, in the temporary folder of the system
+static string BenchCachePath(const string& path)
+{
+    const char* folder = getenv("TMPDIR");
+#ifdef _WIN32
+    if (!folder)
+        folder = getenv("TEMP");
+    if (!folder)
+        folder = ".";
+#else
+    if (!folder)
+        folder = "/tmp";
+#endif
+    size_t separator = path.find_last_of("/\\");
+    string name = separator == string::npos ? path : path.substr(separator + 1);
+    return string(folder) + "/usculpt_bench_" + name + ".uscache";
+}
+
+static void BenchModel(const BenchSettings& settings, const string& path, vector<MeshResult>& results)
+{
+    MeshResult result;
+    result.Name = path;
+    // (the benchmark has its own cache: the cache of the application, next to the model, is not touched)
+    string cachePath = BenchCachePath(path);
+
+    // import from the source file (the cache is removed before each sample, and saved again by the loading)
+    StageTimings import = { "load_import", vector<double>(), 1.0, "models" };
+    for (int r = 0; r < settings.Repeat; r++)
+    {
+        remove(cachePath.c_str());
+        Clock::time_point start = Clock::now();
+        Model model(path, STREAMS, false, cachePath);
+        import.Samples.push_back(ElapsedMs(start));
+    }
+
+    StageTimings cache = { "load_cache", vector<double>(), 1.0, "models" };
+    for (int r = 0; r < settings.Repeat; r++)
+    {
+        Clock::time_point start = Clock::now();
+        Model model(path, STREAMS, false, cachePath);
+        cache.Samples.push_back(ElapsedMs(start));
+    }
+
+    Model model(path, STREAMS, false, cachePath);
+    remove(cachePath.c_str());
+    if (model.meshes.empty())
+    {
+        cout << "ERROR::BENCHMARK:: " << path << " HAS NO MESHES" << endl;
+        return;
+    }
+
+    // the triangles of the model give the throughput of the loading
+    size_t triangles = 0;
+    for (size_t m = 0; m < model.meshes.size(); m++)
+        triangles += model.meshes[m].indices.size() / 3;
+    import.Items = cache.Items = (double)triangles;
+    import.Unit = cache.Unit = "triangles";
+    result.Stages.push_back(import);
+    result.Stages.push_back(cache);
+
+    // the application sculpts the first mesh of the model
+    BenchMesh(settings, model.meshes[0], result);
+    results.push_back(result);
+}
+
+static void BenchSphere(const BenchSettings& settings, size_t triangles, vector<MeshResult>& results)
+{
+    MeshResult result;
+    result.Name = "sphere_" + to_string(triangles);
+
+    // generation of the mesh and of its adjacency (same processing of the loaded models)
+    StageTimings build = { "build_adjacency", vector<double>(), 0.0, "triangles" };
+    vector<Vertex> vertices;
+    vector<GLuint> indices, neighbours;
+    SphereData(triangles, vertices, indices);
+    Clock::time_point start = Clock::now();
+    vector<GLuint> welded;
+    GLuint positions = WeldVertices(vertices, welded);
+    HalfEdges halfEdges;
+    halfEdges.Build(indices, welded, positions);
+    halfEdges.BuildNeighbours(vertices, indices, neighbours);
+    build.Samples.push_back(ElapsedMs(start));
+    build.Items = (double)(indices.size() / 3);
+    result.Stages.push_back(build);
+
+    Mesh mesh(vertices, indices, neighbours, false, STREAMS, false);
+    mesh.halfEdges = std::move(halfEdges);
+    BenchMesh(settings, mesh, result);
+    results.push_back(result);
+}
+
+/////////////////// MAIN ///////////////////////
+static bool ParseArguments(int argc, char** argv, BenchSettings& settings)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = argv[i];
+        if (i + 1 >= argc)
+        {
+            cout << "ERROR::BENCHMARK:: MISSING VALUE OF " << argument << endl;
+            return false;
+        }
+        string value = argv[++i];
+
+        if (argument == "--models")
+            settings.ModelsFolder = value;
+        else if (argument == "--sizes")
+        {
+            settings.Sizes.clear();
+            stringstream list(value);
+            string size;
+            while (getline(list, size, ','))
+            {
+                if (!size.empty())
+                    settings.Sizes.push_back((size_t)strtoull(size.c_str(), nullptr, 10));
+            }
+        }
+        else if (argument == "--dabs")
+            settings.Dabs = atoi(value.c_str());
+        else if (argument == "--rays")
+            settings.Rays = atoi(value.c_str());
+        else if (argument == "--brute-rays")
+            settings.BruteRays = atoi(value.c_str());
+        else if (argument == "--repeat")
+            settings.Repeat = max(1, atoi(value.c_str()));
+        else if (argument == "--radius")
+            settings.Radius = (float)atof(value.c_str());
+        else if (argument == "--strength")
+            settings.Strength = (float)atof(value.c_str());
+        else if (argument == "--brush" || argument == "--falloff")
+        {
+            // (names of the gui, case insensitive)
+            bool brush = argument == "--brush";
+            const char* const* names = brush ? BrushNames() : FalloffNames();
+            int count = brush ? (int)BRUSH_TYPES : (int)FALLOFF_TYPES, found = -1;
+            transform(value.begin(), value.end(), value.begin(), ::tolower);
+            for (int n = 0; n < count && found < 0; n++)
+            {
+                string name = names[n];
+                transform(name.begin(), name.end(), name.begin(), ::tolower);
+                if (name == value)
+                    found = n;
+            }
+            if (found < 0)
+            {
+                cout << "ERROR::BENCHMARK:: UNKNOWN " << (brush ? "BRUSH " : "FALLOFF ") << value << endl;
+                return false;
+            }
+            if (brush)
+                settings.Brush = (BrushType)found;
+            else
+                settings.Falloff = (FalloffType)found;
+        }
+        else if (argument == "--output")
+            settings.Output = value;
+        else
+        {
+            cout << "ERROR::BENCHMARK:: UNKNOWN ARGUMENT " << argument << endl;
+            return false;
+        }
+    }
+
+    return settings.Radius > 0.0f;
+}
+
+int main(int argc, char** argv)
+{
+    BenchSettings settings;
+    if (!ParseArguments(argc, argv, settings))
+        return 1;
+
+    // the messages of the loading and the progress go to the standard error, so the standard output is only the JSON of the results
+    streambuf* standardOutput = cout.rdbuf(cerr.rdbuf());
+    ostream json(standardOutput);
+
+    vector<MeshResult> results;
+    vector<string> models = ListModels(settings.ModelsFolder);
+    for (size_t i = 0; i < models.size(); i++)
+    {
+        cerr << "benchmark: " << models[i] << endl;
+        BenchModel(settings, models[i], results);
+    }
+    for (size_t i = 0; i < settings.Sizes.size(); i++)
+    {
+        cerr << "benchmark: sphere of " << settings.Sizes[i] << " triangles" << endl;
+        BenchSphere(settings, settings.Sizes[i], results);
+    }
+
+    if (settings.Output.empty())
+        WriteResults(json, settings, results);
+    else
+    {
+        ofstream file(settings.Output);
+        if (!file)
+        {
+            cout << "ERROR::BENCHMARK:: CANNOT WRITE " << settings.Output << endl;
+            cout.rdbuf(standardOutput);
+            return 1;
+        }
+        WriteResults(file, settings, results);
+    }
+
+    cout.rdbuf(standardOutput);
+    return 0;
+}